@@ -0,0 +1,172 @@
+#include "file_index.hpp"
+#include "group_commit.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using cloud::server::CommitOptions;
+using cloud::server::CommitRequest;
+using cloud::server::FileIndex;
+using cloud::server::FileMetadata;
+using cloud::server::GroupCommitter;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::filesystem::path dir = "commit_bench.tmp";
+    std::size_t clients = 32;
+    std::size_t commits = 64;  // per client
+    std::size_t file_kib = 64;
+};
+
+struct Mode {
+    const char* name;
+    std::chrono::microseconds window;
+    std::size_t max_batch;
+};
+
+struct Result {
+    double commits_per_sec = 0;
+    double avg_batch = 0;
+    double p50_us = 0;
+    double p95_us = 0;
+    double p99_us = 0;
+};
+
+// Small uploads whose data was just written, as the commit path sees them.
+std::filesystem::path write_file(const std::filesystem::path& dir, const std::string& name, const std::string& data) {
+    const auto path = dir / name;
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ::write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+        std::cerr << "Cannot write " << path << std::endl;
+        std::exit(1);
+    }
+    ::close(fd);
+    return path;
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    return samples.empty() ? 0 : samples[static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1))];
+}
+
+// Every client thread commits its files one after another, waiting for each
+// acknowledgement like a client waiting on FILE_UPLOAD_COMMIT.
+Result run(const Options& options, const Mode& mode) {
+    const auto root = options.dir / mode.name;
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    FileIndex index((root / "index.db").string());
+    GroupCommitter committer(index, CommitOptions{true, mode.window, mode.max_batch});
+    committer.start();
+
+    const std::string data(options.file_kib * 1024, 'x');
+    std::vector<std::vector<double>> latencies(options.clients);
+    std::vector<std::thread> clients;
+    const auto start = Clock::now();
+    for (std::size_t c = 0; c < options.clients; ++c) {
+        clients.emplace_back([&, c] {
+            const auto dir = root / ("client" + std::to_string(c));
+            std::filesystem::create_directories(dir);
+            for (std::size_t i = 0; i < options.commits; ++i) {
+                const auto name = "file" + std::to_string(i);
+                const auto path = write_file(dir, name, data);
+                std::promise<void> acked;
+                CommitRequest request;
+                request.files = {path};
+                request.directories = {dir};
+                request.apply = [&index, path, owner = "user" + std::to_string(c), name, size = data.size()] {
+                    index.upsert(FileMetadata{owner, name, std::string(32, '0'), path.string(), size});
+                };
+                request.done = [&acked](bool) { acked.set_value(); };
+                const auto submitted = Clock::now();
+                committer.submit(std::move(request));
+                acked.get_future().wait();
+                latencies[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - submitted).count());
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    committer.stop();
+
+    std::vector<double> all;
+    for (const auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    Result r;
+    r.commits_per_sec = static_cast<double>(all.size()) / elapsed;
+    const auto report = committer.stats_report();
+    if (const auto pos = report.find("commit.avg_batch="); pos != std::string::npos) {
+        r.avg_batch = std::atof(report.c_str() + pos + 17);
+    }
+    r.p50_us = percentile(all, 0.50);
+    r.p95_us = percentile(all, 0.95);
+    r.p99_us = percentile(all, 0.99);
+    std::filesystem::remove_all(root);
+    return r;
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--dir") {
+            options.dir = value;
+        } else if (key == "--clients") {
+            options.clients = std::stoull(value);
+        } else if (key == "--commits") {
+            options.commits = std::stoull(value);
+        } else if (key == "--file-kib") {
+            options.file_kib = std::stoull(value);
+        } else {
+            std::cerr << "Unknown option " << key << std::endl;
+            std::exit(2);
+        }
+    }
+    if (options.clients == 0 || options.commits == 0) {
+        std::cerr << "--clients and --commits must be positive" << std::endl;
+        std::exit(2);
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const auto options = parse_options(argc, argv);
+    std::filesystem::create_directories(options.dir);
+
+    const Mode modes[] = {
+        {"single", std::chrono::microseconds(0), 1},
+        {"group-0us", std::chrono::microseconds(0), 256},
+        {"group-500us", std::chrono::microseconds(500), 256},
+        {"group-2ms", std::chrono::microseconds(2000), 256},
+        {"group-5ms", std::chrono::microseconds(5000), 256},
+    };
+    std::printf("%zu clients x %zu durable commits of %zu KiB, in %s\n", options.clients, options.commits,
+                options.file_kib, options.dir.c_str());
+    std::printf("%-12s %10s %10s %10s %10s %10s\n", "mode", "commits/s", "avg_batch", "p50_us", "p95_us", "p99_us");
+    for (const auto& mode : modes) {
+        const auto r = run(options, mode);
+        std::printf("%-12s %10.0f %10.1f %10.0f %10.0f %10.0f\n", mode.name, r.commits_per_sec, r.avg_batch, r.p50_us,
+                    r.p95_us, r.p99_us);
+    }
+    std::filesystem::remove_all(options.dir);
+    return 0;
+}
@@ -0,0 +1,350 @@
+#include "protocol.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<std::uint64_t> g_allocations{0};
+std::atomic<std::uint64_t> g_allocated_bytes{0};
+
+struct AllocSnapshot {
+    std::uint64_t count;
+    std::uint64_t bytes;
+
+    static AllocSnapshot now() { return {g_allocations.load(), g_allocated_bytes.load()}; }
+};
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+using cloud::protocol::HeaderMap;
+using cloud::protocol::Message;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::size_t iterations = 20000;
+    std::size_t fuzz_frames = 200000;
+    std::uint64_t seed = 42;
+};
+
+struct Result {
+    double ns_per_frame = 0;
+    double allocs_per_frame = 0;
+    double bytes_copied_per_frame = 0;
+    double mb_per_sec = 0;
+    double compactions_per_frame = 0;
+};
+
+template <typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+Message make_frame(std::size_t header_count, std::size_t body_size) {
+    Message msg;
+    msg.headers.emplace("cmd", "FILE_UPLOAD_CHUNK");
+    for (std::size_t i = 1; i < header_count; ++i) {
+        msg.headers.emplace("key" + std::to_string(i), "value-" + std::to_string(i * 7919));
+    }
+    msg.body.assign(body_size, std::byte{0x5a});
+    return msg;
+}
+
+std::size_t header_blob_size(const HeaderMap& headers) {
+    std::size_t size = 0;
+    for (const auto& [key, value] : headers) {
+        size += key.size() + value.size() + 2;
+    }
+    return size;
+}
+
+void print_row(const char* op, std::size_t headers, std::size_t body, const Result& r) {
+    std::printf("%-18s %7zu %9zu %12.1f %10.2f %14.1f %10.1f %12.3f\n", op, headers, body, r.ns_per_frame,
+                r.allocs_per_frame, r.bytes_copied_per_frame, r.mb_per_sec, r.compactions_per_frame);
+}
+
+// encode(): serialize_headers builds the blob, then header+blob+body are memcpy'd into the frame.
+Result bench_encode(const Message& msg, std::size_t iterations) {
+    const auto blob = header_blob_size(msg.headers);
+    const auto start_alloc = AllocSnapshot::now();
+    const auto start = Clock::now();
+    std::size_t produced = 0;
+    for (std::size_t i = 0; i < iterations; ++i) {
+        auto frame = cloud::protocol::encode(msg);
+        produced += frame.size();
+        do_not_optimize(frame);
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    const auto end_alloc = AllocSnapshot::now();
+    Result r;
+    r.ns_per_frame = elapsed / static_cast<double>(iterations);
+    r.allocs_per_frame = static_cast<double>(end_alloc.count - start_alloc.count) / static_cast<double>(iterations);
+    r.bytes_copied_per_frame = static_cast<double>(blob + sizeof(cloud::protocol::detail::WireHeader) + blob +
+                                                   msg.body.size());
+    r.mb_per_sec = static_cast<double>(produced) / (elapsed / 1e9) / (1024.0 * 1024.0);
+    return r;
+}
+
+// try_decode() fed the way the reactor feeds it: 64 KiB recv-sized appends, draining
+// complete frames after each append so the prefix-erase compaction path is exercised.
+Result bench_decode(const Message& msg, std::size_t iterations) {
+    const auto frame = cloud::protocol::encode(msg);
+    const std::size_t frames_per_stream = std::max<std::size_t>(1, std::min<std::size_t>(iterations, 256));
+    std::vector<std::byte> stream;
+    stream.reserve(frame.size() * frames_per_stream);
+    for (std::size_t i = 0; i < frames_per_stream; ++i) {
+        stream.insert(stream.end(), frame.begin(), frame.end());
+    }
+    const std::size_t rounds = std::max<std::size_t>(1, iterations / frames_per_stream);
+    constexpr std::size_t kRecvBytes = 64 * 1024;
+
+    std::uint64_t copied = 0;
+    std::uint64_t decoded = 0;
+    std::uint64_t compactions = 0;
+    const auto blob = header_blob_size(msg.headers);
+    double elapsed = 0;
+    std::uint64_t allocations = 0;
+
+    for (std::size_t round = 0; round < rounds; ++round) {
+        std::vector<std::byte> inbound;
+        std::size_t offset = 0;
+        Message out;
+        const auto start_alloc = AllocSnapshot::now();
+        const auto start = Clock::now();
+        for (std::size_t pos = 0; pos < stream.size(); pos += kRecvBytes) {
+            const auto end = std::min(stream.size(), pos + kRecvBytes);
+            inbound.insert(inbound.end(), stream.begin() + static_cast<std::ptrdiff_t>(pos),
+                           stream.begin() + static_cast<std::ptrdiff_t>(end));
+            copied += end - pos;
+            while (cloud::protocol::try_decode(inbound, offset, out)) {
+                ++decoded;
+                copied += blob * 2 + out.body.size();
+                if (offset == 0) {
+                    // A successful decode only leaves offset at 0 after the prefix erase,
+                    // which moves every remaining byte to the front of the buffer.
+                    ++compactions;
+                    copied += inbound.size();
+                }
+                do_not_optimize(out);
+            }
+        }
+        elapsed += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        allocations += AllocSnapshot::now().count - start_alloc.count;
+    }
+
+    Result r;
+    r.ns_per_frame = elapsed / static_cast<double>(decoded);
+    r.allocs_per_frame = static_cast<double>(allocations) / static_cast<double>(decoded);
+    r.bytes_copied_per_frame = static_cast<double>(copied) / static_cast<double>(decoded);
+    r.mb_per_sec = static_cast<double>(decoded * frame.size()) / (elapsed / 1e9) / (1024.0 * 1024.0);
+    r.compactions_per_frame = static_cast<double>(compactions) / static_cast<double>(decoded);
+    return r;
+}
+
+Result bench_serialize_headers(const HeaderMap& headers, std::size_t iterations) {
+    const auto start_alloc = AllocSnapshot::now();
+    const auto start = Clock::now();
+    std::size_t produced = 0;
+    for (std::size_t i = 0; i < iterations; ++i) {
+        auto blob = cloud::protocol::detail::serialize_headers(headers);
+        produced += blob.size();
+        do_not_optimize(blob);
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    Result r;
+    r.ns_per_frame = elapsed / static_cast<double>(iterations);
+    r.allocs_per_frame =
+        static_cast<double>(AllocSnapshot::now().count - start_alloc.count) / static_cast<double>(iterations);
+    r.bytes_copied_per_frame = static_cast<double>(produced) / static_cast<double>(iterations);
+    r.mb_per_sec = static_cast<double>(produced) / (elapsed / 1e9) / (1024.0 * 1024.0);
+    return r;
+}
+
+Result bench_parse_headers(const HeaderMap& headers, std::size_t iterations) {
+    const auto blob = cloud::protocol::detail::serialize_headers(headers);
+    const auto start_alloc = AllocSnapshot::now();
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        auto parsed = cloud::protocol::detail::parse_headers(blob);
+        do_not_optimize(parsed);
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    Result r;
+    r.ns_per_frame = elapsed / static_cast<double>(iterations);
+    r.allocs_per_frame =
+        static_cast<double>(AllocSnapshot::now().count - start_alloc.count) / static_cast<double>(iterations);
+    r.bytes_copied_per_frame = static_cast<double>(blob.size());
+    r.mb_per_sec = static_cast<double>(blob.size() * iterations) / (elapsed / 1e9) / (1024.0 * 1024.0);
+    return r;
+}
+
+std::string random_token(std::mt19937_64& rng, std::size_t max_len) {
+    static constexpr char kAlphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789_-./";
+    std::uniform_int_distribution<std::size_t> len_dist(1, max_len);
+    std::uniform_int_distribution<std::size_t> char_dist(0, sizeof(kAlphabet) - 2);
+    std::string token(len_dist(rng), 'a');
+    for (auto& ch : token) {
+        ch = kAlphabet[char_dist(rng)];
+    }
+    return token;
+}
+
+// Randomized frame stream: random header sets and body sizes, delivered in random
+// fragment sizes, with a fraction of frames carrying a corrupted wire header.
+void run_fuzz(const Options& options) {
+    std::mt19937_64 rng(options.seed);
+    std::uniform_int_distribution<std::size_t> header_dist(0, 16);
+    std::uniform_int_distribution<std::size_t> body_dist(0, 64 * 1024);
+    std::uniform_int_distribution<std::size_t> fragment_dist(1, 96 * 1024);
+    std::uniform_int_distribution<int> corrupt_dist(0, 999);
+
+    std::uint64_t frames = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t rejected = 0;
+    std::uint64_t mismatches = 0;
+    double elapsed = 0;
+
+    std::vector<std::byte> inbound;
+    std::size_t offset = 0;
+    std::vector<Message> expected;
+    std::size_t next_expected = 0;
+
+    auto reset_stream = [&]() {
+        inbound.clear();
+        offset = 0;
+        expected.clear();
+        next_expected = 0;
+    };
+
+    std::size_t generated = 0;
+    while (generated < options.fuzz_frames) {
+        std::vector<std::byte> wire;
+        const std::size_t batch = std::min<std::size_t>(64, options.fuzz_frames - generated);
+        bool corrupted = false;
+        for (std::size_t i = 0; i < batch; ++i) {
+            Message msg;
+            const auto header_count = header_dist(rng);
+            for (std::size_t h = 0; h < header_count; ++h) {
+                msg.headers[random_token(rng, 24)] = random_token(rng, 64);
+            }
+            msg.body.resize(body_dist(rng));
+            for (auto& b : msg.body) {
+                b = static_cast<std::byte>(rng());
+            }
+            auto frame = cloud::protocol::encode(msg);
+            if (!corrupted && corrupt_dist(rng) < 5) {
+                frame[rng() % 6] ^= std::byte{0xff};  // magic or version bytes
+                corrupted = true;
+            }
+            wire.insert(wire.end(), frame.begin(), frame.end());
+            expected.push_back(std::move(msg));
+        }
+        generated += batch;
+
+        Message out;
+        std::size_t pos = 0;
+        const auto start = Clock::now();
+        try {
+            while (pos < wire.size()) {
+                const auto len = std::min(wire.size() - pos, fragment_dist(rng));
+                inbound.insert(inbound.end(), wire.begin() + static_cast<std::ptrdiff_t>(pos),
+                               wire.begin() + static_cast<std::ptrdiff_t>(pos + len));
+                pos += len;
+                while (cloud::protocol::try_decode(inbound, offset, out, 1 << 20)) {
+                    if (next_expected < expected.size()) {
+                        const auto& want = expected[next_expected++];
+                        if (want.headers != out.headers || want.body != out.body) {
+                            ++mismatches;
+                        }
+                    }
+                    ++frames;
+                    bytes += out.body.size();
+                }
+            }
+        } catch (const std::exception&) {
+            ++rejected;
+            reset_stream();
+        }
+        elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+        if (next_expected == expected.size()) {
+            expected.clear();
+            next_expected = 0;
+        }
+    }
+
+    std::printf("\nfuzz: seed=%llu frames=%llu rejected_streams=%llu mismatches=%llu\n",
+                static_cast<unsigned long long>(options.seed), static_cast<unsigned long long>(frames),
+                static_cast<unsigned long long>(rejected), static_cast<unsigned long long>(mismatches));
+    std::printf("fuzz: decode %.0f frames/s, %.1f MiB/s body throughput\n", static_cast<double>(frames) / elapsed,
+                static_cast<double>(bytes) / elapsed / (1024.0 * 1024.0));
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const auto value = std::stoull(argv[i + 1]);
+        if (key == "--iterations") {
+            options.iterations = value;
+        } else if (key == "--fuzz-frames") {
+            options.fuzz_frames = value;
+        } else if (key == "--seed") {
+            options.seed = value;
+        } else {
+            std::cerr << "Unknown option " << key << std::endl;
+            std::exit(2);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const auto options = parse_options(argc, argv);
+
+    std::printf("%-18s %7s %9s %12s %10s %14s %10s %12s\n", "op", "headers", "body", "ns/frame", "allocs",
+                "bytes_copied", "MiB/s", "compactions");
+    for (std::size_t headers : {2, 8, 32}) {
+        const auto msg = make_frame(headers, 0);
+        print_row("serialize_headers", headers, 0, bench_serialize_headers(msg.headers, options.iterations));
+        print_row("parse_headers", headers, 0, bench_parse_headers(msg.headers, options.iterations));
+    }
+    for (std::size_t headers : {2, 8, 32}) {
+        for (std::size_t body : {0UL, 1024UL, 64UL * 1024, 1024UL * 1024}) {
+            const auto msg = make_frame(headers, body);
+            const auto iterations = body >= 1024 * 1024 ? options.iterations / 20 + 1 : options.iterations;
+            print_row("encode", headers, body, bench_encode(msg, iterations));
+            print_row("try_decode", headers, body, bench_decode(msg, iterations));
+        }
+    }
+
+    run_fuzz(options);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "storage_manager.hpp"
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using cloud::server::SpaceOptions;
+using cloud::server::StorageManager;
+using cloud::server::UploadSession;
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::filesystem::path dir = "storage_bench.tmp";
+    std::size_t uploads = 8;
+    std::size_t file_mib = 64;
+    std::size_t chunk_kib = 1024;
+};
+
+struct Result {
+    double mib_per_sec = 0;
+    double avg_extents = 0;
+    std::size_t min_extents = 0;
+    std::size_t max_extents = 0;
+};
+
+// Number of extents backing `path`; FIEMAP_FLAG_SYNC flushes delayed allocations first
+// so the count reflects the final on-disk layout.
+std::size_t count_extents(const std::filesystem::path& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    fiemap map{};
+    map.fm_start = 0;
+    map.fm_length = FIEMAP_MAX_OFFSET;
+    map.fm_flags = FIEMAP_FLAG_SYNC;
+    map.fm_extent_count = 0;
+    const bool ok = ::ioctl(fd, FS_IOC_FIEMAP, &map) == 0;
+    ::close(fd);
+    return ok ? map.fm_mapped_extents : 0;
+}
+
+std::string fake_md5(std::size_t index) {
+    char buf[33];
+    std::snprintf(buf, sizeof(buf), "%032zx", index + 1);
+    return buf;
+}
+
+// Writes `uploads` files concurrently the way interleaved clients would: one chunk of
+// each upload in turn, through the server's UploadSession path.
+Result run(const Options& options, bool preallocate) {
+    const auto root = options.dir / (preallocate ? "prealloc" : "grow");
+    std::filesystem::remove_all(root);
+    StorageManager storage(root, {}, {}, SpaceOptions{.preallocate = preallocate, .reserve_bytes = 0});
+
+    const std::uint64_t total = static_cast<std::uint64_t>(options.file_mib) * 1024 * 1024;
+    const std::size_t chunk = options.chunk_kib * 1024;
+    std::vector<std::byte> data(chunk);
+    std::mt19937_64 rng(7);
+    for (auto& b : data) {
+        b = static_cast<std::byte>(rng());
+    }
+
+    std::vector<std::filesystem::path> parts;
+    std::vector<std::unique_ptr<UploadSession>> sessions;
+    const auto start = Clock::now();
+    for (std::size_t i = 0; i < options.uploads; ++i) {
+        auto checkpoint = storage.prepare_upload("bench", fake_md5(i), "file" + std::to_string(i), total);
+        if (!storage.has_space_for(checkpoint)) {
+            std::cerr << "Not enough space in " << root << std::endl;
+            std::exit(1);
+        }
+        parts.push_back(checkpoint.temp_path);
+        sessions.push_back(storage.open_upload(checkpoint));
+    }
+    for (std::uint64_t offset = 0; offset < total; offset += chunk) {
+        const auto length = static_cast<std::size_t>(std::min<std::uint64_t>(chunk, total - offset));
+        for (auto& session : sessions) {
+            session->write(offset, std::span<const std::byte>(data.data(), length));
+        }
+    }
+    for (auto& session : sessions) {
+        session->close();
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result r;
+    r.min_extents = SIZE_MAX;
+    std::size_t extents = 0;
+    for (const auto& part : parts) {
+        const auto count = count_extents(part);
+        extents += count;
+        r.min_extents = std::min(r.min_extents, count);
+        r.max_extents = std::max(r.max_extents, count);
+    }
+    r.avg_extents = static_cast<double>(extents) / static_cast<double>(parts.size());
+    r.mib_per_sec = static_cast<double>(total * options.uploads) / elapsed / (1024.0 * 1024.0);
+    std::filesystem::remove_all(root);
+    return r;
+}
+
+Options parse_options(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--dir") {
+            options.dir = value;
+        } else if (key == "--uploads") {
+            options.uploads = std::stoull(value);
+        } else if (key == "--file-mib") {
+            options.file_mib = std::stoull(value);
+        } else if (key == "--chunk-kib") {
+            options.chunk_kib = std::stoull(value);
+        } else {
+            std::cerr << "Unknown option " << key << std::endl;
+            std::exit(2);
+        }
+    }
+    if (options.uploads == 0 || options.file_mib == 0 || options.chunk_kib == 0) {
+        std::cerr << "--uploads, --file-mib and --chunk-kib must be positive" << std::endl;
+        std::exit(2);
+    }
+    return options;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const auto options = parse_options(argc, argv);
+    std::filesystem::create_directories(options.dir);
+
+    std::printf("%zu interleaved uploads x %zu MiB, %zu KiB chunks, in %s\n", options.uploads, options.file_mib,
+                options.chunk_kib, options.dir.c_str());
+    std::printf("%-10s %10s %12s %12s %12s\n", "mode", "MiB/s", "avg_extents", "min_extents", "max_extents");
+    for (bool preallocate : {false, true}) {
+        const auto r = run(options, preallocate);
+        std::printf("%-10s %10.1f %12.1f %12zu %12zu\n", preallocate ? "prealloc" : "grow", r.mib_per_sec,
+                    r.avg_extents, r.min_extents, r.max_extents);
+    }
+    std::filesystem::remove_all(options.dir);
+    return 0;
+}
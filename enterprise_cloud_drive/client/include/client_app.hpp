@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace cloud::client {
@@ -16,15 +17,21 @@ public:
     ~ClientApp();
 
     bool connect_to_server(const std::string& host, uint16_t port);
+    void set_compression(bool enabled) { compression_requested_ = enabled; }
     void run_shell();
 
 private:
     void close_connection();
-    bool send_message(const cloud::protocol::Message& message);
+    void negotiate();
+    bool send_message(cloud::protocol::Message message);
     bool read_message(cloud::protocol::Message& message);
+    std::optional<std::uint64_t> send_request(cloud::protocol::Message message);
+    std::optional<cloud::protocol::Message> await_response(std::uint64_t rid);
     std::optional<cloud::protocol::Message> call(cloud::protocol::Message message);
 
-    bool handle_upload(const std::filesystem::path& local_path, const std::filesystem::path& remote_path);
+    bool handle_upload(const std::filesystem::path& local_path,
+                       const std::filesystem::path& remote_path,
+                       bool allow_delta = true);
     bool handle_download(const std::filesystem::path& remote_path, const std::filesystem::path& local_path);
     bool ensure_logged_in();
 
@@ -34,6 +41,17 @@ private:
 
     std::string token_;
     std::string remote_cwd_ = ".";
+    bool compression_requested_ = true;
+    bool compression_ = false;
+    bool checksum_ = false;
+    uint16_t protocol_version_ = cloud::protocol::kMinVersion;
+    std::size_t chunk_bytes_ = 1 * 1024 * 1024;
+    std::size_t window_ = 1;
+    bool rid_supported_ = false;
+    bool cdc_supported_ = false;
+    bool delta_supported_ = false;
+    std::uint64_t next_rid_ = 0;
+    std::unordered_map<std::uint64_t, cloud::protocol::Message> stashed_;
 };
 
 }  // namespace cloud::client
@@ -1,5 +1,9 @@
 #include "client_app.hpp"
 
+#include "compression.hpp"
+#include "crc32c.hpp"
+#include "delta_sync.hpp"
+#include "fastcdc.hpp"
 #include "socket_utils.hpp"
 
 #include <arpa/inet.h>
@@ -26,7 +30,51 @@ namespace cloud::client {
 
 namespace {
 constexpr std::size_t kChunkBytes = 1 * 1024 * 1024;
+constexpr std::size_t kMaxChunkBytes = 4 * 1024 * 1024;
+constexpr std::size_t kMaxFrameBytes = 16 * 1024 * 1024;
+constexpr std::size_t kPipelineWindow = 8;
 constexpr std::size_t kMmapThreshold = 100ULL * 1024 * 1024;
+constexpr int kMaxChunkAttempts = 3;
+constexpr std::uint64_t kCdcMinFileBytes = 1024 * 1024;
+
+struct UploadUnit {
+    std::uint64_t offset;
+    std::uint64_t length;
+    std::string chunk_id;
+};
+
+// Content-defined chunks of the whole file with their fingerprints.
+std::vector<UploadUnit> build_manifest(int fd, std::uint64_t size) {
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return {};
+    }
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+    const std::span<const std::byte> data(static_cast<const std::byte*>(mapped), size);
+    std::vector<UploadUnit> manifest;
+    for (const auto& chunk : chunking::split(data)) {
+        manifest.push_back(UploadUnit{chunk.offset, chunk.length,
+                                      chunking::chunk_id(data.subspan(chunk.offset, chunk.length))});
+    }
+    ::munmap(mapped, size);
+    return manifest;
+}
+
+// The file as literals and copies of the blocks the server's version already has.
+std::vector<delta::Segment> build_delta(int fd,
+                                        std::uint64_t size,
+                                        std::size_t block,
+                                        const std::vector<delta::BlockSignature>& signatures) {
+    void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return {};
+    }
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+    auto segments =
+        delta::compute_delta(std::span<const std::byte>(static_cast<const std::byte*>(mapped), size), block, signatures);
+    ::munmap(mapped, size);
+    return segments;
+}
 
 std::string compute_md5(const std::filesystem::path& path) {
     std::ifstream stream(path, std::ios::binary);
@@ -61,17 +109,6 @@ std::string bytes_to_string(const std::vector<std::byte>& data) {
     return std::string(reinterpret_cast<const char*>(data.data()), data.size());
 }
 
-bool write_chunk(const std::filesystem::path& path, std::uint64_t offset, std::span<const std::byte> data) {
-    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR, 0644);
-    if (fd < 0) {
-        return false;
-    }
-    const ssize_t written =
-        ::pwrite(fd, data.data(), static_cast<size_t>(data.size()), static_cast<off_t>(offset));
-    ::close(fd);
-    return written == static_cast<ssize_t>(data.size());
-}
-
 }  // namespace
 
 ClientApp::ClientApp() = default;
@@ -115,9 +152,51 @@ bool ClientApp::connect_to_server(const std::string& host, uint16_t port) {
     inbound_offset_ = 0;
     token_.clear();
     remote_cwd_ = ".";
+    compression_ = false;
+    negotiate();
     return true;
 }
 
+void ClientApp::negotiate() {
+    protocol_version_ = protocol::kMinVersion;
+    chunk_bytes_ = kChunkBytes;
+    window_ = 1;
+    checksum_ = false;
+    rid_supported_ = false;
+    cdc_supported_ = false;
+    delta_supported_ = false;
+    next_rid_ = 0;
+    stashed_.clear();
+
+    protocol::Message hello;
+    hello.headers.emplace("cmd", "HELLO");
+    hello.headers.emplace("version", std::to_string(protocol::kVersion));
+    hello.headers.emplace("max_frame", std::to_string(kMaxFrameBytes));
+    hello.headers.emplace("max_chunk", std::to_string(kMaxChunkBytes));
+    hello.headers.emplace("window", std::to_string(kPipelineWindow));
+    hello.headers.emplace("checksum", "crc32c");
+    if (compression_requested_) {
+        hello.headers.emplace("compression", std::string(compression::kDeflate));
+    }
+    auto resp = call(std::move(hello));
+    if (!resp || protocol::header_value(*resp, "status") != "ok") {
+        // Servers that predate HELLO keep the legacy fixed parameters.
+        return;
+    }
+    auto number = [&](const char* key, std::uint64_t fallback) {
+        const auto value = protocol::header_value(*resp, key);
+        return value.empty() ? fallback : std::stoull(std::string(value));
+    };
+    protocol_version_ = static_cast<uint16_t>(number("version", protocol::kMinVersion));
+    chunk_bytes_ = static_cast<std::size_t>(number("max_chunk", kChunkBytes));
+    window_ = std::max<std::size_t>(1, static_cast<std::size_t>(number("window", 1)));
+    checksum_ = protocol::header_value(*resp, "checksum") == "crc32c";
+    compression_ = protocol::header_value(*resp, "compression") == compression::kDeflate;
+    rid_supported_ = protocol::list_contains(protocol::header_value(*resp, "features"), "rid");
+    cdc_supported_ = protocol::list_contains(protocol::header_value(*resp, "features"), "cdc");
+    delta_supported_ = protocol::list_contains(protocol::header_value(*resp, "features"), "delta");
+}
+
 void ClientApp::close_connection() {
     if (socket_fd_ >= 0) {
         ::close(socket_fd_);
@@ -125,10 +204,11 @@ void ClientApp::close_connection() {
     }
 }
 
-bool ClientApp::send_message(const protocol::Message& message) {
+bool ClientApp::send_message(protocol::Message message) {
     if (socket_fd_ < 0) {
         return false;
     }
+    message.version = protocol_version_;
     const auto buffer = protocol::encode(message);
     return cloud::net::send_all(socket_fd_, buffer.data(), buffer.size());
 }
@@ -137,6 +217,7 @@ bool ClientApp::read_message(protocol::Message& message) {
     std::array<std::byte, 64 * 1024> buffer{};
     while (true) {
         if (protocol::try_decode(inbound_, inbound_offset_, message)) {
+            compression::decompress_message(message);
             return true;
         }
         const ssize_t received = ::recv(socket_fd_, buffer.data(), buffer.size(), 0);
@@ -147,7 +228,7 @@ bool ClientApp::read_message(protocol::Message& message) {
     }
 }
 
-std::optional<protocol::Message> ClientApp::call(protocol::Message message) {
+std::optional<std::uint64_t> ClientApp::send_request(protocol::Message message) {
     if (socket_fd_ < 0) {
         std::cerr << "Not connected" << std::endl;
         return std::nullopt;
@@ -155,14 +236,46 @@ std::optional<protocol::Message> ClientApp::call(protocol::Message message) {
     if (!token_.empty()) {
         message.headers.emplace("token", token_);
     }
-    if (!send_message(message)) {
+    std::uint64_t rid = 0;
+    if (rid_supported_) {
+        rid = ++next_rid_;
+        message.headers.emplace("rid", std::to_string(rid));
+    }
+    if (!send_message(std::move(message))) {
         return std::nullopt;
     }
-    protocol::Message response;
-    if (!read_message(response)) {
+    return rid;
+}
+
+std::optional<protocol::Message> ClientApp::await_response(std::uint64_t rid) {
+    if (auto it = stashed_.find(rid); it != stashed_.end()) {
+        auto response = std::move(it->second);
+        stashed_.erase(it);
+        return response;
+    }
+    while (true) {
+        protocol::Message response;
+        if (!read_message(response)) {
+            return std::nullopt;
+        }
+        const auto tag = protocol::header_value(response, "rid");
+        if (rid == 0 || tag.empty()) {
+            return response;
+        }
+        const auto response_rid = std::stoull(std::string(tag));
+        if (response_rid == rid) {
+            return response;
+        }
+        stashed_[response_rid] = std::move(response);
+    }
+}
+
+std::optional<protocol::Message> ClientApp::call(protocol::Message message) {
+    auto rid = send_request(std::move(message));
+    if (!rid) {
         return std::nullopt;
     }
-    return response;
+    return await_response(*rid);
 }
 
 bool ClientApp::ensure_logged_in() {
@@ -173,7 +286,9 @@ bool ClientApp::ensure_logged_in() {
     return false;
 }
 
-bool ClientApp::handle_upload(const std::filesystem::path& local_path, const std::filesystem::path& remote_path) {
+bool ClientApp::handle_upload(const std::filesystem::path& local_path,
+                              const std::filesystem::path& remote_path,
+                              bool allow_delta) {
     if (!ensure_logged_in()) {
         return false;
     }
@@ -185,24 +300,106 @@ bool ClientApp::handle_upload(const std::filesystem::path& local_path, const std
     std::cout << "Computing MD5..." << std::endl;
     const auto md5 = compute_md5(local_path);
 
+    const int fd = ::open(local_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Unable to open local file: " << local_path << std::endl;
+        return false;
+    }
+    void* mapped = MAP_FAILED;
+    auto release = [&]() {
+        if (mapped != MAP_FAILED) {
+            ::munmap(mapped, size);
+        }
+        ::close(fd);
+    };
+
     protocol::Message init;
     init.headers.emplace("cmd", "FILE_UPLOAD_INIT");
     init.headers.emplace("path", remote_path.generic_string());
     init.headers.emplace("size", std::to_string(size));
     init.headers.emplace("md5", md5);
 
+    // A large file replacing one on the server is matched against that version's block
+    // signatures first; if enough of it is unchanged, only the differing bytes are sent.
+    std::vector<delta::Segment> segments;
+    if (delta_supported_ && allow_delta && size >= kCdcMinFileBytes) {
+        protocol::Message request;
+        request.headers.emplace("cmd", "FILE_DELTA_SIGNATURE");
+        request.headers.emplace("path", remote_path.generic_string());
+        auto signature = call(std::move(request));
+        const auto block = signature ? std::stoull(std::string(protocol::header_value(*signature, "block", "0"))) : 0;
+        auto signatures = signature && protocol::header_value(*signature, "status") == "ok"
+                              ? delta::parse_signatures(bytes_to_string(signature->body))
+                              : std::nullopt;
+        if (signatures && block > 0 && protocol::header_value(*signature, "base") != md5) {
+            segments = build_delta(fd, size, block, *signatures);
+            const auto body = delta::encode_segments(segments);
+            if (!segments.empty() && delta::literal_bytes(segments) + body.size() < size &&
+                body.size() + 4096 < kMaxFrameBytes) {
+                init.headers.emplace("delta", std::string(delta::kRsync));
+                init.headers.emplace("base", std::string(protocol::header_value(*signature, "base")));
+                init.body.assign(reinterpret_cast<const std::byte*>(body.data()),
+                                 reinterpret_cast<const std::byte*>(body.data() + body.size()));
+                if (compression_) {
+                    compression::compress_message(init);
+                }
+            } else {
+                segments.clear();
+            }
+        }
+    }
+
+    // Large files go up as a content-defined chunk manifest so the server only asks
+    // for chunks it does not already hold.
+    std::vector<UploadUnit> manifest;
+    if (segments.empty() && cdc_supported_ && size >= kCdcMinFileBytes) {
+        manifest = build_manifest(fd, size);
+        std::string listing;
+        for (const auto& unit : manifest) {
+            listing += unit.chunk_id + " " + std::to_string(unit.length) + "\n";
+        }
+        if (!manifest.empty() && listing.size() + 4096 < kMaxFrameBytes) {
+            init.headers.emplace("chunking", std::string(chunking::kFastCdc));
+            init.body.assign(reinterpret_cast<const std::byte*>(listing.data()),
+                             reinterpret_cast<const std::byte*>(listing.data() + listing.size()));
+            if (compression_) {
+                compression::compress_message(init);
+            }
+        } else {
+            manifest.clear();
+        }
+    }
+
     auto init_resp = call(std::move(init));
     if (!init_resp) {
         std::cerr << "Failed to initialize upload" << std::endl;
+        release();
         return false;
     }
     const auto status = protocol::header_value(*init_resp, "status");
     if (status == "instant") {
         std::cout << "Instant transfer succeeded (server already has the file)." << std::endl;
+        release();
         return true;
     }
+    if (status == "no_space") {
+        std::cerr << "Upload rejected: not enough free space on the server" << std::endl;
+        release();
+        return false;
+    }
+    if (status == "quota_exceeded") {
+        std::cerr << "Upload rejected: storage quota exceeded" << std::endl;
+        release();
+        return false;
+    }
+    if (status == "stale") {
+        // The version the delta was computed against has changed; send the whole file.
+        release();
+        return handle_upload(local_path, remote_path, false);
+    }
     if (status != "ready") {
         std::cerr << "Upload init failed: " << bytes_to_string(init_resp->body) << std::endl;
+        release();
         return false;
     }
     std::uint64_t offset = 0;
@@ -211,49 +408,153 @@ bool ClientApp::handle_upload(const std::filesystem::path& local_path, const std
         offset = std::stoull(std::string(offset_view));
     }
 
-    const bool use_mmap = size >= kMmapThreshold;
-    const int fd = use_mmap ? ::open(local_path.c_str(), O_RDONLY) : -1;
-    void* mapped = MAP_FAILED;
-    if (use_mmap && fd >= 0) {
+    // Units the server still needs: the whole file, the chunks it reported missing, or
+    // the literal segments of a delta. A delta's units are laid out back to back in the
+    // upload stream, with `local_offsets` holding where each one sits in the file.
+    std::vector<UploadUnit> units;
+    std::vector<char> needed;
+    std::vector<std::uint64_t> local_offsets;
+    std::uint64_t stream_size = size;
+    const bool delta_upload = !segments.empty() && protocol::header_value(*init_resp, "delta") == delta::kRsync;
+    if (delta_upload) {
+        stream_size = 0;
+        std::uint64_t local = 0;
+        for (const auto& segment : segments) {
+            if (!segment.base_offset) {
+                units.push_back(UploadUnit{stream_size, segment.length, {}});
+                needed.push_back(1);
+                local_offsets.push_back(local);
+                stream_size += segment.length;
+            }
+            local += segment.length;
+        }
+        std::cout << "Sending " << stream_size << " of " << size << " bytes as a delta" << std::endl;
+    } else if (!manifest.empty() && protocol::header_value(*init_resp, "chunking") == chunking::kFastCdc) {
+        units = std::move(manifest);
+        needed.assign(units.size(), 0);
+        std::istringstream missing(bytes_to_string(init_resp->body));
+        std::size_t index = 0;
+        std::size_t missing_count = 0;
+        while (missing >> index) {
+            if (index < needed.size()) {
+                needed[index] = 1;
+                ++missing_count;
+            }
+        }
+        std::cout << "Server already holds " << units.size() - missing_count << "/" << units.size()
+                  << " chunks" << std::endl;
+    } else {
+        units.push_back(UploadUnit{0, size, {}});
+        needed.push_back(1);
+    }
+    auto unit_at = [&](std::uint64_t pos) -> std::size_t {
+        auto it = std::upper_bound(units.begin(), units.end(), pos,
+                                   [](std::uint64_t p, const UploadUnit& unit) { return p < unit.offset; });
+        return static_cast<std::size_t>(it - units.begin()) - 1;
+    };
+    auto next_needed = [&](std::uint64_t pos) -> std::uint64_t {
+        for (auto i = unit_at(pos); i < units.size(); ++i) {
+            if (needed[i] && units[i].offset + units[i].length > pos) {
+                return std::max(pos, units[i].offset);
+            }
+        }
+        return stream_size;
+    };
+    auto run_end = [&](std::uint64_t pos) {
+        auto i = unit_at(pos);
+        while (!delta_upload && i + 1 < units.size() && needed[i + 1]) {
+            ++i;
+        }
+        return units[i].offset + units[i].length;
+    };
+
+    if (size >= kMmapThreshold) {
         mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
-    std::ifstream stream;
-    if (!use_mmap) {
-        stream.open(local_path, std::ios::binary);
-    }
 
-    while (offset < size) {
-        const auto chunk_size = std::min<std::uint64_t>(kChunkBytes, size - offset);
+    auto build_chunk = [&](std::uint64_t at, std::uint64_t chunk_size) {
         protocol::Message chunk_msg;
         chunk_msg.headers.emplace("cmd", "FILE_UPLOAD_CHUNK");
-        chunk_msg.headers.emplace("offset", std::to_string(offset));
-
-        if (use_mmap && mapped != MAP_FAILED) {
-            chunk_msg.body = slice_from_mmap(static_cast<std::byte*>(mapped), offset, chunk_size);
+        chunk_msg.headers.emplace("offset", std::to_string(at));
+        chunk_msg.headers.emplace("token", token_);
+        const auto local = delta_upload ? local_offsets[unit_at(at)] + (at - units[unit_at(at)].offset) : at;
+        if (mapped != MAP_FAILED) {
+            chunk_msg.body = slice_from_mmap(static_cast<std::byte*>(mapped), local, chunk_size);
         } else {
             std::vector<std::byte> buffer(chunk_size);
-            stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(chunk_size));
+            const ssize_t got = ::pread(fd, buffer.data(), chunk_size, static_cast<off_t>(local));
+            buffer.resize(got > 0 ? static_cast<std::size_t>(got) : 0);
             chunk_msg.body = std::move(buffer);
         }
+        chunk_msg.headers.emplace("crc32c", integrity::crc32c_hex(chunk_msg.body));
+        if (compression_) {
+            compression::compress_message(chunk_msg);
+        }
+        return chunk_msg;
+    };
+
+    // Keep up to window_ chunks in flight. On a rejected chunk, drain the window and
+    // rewind to the offset the server reports as received.
+    std::uint64_t next = next_needed(offset);
+    std::size_t in_flight = 0;
+    std::uint64_t rewind_offset = offset;
+    int rewinds = 0;
+    while (true) {
+        while (in_flight < window_ && next < stream_size) {
+            const auto chunk_size = std::min<std::uint64_t>(chunk_bytes_, run_end(next) - next);
+            if (!send_message(build_chunk(next, chunk_size))) {
+                release();
+                return false;
+            }
+            next = next_needed(next + chunk_size);
+            ++in_flight;
+        }
+        if (in_flight == 0) {
+            break;
+        }
 
-        auto resp = call(std::move(chunk_msg));
-        if (!resp || protocol::header_value(*resp, "status") != "ok") {
-            std::cerr << "Failed to upload chunk at offset " << offset << std::endl;
-            if (use_mmap && mapped != MAP_FAILED) {
-                ::munmap(mapped, size);
-                ::close(fd);
+        protocol::Message resp;
+        if (!read_message(resp)) {
+            release();
+            return false;
+        }
+        --in_flight;
+        const auto chunk_status = protocol::header_value(resp, "status");
+        const auto received = std::stoull(std::string(protocol::header_value(resp, "received", "0")));
+        if (chunk_status == "ok") {
+            offset = received;
+            std::cout << "\rUploaded " << offset << "/" << stream_size << std::flush;
+            continue;
+        }
+        if (chunk_status != "checksum_mismatch" && chunk_status != "offset") {
+            std::cerr << "\nFailed to upload chunk: " << chunk_status << std::endl;
+            release();
+            return false;
+        }
+        while (in_flight > 0) {
+            if (!read_message(resp)) {
+                release();
+                return false;
             }
+            --in_flight;
+        }
+        rewinds = received == rewind_offset ? rewinds + 1 : 1;
+        rewind_offset = received;
+        if (rewinds >= kMaxChunkAttempts) {
+            std::cerr << "\nFailed to upload chunk at offset " << received << std::endl;
+            release();
             return false;
         }
-        offset += chunk_size;
-        std::cout << "\rUploaded " << offset << "/" << size << std::flush;
+        std::cerr << "\nChunk rejected (" << chunk_status << "), resending from offset " << received << std::endl;
+        // The server may have been unable to reuse a chunk it listed as present.
+        if (received < stream_size) {
+            needed[unit_at(received)] = 1;
+        }
+        offset = received;
+        next = next_needed(received);
     }
     std::cout << std::endl;
-
-    if (use_mmap && mapped != MAP_FAILED) {
-        ::munmap(mapped, size);
-        ::close(fd);
-    }
+    release();
 
     protocol::Message commit;
     commit.headers.emplace("cmd", "FILE_UPLOAD_COMMIT");
@@ -296,30 +597,90 @@ bool ClientApp::handle_download(const std::filesystem::path& remote_path, const
     }
     ::ftruncate(fd, static_cast<off_t>(total_size));
 
-    while (local_offset < total_size) {
+    // Keep up to window_ fetches in flight; when the server supports request ids the
+    // replies may arrive in any order and each one is written at its own offset.
+    struct PendingFetch {
+        std::uint64_t offset;
+        std::uint64_t length;
+        int attempts;
+    };
+    std::unordered_map<std::uint64_t, PendingFetch> pending;
+    const std::size_t window = rid_supported_ ? window_ : 1;
+    std::uint64_t next = local_offset;
+    std::uint64_t downloaded = local_offset;
+
+    auto issue = [&](std::uint64_t at, std::uint64_t length, int attempts) {
         protocol::Message chunk_req;
         chunk_req.headers.emplace("cmd", "FILE_DOWNLOAD_FETCH");
         chunk_req.headers.emplace("path", remote_path.generic_string());
-        chunk_req.headers.emplace("offset", std::to_string(local_offset));
-        chunk_req.headers.emplace(
-            "length",
-            std::to_string(std::min<std::uint64_t>(kChunkBytes, total_size - local_offset)));
-
-        auto chunk_resp = call(std::move(chunk_req));
-        if (!chunk_resp) {
-            ::close(fd);
+        chunk_req.headers.emplace("offset", std::to_string(at));
+        chunk_req.headers.emplace("length", std::to_string(length));
+        if (checksum_) {
+            chunk_req.headers.emplace("checksum", "crc32c");
+        }
+        auto rid = send_request(std::move(chunk_req));
+        if (!rid) {
             return false;
         }
-        if (protocol::header_value(*chunk_resp, "status") == "done") {
-            break;
+        pending[*rid] = PendingFetch{at, length, attempts};
+        return true;
+    };
+    auto fail = [&](const std::string& reason) {
+        if (!reason.empty()) {
+            std::cerr << "\n" << reason << std::endl;
         }
-        if (!write_chunk(local_path, local_offset, chunk_resp->body)) {
-            std::cerr << "Failed to write downloaded chunk" << std::endl;
-            ::close(fd);
-            return false;
+        ::close(fd);
+        return false;
+    };
+
+    while (next < total_size || !pending.empty()) {
+        while (pending.size() < window && next < total_size) {
+            const auto length = std::min<std::uint64_t>(chunk_bytes_, total_size - next);
+            if (!issue(next, length, 1)) {
+                return fail("Connection lost");
+            }
+            next += length;
+        }
+
+        protocol::Message chunk_resp;
+        if (!read_message(chunk_resp)) {
+            return fail("Connection lost");
         }
-        local_offset += chunk_resp->body.size();
-        std::cout << "\rDownloaded " << local_offset << "/" << total_size << std::flush;
+        const auto rid_view = protocol::header_value(chunk_resp, "rid");
+        auto it = pending.find(rid_view.empty() ? 0 : std::stoull(std::string(rid_view)));
+        if (it == pending.end()) {
+            continue;
+        }
+        const auto fetch = it->second;
+        pending.erase(it);
+
+        const auto chunk_status = protocol::header_value(chunk_resp, "status");
+        if (chunk_status == "done") {
+            continue;
+        }
+        if (chunk_status != "ok") {
+            return fail("Download failed at offset " + std::to_string(fetch.offset) + ": " + std::string(chunk_status));
+        }
+        if (!integrity::verify_crc32c(chunk_resp.body, protocol::header_value(chunk_resp, "crc32c"))) {
+            if (fetch.attempts >= kMaxChunkAttempts) {
+                return fail("Chunk at offset " + std::to_string(fetch.offset) + " failed integrity check");
+            }
+            std::cerr << "\nChecksum mismatch at offset " << fetch.offset << ", refetching chunk" << std::endl;
+            if (!issue(fetch.offset, fetch.length, fetch.attempts + 1)) {
+                return fail("Connection lost");
+            }
+            continue;
+        }
+        const auto got = chunk_resp.body.size();
+        const ssize_t written = ::pwrite(fd, chunk_resp.body.data(), got, static_cast<off_t>(fetch.offset));
+        if (written != static_cast<ssize_t>(got)) {
+            return fail("Failed to write downloaded chunk");
+        }
+        if (got > 0 && got < fetch.length && !issue(fetch.offset + got, fetch.length - got, 1)) {
+            return fail("Connection lost");
+        }
+        downloaded += got;
+        std::cout << "\rDownloaded " << downloaded << "/" << total_size << std::flush;
     }
     std::cout << std::endl;
     ::close(fd);
@@ -361,6 +722,11 @@ void ClientApp::run_shell() {
                       << "  upload <local> [remote]\n"
                       << "  download <remote> <local>\n"
                       << "  delete <remote>\n"
+                      << "  mv <remote> <target>\n"
+                      << "  cp <remote> <target>\n"
+                      << "  trash\n"
+                      << "  usage\n"
+                      << "  stats\n"
                       << "  logout\n"
                       << "  quit" << std::endl;
             continue;
@@ -402,6 +768,9 @@ void ClientApp::run_shell() {
             msg.headers.emplace("cmd", "LOGIN");
             msg.headers.emplace("username", username);
             msg.headers.emplace("password", password);
+            if (compression_requested_) {
+                msg.headers.emplace("accept_encoding", std::string(compression::kDeflate));
+            }
             auto resp = call(std::move(msg));
             if (!resp) {
                 std::cout << "Connection lost." << std::endl;
@@ -410,6 +779,7 @@ void ClientApp::run_shell() {
             if (protocol::header_value(*resp, "status") == "ok") {
                 token_ = std::string(protocol::header_value(*resp, "token"));
                 remote_cwd_ = ".";
+                compression_ = protocol::header_value(*resp, "compression") == compression::kDeflate;
                 std::cout << "Login successful. Token issued." << std::endl;
             } else {
                 std::cout << "Login failed." << std::endl;
@@ -536,9 +906,75 @@ void ClientApp::run_shell() {
             continue;
         }
 
+        if (cmd_lower == "mv" || cmd_lower == "cp") {
+            std::string path, target;
+            iss >> path >> target;
+            if (path.empty() || target.empty()) {
+                std::cout << "Usage: " << cmd_lower << " <path> <target>" << std::endl;
+                continue;
+            }
+            protocol::Message msg;
+            msg.headers.emplace("cmd", cmd_lower == "mv" ? "FILE_MOVE" : "FILE_COPY");
+            msg.headers.emplace("path", path);
+            msg.headers.emplace("target", target);
+            auto resp = call(std::move(msg));
+            if (!resp) {
+                std::cout << "Connection lost." << std::endl;
+                break;
+            }
+            std::cout << cmd_lower << ": " << protocol::header_value(*resp, "status", "error") << std::endl;
+            continue;
+        }
+
+        if (cmd_lower == "stats") {
+            protocol::Message msg;
+            msg.headers.emplace("cmd", "SERVER_STATS");
+            auto resp = call(std::move(msg));
+            if (!resp || protocol::header_value(*resp, "status") != "ok") {
+                std::cout << "Stats unavailable" << std::endl;
+                continue;
+            }
+            std::cout << bytes_to_string(resp->body);
+            continue;
+        }
+
+        if (cmd_lower == "trash") {
+            protocol::Message msg;
+            msg.headers.emplace("cmd", "TRASH_STATUS");
+            auto resp = call(std::move(msg));
+            if (!resp || protocol::header_value(*resp, "status") != "ok") {
+                std::cout << "Trash status unavailable" << std::endl;
+                continue;
+            }
+            std::cout << "Pending deletes: " << protocol::header_value(*resp, "pending", "0") << std::endl;
+            std::cout << bytes_to_string(resp->body);
+            continue;
+        }
+
+        if (cmd_lower == "usage") {
+            protocol::Message msg;
+            msg.headers.emplace("cmd", "USAGE");
+            auto resp = call(std::move(msg));
+            if (!resp || protocol::header_value(*resp, "status") != "ok") {
+                std::cout << "Usage unavailable" << std::endl;
+                continue;
+            }
+            auto limit = [](std::string_view value) {
+                return value == "0" ? std::string("unlimited") : std::string(value);
+            };
+            std::cout << "Bytes: " << protocol::header_value(*resp, "bytes", "0") << " / "
+                      << limit(protocol::header_value(*resp, "quota_bytes", "0")) << "\n"
+                      << "Files: " << protocol::header_value(*resp, "files", "0") << " / "
+                      << limit(protocol::header_value(*resp, "quota_files", "0")) << "\n"
+                      << "Uploads in progress: " << protocol::header_value(*resp, "pending_bytes", "0") << " bytes"
+                      << std::endl;
+            continue;
+        }
+
         if (cmd_lower == "logout") {
             token_.clear();
             remote_cwd_ = ".";
+            compression_ = false;
             std::cout << "Cleared local token." << std::endl;
             continue;
         }
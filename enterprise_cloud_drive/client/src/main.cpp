@@ -4,7 +4,7 @@
 
 int main(int argc, char* argv[]) {
     if (argc < 3) {
-        std::cerr << "Usage: cloud_drive_client <host> <port>" << std::endl;
+        std::cerr << "Usage: cloud_drive_client <host> <port> [--no-compress]" << std::endl;
         return 1;
     }
 
@@ -12,6 +12,9 @@ int main(int argc, char* argv[]) {
     const uint16_t port = static_cast<uint16_t>(std::stoi(argv[2]));
 
     cloud::client::ClientApp app;
+    if (argc > 3 && std::string(argv[3]) == "--no-compress") {
+        app.set_compression(false);
+    }
     if (!app.connect_to_server(host, port)) {
         return 1;
     }
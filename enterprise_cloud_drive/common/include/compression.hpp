@@ -0,0 +1,118 @@
+#pragma once
+
+#include "protocol.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloud::compression {
+
+inline constexpr std::string_view kDeflate = "deflate";
+inline constexpr std::size_t kMinCompressBytes = 512;
+inline constexpr std::size_t kEntropySampleBytes = 16 * 1024;
+inline constexpr double kMaxEntropyBitsPerByte = 7.2;
+inline constexpr std::size_t kMaxInflatedBytes = 64 * 1024 * 1024;
+
+// Shannon entropy (bits/byte) over an evenly strided sample of the payload.
+inline double estimate_entropy(std::span<const std::byte> data) {
+    if (data.empty()) {
+        return 0.0;
+    }
+    std::array<std::uint32_t, 256> histogram{};
+    const std::size_t stride = std::max<std::size_t>(1, data.size() / kEntropySampleBytes);
+    std::size_t samples = 0;
+    for (std::size_t i = 0; i < data.size(); i += stride) {
+        ++histogram[static_cast<unsigned char>(data[i])];
+        ++samples;
+    }
+    double entropy = 0.0;
+    for (auto count : histogram) {
+        if (count == 0) {
+            continue;
+        }
+        const double p = static_cast<double>(count) / static_cast<double>(samples);
+        entropy -= p * std::log2(p);
+    }
+    return entropy;
+}
+
+inline bool looks_compressible(std::span<const std::byte> data) {
+    return data.size() >= kMinCompressBytes && estimate_entropy(data) < kMaxEntropyBitsPerByte;
+}
+
+inline std::optional<std::vector<std::byte>> deflate_bytes(std::span<const std::byte> data) {
+    uLongf bound = compressBound(static_cast<uLong>(data.size()));
+    std::vector<std::byte> output(bound);
+    const int rc = compress2(reinterpret_cast<Bytef*>(output.data()), &bound,
+                             reinterpret_cast<const Bytef*>(data.data()), static_cast<uLong>(data.size()),
+                             Z_BEST_SPEED);
+    if (rc != Z_OK || bound >= data.size()) {
+        return std::nullopt;
+    }
+    output.resize(bound);
+    return output;
+}
+
+inline std::vector<std::byte> inflate_bytes(std::span<const std::byte> data, std::size_t raw_size) {
+    if (raw_size > kMaxInflatedBytes) {
+        throw std::runtime_error("Inflated body exceeds limit");
+    }
+    std::vector<std::byte> output(raw_size);
+    uLongf produced = static_cast<uLongf>(raw_size);
+    const int rc = uncompress(reinterpret_cast<Bytef*>(output.data()), &produced,
+                              reinterpret_cast<const Bytef*>(data.data()), static_cast<uLong>(data.size()));
+    if (rc != Z_OK || produced != raw_size) {
+        throw std::runtime_error("Corrupted compressed body");
+    }
+    return output;
+}
+
+inline bool accepts_deflate(std::string_view accept_list) {
+    return protocol::list_contains(accept_list, kDeflate);
+}
+
+// Replaces the body with its deflated form when it is worth it. Returns true if the
+// frame was compressed; incompressible or high-entropy bodies are left untouched.
+inline bool compress_message(protocol::Message& message) {
+    if (!looks_compressible(message.body)) {
+        return false;
+    }
+    auto packed = deflate_bytes(message.body);
+    if (!packed) {
+        return false;
+    }
+    message.headers["encoding"] = std::string(kDeflate);
+    message.headers["raw_size"] = std::to_string(message.body.size());
+    message.body = std::move(*packed);
+    return true;
+}
+
+// Inflates a body marked with `encoding=deflate` in place. Returns false if the frame
+// carried no encoding; throws on unknown encodings or corrupted payloads.
+inline bool decompress_message(protocol::Message& message) {
+    auto it = message.headers.find("encoding");
+    if (it == message.headers.end()) {
+        return false;
+    }
+    if (it->second != kDeflate) {
+        throw std::runtime_error("Unsupported body encoding");
+    }
+    const auto raw_size = std::stoull(std::string(protocol::header_value(message, "raw_size", "0")));
+    message.body = inflate_bytes(message.body, static_cast<std::size_t>(raw_size));
+    message.headers.erase(it);
+    message.headers.erase("raw_size");
+    return true;
+}
+
+}  // namespace cloud::compression
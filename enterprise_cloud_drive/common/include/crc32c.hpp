@@ -0,0 +1,248 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace cloud::integrity {
+
+namespace detail {
+
+inline constexpr std::uint32_t kCrc32cPoly = 0x82f63b78;  // reflected Castagnoli
+inline constexpr std::size_t kLongBlock = 8192;
+inline constexpr std::size_t kShortBlock = 256;
+
+using ShiftTable = std::array<std::array<std::uint32_t, 256>, 4>;
+
+inline std::uint32_t gf2_matrix_times(const std::uint32_t* mat, std::uint32_t vec) {
+    std::uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        ++mat;
+    }
+    return sum;
+}
+
+inline void gf2_matrix_square(std::uint32_t* square, const std::uint32_t* mat) {
+    for (int n = 0; n < 32; ++n) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+// Builds the GF(2) operator that advances a CRC over `len` zero bytes.
+inline void zeros_operator(std::uint32_t* even, std::size_t len) {
+    std::uint32_t odd[32];
+    odd[0] = kCrc32cPoly;
+    std::uint32_t row = 1;
+    for (int n = 1; n < 32; ++n) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0) {
+            return;
+        }
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+    std::memcpy(even, odd, sizeof(odd));
+}
+
+inline ShiftTable make_shift_table(std::size_t len) {
+    std::uint32_t op[32];
+    zeros_operator(op, len);
+    ShiftTable table{};
+    for (std::uint32_t n = 0; n < 256; ++n) {
+        table[0][n] = gf2_matrix_times(op, n);
+        table[1][n] = gf2_matrix_times(op, n << 8);
+        table[2][n] = gf2_matrix_times(op, n << 16);
+        table[3][n] = gf2_matrix_times(op, n << 24);
+    }
+    return table;
+}
+
+inline std::uint32_t shift(const ShiftTable& table, std::uint32_t crc) {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^
+           table[3][crc >> 24];
+}
+
+struct Tables {
+    std::array<std::array<std::uint32_t, 256>, 8> slice{};
+    ShiftTable long_shift{};
+    ShiftTable short_shift{};
+
+    Tables() {
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t crc = n;
+            for (int k = 0; k < 8; ++k) {
+                crc = crc & 1 ? (crc >> 1) ^ kCrc32cPoly : crc >> 1;
+            }
+            slice[0][n] = crc;
+        }
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t crc = slice[0][n];
+            for (std::size_t k = 1; k < 8; ++k) {
+                crc = slice[0][crc & 0xff] ^ (crc >> 8);
+                slice[k][n] = crc;
+            }
+        }
+        long_shift = make_shift_table(kLongBlock);
+        short_shift = make_shift_table(kShortBlock);
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+// Portable slicing-by-8 kernel.
+inline std::uint32_t crc32c_sw(std::uint32_t crc, const unsigned char* data, std::size_t length) {
+    const auto& t = tables().slice;
+    crc = ~crc;
+    while (length >= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^
+              t[4][(word >> 24) & 0xff] ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+              t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+inline std::uint64_t load64(const unsigned char* p) {
+    std::uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+__attribute__((target("sse4.2"))) inline std::uint64_t crc32c_hw_blocks(std::uint64_t crc0,
+                                                                         const unsigned char*& data,
+                                                                         std::size_t& length,
+                                                                         std::size_t block,
+                                                                         const ShiftTable& shift_table) {
+    while (length >= block * 3) {
+        std::uint64_t crc1 = 0;
+        std::uint64_t crc2 = 0;
+        const unsigned char* end = data + block;
+        do {
+            crc0 = _mm_crc32_u64(crc0, load64(data));
+            crc1 = _mm_crc32_u64(crc1, load64(data + block));
+            crc2 = _mm_crc32_u64(crc2, load64(data + block * 2));
+            data += 8;
+        } while (data < end);
+        crc0 = shift(shift_table, static_cast<std::uint32_t>(crc0)) ^ crc1;
+        crc0 = shift(shift_table, static_cast<std::uint32_t>(crc0)) ^ crc2;
+        data += block * 2;
+        length -= block * 3;
+    }
+    return crc0;
+}
+
+// SSE4.2 kernel: three independent crc32 streams hide the instruction latency and are
+// stitched back together with precomputed zero-shift operators.
+__attribute__((target("sse4.2"))) inline std::uint32_t crc32c_hw(std::uint32_t crc,
+                                                                  const unsigned char* data,
+                                                                  std::size_t length) {
+    const auto& t = tables();
+    std::uint64_t crc0 = ~crc;
+
+    while (length && (reinterpret_cast<std::uintptr_t>(data) & 7) != 0) {
+        crc0 = _mm_crc32_u8(static_cast<std::uint32_t>(crc0), *data++);
+        --length;
+    }
+    crc0 = crc32c_hw_blocks(crc0, data, length, kLongBlock, t.long_shift);
+    crc0 = crc32c_hw_blocks(crc0, data, length, kShortBlock, t.short_shift);
+    while (length >= 8) {
+        crc0 = _mm_crc32_u64(crc0, load64(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc0 = _mm_crc32_u8(static_cast<std::uint32_t>(crc0), *data++);
+    }
+    return ~static_cast<std::uint32_t>(crc0);
+}
+#endif
+
+inline bool hardware_available() {
+#if defined(__x86_64__)
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+}  // namespace detail
+
+inline std::uint32_t crc32c(std::span<const std::byte> data, std::uint32_t crc = 0) {
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+#if defined(__x86_64__)
+    if (detail::hardware_available()) {
+        return detail::crc32c_hw(crc, bytes, data.size());
+    }
+#endif
+    return detail::crc32c_sw(crc, bytes, data.size());
+}
+
+inline std::string crc32c_hex(std::span<const std::byte> data) {
+    char buf[9];
+    std::snprintf(buf, sizeof(buf), "%08x", crc32c(data));
+    return std::string(buf, 8);
+}
+
+inline std::optional<std::uint32_t> parse_crc32c(std::string_view hex) {
+    if (hex.empty() || hex.size() > 8) {
+        return std::nullopt;
+    }
+    std::uint32_t value = 0;
+    for (char ch : hex) {
+        value <<= 4;
+        if (ch >= '0' && ch <= '9') {
+            value |= static_cast<std::uint32_t>(ch - '0');
+        } else if (ch >= 'a' && ch <= 'f') {
+            value |= static_cast<std::uint32_t>(ch - 'a' + 10);
+        } else if (ch >= 'A' && ch <= 'F') {
+            value |= static_cast<std::uint32_t>(ch - 'A' + 10);
+        } else {
+            return std::nullopt;
+        }
+    }
+    return value;
+}
+
+// True when `expected_hex` is absent or matches the payload; false on mismatch or garbage.
+inline bool verify_crc32c(std::span<const std::byte> data, std::string_view expected_hex) {
+    if (expected_hex.empty()) {
+        return true;
+    }
+    const auto expected = parse_crc32c(expected_hex);
+    return expected && *expected == crc32c(data);
+}
+
+}  // namespace cloud::integrity
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace cloud::delta {
+
+inline constexpr std::string_view kRsync = "rsync";
+
+// Fingerprint of one block of the version the server holds: a weak checksum that can
+// be rolled along the new file one byte at a time, and a strong hash that confirms
+// a weak match.
+struct BlockSignature {
+    std::uint32_t weak = 0;
+    std::string strong;
+};
+
+// One stretch of the new file: `length` bytes either copied from the base version at
+// `base_offset`, or (without one) sent by the client as literal data.
+struct Segment {
+    std::uint64_t length = 0;
+    std::optional<std::uint64_t> base_offset;
+};
+
+// About sqrt(size), as rsync does: the signature and the work to match it stay small
+// while an edit costs at most a couple of blocks. Grown until the signature fits in
+// `max_body` bytes.
+inline std::size_t block_size(std::uint64_t size, std::uint64_t max_body) {
+    std::size_t block = 2048;
+    while (block < 1024 * 1024 && static_cast<std::uint64_t>(block) * block < size) {
+        block *= 2;
+    }
+    constexpr std::uint64_t kLineBytes = 42;
+    while ((size / block + 1) * kLineBytes > max_body) {
+        block *= 2;
+    }
+    return block;
+}
+
+// rsync's rolling checksum: two 16-bit sums over the window, the second weighted by
+// distance from the window's end.
+class RollingChecksum {
+public:
+    explicit RollingChecksum(std::span<const std::byte> window) : length_(static_cast<std::uint32_t>(window.size())) {
+        for (std::size_t i = 0; i < window.size(); ++i) {
+            const auto x = static_cast<std::uint32_t>(window[i]);
+            a_ += x;
+            b_ += static_cast<std::uint32_t>(window.size() - i) * x;
+        }
+    }
+
+    void roll(std::byte out, std::byte in) {
+        a_ += static_cast<std::uint32_t>(in) - static_cast<std::uint32_t>(out);
+        b_ += a_ - length_ * static_cast<std::uint32_t>(out);
+    }
+
+    std::uint32_t value() const { return (a_ & 0xffff) | (b_ << 16); }
+
+private:
+    std::uint32_t length_ = 0;
+    std::uint32_t a_ = 0;
+    std::uint32_t b_ = 0;
+};
+
+inline std::string strong_hash(std::span<const std::byte> data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_md5(), nullptr);
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(length * 2);
+    for (unsigned int i = 0; i < length; ++i) {
+        out.push_back(kHex[digest[i] >> 4]);
+        out.push_back(kHex[digest[i] & 0xf]);
+    }
+    return out;
+}
+
+inline BlockSignature sign_block(std::span<const std::byte> block) {
+    return BlockSignature{RollingChecksum(block).value(), strong_hash(block)};
+}
+
+// Signature body: one "<weak hex> <strong hex>" line per block.
+inline std::string encode_signatures(const std::vector<BlockSignature>& signatures) {
+    std::string out;
+    out.reserve(signatures.size() * 42);
+    char weak[9];
+    for (const auto& signature : signatures) {
+        std::snprintf(weak, sizeof(weak), "%08x", signature.weak);
+        out += weak;
+        out += ' ';
+        out += signature.strong;
+        out += '\n';
+    }
+    return out;
+}
+
+inline std::optional<std::vector<BlockSignature>> parse_signatures(std::string_view body) {
+    std::vector<BlockSignature> signatures;
+    std::istringstream stream{std::string(body)};
+    std::string weak;
+    std::string strong;
+    while (stream >> weak >> strong) {
+        if (weak.size() != 8 || strong.size() != 32 ||
+            weak.find_first_not_of("0123456789abcdef") != std::string::npos) {
+            return std::nullopt;
+        }
+        signatures.push_back(BlockSignature{static_cast<std::uint32_t>(std::stoul(weak, nullptr, 16)), strong});
+    }
+    return signatures;
+}
+
+// Delta body: one "<length> <base offset>" or "<length> -" line per segment.
+inline std::string encode_segments(const std::vector<Segment>& segments) {
+    std::string out;
+    for (const auto& segment : segments) {
+        out += std::to_string(segment.length);
+        out += ' ';
+        out += segment.base_offset ? std::to_string(*segment.base_offset) : std::string("-");
+        out += '\n';
+    }
+    return out;
+}
+
+// Rejects a delta that does not add up to `total` bytes or reads past the base.
+inline std::optional<std::vector<Segment>> parse_segments(std::string_view body,
+                                                          std::uint64_t total,
+                                                          std::uint64_t base_size) {
+    std::vector<Segment> segments;
+    std::istringstream stream{std::string(body)};
+    std::string length;
+    std::string base;
+    std::uint64_t covered = 0;
+    while (stream >> length >> base) {
+        // At most 19 digits, so std::stoull cannot overflow on a hostile body.
+        if (length.size() > 19 || length.find_first_not_of("0123456789") != std::string::npos ||
+            (base != "-" && (base.size() > 19 || base.find_first_not_of("0123456789") != std::string::npos))) {
+            return std::nullopt;
+        }
+        Segment segment;
+        segment.length = std::stoull(length);
+        if (base != "-") {
+            segment.base_offset = std::stoull(base);
+            if (*segment.base_offset > base_size || segment.length > base_size - *segment.base_offset) {
+                return std::nullopt;
+            }
+        }
+        if (segment.length == 0 || segment.length > total - covered) {
+            return std::nullopt;
+        }
+        covered += segment.length;
+        segments.push_back(segment);
+    }
+    if (covered != total) {
+        return std::nullopt;
+    }
+    return segments;
+}
+
+inline std::uint64_t literal_bytes(const std::vector<Segment>& segments) {
+    std::uint64_t total = 0;
+    for (const auto& segment : segments) {
+        total += segment.base_offset ? 0 : segment.length;
+    }
+    return total;
+}
+
+// Matches `data` against the base's block signatures: wherever the rolling checksum
+// and then the strong hash of the window equal a base block, the block is copied;
+// everything in between becomes literal data. Consecutive base blocks merge into one
+// segment, so an unchanged file is a single copy.
+inline std::vector<Segment> compute_delta(std::span<const std::byte> data,
+                                          std::size_t block,
+                                          const std::vector<BlockSignature>& signatures) {
+    std::vector<Segment> segments;
+    const auto emit = [&](std::uint64_t length, std::optional<std::uint64_t> base_offset) {
+        if (length == 0) {
+            return;
+        }
+        if (!segments.empty()) {
+            auto& last = segments.back();
+            if (!base_offset && !last.base_offset) {
+                last.length += length;
+                return;
+            }
+            if (base_offset && last.base_offset && *last.base_offset + last.length == *base_offset) {
+                last.length += length;
+                return;
+            }
+        }
+        segments.push_back(Segment{length, base_offset});
+    };
+
+    std::unordered_multimap<std::uint32_t, std::size_t> by_weak;
+    by_weak.reserve(signatures.size());
+    for (std::size_t i = 0; i < signatures.size(); ++i) {
+        by_weak.emplace(signatures[i].weak, i);
+    }
+
+    std::size_t literal_start = 0;
+    std::size_t pos = 0;
+    std::optional<RollingChecksum> rolling;
+    while (block > 0 && pos + block <= data.size()) {
+        if (!rolling) {
+            rolling.emplace(data.subspan(pos, block));
+        }
+        std::optional<std::size_t> match;
+        auto [first, last] = by_weak.equal_range(rolling->value());
+        if (first != last) {
+            const auto strong = strong_hash(data.subspan(pos, block));
+            for (auto it = first; it != last; ++it) {
+                if (signatures[it->second].strong == strong) {
+                    match = it->second;
+                    break;
+                }
+            }
+        }
+        if (match) {
+            emit(pos - literal_start, std::nullopt);
+            emit(block, static_cast<std::uint64_t>(*match) * block);
+            pos += block;
+            literal_start = pos;
+            rolling.reset();
+            continue;
+        }
+        if (pos + block < data.size()) {
+            rolling->roll(data[pos], data[pos + block]);
+        }
+        ++pos;
+    }
+    emit(data.size() - literal_start, std::nullopt);
+    return segments;
+}
+
+}  // namespace cloud::delta
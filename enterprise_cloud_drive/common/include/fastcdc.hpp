@@ -0,0 +1,152 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloud::chunking {
+
+inline constexpr std::string_view kFastCdc = "fastcdc";
+
+struct Params {
+    std::size_t min_size = 16 * 1024;
+    std::size_t avg_size = 64 * 1024;
+    std::size_t max_size = 256 * 1024;
+};
+
+struct Chunk {
+    std::uint64_t offset;
+    std::uint32_t length;
+};
+
+namespace detail {
+
+constexpr std::uint64_t splitmix64(std::uint64_t& state) {
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Gear table and its left-shifted twin; fixed so clients and servers agree on
+// boundaries.
+struct GearTables {
+    std::array<std::uint64_t, 256> gear{};
+    std::array<std::uint64_t, 256> gear_ls{};
+
+    constexpr GearTables() {
+        std::uint64_t state = 0x6665617374636463ULL;
+        for (std::size_t i = 0; i < 256; ++i) {
+            gear[i] = splitmix64(state);
+            gear_ls[i] = gear[i] << 1;
+        }
+    }
+};
+
+inline constexpr GearTables kGear{};
+
+// `bits` one-bits ending just below bit 63. The gear hash's high bits depend on the
+// longest byte window; bit 63 is left out so the masks survive the <<1 of the
+// two-bytes-per-step loop.
+constexpr std::uint64_t high_mask(int bits) {
+    std::uint64_t mask = 0;
+    for (int i = 0; i < bits; ++i) {
+        mask |= 1ULL << (62 - i);
+    }
+    return mask;
+}
+
+constexpr int log2_floor(std::size_t value) {
+    int bits = 0;
+    while (value > 1) {
+        value >>= 1;
+        ++bits;
+    }
+    return bits;
+}
+
+}  // namespace detail
+
+// Length of the next chunk of `data` (FastCDC with normalized chunking, level 2). The
+// gear hash is rolled two bytes per iteration using the pre-shifted table, which
+// halves the loop-carried shift/add chain per byte.
+inline std::size_t next_boundary(std::span<const std::byte> data, const Params& params = {}) {
+    const std::size_t size = data.size();
+    if (size <= params.min_size) {
+        return size;
+    }
+    const std::size_t limit = std::min(size, params.max_size);
+    const std::size_t normal = std::min(limit, params.avg_size);
+    const int bits = detail::log2_floor(params.avg_size);
+    const std::uint64_t mask_s = detail::high_mask(bits + 2);
+    const std::uint64_t mask_l = detail::high_mask(bits - 2);
+    const std::uint64_t mask_s_ls = mask_s << 1;
+    const std::uint64_t mask_l_ls = mask_l << 1;
+    const auto* p = reinterpret_cast<const unsigned char*>(data.data());
+    const auto& gear = detail::kGear.gear;
+    const auto& gear_ls = detail::kGear.gear_ls;
+
+    std::uint64_t fp = 0;
+    std::size_t i = params.min_size;
+    for (; i + 1 < normal; i += 2) {
+        fp = (fp << 2) + gear_ls[p[i]];
+        if ((fp & mask_s_ls) == 0) {
+            return i + 1;
+        }
+        fp += gear[p[i + 1]];
+        if ((fp & mask_s) == 0) {
+            return i + 2;
+        }
+    }
+    for (; i + 1 < limit; i += 2) {
+        fp = (fp << 2) + gear_ls[p[i]];
+        if ((fp & mask_l_ls) == 0) {
+            return i + 1;
+        }
+        fp += gear[p[i + 1]];
+        if ((fp & mask_l) == 0) {
+            return i + 2;
+        }
+    }
+    return limit;
+}
+
+inline std::vector<Chunk> split(std::span<const std::byte> data, const Params& params = {}) {
+    std::vector<Chunk> chunks;
+    chunks.reserve(data.size() / params.avg_size + 1);
+    std::uint64_t offset = 0;
+    while (offset < data.size()) {
+        const auto length = next_boundary(data.subspan(static_cast<std::size_t>(offset)), params);
+        chunks.push_back(Chunk{offset, static_cast<std::uint32_t>(length)});
+        offset += length;
+    }
+    return chunks;
+}
+
+// Chunk fingerprint: lowercase hex SHA-256 of the chunk bytes.
+inline std::string chunk_id(std::span<const std::byte> data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(), nullptr);
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(length * 2);
+    for (unsigned int i = 0; i < length; ++i) {
+        out.push_back(kHex[digest[i] >> 4]);
+        out.push_back(kHex[digest[i] & 0xf]);
+    }
+    return out;
+}
+
+inline bool valid_chunk_id(std::string_view id) {
+    return id.size() == 64 && id.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+}
+
+}  // namespace cloud::chunking
@@ -17,13 +17,15 @@
 namespace cloud::protocol {
 
 inline constexpr uint32_t kMagic = 0x45434452;  // "E C D R"
-inline constexpr uint16_t kVersion = 1;
+inline constexpr uint16_t kVersion = 2;
+inline constexpr uint16_t kMinVersion = 1;
 
 using HeaderMap = std::unordered_map<std::string, std::string>;
 
 struct Message {
     HeaderMap headers;
     std::vector<std::byte> body;
+    uint16_t version = kVersion;
 };
 
 namespace detail {
@@ -88,11 +90,28 @@ inline std::string_view header_value(const Message& msg, const std::string& key,
     return it->second;
 }
 
+// True when `token` appears in a comma separated capability list such as "deflate,zstd".
+inline bool list_contains(std::string_view list, std::string_view token) {
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        const auto end = list.find(',', start);
+        const auto item = list.substr(start, end == std::string_view::npos ? end : end - start);
+        if (item == token) {
+            return true;
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
 inline std::vector<std::byte> encode(const Message& message) {
     const auto header_blob = detail::serialize_headers(message.headers);
     detail::WireHeader wire{};
     wire.magic = htonl(kMagic);
-    wire.version = htons(kVersion);
+    wire.version = htons(message.version);
     wire.header_size = htons(static_cast<uint16_t>(header_blob.size()));
     wire.body_size = htonl(static_cast<uint32_t>(message.body.size()));
 
@@ -106,7 +125,10 @@ inline std::vector<std::byte> encode(const Message& message) {
     return buffer;
 }
 
-inline bool try_decode(std::vector<std::byte>& buffer, std::size_t& offset, Message& out) {
+// Decodes one frame starting at `offset`. Frames of any version in [kMinVersion, kVersion]
+// are accepted; `max_frame_bytes` (0 = unlimited) bounds the whole frame.
+inline bool try_decode(std::vector<std::byte>& buffer, std::size_t& offset, Message& out,
+                       std::size_t max_frame_bytes = 0) {
     const auto available = buffer.size() - offset;
     if (available < sizeof(detail::WireHeader)) {
         return false;
@@ -122,11 +144,14 @@ inline bool try_decode(std::vector<std::byte>& buffer, std::size_t& offset, Mess
     if (magic != kMagic) {
         throw std::runtime_error("Protocol magic mismatch");
     }
-    if (version != kVersion) {
+    if (version < kMinVersion || version > kVersion) {
         throw std::runtime_error("Unsupported protocol version");
     }
 
     const std::size_t frame_size = sizeof(detail::WireHeader) + header_size + body_size;
+    if (max_frame_bytes != 0 && frame_size > max_frame_bytes) {
+        throw std::runtime_error("Frame exceeds negotiated size");
+    }
     if (available < frame_size) {
         return false;
     }
@@ -134,6 +159,7 @@ inline bool try_decode(std::vector<std::byte>& buffer, std::size_t& offset, Mess
     const auto* header_begin = buffer.data() + offset + sizeof(detail::WireHeader);
     std::string header_blob(reinterpret_cast<const char*>(header_begin), header_size);
     out.headers = detail::parse_headers(header_blob);
+    out.version = version;
 
     out.body.resize(body_size);
     if (body_size > 0) {
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace cloud::server {
+
+class AlignedBufferPool;
+
+// A fixed-size, `alignment`-aligned buffer borrowed from an AlignedBufferPool; it goes
+// back to the pool when the handle is destroyed.
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    AlignedBuffer(AlignedBuffer&& other) noexcept;
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+    ~AlignedBuffer();
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    std::byte* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+private:
+    friend class AlignedBufferPool;
+    AlignedBuffer(AlignedBufferPool* pool, std::byte* data, std::size_t size)
+        : pool_(pool), data_(data), size_(size) {}
+
+    AlignedBufferPool* pool_ = nullptr;
+    std::byte* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Recycles the aligned buffers O_DIRECT transfers need, so a large transfer does not
+// pay for posix_memalign and fresh page faults on every chunk. At most `max_idle`
+// buffers are kept around once returned, and at most `max_outstanding` exist at all:
+// past that acquire() hands out an empty buffer and the caller uses buffered I/O.
+class AlignedBufferPool {
+public:
+    AlignedBufferPool(std::size_t buffer_bytes,
+                      std::size_t alignment,
+                      std::size_t max_outstanding = 64,
+                      std::size_t max_idle = 16);
+    ~AlignedBufferPool();
+
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    AlignedBuffer acquire();
+    std::size_t buffer_bytes() const { return buffer_bytes_; }
+    std::size_t alignment() const { return alignment_; }
+    std::size_t outstanding() const;
+
+private:
+    friend class AlignedBuffer;
+    void release(std::byte* data);
+
+    std::size_t buffer_bytes_;
+    std::size_t alignment_;
+    std::size_t max_outstanding_;
+    std::size_t max_idle_;
+    mutable std::mutex mutex_;
+    std::size_t outstanding_ = 0;
+    std::vector<std::byte*> idle_;
+};
+
+}  // namespace cloud::server
@@ -4,6 +4,7 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 
 namespace cloud::server {
 
@@ -20,6 +21,10 @@ public:
 
     void initialize_schema();
 
+    // A username is also the name of the user's home directory, next to the devices'
+    // internal ones (.objects, .trash, ...), so it must be one plain, undotted component.
+    static bool valid_username(std::string_view username);
+
     bool register_user(const std::string& username, const std::string& password);
     bool validate_user(const std::string& username, const std::string& password);
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace cloud::server {
+
+// Content-addressed object store under `<storage_root>/.objects/<aa>/<md5>`. User
+// files are hardlinks to (or reflinks of) these objects, so an instant upload only
+// adds a directory entry no matter how large the file is.
+//
+// An erasure-coded object is a stub: it keeps its size, its data blocks are punched
+// out and the `kStubXattr` attribute names the digest its shards are stored under.
+// A small object packed into a segment file is the same kind of stub, marked with
+// `kPackedXattr` instead. Copying a stub copies only the stub, so stubs are only ever
+// copied between object stores; a user file is a link of a stub or holds real bytes.
+class BlobStore {
+public:
+    static constexpr const char* kStubXattr = "user.cloud.erasure";
+    static constexpr const char* kPackedXattr = "user.cloud.packed";
+
+    explicit BlobStore(std::filesystem::path root);
+
+    static bool valid_digest(std::string_view md5);
+    static std::optional<std::string> stub_digest(int fd);
+    static std::optional<std::string> stub_digest(const std::filesystem::path& path);
+    static std::optional<std::string> packed_digest(int fd);
+    static std::optional<std::string> packed_digest(const std::filesystem::path& path);
+    // The digest either kind of stub names.
+    static std::optional<std::string> stub_of(const std::filesystem::path& path);
+    // Reflinks or copies the bytes of a file. Fails on a stub, whose bytes are elsewhere.
+    static bool copy_data(const std::filesystem::path& source, const std::filesystem::path& target);
+
+    std::filesystem::path object_path(const std::string& md5) const;
+    bool contains(const std::string& md5) const;
+
+    bool ingest(const std::filesystem::path& source, const std::string& md5);
+    bool materialize(const std::string& md5, const std::filesystem::path& target);
+    bool release(const std::string& md5);
+
+private:
+    std::filesystem::path root_;
+};
+
+}  // namespace cloud::server
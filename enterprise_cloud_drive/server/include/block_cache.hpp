@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cloud::server {
+
+// A fixed-size block of one stored file. Files are identified by inode plus size and
+// mtime, so every hardlink of a blob shares entries and a replaced file never hits
+// stale data.
+struct BlockKey {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::uint64_t mtime_ns = 0;
+    std::uint64_t block = 0;
+
+    bool operator==(const BlockKey&) const = default;
+};
+
+struct BlockKeyHash {
+    std::size_t operator()(const BlockKey& key) const noexcept;
+};
+
+using BlockData = std::shared_ptr<const std::vector<std::byte>>;
+
+// Sharded LRU cache with TinyLFU admission: a count-min sketch of recent access
+// frequency decides whether a new block may displace the shard's LRU victim, so one
+// pass over a cold file cannot flush the hot set.
+class BlockCache {
+public:
+    static constexpr std::size_t kBlockBytes = 256 * 1024;
+
+    explicit BlockCache(std::size_t capacity_bytes, std::size_t shard_count = 16);
+    ~BlockCache();
+
+    bool enabled() const { return capacity_bytes_ > 0; }
+    BlockData lookup(const BlockKey& key);
+    void insert(const BlockKey& key, BlockData data);
+
+    std::string stats_report() const;
+
+private:
+    struct Shard;
+
+    Shard& shard_for(const BlockKey& key);
+
+    std::size_t capacity_bytes_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+    std::atomic<std::uint64_t> admitted_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> evicted_{0};
+};
+
+}  // namespace cloud::server
@@ -1,16 +1,23 @@
 #pragma once
 
 #include "auth_service.hpp"
+#include "block_cache.hpp"
 #include "config_loader.hpp"
 #include "file_index.hpp"
+#include "group_commit.hpp"
 #include "jwt_service.hpp"
+#include "listing_cache.hpp"
 #include "logger.hpp"
 #include "protocol.hpp"
 #include "storage_manager.hpp"
-#include "task_executor.hpp"
+#include "quota_manager.hpp"
+#include "resume_sweeper.hpp"
+#include "trash_manager.hpp"
 
 #include <atomic>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -34,8 +41,17 @@ public:
 
 private:
     struct ConnectionContext;
+    struct CompressionStats {
+        std::atomic<std::uint64_t> raw_in_bytes{0};
+        std::atomic<std::uint64_t> wire_in_bytes{0};
+        std::atomic<std::uint64_t> raw_out_bytes{0};
+        std::atomic<std::uint64_t> wire_out_bytes{0};
+        std::atomic<std::uint64_t> skipped_frames{0};
+        std::atomic<std::uint64_t> cpu_ns{0};
+    };
     struct PendingResponse {
         int fd;
+        std::uint64_t connection_id;
         protocol::Message message;
     };
 
@@ -43,8 +59,23 @@ private:
     void handle_accept();
     void handle_fd_event(int fd, uint32_t events);
     void drain_async_queue();
-    void schedule_response(int fd, protocol::Message message);
+    void schedule_response(int fd, protocol::Message message, std::uint64_t connection_id = 0);
+    void complete_async(int fd,
+                        std::uint64_t connection_id,
+                        const std::string& username,
+                        std::string rid,
+                        std::string command,
+                        std::function<protocol::Message()> produce);
     void close_connection(int fd);
+    void drop_upload(ConnectionContext& ctx);
+    void inflate_request(protocol::Message& message);
+    void deflate_response(protocol::Message& message);
+    std::string stats_report() const;
+    std::shared_ptr<const Listing> cached_listing(const std::string& username, const std::filesystem::path& relative);
+    std::vector<std::byte> read_cached(DownloadSession& session, std::uint64_t offset, std::size_t length);
+    std::vector<ChunkRef> verified_chunks(const std::vector<ManifestChunk>& manifest,
+                                          const std::filesystem::path& final_path,
+                                          const std::string& md5);
 
     ServerConfig config_;
     AuthService& auth_service_;
@@ -57,13 +88,21 @@ private:
     int epoll_fd_ = -1;
     int notify_fd_ = -1;
     std::atomic<bool> running_{false};
+    std::uint64_t next_connection_id_ = 0;
     std::thread reactor_thread_;
-    TaskExecutor task_executor_;
 
     std::unordered_map<int, std::unique_ptr<ConnectionContext>> connections_;
     std::deque<std::pair<int, uint32_t>> ready_queue_;
     std::mutex async_mutex_;
     std::vector<PendingResponse> async_responses_;
+    BlockCache block_cache_;
+    ListingCache listing_cache_;
+    TrashManager trash_;
+    ResumeSweeper sweeper_;
+    QuotaManager quota_;
+    GroupCommitter committer_;
+    CompressionStats compression_stats_;
+    std::atomic<std::uint64_t> rejected_chunks_{0};
 };
 
 }  // namespace cloud::server
@@ -9,12 +9,46 @@ struct ServerConfig {
     std::string listen_address = "0.0.0.0";
     uint16_t listen_port = 6000;
     std::string storage_root = "./server/storage";
+    std::string storage_devices;  // path[:weight[:state]],...; empty = storage_root only
+    unsigned erasure_data_shards = 0;  // 0 = keep whole objects
+    unsigned erasure_parity_shards = 2;
+    std::uint64_t erasure_min_bytes = 1024 * 1024;
+    std::size_t erasure_cell_bytes = 64 * 1024;
+    std::uint64_t pack_max_file_bytes = 0;  // 0 = every object keeps its own file
+    std::uint64_t pack_segment_bytes = 64ULL * 1024 * 1024;
+    double pack_compact_ratio = 0.5;
+    uint32_t pack_compact_interval_seconds = 300;
     std::string database_file = "./data/cloud_drive.db";
     std::string log_file = "./data/server.log";
     std::size_t max_clients = 512;
     std::size_t thread_pool_size = 8;
     std::size_t long_task_threads = 4;
     std::size_t max_chunk_bytes = 1 * 1024 * 1024;
+    std::size_t max_frame_bytes = 16 * 1024 * 1024;
+    std::size_t pipeline_window = 8;
+    bool compression_enabled = true;
+    std::uint64_t resume_sync_bytes = 32ULL * 1024 * 1024;
+    uint32_t resume_sync_interval_ms = 1000;
+    std::size_t block_cache_bytes = 256 * 1024 * 1024;
+    std::size_t listing_cache_bytes = 64 * 1024 * 1024;
+    std::uint64_t direct_io_threshold = 0;
+    std::size_t direct_io_buffer_bytes = 4 * 1024 * 1024;
+    std::size_t direct_io_max_buffers = 64;
+    bool preallocate_uploads = true;
+    std::uint64_t preallocate_min_bytes = 1024 * 1024;
+    std::uint64_t disk_reserve_bytes = 256ULL * 1024 * 1024;
+    uint32_t trash_retention_seconds = 0;
+    double trash_purge_rate = 2000;
+    std::size_t trash_batch_rows = 512;
+    uint32_t resume_max_age_seconds = 7 * 24 * 3600;  // 0 = never expire abandoned uploads
+    uint32_t resume_sweep_interval_seconds = 3600;
+    double resume_sweep_rate = 500;
+    uint64_t quota_bytes = 0;  // per user, 0 = unlimited
+    uint64_t quota_files = 0;
+    uint32_t usage_reconcile_interval_seconds = 24 * 3600;  // 0 = never
+    bool durable_commits = false;  // acknowledge uploads only once data, names and index are synced
+    uint32_t commit_window_us = 2000;
+    std::size_t commit_max_batch = 256;
     std::string jwt_secret = "change-me";
     std::string jwt_issuer = "enterprise-cloud-drive";
     uint32_t token_ttl_seconds = 3600;
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "reed_solomon.hpp"
+#include "storage_device.hpp"
+#include "task_executor.hpp"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cloud::server {
+
+// Objects of at least `min_bytes` are striped into `data_shards` + `parity_shards`
+// shards of `cell_bytes` cells each; 0 data shards disables encoding.
+struct ErasureOptions {
+    unsigned data_shards = 0;
+    unsigned parity_shards = 2;
+    std::uint64_t min_bytes = 1024 * 1024;
+    std::size_t cell_bytes = 64 * 1024;
+};
+
+// Erasure-coded object layout across the storage devices. After commit, a background
+// worker stripes an object into RS(k, m) shards, one per device, under
+// `<device>/.shards/<aa>/<md5>.<index>`, then turns the object into a stub (see
+// BlobStore), so the content costs (k + m) / k of its size instead of a full copy.
+// Reads of a stub fetch the shards covering the range in parallel on a fixed pool;
+// when a shard is missing or unreadable, the stripe is rebuilt from any k others.
+//
+// Download sessions register as readers, and an object with readers is not converted,
+// so a session never sees its data punched out under it.
+class ErasureStore {
+public:
+    ErasureStore(const std::vector<std::unique_ptr<StorageDevice>>& devices, ErasureOptions options);
+    ~ErasureStore();
+
+    ErasureStore(const ErasureStore&) = delete;
+    ErasureStore& operator=(const ErasureStore&) = delete;
+
+    bool enabled() const { return options_.data_shards > 0; }
+
+    void start();
+    void stop();
+    void enqueue(StorageDevice& device, const std::string& md5);
+
+    // Returns the digest if the file is a stub.
+    std::optional<std::string> open_reader(int fd, const struct stat& st);
+    void close_reader(const struct stat& st);
+    std::vector<std::byte> read(const std::string& md5, std::uint64_t offset, std::size_t length);
+    // Removes the shards once no device holds the object any more.
+    void drop(const std::string& md5);
+
+    std::string stats_report() const;
+
+private:
+    struct ShardSet;
+    struct Job {
+        StorageDevice* device;
+        std::string md5;
+    };
+
+    void worker_loop();
+    void scan_objects();
+    bool encode(StorageDevice& device, const std::string& md5, bool& busy);
+    std::vector<StorageDevice*> shard_devices(const std::string& md5) const;
+    std::shared_ptr<ShardSet> open_shards(const std::string& md5);
+    const ReedSolomon& coder(unsigned data_shards, unsigned parity_shards);
+
+    const std::vector<std::unique_ptr<StorageDevice>>& devices_;
+    ErasureOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    std::vector<Job> deferred_;
+    bool stopping_ = false;
+    std::thread worker_;
+    // One thread per shard of a read, shared by all readers.
+    TaskExecutor fetcher_;
+    std::mutex fetch_mutex_;
+    bool fetching_ = false;  // guarded by fetch_mutex_
+
+    std::mutex readers_mutex_;
+    std::map<std::pair<dev_t, ino_t>, unsigned> readers_;
+
+    std::mutex cache_mutex_;
+    std::map<std::string, std::shared_ptr<ShardSet>> shard_cache_;
+    std::map<std::pair<unsigned, unsigned>, std::unique_ptr<ReedSolomon>> coders_;
+
+    std::atomic<std::uint64_t> encoded_objects_{0};
+    std::atomic<std::uint64_t> encoded_bytes_{0};
+    std::atomic<std::uint64_t> shard_bytes_{0};
+    std::atomic<std::uint64_t> skipped_{0};
+    std::atomic<std::uint64_t> reads_{0};
+    std::atomic<std::uint64_t> degraded_reads_{0};
+    std::atomic<std::uint64_t> failed_reads_{0};
+};
+
+}  // namespace cloud::server
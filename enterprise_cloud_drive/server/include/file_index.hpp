@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 struct sqlite3;
 
@@ -16,6 +21,50 @@ struct FileMetadata {
     std::uint64_t size;
 };
 
+// Where a content-defined chunk can be read back from: a byte range of a blob.
+struct ChunkRef {
+    std::string chunk_id;
+    std::string md5;
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// A small blob packed into a segment file: `length` bytes at `offset`.
+struct PackedBlob {
+    std::string md5;
+    std::int64_t segment = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+};
+
+// An append-only segment file on `device`. `live_bytes` counts the blobs still packed
+// in it; the rest of the file is garbage left by deleted objects. Only the one open
+// segment per device is written to; sealed ones are only read and compacted.
+struct SegmentInfo {
+    std::int64_t id = 0;
+    std::string device;
+    std::uint64_t live_bytes = 0;
+    bool sealed = false;
+};
+
+// A deleted file or directory waiting in the trash. `max_file_id` is the highest
+// user_files id at deletion time: rows under `logical_path` up to it belong to the
+// deleted tree, while anything uploaded to the same path later gets a larger id.
+struct TrashEntry {
+    std::int64_t id = 0;
+    std::string owner;
+    std::string logical_path;
+    std::string trash_path;
+    std::int64_t max_file_id = 0;
+    std::int64_t deleted_at = 0;
+};
+
+// Indexed bytes and files of one owner, not counting deletes waiting in the trash.
+struct UsageTotals {
+    std::uint64_t bytes = 0;
+    std::uint64_t files = 0;
+};
+
 class FileIndex {
 public:
     explicit FileIndex(const std::string& database_path);
@@ -24,11 +73,85 @@ public:
     void initialize_schema();
     std::optional<FileMetadata> find_by_path(const std::string& owner, const std::string& logical_path);
     std::optional<FileMetadata> find_by_md5(const std::string& md5);
-    void upsert(const FileMetadata& metadata);
+    std::optional<std::string> upsert(const FileMetadata& metadata);
     void remove(const std::string& owner, const std::string& logical_path);
+    std::vector<FileMetadata> files_of(const std::string& owner);
+    std::vector<FileMetadata> tree_files(const std::string& owner, const std::string& logical_path);
+    void move_tree(const std::string& owner,
+                   const std::string& from_path,
+                   const std::string& to_path,
+                   const std::string& from_storage,
+                   const std::string& to_storage);
+    void relocate(const std::string& owner, const std::string& from_prefix, const std::string& to_prefix);
+
+    std::optional<ChunkRef> find_chunk(const std::string& chunk_id);
+    void add_chunks(const std::vector<ChunkRef>& chunks);
+    void remove_chunk(const std::string& chunk_id);
+
+    std::int64_t add_segment(const std::string& device);
+    std::optional<SegmentInfo> find_segment(std::int64_t id);
+    std::optional<SegmentInfo> open_segment(const std::string& device);
+    std::vector<SegmentInfo> sealed_segments();
+    void seal_segment(std::int64_t id);
+    void remove_segment(std::int64_t id);
+    // End of the last blob indexed in the segment; anything after it was never published.
+    std::uint64_t segment_end(std::int64_t id);
+    std::optional<PackedBlob> find_packed(const std::string& md5);
+    std::vector<PackedBlob> packed_in(std::int64_t segment);
+    // Keeps an existing entry: equal digests mean equal content.
+    void add_packed(const PackedBlob& blob);
+    // Points the blob at its copy in another segment, unless it was removed or moved meanwhile.
+    void move_packed(const PackedBlob& blob, std::int64_t from_segment);
+    void remove_packed(const std::string& md5);
+
+    std::int64_t max_file_id();
+    std::vector<std::string> remove_tree_batch(const std::string& owner,
+                                               const std::string& logical_path,
+                                               std::int64_t max_file_id,
+                                               std::size_t limit);
+    std::int64_t add_trash(const TrashEntry& entry);
+    std::vector<TrashEntry> pending_trash();
+    void remove_trash(std::int64_t id);
+    std::vector<std::string> held_blobs(std::int64_t id);
+
+    // Runs `body` as one transaction, so its writes cost a single journal sync. Other
+    // threads' writes wait until it commits. Nested calls are savepoints: if `body`
+    // throws, only its own writes are undone.
+    void transaction(const std::function<void()>& body);
+
+    UsageTotals usage_of(const std::string& owner);
+    // Recomputes every owner's totals from user_files; returns how many had drifted.
+    std::size_t reconcile_usage();
 
 private:
+    // The connection one call runs on. Writes take the writer under `write_mutex_` for
+    // the whole call, so a statement from another thread can never land inside someone
+    // else's transaction. Reads go to the reader, which in WAL mode does not wait for a
+    // writer's commit, unless the calling thread already holds the writer and must see
+    // its own uncommitted rows.
+    class Connection {
+    public:
+        Connection(FileIndex& index, bool write);
+        ~Connection();
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+        operator sqlite3*() const { return db_; }
+
+    private:
+        FileIndex& index_;
+        bool write_;
+        sqlite3* db_ = nullptr;
+    };
+
+    void initialize_usage();
+
+    std::string path_;
     sqlite3* db_{};
+    sqlite3* reader_{};
+    std::recursive_mutex write_mutex_;
+    std::atomic<std::thread::id> writer_thread_{};
+    unsigned write_depth_ = 0;  // guarded by write_mutex_
+    std::mutex read_mutex_;
 };
 
 }  // namespace cloud::server
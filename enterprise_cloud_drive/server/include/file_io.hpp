@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace cloud::server {
+
+// Positional reads and writes that retry short transfers and EINTR. Both return false
+// on an error or, for reads, on end of file before `length` bytes.
+bool read_full(int fd, std::byte* data, std::size_t length, std::uint64_t offset);
+bool write_full(int fd, const std::byte* data, std::size_t length, std::uint64_t offset);
+// Makes the entries of `dir` (new names, renames) durable.
+bool sync_directory(const std::filesystem::path& dir);
+
+}  // namespace cloud::server
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "file_index.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cloud::server {
+
+struct CommitOptions {
+    bool durable = false;                      // off: acknowledge as soon as the index is updated
+    std::chrono::microseconds window{2000};    // how long a batch waits for company
+    std::size_t max_batch = 256;
+};
+
+// One upload commit: the data files and directory entries it created, the index
+// writes that publish it, and the acknowledgement. `done(false)` means the commit
+// could not be made durable.
+struct CommitRequest {
+    std::vector<std::filesystem::path> files;
+    std::vector<std::filesystem::path> directories;
+    std::function<void()> apply;
+    std::function<void(bool)> done;
+};
+
+// Makes commits durable in groups. Requests arriving within one window share a single
+// round of syncs: writeback is started on every file first so the disk sees them
+// together, then each file and each distinct directory is synced once, and all index
+// writes go into one transaction. Only then is every commit in the batch acknowledged,
+// so an acknowledged upload survives a crash without paying one fsync chain apiece.
+class GroupCommitter {
+public:
+    GroupCommitter(FileIndex& index, CommitOptions options);
+    ~GroupCommitter();
+
+    GroupCommitter(const GroupCommitter&) = delete;
+    GroupCommitter& operator=(const GroupCommitter&) = delete;
+
+    bool durable() const { return options_.durable; }
+
+    void start();
+    void stop();
+
+    void submit(CommitRequest request);
+
+    std::string stats_report() const;
+
+private:
+    struct Pending {
+        CommitRequest request;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    void worker_loop();
+    void commit_batch(std::vector<Pending>& batch);
+    void record_latency(std::chrono::steady_clock::duration latency);
+
+    FileIndex& index_;
+    CommitOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Pending> queue_;
+    bool stopping_ = false;
+    std::thread worker_;
+
+    static constexpr std::size_t kLatencySamples = 4096;
+    mutable std::mutex latency_mutex_;
+    std::array<std::uint32_t, kLatencySamples> latencies_us_{};
+    std::size_t latency_count_ = 0;
+
+    std::atomic<std::uint64_t> batches_{0};
+    std::atomic<std::uint64_t> entries_{0};
+    std::atomic<std::uint64_t> files_synced_{0};
+    std::atomic<std::uint64_t> dirs_synced_{0};
+    std::atomic<std::uint64_t> failures_{0};
+};
+
+}  // namespace cloud::server
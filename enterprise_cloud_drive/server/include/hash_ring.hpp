@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cloud::server {
+
+// Consistent hash ring. Each member owns `weight * kPointsPerWeight` points derived
+// from its name, so placement does not depend on configuration order, and adding a
+// member takes over only about its weighted share of the keys.
+class HashRing {
+public:
+    static constexpr unsigned kPointsPerWeight = 64;
+
+    // FNV-1a followed by a murmur finalizer: stable across builds and runs (unlike
+    // std::hash), which placement on disk depends on.
+    static std::uint64_t hash(std::string_view data);
+
+    void add(std::size_t member, std::string_view name, unsigned weight);
+    std::optional<std::size_t> locate(std::string_view key) const;
+    bool empty() const { return points_.empty(); }
+
+private:
+    std::vector<std::pair<std::uint64_t, std::size_t>> points_;  // sorted by hash
+};
+
+}  // namespace cloud::server
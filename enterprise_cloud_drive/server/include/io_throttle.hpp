@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+namespace cloud::server {
+
+// Token bucket that paces background work to `rate` operations per second on average,
+// allowing bursts of up to `burst`. A rate of 0 disables throttling.
+class IoThrottle {
+public:
+    IoThrottle(double rate, double burst);
+
+    void acquire(double cost = 1.0);
+    double rate() const { return rate_; }
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    std::chrono::steady_clock::time_point last_;
+    std::mutex mutex_;
+};
+
+}  // namespace cloud::server
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cloud::server {
+
+// A directory listing already encoded as a DIR_LIST body ("name|dir|size|mtime" lines),
+// plus its deflated form when the body compresses.
+struct Listing {
+    std::size_t count = 0;
+    std::vector<std::byte> body;
+    std::optional<std::vector<std::byte>> deflated;
+};
+
+// Caches encoded listings per absolute directory path. Each cached directory carries an
+// inotify watch; queued events are drained before every lookup, so a change made
+// outside the server is never served stale. The server's own mutations invalidate
+// explicitly. A listing shows its subdirectories' mtimes, so each of them gets a
+// watch of its own too (entries created, deleted or renamed, attribute changes), and
+// such an event drops the parent's listing whether or not the subdirectory is cached.
+// A directory with too many subdirectories to watch is not cached at all.
+class ListingCache {
+public:
+    explicit ListingCache(std::size_t capacity_bytes);
+    ~ListingCache();
+
+    ListingCache(const ListingCache&) = delete;
+    ListingCache& operator=(const ListingCache&) = delete;
+
+    bool enabled() const { return capacity_bytes_ > 0 && inotify_fd_ >= 0; }
+
+    std::shared_ptr<const Listing> lookup(const std::filesystem::path& dir);
+    // Watches `dir` ahead of reading it; store() keeps the result only if nothing
+    // invalidated the directory in between and `subdirs` (name, listed mtime) can be
+    // watched and still carry those mtimes. abandon() drops a listing that failed.
+    void begin(const std::filesystem::path& dir);
+    void store(const std::filesystem::path& dir,
+               std::shared_ptr<const Listing> listing,
+               const std::vector<std::pair<std::string, std::uint64_t>>& subdirs);
+    void abandon(const std::filesystem::path& dir);
+    void invalidate(const std::filesystem::path& dir);
+    void invalidate_tree(const std::filesystem::path& dir);
+
+    std::string stats_report() const;
+
+private:
+    struct Entry {
+        std::string key;
+        int wd = -1;
+        std::shared_ptr<const Listing> listing;  // null while being built
+        std::size_t bytes = 0;
+        std::vector<std::pair<int, std::string>> children;  // subdirectory watches
+    };
+    using EntryList = std::list<Entry>;
+
+    void drain_events();
+    void erase(EntryList::iterator it);
+    void erase_key(const std::string& key);
+    void unwatch(int wd, const std::string& key);
+    void clear();
+
+    std::size_t capacity_bytes_;
+    int inotify_fd_ = -1;
+
+    mutable std::mutex mutex_;
+    std::size_t used_bytes_ = 0;
+    EntryList lru_;  // front = most recently used
+    std::unordered_map<std::string, EntryList::iterator> index_;
+    std::unordered_map<int, std::vector<std::string>> watches_;
+
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+    std::atomic<std::uint64_t> invalidations_{0};
+    std::atomic<std::uint64_t> uncacheable_{0};  // too many subdirectories to watch
+};
+
+}  // namespace cloud::server
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cloud::server {
+
+// Incremental MD5 (RFC 1321) whose state can be saved and restored. Upload sessions
+// checkpoint the running digest with their progress, so the state format has to be
+// ours: "m1:<A><B><C><D><Nl><Nh><num><buffered bytes>", the chaining words, the bit
+// count as low and high halves and the count of buffered input bytes as 8-digit hex
+// words, then those bytes. Whole-file hashing elsewhere goes through EVP.
+class Md5 {
+public:
+    static constexpr std::size_t kDigestBytes = 16;
+    static constexpr std::size_t kBlockBytes = 64;
+
+    Md5() = default;
+
+    void update(const void* data, std::size_t length);
+    // Digest of everything passed so far, as lowercase hex; the context stays usable.
+    std::string hex_digest() const;
+
+    std::string save() const;
+    // Replaces the state with a saved one; fails on anything save() did not produce.
+    bool restore(std::string_view state);
+
+private:
+    void transform(const std::uint8_t* block);
+
+    std::array<std::uint32_t, 4> words_{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    std::uint64_t length_ = 0;  // input bytes
+    std::array<std::uint8_t, kBlockBytes> buffer_{};
+};
+
+}  // namespace cloud::server
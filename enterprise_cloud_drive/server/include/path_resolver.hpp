@@ -0,0 +1,64 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cloud::server {
+
+// Maps a user's relative path to an absolute path under their root without letting it
+// escape. `locate` names a user's root; each root is created and canonicalized once,
+// then kept open as an O_PATH descriptor. Files are opened with one
+// openat2(RESOLVE_BENEATH) on that descriptor, so the kernel confines the lookup that
+// yields the descriptor itself and a symlink swapped in later cannot redirect it.
+// resolve() only names a path (index keys, cache keys, messages); anything that reads
+// or creates user files goes through open() or open_parent(). Kernels without openat2
+// fall back to the weakly_canonical prefix check, followed by a plain open.
+class PathResolver {
+public:
+    using HomeLocator = std::function<std::filesystem::path(const std::string& username)>;
+
+    explicit PathResolver(HomeLocator locate);
+    ~PathResolver();
+
+    PathResolver(const PathResolver&) = delete;
+    PathResolver& operator=(const PathResolver&) = delete;
+
+    std::filesystem::path user_root(const std::string& username);
+    std::filesystem::path resolve(const std::string& username, const std::filesystem::path& relative);
+    // Opens `relative` beneath the user's root. Returns -1 with errno set if it cannot
+    // be opened; throws if the path escapes the root.
+    int open(const std::string& username, const std::filesystem::path& relative, int flags, mode_t mode = 0);
+    // Opens the directory holding `relative` as an O_PATH descriptor for the *at()
+    // calls and stores the last component in `name`. `create` makes missing
+    // directories on the way, one mkdirat() per component, and appends each one it
+    // made to `created` (relative to the root).
+    int open_parent(const std::string& username,
+                    const std::filesystem::path& relative,
+                    std::string& name,
+                    bool create = false,
+                    std::vector<std::filesystem::path>* created = nullptr);
+
+private:
+    struct UserRoot {
+        std::filesystem::path path;
+        int fd = -1;
+    };
+
+    const UserRoot& root_for(const std::string& username);
+    bool beneath(const UserRoot& user, const std::filesystem::path& relative);
+    int open_beneath(const UserRoot& user, const std::filesystem::path& relative, int flags, mode_t mode);
+
+    HomeLocator locate_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, UserRoot> roots_;
+    std::atomic<bool> openat2_available_{true};
+};
+
+}  // namespace cloud::server
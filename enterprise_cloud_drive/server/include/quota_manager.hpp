@@ -0,0 +1,81 @@
+#pragma once
+
+#include "file_index.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace cloud::server {
+
+struct QuotaOptions {
+    std::uint64_t max_bytes = 0;  // per user, 0 = unlimited
+    std::uint64_t max_files = 0;  // per user, 0 = unlimited
+    std::chrono::seconds reconcile_interval{24 * 3600};
+};
+
+// Room held for an upload between INIT and COMMIT.
+struct QuotaReservation {
+    std::uint64_t bytes = 0;
+    std::uint64_t files = 0;
+};
+
+struct UsageStatus {
+    UsageTotals used;
+    QuotaReservation pending;
+    std::uint64_t max_bytes = 0;
+    std::uint64_t max_files = 0;
+};
+
+// Admits uploads against per-user quotas. Usage comes from the counters FileIndex keeps
+// up to date on every commit and delete, plus the uploads admitted but not yet
+// committed, so a decision is one keyed lookup and never walks a tree. A background
+// worker recounts the index now and then and repairs any drift.
+class QuotaManager {
+public:
+    QuotaManager(FileIndex& index, QuotaOptions options);
+    ~QuotaManager();
+
+    QuotaManager(const QuotaManager&) = delete;
+    QuotaManager& operator=(const QuotaManager&) = delete;
+
+    void start();
+    void stop();
+
+    // `replaced_bytes` is the size of the file the upload overwrites, if any.
+    std::optional<QuotaReservation> reserve(const std::string& owner,
+                                            std::uint64_t bytes,
+                                            std::optional<std::uint64_t> replaced_bytes);
+    std::optional<QuotaReservation> reserve(const std::string& owner, QuotaReservation reservation);
+    void release(const std::string& owner, const QuotaReservation& reservation);
+
+    UsageStatus status(const std::string& owner);
+    std::string stats_report() const;
+
+private:
+    void worker_loop();
+
+    FileIndex& index_;
+    QuotaOptions options_;
+
+    std::mutex reserved_mutex_;
+    std::unordered_map<std::string, QuotaReservation> reserved_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread worker_;
+
+    std::atomic<std::uint64_t> admitted_{0};
+    std::atomic<std::uint64_t> rejected_{0};
+    std::atomic<std::uint64_t> reconciliations_{0};
+    std::atomic<std::uint64_t> drifted_owners_{0};
+};
+
+}  // namespace cloud::server
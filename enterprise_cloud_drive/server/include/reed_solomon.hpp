@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace cloud::server {
+
+// Systematic Reed-Solomon code over GF(2^8): `data_shards` data shards plus
+// `parity_shards` parity shards, any `data_shards` of which recover the rest. Parity
+// rows come from a Cauchy matrix, so every square submatrix of the generator is
+// invertible. The multiply-accumulate kernel uses AVX2 or SSSE3 nibble lookups
+// (vpshufb) when the CPU has them, and a full product table otherwise.
+class ReedSolomon {
+public:
+    ReedSolomon(unsigned data_shards, unsigned parity_shards);
+
+    unsigned data_shards() const { return k_; }
+    unsigned parity_shards() const { return m_; }
+    unsigned total_shards() const { return k_ + m_; }
+
+    void encode(const std::vector<const std::byte*>& data, const std::vector<std::byte*>& parity,
+                std::size_t length) const;
+    // `shards` holds total_shards() buffers of `length` bytes; those not marked present
+    // are rebuilt in place. Fails if fewer than data_shards() are present.
+    bool reconstruct(const std::vector<std::byte*>& shards, const std::vector<bool>& present,
+                     std::size_t length) const;
+
+    static const char* kernel_name();
+    // Switches every coder to the named kernel ("avx2", "ssse3", "scalar"), so tests and
+    // benchmarks can compare them; fails if the CPU lacks it. Not safe while coding.
+    static bool select_kernel(std::string_view name);
+
+private:
+    std::uint8_t coefficient(unsigned row, unsigned column) const { return matrix_[row * k_ + column]; }
+
+    unsigned k_;
+    unsigned m_;
+    std::vector<std::uint8_t> matrix_;  // (k + m) x k, top k rows are the identity
+};
+
+}  // namespace cloud::server
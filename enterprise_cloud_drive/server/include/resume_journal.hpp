@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cloud::server {
+
+struct ResumeOptions {
+    std::uint64_t sync_bytes = 32ULL * 1024 * 1024;
+    std::chrono::milliseconds sync_interval{1000};
+};
+
+struct ResumeRecord {
+    std::uint64_t total = 0;
+    std::uint64_t received = 0;
+    std::string digest_state;  // versioned MD5 context as of `received`, may be empty
+};
+
+// Append-only log of upload checkpoints shared by all users. Records are buffered in
+// memory and written + fdatasync'ed at most once per sync interval; the log is
+// rewritten as a snapshot once dead records dominate it. Each line carries a CRC32C so
+// a torn tail left by a crash is detected and truncated on replay.
+//
+// Once started, a flusher thread does all the syncing: the parts of checkpointed
+// uploads, then the log itself, so the threads recording progress never wait on a disk.
+class ResumeJournal {
+public:
+    ResumeJournal(std::filesystem::path path, std::chrono::milliseconds sync_interval);
+    ~ResumeJournal();
+
+    ResumeJournal(const ResumeJournal&) = delete;
+    ResumeJournal& operator=(const ResumeJournal&) = delete;
+
+    void start();
+    void stop();
+
+    std::optional<ResumeRecord> lookup(const std::string& key) const;
+    void progress(const std::string& key, std::uint64_t total, std::uint64_t received, std::string digest_state);
+    // Records `received` once the part behind `part_fd` is synced. With the flusher
+    // running the sync happens there, and a newer checkpoint of the same part replaces
+    // one still queued; finish() drops both.
+    void checkpoint(int part_fd,
+                    const std::string& key,
+                    std::uint64_t total,
+                    std::uint64_t received,
+                    std::string digest_state);
+    void finish(const std::string& key);
+    std::vector<std::string> keys() const;
+
+    void flush();
+
+private:
+    struct PartSync {
+        int fd = -1;
+        std::string key;
+        ResumeRecord record;
+        bool synced = false;
+    };
+
+    void flusher_loop();
+    void record_locked(const std::string& key, ResumeRecord record);
+    void append_locked(const std::string& payload);
+    void flush_locked();
+    void compact_locked();
+    void replay();
+    void open_for_append();
+
+    std::filesystem::path path_;
+    std::chrono::milliseconds sync_interval_;
+    int fd_ = -1;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, ResumeRecord> entries_;
+    std::string pending_;
+    std::size_t records_ = 0;
+    std::chrono::steady_clock::time_point last_sync_;
+
+    std::condition_variable cv_;
+    std::vector<PartSync> syncs_;                     // queued, at most one per part
+    std::unordered_map<std::string, bool> syncing_;   // taken by the flusher; false once finished
+    bool stopping_ = false;
+    std::thread flusher_;
+};
+
+}  // namespace cloud::server
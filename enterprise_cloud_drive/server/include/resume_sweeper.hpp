@@ -0,0 +1,61 @@
+#pragma once
+
+#include "io_throttle.hpp"
+#include "storage_manager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+namespace cloud::server {
+
+struct SweepOptions {
+    std::chrono::seconds max_age{7 * 24 * 3600};  // 0 = keep abandoned uploads forever
+    std::chrono::seconds interval{3600};
+    double rate = 500;  // entries examined (or 64 MiB truncated) per second, 0 = unthrottled
+};
+
+// Reclaims abandoned uploads. Once per interval a background worker walks every
+// home's `.resume` directory at a throttled pace and retires parts and legacy `.meta`
+// files nobody has written for `max_age`, along with their journal records. Large
+// parts are truncated in steps before the unlink, so freeing a multi-GB preallocated
+// file does not stall foreground I/O on the same disk.
+class ResumeSweeper {
+public:
+    ResumeSweeper(StorageManager& storage, SweepOptions options);
+    ~ResumeSweeper();
+
+    ResumeSweeper(const ResumeSweeper&) = delete;
+    ResumeSweeper& operator=(const ResumeSweeper&) = delete;
+
+    void start();
+    void stop();
+
+    std::string stats_report() const;
+
+private:
+    void worker_loop();
+    void sweep();
+    void reclaim(const std::filesystem::path& file);
+
+    StorageManager& storage_;
+    SweepOptions options_;
+    IoThrottle throttle_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> stopping_{false};
+    std::thread worker_;
+
+    std::atomic<std::uint64_t> passes_{0};
+    std::atomic<std::uint64_t> scanned_{0};
+    std::atomic<std::uint64_t> expired_{0};
+    std::atomic<std::uint64_t> reclaimed_bytes_{0};
+    std::atomic<std::uint64_t> journal_pruned_{0};
+};
+
+}  // namespace cloud::server
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "file_index.hpp"
+#include "storage_device.hpp"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cloud::server {
+
+// Objects of at most `max_file_bytes` are packed into segments; 0 disables packing.
+// A sealed segment is rewritten once `compact_ratio` of it is garbage.
+struct SegmentOptions {
+    std::uint64_t max_file_bytes = 0;
+    std::uint64_t segment_bytes = 64ULL * 1024 * 1024;
+    double compact_ratio = 0.5;
+    std::chrono::seconds compact_interval{300};
+};
+
+// Small-object layout. After commit, a background worker appends small objects to the
+// device's open segment, `<device>/.segments/<id>.seg`, syncs it once per batch,
+// records every blob's offset in the file index and then turns the objects into stubs
+// (see BlobStore), so a small file costs its bytes in a large sequential file instead
+// of a block of its own. Reads of a packed stub are one pread from its segment. Only
+// data blocks are saved: user files stay links of their objects, so every distinct
+// small file still has its inode and directory entry.
+//
+// Deleting the last reference to an object only drops its index entry; a periodic pass
+// copies the live blobs of mostly-garbage segments into the open one and deletes the old
+// file. Download sessions register as readers exactly as for erasure coding.
+class SegmentStore {
+public:
+    // An open segment file, shared by the readers of the blobs in it so that
+    // compaction can unlink it under them.
+    struct File {
+        int fd = -1;
+        ~File();
+    };
+    struct Extent {
+        std::shared_ptr<const File> file;  // null if the segment is gone
+        std::uint64_t offset = 0;
+        std::uint64_t length = 0;
+    };
+
+    SegmentStore(const std::vector<std::unique_ptr<StorageDevice>>& devices, SegmentOptions options);
+    ~SegmentStore();
+
+    SegmentStore(const SegmentStore&) = delete;
+    SegmentStore& operator=(const SegmentStore&) = delete;
+
+    void attach_index(FileIndex& index) { index_ = &index; }
+    bool enabled() const { return index_ != nullptr && options_.max_file_bytes > 0; }
+
+    void start();
+    void stop();
+    void enqueue(StorageDevice& device, const std::string& md5);
+
+    // Returns where the data is if the file is a packed stub.
+    std::optional<Extent> open_reader(int fd, const struct stat& st);
+    void close_reader(const struct stat& st);
+    std::vector<std::byte> read(const Extent& extent, std::uint64_t offset, std::size_t length);
+    // Forgets the blob once no device holds the object any more.
+    void drop(const std::string& md5);
+
+    std::string stats_report() const;
+
+private:
+    struct Job {
+        StorageDevice* device;
+        std::string md5;
+    };
+    struct Writer {
+        std::int64_t id = 0;
+        int fd = -1;
+        std::uint64_t end = 0;
+    };
+
+    void worker_loop();
+    void scan_objects();
+    void pack(std::vector<Job>& batch, std::vector<Job>& busy);
+    void compact();
+    Writer& writer_for(StorageDevice& device);
+    bool append(Writer& writer, const std::byte* data, std::size_t length);
+    void seal_if_full(StorageDevice& device);
+    void retire(const SegmentInfo& segment);
+    bool has_readers(const struct stat& st);
+    StorageDevice* device_at(const std::string& root) const;
+    std::filesystem::path segment_path(const std::string& device, std::int64_t id) const;
+
+    const std::vector<std::unique_ptr<StorageDevice>>& devices_;
+    SegmentOptions options_;
+    FileIndex* index_ = nullptr;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    std::vector<Job> deferred_;
+    bool stopping_ = false;
+    std::thread worker_;
+
+    std::map<StorageDevice*, Writer> writers_;  // worker thread only
+
+    std::mutex readers_mutex_;
+    std::map<std::pair<dev_t, ino_t>, unsigned> readers_;
+
+    std::mutex files_mutex_;  // orders lookups against compaction unlinking a segment
+    std::map<std::int64_t, std::weak_ptr<const File>> files_;
+
+    std::atomic<std::uint64_t> packed_objects_{0};
+    std::atomic<std::uint64_t> packed_bytes_{0};
+    std::atomic<std::uint64_t> skipped_{0};
+    std::atomic<std::uint64_t> reads_{0};
+    std::atomic<std::uint64_t> failed_reads_{0};
+    std::atomic<std::uint64_t> compactions_{0};
+    std::atomic<std::uint64_t> compacted_bytes_{0};
+    std::atomic<std::uint64_t> reclaimed_bytes_{0};
+};
+
+}  // namespace cloud::server
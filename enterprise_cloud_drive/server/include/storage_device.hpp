@@ -0,0 +1,74 @@
+#pragma once
+
+#include "blob_store.hpp"
+#include "task_executor.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cloud::server {
+
+// active: holds homes and receives new ones. draining: still serves its homes but gets
+// no new ones, and the rebalancer moves them away. failed: not touched at all.
+enum class DeviceState { active, draining, failed };
+
+const char* to_string(DeviceState state);
+
+struct DeviceSpec {
+    std::filesystem::path root;
+    unsigned weight = 1;
+    DeviceState state = DeviceState::active;
+};
+
+// Parses `path[:weight[:state]]` entries separated by commas.
+std::vector<DeviceSpec> parse_device_specs(const std::string& list);
+
+// One disk of the storage pool. User homes live whole on one device together with the
+// device's own object store and trash, since user files are hardlinks of their blobs
+// and a hardlink or rename cannot cross filesystems. Each device has its own I/O
+// queue, so a slow or busy disk only delays the requests that touch it.
+class StorageDevice {
+public:
+    explicit StorageDevice(DeviceSpec spec);
+
+    StorageDevice(const StorageDevice&) = delete;
+    StorageDevice& operator=(const StorageDevice&) = delete;
+
+    const std::filesystem::path& root() const { return spec_.root; }
+    unsigned weight() const { return spec_.weight; }
+    DeviceState state() const { return spec_.state; }
+
+    std::filesystem::path home(const std::string& username) const { return spec_.root / username; }
+    bool has_home(const std::string& username) const;
+    bool same_filesystem(const std::filesystem::path& path) const;
+    std::vector<std::string> homes() const;
+    std::filesystem::path trash_root() const;
+    BlobStore& blobs() { return blobs_; }
+
+    // Bytes admitted uploads may still write here. statvfs does not see them yet, so
+    // admission control counts them as used.
+    void admit(std::uint64_t bytes) { admitted_ += bytes; }
+    void settle(std::uint64_t bytes) { admitted_ -= bytes; }
+    std::uint64_t admitted() const { return admitted_.load(); }
+
+    void start_io(std::size_t threads);
+    void stop_io();
+    void submit(std::function<void()> task);
+
+    std::string report(std::size_t index) const;
+
+private:
+    DeviceSpec spec_;
+    BlobStore blobs_;
+    TaskExecutor io_;
+    std::atomic<std::uint64_t> queued_{0};
+    std::atomic<std::uint64_t> completed_{0};
+    std::atomic<std::uint64_t> admitted_{0};
+};
+
+}  // namespace cloud::server
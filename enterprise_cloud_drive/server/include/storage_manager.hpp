@@ -1,9 +1,31 @@
 #pragma once
 
+#include "aligned_buffer_pool.hpp"
+#include "blob_store.hpp"
+#include "delta_sync.hpp"
+#include "erasure_store.hpp"
+#include "hash_ring.hpp"
+#include "md5.hpp"
+#include "path_resolver.hpp"
+#include "resume_journal.hpp"
+#include "segment_store.hpp"
+#include "storage_device.hpp"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace cloud::server {
@@ -18,46 +40,341 @@ struct DirEntry {
 struct UploadCheckpoint {
     bool active = false;
     std::filesystem::path temp_path;
-    std::filesystem::path meta_path;
     std::filesystem::path final_path;
     std::uint64_t total = 0;
     std::uint64_t received = 0;
+    std::string digest_state;
+    StorageDevice* device = nullptr;  // holding the part, set by prepare_upload
+    std::string username;
+    std::filesystem::path logical_path;
+    // A delta upload's part holds only literals; the file rebuilt from it at commit
+    // needs this much more space.
+    std::uint64_t rebuild_bytes = 0;
+    // Directories that gained an entry when prepare_upload created the file's parents.
+    std::vector<std::filesystem::path> new_directories;
+};
+
+// One content-defined chunk of an upload. `source` names a blob holding the same
+// bytes at `source_offset`; it is empty when the client has to send them.
+struct ManifestChunk {
+    std::uint64_t offset = 0;
+    std::uint64_t length = 0;
+    std::string chunk_id;
+    std::filesystem::path source;
+    std::uint64_t source_offset = 0;
+};
+
+// Result of StorageManager::copy_tree. `files` pairs each new file with its digest;
+// `copied` lists those whose bytes were written out rather than linked, and
+// `directories` every directory that gained an entry.
+struct TreeCopy {
+    struct File {
+        std::filesystem::path target;
+        std::string md5;
+        std::uint64_t size = 0;
+    };
+    std::vector<File> files;
+    std::vector<std::filesystem::path> copied;
+    std::vector<std::filesystem::path> directories;
+};
+
+// A delta upload: the new file is `segments` laid over the base object, and the
+// upload's part holds only the literal segments, back to back.
+struct DeltaPlan {
+    std::filesystem::path base;
+    std::vector<delta::Segment> segments;
+};
+
+// Files of at least `threshold` bytes are transferred with O_DIRECT through pooled
+// aligned buffers; 0 keeps every transfer in the page cache. At most `max_buffers`
+// are lent out at once, further transfers use the page cache.
+struct DirectIoOptions {
+    std::uint64_t threshold = 0;
+    std::size_t buffer_bytes = 4 * 1024 * 1024;
+    std::size_t max_buffers = 64;
+};
+
+// Uploads of at least `preallocate_min_bytes` reserve their full size at INIT, so the
+// part gets few large extents and ENOSPC shows up before any data is sent. Uploads are
+// admitted only if the filesystem keeps `reserve_bytes` free after them.
+struct SpaceOptions {
+    bool preallocate = true;
+    std::uint64_t preallocate_min_bytes = 1024 * 1024;
+    std::uint64_t reserve_bytes = 256ULL * 1024 * 1024;
+};
+
+struct IoStats {
+    std::atomic<std::uint64_t> sequential_streams{0};
+    std::atomic<std::uint64_t> readahead_bytes{0};
+    std::atomic<std::uint64_t> dropped_bytes{0};
+    std::atomic<std::uint64_t> kept_streams{0};
+    std::atomic<std::uint64_t> direct_written_bytes{0};
+    std::atomic<std::uint64_t> direct_read_bytes{0};
+    std::atomic<std::uint64_t> direct_fallbacks{0};
+    std::atomic<std::uint64_t> direct_pool_exhausted{0};
+    std::atomic<std::uint64_t> preallocated_bytes{0};
+    std::atomic<std::uint64_t> rejected_uploads{0};
+    std::atomic<std::uint64_t> copy_linked_files{0};
+    std::atomic<std::uint64_t> copy_written_bytes{0};
+    std::atomic<std::uint64_t> delta_signatures{0};
+    std::atomic<std::uint64_t> delta_rebuilt_files{0};
+    std::atomic<std::uint64_t> delta_reused_bytes{0};
+    std::atomic<std::uint64_t> delta_literal_bytes{0};
 };
 
+// Holds the `.part` descriptor for the lifetime of one upload, so each chunk costs a
+// single pwritev. Progress is checkpointed (fdatasync of the part, then a journal
+// record) only every `sync_bytes` or `sync_interval`, and when the session closes.
+// In-order chunks also feed an MD5 context that is saved with each checkpoint, so
+// commit only finalizes the digest instead of re-reading the file.
+//
+// With a direct-I/O pool, contiguous writes are staged in an aligned buffer that goes
+// to disk through an O_DIRECT descriptor once full; the unaligned tail of the stage is
+// written through the page cache at checkpoints and stays staged, so the next direct
+// write simply covers it again.
+class UploadSession {
+public:
+    UploadSession(UploadCheckpoint checkpoint,
+                  ResumeJournal& journal,
+                  ResumeOptions options,
+                  AlignedBufferPool* direct_pool,
+                  IoStats& stats);
+    ~UploadSession();
+
+    UploadSession(const UploadSession&) = delete;
+    UploadSession& operator=(const UploadSession&) = delete;
+
+    bool write(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers);
+    bool write(std::uint64_t offset, std::span<const std::byte> data);
+    void checkpoint_progress();
+    // `checkpoint` = false skips the progress sync, for a part about to be committed
+    // by a caller that syncs it itself.
+    void close(bool checkpoint = true);
+    // Charges the bytes still to be written against the device until they are written
+    // or the session closes.
+    void admit(std::uint64_t bytes);
+    std::string finish_digest();
+
+    // A chunked upload is `preparing` from INIT until place_known() has copied the
+    // chunks the server already holds; nothing else may touch the session meanwhile.
+    void set_manifest(std::vector<ManifestChunk> manifest) { manifest_ = std::move(manifest); }
+    const std::vector<ManifestChunk>& manifest() const { return manifest_; }
+    void begin_preparing() { preparing_.store(true, std::memory_order_relaxed); }
+    void end_preparing() { preparing_.store(false, std::memory_order_release); }
+    bool preparing() const { return preparing_.load(std::memory_order_acquire); }
+    void place_known();
+    void fill_known(std::uint64_t upto);
+    bool preallocate();
+
+    const UploadCheckpoint& checkpoint() const { return checkpoint_; }
+    std::uint64_t received() const { return checkpoint_.received; }
+
+private:
+    bool write_buffered(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers);
+    bool write_staged(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers);
+    bool begin_stage(std::uint64_t offset);
+    bool flush_stage(bool with_tail);
+    void maybe_checkpoint();
+    void consume_admitted(std::uint64_t bytes);
+
+    UploadCheckpoint checkpoint_;
+    ResumeJournal& journal_;
+    ResumeOptions options_;
+    IoStats& stats_;
+    int fd_ = -1;
+    int direct_fd_ = -1;
+    AlignedBufferPool* direct_pool_ = nullptr;
+    AlignedBuffer stage_;
+    bool staged_ = false;
+    std::uint64_t stage_start_ = 0;
+    std::size_t stage_len_ = 0;
+    Md5 md5_;
+    std::uint64_t hashed_ = 0;
+    std::uint64_t persisted_ = 0;
+    std::chrono::steady_clock::time_point last_checkpoint_;
+    std::vector<ManifestChunk> manifest_;
+    std::atomic<bool> preparing_{false};
+    std::uint64_t admitted_ = 0;
+};
+
+// Open downloads per inode. Pages behind a reader are only dropped while it is the
+// file's sole reader.
+class ReaderCounts {
+public:
+    void add(const struct stat& st);
+    void remove(const struct stat& st);
+    unsigned count(const struct stat& st) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::pair<dev_t, ino_t>, unsigned> counts_;
+};
+
+// Keeps one file open for a client's download and watches its access pattern. Once
+// reads look sequential the kernel gets SEQUENTIAL + WILLNEED hints for a growing
+// window ahead of the reader; for large files, pages well behind the reader are
+// dropped so a one-shot download does not push the hot set out of the page cache.
+// A download counts as one-shot only if the file was mostly uncached when it was
+// opened and nobody else is reading it; popular files keep their pages.
+// Safe to share between the executor threads serving pipelined fetches. Given a
+// direct-I/O pool, reads bypass the page cache (and its hints) altogether. A stub
+// is read from its erasure-coded shards instead, and a packed stub from its segment.
+class DownloadSession {
+public:
+    // Takes ownership of `fd`, and of `direct_fd` (an O_DIRECT descriptor of the same
+    // file, or -1). `path` is the user's logical path, which names the session.
+    DownloadSession(int fd,
+                    int direct_fd,
+                    const std::filesystem::path& path,
+                    IoStats& stats,
+                    AlignedBufferPool* direct_pool,
+                    ErasureStore* erasure = nullptr,
+                    SegmentStore* segments = nullptr,
+                    ReaderCounts* readers = nullptr);
+    ~DownloadSession();
+
+    DownloadSession(const DownloadSession&) = delete;
+    DownloadSession& operator=(const DownloadSession&) = delete;
+
+    bool same_file(const struct stat& st) const;
+    const std::filesystem::path& path() const { return path_; }
+    const struct stat& status() const { return st_; }
+
+    std::vector<std::byte> read(std::uint64_t offset, std::size_t length);
+
+private:
+    void advise(std::uint64_t offset, std::uint64_t end);
+    bool keep_pages();
+    std::size_t read_direct(std::uint64_t offset, std::span<std::byte> out);
+
+    std::filesystem::path path_;
+    IoStats& stats_;
+    int fd_ = -1;
+    int direct_fd_ = -1;
+    AlignedBufferPool* direct_pool_ = nullptr;
+    std::atomic<bool> direct_{false};
+    struct stat st_ {};
+    ErasureStore* erasure_ = nullptr;
+    std::optional<std::string> stub_;
+    SegmentStore* segments_ = nullptr;
+    std::optional<SegmentStore::Extent> packed_;
+    ReaderCounts* readers_ = nullptr;
+    bool cached_at_open_ = false;
+
+    std::mutex mutex_;
+    std::uint64_t stream_end_ = 0;
+    unsigned streak_ = 0;
+    bool sequential_ = false;
+    std::uint64_t window_ = 0;
+    std::uint64_t readahead_end_ = 0;
+    std::uint64_t dropped_until_ = 0;
+    bool kept_ = false;
+};
+
+// `root` keeps server-wide state (the resume journal). User data lives on `devices`,
+// or on `root` itself when none are given. A user's home stays on whichever device
+// already holds it; new homes are placed by consistent hashing of the username over
+// the active devices, weighted by capacity.
 class StorageManager {
 public:
-    explicit StorageManager(std::filesystem::path root);
+    explicit StorageManager(std::filesystem::path root,
+                            ResumeOptions resume_options = {},
+                            DirectIoOptions direct_options = {},
+                            SpaceOptions space_options = {},
+                            std::vector<DeviceSpec> devices = {},
+                            ErasureOptions erasure_options = {},
+                            SegmentOptions segment_options = {});
 
     std::filesystem::path user_root(const std::string& username) const;
+    StorageDevice& device_for(const std::string& username) const;
+    StorageDevice* device_containing(const std::filesystem::path& path) const;
+    std::optional<std::size_t> placement(const std::string& username) const;
+    const std::vector<std::unique_ptr<StorageDevice>>& devices() const { return devices_; }
+    std::filesystem::path find_blob(const std::string& username, const std::string& md5) const;
+    void schedule_erasure(const std::string& username, const std::string& md5);
+    void schedule_packing(const std::string& username, const std::string& md5);
+    // Packing keeps its offsets in the file index; without one small objects stay whole.
+    void attach_index(FileIndex& index) { segments_.attach_index(index); }
+    // Drops one device's reference to the object, and its shards or packed blob with the last one.
+    bool release_blob(StorageDevice& device, const std::string& md5);
+    // Releases, on the user's I/O queue, the blob of content an overwritten file held.
+    void release_replaced(const std::string& username, const std::string& md5);
+
+    void start_io(std::size_t threads_per_device);
+    void stop_io();
+    void submit_io(const std::string& username, std::function<void()> task);
     std::filesystem::path resolve(const std::string& username, const std::filesystem::path& relative) const;
 
     std::vector<DirEntry> list(const std::string& username, const std::filesystem::path& relative_path);
     bool ensure_directory(const std::string& username, const std::filesystem::path& relative_path);
     bool remove(const std::string& username, const std::filesystem::path& relative_path);
+    // Copies the file or tree at `source` to `target` in the user's home. `digests`
+    // maps paths relative to `source` ("" for `source` itself) to known content digests.
+    TreeCopy copy_tree(const std::string& username,
+                       const std::filesystem::path& source,
+                       const std::filesystem::path& target,
+                       const std::unordered_map<std::string, std::string>& digests);
 
     UploadCheckpoint prepare_upload(const std::string& username,
                                     const std::string& md5,
                                     const std::filesystem::path& logical_path,
                                     std::uint64_t total_bytes);
-    bool write_chunk(const UploadCheckpoint& checkpoint, std::uint64_t offset, std::span<const std::byte> data);
-    void update_progress(const UploadCheckpoint& checkpoint, std::uint64_t received_bytes);
+    bool has_space_for(const UploadCheckpoint& checkpoint);
+    // Returns null if the upload's space could not be reserved.
+    std::unique_ptr<UploadSession> open_upload(const UploadCheckpoint& checkpoint);
     std::filesystem::path finalize_upload(const UploadCheckpoint& checkpoint);
+    // Signatures of every full `block` of a stored object.
+    std::vector<delta::BlockSignature> block_signatures(const std::filesystem::path& object, std::size_t block);
+    // Builds the new file of a delta upload from its base and the literals in its part,
+    // then moves it into place like finalize_upload. `md5` receives its digest.
+    std::filesystem::path finalize_delta(const UploadCheckpoint& checkpoint, const DeltaPlan& plan, std::string& md5);
     void discard_checkpoint(const UploadCheckpoint& checkpoint);
+    // Moves a part (or legacy .meta) last written before `cutoff` out of the way of a
+    // resuming upload and forgets its journal record. Returns the new name of the
+    // file, to be reclaimed by the caller, or an empty path if it is still live.
+    std::filesystem::path retire_checkpoint(const std::filesystem::path& file, std::time_t cutoff);
+    // Drops journal records whose part is gone; returns how many.
+    std::size_t prune_resume_journal();
+
+    // Opens the user's file beneath their home; null if it does not exist.
+    std::shared_ptr<DownloadSession> open_download(const std::string& username, const std::filesystem::path& relative);
+    bool stat_file(const std::string& username, const std::filesystem::path& relative, struct stat& st);
+    std::string io_report() const;
 
     std::vector<std::byte> read_chunk(const std::filesystem::path& absolute_path,
                                       std::uint64_t offset,
                                       std::size_t length) const;
     std::string compute_md5(const std::filesystem::path& absolute_path) const;
+    std::string compute_md5(const std::string& username, const std::filesystem::path& relative);
     std::uint64_t file_size(const std::filesystem::path& absolute_path) const;
 
 private:
-    std::filesystem::path sanitize_path(const std::filesystem::path& base, const std::filesystem::path& relative) const;
-
     std::filesystem::path checkpoint_dir(const std::string& username) const;
     std::filesystem::path meta_file(const std::string& username, const std::string& md5) const;
     std::filesystem::path temp_file(const std::string& username, const std::string& md5) const;
 
+    bool unpack(const std::filesystem::path& from, const std::filesystem::path& to);
+    std::vector<std::filesystem::path> place_in_home(const UploadCheckpoint& checkpoint,
+                                                     const std::filesystem::path& file);
+    AlignedBufferPool* direct_pool_for(std::uint64_t size);
+    std::size_t locate_home(const std::string& username) const;
+
     std::filesystem::path root_;
+    std::vector<std::unique_ptr<StorageDevice>> devices_;
+    ErasureStore erasure_;
+    SegmentStore segments_;
+    HashRing ring_;
+    mutable std::mutex homes_mutex_;
+    mutable std::unordered_map<std::string, std::size_t> homes_;
+    mutable PathResolver resolver_;
+    ResumeOptions resume_options_;
+    DirectIoOptions direct_options_;
+    SpaceOptions space_options_;
+    ResumeJournal journal_;
+    std::mutex checkpoints_mutex_;  // orders resuming uploads against retire_checkpoint
+    AlignedBufferPool direct_buffers_;
+    ReaderCounts readers_;
+    IoStats io_stats_;
 };
 
 }  // namespace cloud::server
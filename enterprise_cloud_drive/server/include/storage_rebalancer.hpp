@@ -0,0 +1,44 @@
+#pragma once
+
+#include "file_index.hpp"
+#include "storage_manager.hpp"
+#include "trash_manager.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cloud::server {
+
+struct HomeMove {
+    std::string username;
+    std::size_t from = 0;
+    std::size_t to = 0;
+};
+
+struct MoveResult {
+    std::uint64_t files = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t linked = 0;  // files that became links of an object already on the target
+};
+
+// Moves user homes onto the device the hash ring assigns them, e.g. after a device was
+// added or set to draining. Meant to run while the server is stopped. A home is copied
+// into a staging directory on the target, renamed into place, re-pointed in the index
+// and only then removed from the source, so an interrupted run can simply be repeated.
+// The user's trash on the source is purged first instead of being carried over.
+class StorageRebalancer {
+public:
+    StorageRebalancer(StorageManager& storage, FileIndex& index, TrashManager& trash);
+
+    std::vector<HomeMove> plan() const;
+    MoveResult migrate(const HomeMove& move);
+
+private:
+    StorageManager& storage_;
+    FileIndex& index_;
+    TrashManager& trash_;
+};
+
+}  // namespace cloud::server
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "file_index.hpp"
+#include "io_throttle.hpp"
+#include "storage_manager.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cloud::server {
+
+struct TrashOptions {
+    std::chrono::seconds retention{0};
+    double purge_rate = 2000;  // unlinks per second, 0 = unthrottled
+    std::size_t batch_rows = 512;
+};
+
+// Deletes in two phases. FILE_DELETE renames the target into `.trash/<user>/` on the
+// user's storage device (O(1) on the same filesystem) and records it in the
+// index; a background worker later removes the tree's index rows in batches, unlinks
+// its files at a throttled rate and releases the blobs nobody links to any more.
+// Pending entries survive restarts.
+class TrashManager {
+public:
+    TrashManager(StorageManager& storage, FileIndex& index, TrashOptions options);
+    ~TrashManager();
+
+    TrashManager(const TrashManager&) = delete;
+    TrashManager& operator=(const TrashManager&) = delete;
+
+    void start();
+    void stop();
+
+    bool move_to_trash(const std::string& owner, const std::string& logical_path, const std::filesystem::path& absolute);
+    // Purges everything `owner` has in the trash of `device` now, regardless of retention.
+    std::size_t purge_owner(const std::string& owner, const StorageDevice& device);
+    std::string status_report(const std::string& owner) const;
+    std::string stats_report() const;
+
+private:
+    void worker_loop();
+    void recover();
+    bool purge(const TrashEntry& entry);
+
+    StorageManager& storage_;
+    FileIndex& index_;
+    TrashOptions options_;
+    IoThrottle throttle_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<TrashEntry> queue_;
+    std::atomic<bool> stopping_{false};
+    std::thread worker_;
+
+    std::atomic<std::int64_t> current_id_{0};
+    std::atomic<std::uint64_t> current_files_{0};
+    std::atomic<std::uint64_t> entries_purged_{0};
+    std::atomic<std::uint64_t> files_purged_{0};
+    std::atomic<std::uint64_t> bytes_purged_{0};
+    std::atomic<std::uint64_t> rows_deleted_{0};
+    std::atomic<std::uint64_t> blobs_released_{0};
+};
+
+}  // namespace cloud::server
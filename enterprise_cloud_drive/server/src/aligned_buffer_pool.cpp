@@ -0,0 +1,86 @@
+#include "aligned_buffer_pool.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace cloud::server {
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr)),
+      data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)) {}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+    if (this != &other) {
+        if (pool_ && data_) {
+            pool_->release(data_);
+        }
+        pool_ = std::exchange(other.pool_, nullptr);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+AlignedBuffer::~AlignedBuffer() {
+    if (pool_ && data_) {
+        pool_->release(data_);
+    }
+}
+
+AlignedBufferPool::AlignedBufferPool(std::size_t buffer_bytes,
+                                     std::size_t alignment,
+                                     std::size_t max_outstanding,
+                                     std::size_t max_idle)
+    : buffer_bytes_((buffer_bytes + alignment - 1) / alignment * alignment),
+      alignment_(alignment),
+      max_outstanding_(max_outstanding),
+      max_idle_(max_idle) {}
+
+AlignedBufferPool::~AlignedBufferPool() {
+    for (auto* data : idle_) {
+        std::free(data);
+    }
+}
+
+AlignedBuffer AlignedBufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (outstanding_ >= max_outstanding_) {
+            return {};
+        }
+        ++outstanding_;
+        if (!idle_.empty()) {
+            auto* data = idle_.back();
+            idle_.pop_back();
+            return AlignedBuffer(this, data, buffer_bytes_);
+        }
+    }
+    void* data = nullptr;
+    if (::posix_memalign(&data, alignment_, buffer_bytes_) != 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --outstanding_;
+        throw std::bad_alloc();
+    }
+    return AlignedBuffer(this, static_cast<std::byte*>(data), buffer_bytes_);
+}
+
+std::size_t AlignedBufferPool::outstanding() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return outstanding_;
+}
+
+void AlignedBufferPool::release(std::byte* data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --outstanding_;
+        if (idle_.size() < max_idle_) {
+            idle_.push_back(data);
+            return;
+        }
+    }
+    std::free(data);
+}
+
+}  // namespace cloud::server
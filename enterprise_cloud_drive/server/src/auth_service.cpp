@@ -44,8 +44,13 @@ void AuthService::initialize_schema() {
     }
 }
 
+bool AuthService::valid_username(std::string_view username) {
+    return !username.empty() && username.front() != '.' && username.find('/') == std::string_view::npos &&
+           username.find('\0') == std::string_view::npos && username != "lost+found";
+}
+
 bool AuthService::register_user(const std::string& username, const std::string& password) {
-    if (username.empty() || password.empty()) {
+    if (!valid_username(username) || password.empty()) {
         return false;
     }
     if (find_user(username).has_value()) {
@@ -69,6 +74,9 @@ bool AuthService::register_user(const std::string& username, const std::string&
 }
 
 bool AuthService::validate_user(const std::string& username, const std::string& password) {
+    if (!valid_username(username)) {
+        return false;
+    }
     auto record = find_user(username);
     if (!record.has_value()) {
         return false;
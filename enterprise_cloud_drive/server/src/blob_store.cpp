@@ -0,0 +1,226 @@
+#include "blob_store.hpp"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+namespace cloud::server {
+
+namespace {
+
+bool clone_file(const std::filesystem::path& source, const std::filesystem::path& target) {
+    const int src = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src < 0) {
+        return false;
+    }
+    const int dst = ::open(target.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+    if (dst < 0) {
+        ::close(src);
+        return false;
+    }
+    const bool ok = ::ioctl(dst, FICLONE, src) == 0;
+    ::close(dst);
+    ::close(src);
+    if (!ok) {
+        ::unlink(target.c_str());
+    }
+    return ok;
+}
+
+std::optional<std::string> digest_attribute(int fd, const char* name) {
+    char digest[64];
+    const ssize_t got = ::fgetxattr(fd, name, digest, sizeof(digest));
+    if (got <= 0) {
+        return std::nullopt;
+    }
+    return std::string(digest, static_cast<std::size_t>(got));
+}
+
+std::optional<std::string> digest_attribute(const std::filesystem::path& path, const char* name) {
+    char digest[64];
+    const ssize_t got = ::getxattr(path.c_str(), name, digest, sizeof(digest));
+    if (got <= 0) {
+        return std::nullopt;
+    }
+    return std::string(digest, static_cast<std::size_t>(got));
+}
+
+// A stub's data lives in its shards or segment, so a copy is just another stub: same
+// size, no blocks, same attribute.
+bool copy_stub(const std::filesystem::path& source,
+               const char* attribute,
+               const std::string& md5,
+               const std::filesystem::path& target) {
+    struct stat st {};
+    if (::stat(source.c_str(), &st) != 0) {
+        return false;
+    }
+    const int dst = ::open(target.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+    if (dst < 0) {
+        return false;
+    }
+    const struct timespec times[2] = {{0, UTIME_OMIT}, st.st_mtim};
+    const bool ok = ::ftruncate(dst, st.st_size) == 0 &&
+                    ::fsetxattr(dst, attribute, md5.data(), md5.size(), 0) == 0 &&
+                    ::futimens(dst, times) == 0;
+    ::close(dst);
+    if (!ok) {
+        ::unlink(target.c_str());
+    }
+    return ok;
+}
+
+// Places `source` at `target` using the cheapest mechanism the filesystem allows:
+// hardlink, then reflink, then a plain copy. Only used to fill the store: a stub is
+// copied as a stub there, since the shards or segment entry live as long as some
+// object names them.
+bool place(const std::filesystem::path& source, const std::filesystem::path& target) {
+    if (::link(source.c_str(), target.c_str()) == 0) {
+        return true;
+    }
+    if (const auto stub = BlobStore::stub_digest(source)) {
+        return copy_stub(source, BlobStore::kStubXattr, *stub, target);
+    }
+    if (const auto packed = BlobStore::packed_digest(source)) {
+        return copy_stub(source, BlobStore::kPackedXattr, *packed, target);
+    }
+    if (clone_file(source, target)) {
+        return true;
+    }
+    std::error_code ec;
+    return std::filesystem::copy_file(source, target, ec) && !ec;
+}
+
+// Unique per call: ingests of one digest can run on several I/O threads at once.
+std::filesystem::path staging_path(const std::filesystem::path& target) {
+    static std::atomic<std::uint64_t> sequence{0};
+    return target.parent_path() / ("." + target.filename().string() + ".blob-" + std::to_string(::getpid()) + "-" +
+                                   std::to_string(sequence++));
+}
+
+}  // namespace
+
+BlobStore::BlobStore(std::filesystem::path root) : root_(std::move(root)) {
+    std::error_code ec;
+    std::filesystem::create_directories(root_, ec);
+}
+
+bool BlobStore::valid_digest(std::string_view md5) {
+    if (md5.size() != 32) {
+        return false;
+    }
+    for (char ch : md5) {
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<std::string> BlobStore::stub_digest(int fd) {
+    return digest_attribute(fd, kStubXattr);
+}
+
+std::optional<std::string> BlobStore::stub_digest(const std::filesystem::path& path) {
+    return digest_attribute(path, kStubXattr);
+}
+
+std::optional<std::string> BlobStore::packed_digest(int fd) {
+    return digest_attribute(fd, kPackedXattr);
+}
+
+std::optional<std::string> BlobStore::packed_digest(const std::filesystem::path& path) {
+    return digest_attribute(path, kPackedXattr);
+}
+
+std::optional<std::string> BlobStore::stub_of(const std::filesystem::path& path) {
+    if (auto stub = stub_digest(path)) {
+        return stub;
+    }
+    return packed_digest(path);
+}
+
+bool BlobStore::copy_data(const std::filesystem::path& source, const std::filesystem::path& target) {
+    if (stub_of(source)) {
+        return false;
+    }
+    if (clone_file(source, target)) {
+        return true;
+    }
+    std::error_code ec;
+    return std::filesystem::copy_file(source, target, ec) && !ec;
+}
+
+std::filesystem::path BlobStore::object_path(const std::string& md5) const {
+    return root_ / md5.substr(0, 2) / md5;
+}
+
+bool BlobStore::contains(const std::string& md5) const {
+    return valid_digest(md5) && std::filesystem::exists(object_path(md5));
+}
+
+// Publishes a verified file under its digest. An existing object wins, since equal
+// digests mean equal content.
+bool BlobStore::ingest(const std::filesystem::path& source, const std::string& md5) {
+    if (!valid_digest(md5)) {
+        return false;
+    }
+    const auto object = object_path(md5);
+    if (std::filesystem::exists(object)) {
+        return true;
+    }
+    std::filesystem::create_directories(object.parent_path());
+    const auto staging = staging_path(object);
+    std::filesystem::remove(staging);
+    if (!place(source, staging)) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(staging, object, ec);
+    if (ec) {
+        std::filesystem::remove(staging);
+        return false;
+    }
+    return true;
+}
+
+// Only ever a hardlink: callers on the reactor must not copy, and a user file that
+// cannot be linked (another filesystem, the link limit) is the caller's to copy.
+bool BlobStore::materialize(const std::string& md5, const std::filesystem::path& target) {
+    if (!contains(md5)) {
+        return false;
+    }
+    std::filesystem::create_directories(target.parent_path());
+    const auto staging = staging_path(target);
+    std::filesystem::remove(staging);
+    if (::link(object_path(md5).c_str(), staging.c_str()) != 0) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(staging, target, ec);
+    // rename() is a no-op when both names already link the same inode.
+    std::filesystem::remove(staging);
+    return !ec;
+}
+
+// Drops the object once no user path links to it any more. Reflinked or copied user
+// files do not count as links; they stay indexed and are re-adopted by the next
+// instant upload of the same content.
+bool BlobStore::release(const std::string& md5) {
+    if (!valid_digest(md5)) {
+        return false;
+    }
+    const auto object = object_path(md5);
+    struct stat st {};
+    return ::stat(object.c_str(), &st) == 0 && st.st_nlink == 1 && ::unlink(object.c_str()) == 0;
+}
+
+}  // namespace cloud::server
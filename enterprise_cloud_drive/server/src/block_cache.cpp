@@ -0,0 +1,191 @@
+#include "block_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <sstream>
+
+namespace cloud::server {
+
+namespace {
+
+std::uint64_t mix(std::uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+// Count-min sketch with 4-bit saturating counters, halved every `sample` increments
+// so the frequency estimate follows recent popularity.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(std::size_t expected_entries) {
+        std::size_t width = 64;
+        while (width < expected_entries * 2) {
+            width <<= 1;
+        }
+        mask_ = width - 1;
+        for (auto& row : rows_) {
+            row.assign(width, 0);
+        }
+        sample_ = std::max<std::size_t>(expected_entries * 10, 1024);
+    }
+
+    void record(std::uint64_t hash) {
+        for (std::size_t i = 0; i < rows_.size(); ++i) {
+            auto& counter = rows_[i][index(hash, i)];
+            if (counter < 15) {
+                ++counter;
+            }
+        }
+        if (++additions_ >= sample_) {
+            for (auto& row : rows_) {
+                for (auto& counter : row) {
+                    counter >>= 1;
+                }
+            }
+            additions_ /= 2;
+        }
+    }
+
+    std::uint8_t estimate(std::uint64_t hash) const {
+        std::uint8_t result = 15;
+        for (std::size_t i = 0; i < rows_.size(); ++i) {
+            result = std::min(result, rows_[i][index(hash, i)]);
+        }
+        return result;
+    }
+
+private:
+    std::size_t index(std::uint64_t hash, std::size_t row) const {
+        return static_cast<std::size_t>(mix(hash + row * 0x9e3779b97f4a7c15ULL)) & mask_;
+    }
+
+    std::array<std::vector<std::uint8_t>, 4> rows_;
+    std::size_t mask_ = 0;
+    std::size_t sample_ = 0;
+    std::size_t additions_ = 0;
+};
+
+}  // namespace
+
+std::size_t BlockKeyHash::operator()(const BlockKey& key) const noexcept {
+    std::uint64_t h = mix(key.device ^ 0x9e3779b97f4a7c15ULL);
+    h = mix(h ^ key.inode);
+    h = mix(h ^ key.size);
+    h = mix(h ^ key.mtime_ns);
+    return static_cast<std::size_t>(mix(h ^ key.block));
+}
+
+struct BlockCache::Shard {
+    explicit Shard(std::size_t capacity)
+        : capacity_bytes(capacity), sketch(std::max<std::size_t>(capacity / kBlockBytes, 1)) {}
+
+    struct Entry {
+        BlockKey key;
+        BlockData data;
+    };
+
+    std::mutex mutex;
+    std::size_t capacity_bytes;
+    std::size_t used_bytes = 0;
+    std::list<Entry> lru;  // front = most recently used
+    std::unordered_map<BlockKey, std::list<Entry>::iterator, BlockKeyHash> index;
+    FrequencySketch sketch;
+};
+
+BlockCache::BlockCache(std::size_t capacity_bytes, std::size_t shard_count) : capacity_bytes_(capacity_bytes) {
+    if (capacity_bytes_ == 0) {
+        return;
+    }
+    // Small caches use fewer shards so that every shard still holds a few blocks.
+    shard_count = std::clamp<std::size_t>(capacity_bytes_ / (kBlockBytes * 4), 1, std::max<std::size_t>(shard_count, 1));
+    for (std::size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<Shard>(capacity_bytes_ / shard_count));
+    }
+}
+
+BlockCache::~BlockCache() = default;
+
+BlockCache::Shard& BlockCache::shard_for(const BlockKey& key) {
+    return *shards_[BlockKeyHash{}(key) % shards_.size()];
+}
+
+BlockData BlockCache::lookup(const BlockKey& key) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sketch.record(BlockKeyHash{}(key));
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    ++hits_;
+    return it->second->data;
+}
+
+void BlockCache::insert(const BlockKey& key, BlockData data) {
+    if (!enabled() || !data) {
+        return;
+    }
+    auto& shard = shard_for(key);
+    const auto size = data->size();
+    if (size > shard.capacity_bytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.index.count(key) != 0) {
+        return;
+    }
+    if (shard.used_bytes + size > shard.capacity_bytes && !shard.lru.empty()) {
+        const auto candidate = shard.sketch.estimate(BlockKeyHash{}(key));
+        const auto victim = shard.sketch.estimate(BlockKeyHash{}(shard.lru.back().key));
+        if (candidate <= victim) {
+            ++rejected_;
+            return;
+        }
+    }
+    while (shard.used_bytes + size > shard.capacity_bytes && !shard.lru.empty()) {
+        auto& tail = shard.lru.back();
+        shard.used_bytes -= tail.data->size();
+        shard.index.erase(tail.key);
+        shard.lru.pop_back();
+        ++evicted_;
+    }
+    shard.lru.push_front(Shard::Entry{key, std::move(data)});
+    shard.index.emplace(key, shard.lru.begin());
+    shard.used_bytes += size;
+    ++admitted_;
+}
+
+std::string BlockCache::stats_report() const {
+    std::size_t used = 0;
+    std::size_t entries = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        used += shard->used_bytes;
+        entries += shard->index.size();
+    }
+    const auto hits = hits_.load();
+    const auto lookups = hits + misses_.load();
+    std::ostringstream out;
+    out << "cache.capacity_bytes=" << capacity_bytes_ << "\n";
+    out << "cache.used_bytes=" << used << "\n";
+    out << "cache.blocks=" << entries << "\n";
+    out << "cache.hits=" << hits << "\n";
+    out << "cache.misses=" << misses_.load() << "\n";
+    out << "cache.hit_ratio=" << (lookups > 0 ? static_cast<double>(hits) / static_cast<double>(lookups) : 0.0)
+        << "\n";
+    out << "cache.admitted=" << admitted_.load() << "\n";
+    out << "cache.rejected=" << rejected_.load() << "\n";
+    out << "cache.evicted=" << evicted_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
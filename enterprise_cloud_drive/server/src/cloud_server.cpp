@@ -1,6 +1,9 @@
 #include "cloud_server.hpp"
 
 #include "auth_service.hpp"
+#include "compression.hpp"
+#include "crc32c.hpp"
+#include "fastcdc.hpp"
 #include "socket_utils.hpp"
 
 #include <arpa/inet.h>
@@ -9,22 +12,28 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <array>
 #include <chrono>
 #include <cstring>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string_view>
+#include <utility>
 
 namespace cloud::server {
 
 namespace {
 
 constexpr int kMaxEvents = 128;
+constexpr std::size_t kFrameHeadroom = 64 * 1024;
 
 int set_non_blocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -58,10 +67,70 @@ std::string normalize_relative(const std::filesystem::path& path) {
     return normalized.empty() ? std::string(".") : normalized.generic_string();
 }
 
+std::uint64_t header_number(const protocol::Message& message, const std::string& key, std::uint64_t fallback) {
+    const auto value = protocol::header_value(message, key);
+    return value.empty() ? fallback : std::stoull(std::string(value));
+}
+
+// Manifest body of a chunked FILE_UPLOAD_INIT: one "<chunk id> <length>" line per
+// content-defined chunk, in file order, covering exactly `total` bytes.
+std::optional<std::vector<ManifestChunk>> parse_manifest(const std::vector<std::byte>& body,
+                                                         std::uint64_t total,
+                                                         std::uint64_t max_chunk) {
+    std::vector<ManifestChunk> manifest;
+    std::istringstream stream(bytes_to_string(body));
+    std::string line;
+    std::uint64_t offset = 0;
+    while (std::getline(stream, line)) {
+        const auto space = line.find(' ');
+        if (space == std::string::npos) {
+            return std::nullopt;
+        }
+        ManifestChunk chunk;
+        chunk.chunk_id = line.substr(0, space);
+        chunk.offset = offset;
+        chunk.length = std::stoull(line.substr(space + 1));
+        if (!chunking::valid_chunk_id(chunk.chunk_id) || chunk.length == 0 || chunk.length > max_chunk) {
+            return std::nullopt;
+        }
+        offset += chunk.length;
+        manifest.push_back(std::move(chunk));
+    }
+    if (offset != total) {
+        return std::nullopt;
+    }
+    return manifest;
+}
+
+// Keeps the file an instant upload replaces linked under a hidden name until the commit
+// is decided. Returns an empty path if there is nothing to keep or it cannot be kept.
+std::filesystem::path keep_replaced(const std::filesystem::path& target, bool& kept) {
+    static std::atomic<std::uint64_t> sequence{0};
+    struct stat st {};
+    kept = false;
+    if (::lstat(target.c_str(), &st) != 0) {
+        return {};
+    }
+    auto backup = target.parent_path() / ("." + target.filename().string() + ".replaced-" +
+                                          std::to_string(::getpid()) + "-" + std::to_string(sequence++));
+    if (!S_ISREG(st.st_mode) || ::link(target.c_str(), backup.c_str()) != 0) {
+        return {};
+    }
+    kept = true;
+    return backup;
+}
+
+std::uint64_t thread_cpu_ns() {
+    timespec ts{};
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000ULL + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
 }  // namespace
 
 struct CloudServer::ConnectionContext {
     int fd;
+    std::uint64_t id = 0;
     std::string peer;
     std::vector<std::byte> inbound;
     std::size_t inbound_offset = 0;
@@ -70,12 +139,20 @@ struct CloudServer::ConnectionContext {
     std::string username;
     std::string token;
     std::filesystem::path cwd{"."};
+    uint16_t version = protocol::kMinVersion;
+    std::size_t max_chunk = 0;
+    bool hello = false;  // settings were negotiated; LOGIN no longer changes them
+    bool compression = false;
+    bool checksum = false;
 
-    bool upload_active = false;
-    UploadCheckpoint upload_checkpoint;
+    std::shared_ptr<UploadSession> upload;
     std::uint64_t upload_expected = 0;
+    QuotaReservation upload_quota;
     std::string upload_md5;
     std::filesystem::path upload_logical;
+    std::optional<DeltaPlan> upload_delta;
+
+    std::shared_ptr<DownloadSession> download;
 };
 
 CloudServer::CloudServer(ServerConfig config,
@@ -89,7 +166,22 @@ CloudServer::CloudServer(ServerConfig config,
       storage_manager_(storage_manager),
       file_index_(file_index),
       jwt_service_(jwt_service),
-      logger_(logger) {}
+      logger_(logger),
+      block_cache_(config_.block_cache_bytes),
+      listing_cache_(config_.listing_cache_bytes),
+      trash_(storage_manager,
+             file_index,
+             TrashOptions{std::chrono::seconds(config_.trash_retention_seconds), config_.trash_purge_rate,
+                          config_.trash_batch_rows}),
+      sweeper_(storage_manager,
+               SweepOptions{std::chrono::seconds(config_.resume_max_age_seconds),
+                            std::chrono::seconds(config_.resume_sweep_interval_seconds), config_.resume_sweep_rate}),
+      quota_(file_index,
+             QuotaOptions{config_.quota_bytes, config_.quota_files,
+                          std::chrono::seconds(config_.usage_reconcile_interval_seconds)}),
+      committer_(file_index,
+                 CommitOptions{config_.durable_commits, std::chrono::microseconds(config_.commit_window_us),
+                               config_.commit_max_batch}) {}
 
 CloudServer::~CloudServer() {
     stop();
@@ -138,7 +230,11 @@ void CloudServer::start() {
     notify_event.events = EPOLLIN;
     ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, notify_fd_, &notify_event);
 
-    task_executor_.start(config_.long_task_threads);
+    storage_manager_.start_io(config_.long_task_threads);
+    trash_.start();
+    sweeper_.start();
+    quota_.start();
+    committer_.start();
 
     running_ = true;
     reactor_thread_ = std::thread(&CloudServer::reactor_loop, this);
@@ -179,7 +275,12 @@ void CloudServer::stop() {
         notify_fd_ = -1;
     }
 
-    task_executor_.shutdown();
+    quota_.stop();
+    sweeper_.stop();
+    trash_.stop();
+    storage_manager_.stop_io();
+    committer_.stop();  // after the I/O threads, which may still be submitting commits
+    logger_.info("Server stats:\n" + stats_report());
 }
 
 void CloudServer::reactor_loop() {
@@ -201,9 +302,11 @@ void CloudServer::reactor_loop() {
                 continue;
             }
             if (event.data.fd == notify_fd_) {
-                drain_async_queue();
+                // Reset the eventfd before draining: a response queued after the swap
+                // must leave the counter set, or its wakeup would be lost.
                 uint64_t tmp;
                 ::read(notify_fd_, &tmp, sizeof(tmp));
+                drain_async_queue();
                 continue;
             }
             ready_queue_.emplace_back(event.data.fd, event.events);
@@ -245,7 +348,9 @@ void CloudServer::handle_accept() {
 
         auto ctx = std::make_unique<ConnectionContext>();
         ctx->fd = client_fd;
+        ctx->id = ++next_connection_id_;
         ctx->peer = peer.str();
+        ctx->max_chunk = config_.max_chunk_bytes;
         connections_.emplace(client_fd, std::move(ctx));
         logger_.info("Accepted connection from " + peer.str());
     }
@@ -282,25 +387,72 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
         }
 
         protocol::Message message;
-        while (protocol::try_decode(ctx.inbound, ctx.inbound_offset, message)) {
+        while (true) {
+            try {
+                if (!protocol::try_decode(ctx.inbound, ctx.inbound_offset, message, config_.max_frame_bytes)) {
+                    break;
+                }
+            } catch (const std::exception& ex) {
+                logger_.warn("Dropping " + ctx.peer + ": " + ex.what());
+                close_connection(fd);
+                return;
+            }
+            ctx.version = message.version;
             const auto cmd = protocol::header_value(message, "cmd");
             if (cmd.empty()) {
                 schedule_response(fd, protocol::make_message({{"cmd", "ERROR"}, {"reason", "MissingCommand"}}));
                 continue;
             }
             const std::string command(cmd);
+            const std::string rid(protocol::header_value(message, "rid"));
+            auto reply = [this, fd, &rid](protocol::Message response) {
+                if (!rid.empty()) {
+                    response.headers["rid"] = rid;
+                }
+                schedule_response(fd, std::move(response));
+            };
             try {
+                if (command == "HELLO") {
+                    const auto peer_version = header_number(message, "version", protocol::kMinVersion);
+                    const auto version = std::clamp<std::uint64_t>(peer_version, protocol::kMinVersion, protocol::kVersion);
+                    const auto max_frame =
+                        std::min<std::uint64_t>(header_number(message, "max_frame", config_.max_frame_bytes),
+                                                config_.max_frame_bytes);
+                    const auto frame_budget = max_frame > kFrameHeadroom ? max_frame - kFrameHeadroom : max_frame;
+                    ctx.max_chunk = static_cast<std::size_t>(std::min<std::uint64_t>(
+                        {header_number(message, "max_chunk", config_.max_chunk_bytes), config_.max_chunk_bytes,
+                         frame_budget}));
+                    const auto window = std::clamp<std::uint64_t>(header_number(message, "window", 1), 1,
+                                                                  std::max<std::size_t>(1, config_.pipeline_window));
+                    ctx.compression = config_.compression_enabled &&
+                                      compression::accepts_deflate(protocol::header_value(message, "compression"));
+                    ctx.checksum = protocol::list_contains(protocol::header_value(message, "checksum"), "crc32c");
+                    ctx.hello = true;
+
+                    protocol::Message resp;
+                    resp.headers.emplace("cmd", "HELLO");
+                    resp.headers.emplace("status", "ok");
+                    resp.headers.emplace("version", std::to_string(version));
+                    resp.headers.emplace("max_frame", std::to_string(max_frame));
+                    resp.headers.emplace("max_chunk", std::to_string(ctx.max_chunk));
+                    resp.headers.emplace("window", std::to_string(window));
+                    resp.headers.emplace("compression", ctx.compression ? std::string(compression::kDeflate) : "none");
+                    resp.headers.emplace("checksum", ctx.checksum ? "crc32c" : "none");
+                    resp.headers.emplace("features", "rid,cdc,delta");
+                    reply(std::move(resp));
+                    continue;
+                }
                 if (command == "REGISTER") {
                     auto username = protocol::header_value(message, "username");
                     auto password = protocol::header_value(message, "password");
-                    if (username.empty() || password.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "REGISTER"}, {"status", "invalid"}}));
+                    if (!AuthService::valid_username(username) || password.empty()) {
+                        reply(protocol::make_message({{"cmd", "REGISTER"}, {"status", "invalid"}}));
                         continue;
                     }
                     if (auth_service_.register_user(std::string(username), std::string(password))) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "REGISTER"}, {"status", "ok"}}));
+                        reply(protocol::make_message({{"cmd", "REGISTER"}, {"status", "ok"}}));
                     } else {
-                        schedule_response(fd, protocol::make_message({{"cmd", "REGISTER"}, {"status", "exists"}}));
+                        reply(protocol::make_message({{"cmd", "REGISTER"}, {"status", "exists"}}));
                     }
                     continue;
                 }
@@ -308,7 +460,7 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
                     auto username = protocol::header_value(message, "username");
                     auto password = protocol::header_value(message, "password");
                     if (username.empty() || password.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "LOGIN"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "LOGIN"}, {"status", "invalid"}}));
                         continue;
                     }
                     if (auth_service_.validate_user(std::string(username), std::string(password))) {
@@ -316,85 +468,142 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
                         ctx.username = username;
                         ctx.token = token;
                         ctx.cwd = ".";
-                        schedule_response(fd, protocol::make_message({{"cmd", "LOGIN"},
-                                                                      {"status", "ok"},
-                                                                      {"token", token},
-                                                                      {"home", "."}}));
+                        // accept_encoding is for clients that skip HELLO; it must not undo
+                        // what HELLO negotiated.
+                        if (!ctx.hello) {
+                            ctx.compression =
+                                config_.compression_enabled &&
+                                compression::accepts_deflate(protocol::header_value(message, "accept_encoding"));
+                        }
+                        auto resp = protocol::make_message({{"cmd", "LOGIN"},
+                                                            {"status", "ok"},
+                                                            {"token", token},
+                                                            {"home", "."}});
+                        if (ctx.compression) {
+                            resp.headers.emplace("compression", std::string(compression::kDeflate));
+                        }
+                        reply(std::move(resp));
                         logger_.info("User " + std::string(username) + " logged in from " + ctx.peer);
                     } else {
-                        schedule_response(fd, protocol::make_message({{"cmd", "LOGIN"}, {"status", "denied"}}));
+                        reply(protocol::make_message({{"cmd", "LOGIN"}, {"status", "denied"}}));
                     }
                     continue;
                 }
                 if (command == "TOKEN_AUTH") {
                     auto token = protocol::header_value(message, "token");
                     if (token.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "missing"}}));
+                        reply(protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "missing"}}));
                         continue;
                     }
                     auto claims = jwt_service_.verify(std::string(token));
                     if (!claims) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "invalid"}}));
                         continue;
                     }
                     ctx.username = claims->subject;
                     ctx.token = std::string(token);
-                    schedule_response(fd, protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "ok"}}));
+                    if (!ctx.hello) {
+                        ctx.compression = config_.compression_enabled &&
+                                          compression::accepts_deflate(protocol::header_value(message, "accept_encoding"));
+                    }
+                    auto resp = protocol::make_message({{"cmd", "TOKEN_AUTH"}, {"status", "ok"}});
+                    if (ctx.compression) {
+                        resp.headers.emplace("compression", std::string(compression::kDeflate));
+                    }
+                    reply(std::move(resp));
                     continue;
                 }
 
                 auto token = protocol::header_value(message, "token");
                 if (token.empty()) {
-                    schedule_response(fd, protocol::make_message({{"cmd", command}, {"status", "auth_required"}}));
+                    reply(protocol::make_message({{"cmd", command}, {"status", "auth_required"}}));
                     continue;
                 }
                 auto claims = jwt_service_.verify(std::string(token));
                 if (!claims) {
-                    schedule_response(fd, protocol::make_message({{"cmd", command}, {"status", "token_invalid"}}));
+                    reply(protocol::make_message({{"cmd", command}, {"status", "token_invalid"}}));
                     continue;
                 }
                 ctx.username = claims->subject;
                 ctx.token = std::string(token);
 
+                if (message.headers.count("encoding") != 0) {
+                    if (!ctx.compression) {
+                        reply(protocol::make_message({{"cmd", command},
+                                                      {"status", "unsupported_encoding"}}));
+                        continue;
+                    }
+                    inflate_request(message);
+                }
+
+                if (command == "SERVER_STATS") {
+                    protocol::Message resp;
+                    resp.headers.emplace("cmd", "SERVER_STATS");
+                    resp.headers.emplace("status", "ok");
+                    resp.body = to_bytes(stats_report());
+                    reply(std::move(resp));
+                    continue;
+                }
+                if (command == "TRASH_STATUS") {
+                    const auto body = trash_.status_report(ctx.username);
+                    protocol::Message resp;
+                    resp.headers.emplace("cmd", "TRASH_STATUS");
+                    resp.headers.emplace("status", "ok");
+                    resp.headers.emplace("pending", std::to_string(std::count(body.begin(), body.end(), '\n')));
+                    resp.body = to_bytes(body);
+                    reply(std::move(resp));
+                    continue;
+                }
+                if (command == "USAGE") {
+                    const auto usage = quota_.status(ctx.username);
+                    reply(protocol::make_message({{"cmd", "USAGE"},
+                                                  {"status", "ok"},
+                                                  {"bytes", std::to_string(usage.used.bytes)},
+                                                  {"files", std::to_string(usage.used.files)},
+                                                  {"pending_bytes", std::to_string(usage.pending.bytes)},
+                                                  {"quota_bytes", std::to_string(usage.max_bytes)},
+                                                  {"quota_files", std::to_string(usage.max_files)}}));
+                    continue;
+                }
                 if (command == "DIR_PWD") {
-                    schedule_response(fd, protocol::make_message(
-                                            {{"cmd", "DIR_PWD"}, {"status", "ok"}, {"path", ctx.cwd.generic_string()}}));
+                    reply(protocol::make_message(
+                            {{"cmd", "DIR_PWD"}, {"status", "ok"}, {"path", ctx.cwd.generic_string()}}));
                     continue;
                 }
                 if (command == "DIR_CHANGE") {
                     auto path = protocol::header_value(message, "path");
                     if (path.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", "invalid"}}));
                         continue;
                     }
                     try {
                         auto resolved = storage_manager_.resolve(ctx.username, ctx.cwd / std::string(path));
                         if (!std::filesystem::is_directory(resolved)) {
-                            schedule_response(fd, protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", "notfound"}}));
+                            reply(protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", "notfound"}}));
                             continue;
                         }
-                        ctx.cwd =
-                            std::filesystem::relative(resolved, storage_manager_.user_root(ctx.username)).lexically_normal();
+                        ctx.cwd = resolved.lexically_relative(storage_manager_.user_root(ctx.username));
                         if (ctx.cwd.empty()) {
                             ctx.cwd = ".";
                         }
-                        schedule_response(fd, protocol::make_message(
-                                                {{"cmd", "DIR_CHANGE"}, {"status", "ok"}, {"path", ctx.cwd.string()}}));
+                        reply(protocol::make_message(
+                                {{"cmd", "DIR_CHANGE"}, {"status", "ok"}, {"path", ctx.cwd.string()}}));
                     } catch (const std::exception& ex) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", ex.what()}}));
+                        reply(protocol::make_message({{"cmd", "DIR_CHANGE"}, {"status", ex.what()}}));
                     }
                     continue;
                 }
                 if (command == "DIR_MKDIR") {
                     auto path = protocol::header_value(message, "path");
                     if (path.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "invalid"}}));
                         continue;
                     }
                     if (storage_manager_.ensure_directory(ctx.username, ctx.cwd / std::string(path))) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "ok"}}));
+                        listing_cache_.invalidate(storage_manager_.resolve(ctx.username, ctx.cwd / std::string(path)));
+                        reply(protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "ok"}}));
                     } else {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "failed"}}));
+                        reply(protocol::make_message({{"cmd", "DIR_MKDIR"}, {"status", "failed"}}));
                     }
                     continue;
                 }
@@ -405,35 +614,197 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
                         target /= std::string(path);
                     }
                     try {
-                        auto entries = storage_manager_.list(ctx.username, target);
-                        std::ostringstream body;
-                        for (const auto& entry : entries) {
-                            body << entry.name << "|" << (entry.is_directory ? "dir" : "file") << "|" << entry.size << "|"
-                                 << entry.modified << "\n";
-                        }
+                        const auto listing = cached_listing(ctx.username, target);
                         protocol::Message resp;
                         resp.headers.emplace("cmd", "DIR_LIST");
                         resp.headers.emplace("status", "ok");
-                        resp.headers.emplace("count", std::to_string(entries.size()));
-                        resp.body = to_bytes(body.str());
-                        schedule_response(fd, std::move(resp));
+                        resp.headers.emplace("count", std::to_string(listing->count));
+                        if (ctx.compression && listing->deflated) {
+                            resp.headers.emplace("encoding", std::string(compression::kDeflate));
+                            resp.headers.emplace("raw_size", std::to_string(listing->body.size()));
+                            resp.body = *listing->deflated;
+                            compression_stats_.raw_out_bytes += listing->body.size();
+                            compression_stats_.wire_out_bytes += resp.body.size();
+                        } else {
+                            resp.body = listing->body;
+                        }
+                        reply(std::move(resp));
                     } catch (const std::exception& ex) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "DIR_LIST"}, {"status", ex.what()}}));
+                        reply(protocol::make_message({{"cmd", "DIR_LIST"}, {"status", ex.what()}}));
                     }
                     continue;
                 }
                 if (command == "FILE_DELETE") {
                     auto path = protocol::header_value(message, "path");
                     if (path.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "invalid"}}));
+                        continue;
+                    }
+                    // The tree is renamed into the trash and answered at once; its index
+                    // rows, files and blobs are purged in the background.
+                    const auto logical = normalize_relative(ctx.cwd / std::string(path));
+                    const auto absolute = storage_manager_.resolve(ctx.username, std::filesystem::path(logical));
+                    if (absolute == storage_manager_.user_root(ctx.username)) {
+                        reply(protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "invalid"}}));
                         continue;
                     }
-                    if (storage_manager_.remove(ctx.username, ctx.cwd / std::string(path))) {
-                        file_index_.remove(ctx.username, normalize_relative(ctx.cwd / std::string(path)));
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "ok"}}));
+                    if (trash_.move_to_trash(ctx.username, logical, absolute)) {
+                        listing_cache_.invalidate_tree(absolute);
+                        reply(protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "ok"}}));
                     } else {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "notfound"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_DELETE"}, {"status", "notfound"}}));
+                    }
+                    continue;
+                }
+                if (command == "FILE_MOVE" || command == "FILE_COPY") {
+                    auto path = protocol::header_value(message, "path");
+                    auto target = protocol::header_value(message, "target");
+                    if (path.empty() || target.empty()) {
+                        reply(protocol::make_message({{"cmd", command}, {"status", "invalid"}}));
+                        continue;
+                    }
+                    const auto from = normalize_relative(ctx.cwd / std::string(path));
+                    const auto to = normalize_relative(ctx.cwd / std::string(target));
+                    const auto source = storage_manager_.resolve(ctx.username, std::filesystem::path(from));
+                    const auto destination = storage_manager_.resolve(ctx.username, std::filesystem::path(to));
+                    const auto root = storage_manager_.user_root(ctx.username);
+                    if (source == root || destination == root || to == from || to.starts_with(from + "/")) {
+                        reply(protocol::make_message({{"cmd", command}, {"status", "invalid"}}));
+                        continue;
+                    }
+                    std::error_code ec;
+                    if (!std::filesystem::exists(std::filesystem::symlink_status(source, ec))) {
+                        reply(protocol::make_message({{"cmd", command}, {"status", "notfound"}}));
+                        continue;
+                    }
+                    if (std::filesystem::exists(std::filesystem::symlink_status(destination, ec))) {
+                        reply(protocol::make_message({{"cmd", command}, {"status", "exists"}}));
+                        continue;
+                    }
+                    auto respond = [this, fd, conn_id = ctx.id, rid, command, to](bool committed) {
+                        auto response = committed
+                                            ? protocol::make_message({{"cmd", command}, {"status", "ok"}, {"path", to}})
+                                            : protocol::make_message({{"cmd", command}, {"status", "io_error"}});
+                        if (!rid.empty()) {
+                            response.headers["rid"] = rid;
+                        }
+                        schedule_response(fd, std::move(response), conn_id);
+                    };
+
+                    if (command == "FILE_MOVE") {
+                        // One rename and one index update, however large the tree; both run
+                        // on the user's I/O queue, since the index update of a non-durable
+                        // commit is applied by the submitting thread.
+                        storage_manager_.submit_io(ctx.username, [this, username = ctx.username, from, to, source,
+                                                                  destination, fd, conn_id = ctx.id, rid, command,
+                                                                  respond = std::move(respond)]() mutable {
+                            std::error_code ec;
+                            std::filesystem::create_directories(destination.parent_path(), ec);
+                            if (!ec) {
+                                std::filesystem::rename(source, destination, ec);
+                            }
+                            if (ec) {
+                                auto response = protocol::make_message({{"cmd", command}, {"status", "failed"}});
+                                if (!rid.empty()) {
+                                    response.headers["rid"] = rid;
+                                }
+                                schedule_response(fd, std::move(response), conn_id);
+                                return;
+                            }
+                            listing_cache_.invalidate_tree(source);
+                            listing_cache_.invalidate(destination.parent_path());
+                            CommitRequest request;
+                            request.directories = {source.parent_path(), destination.parent_path()};
+                            request.apply = [this, username, from, to, source, destination] {
+                                file_index_.move_tree(username, from, to, source.string(), destination.string());
+                            };
+                            request.done = std::move(respond);
+                            committer_.submit(std::move(request));
+                        });
+                        continue;
+                    }
+
+                    // Indexed files are linked to their objects rather than copied, so the
+                    // copy adds directory entries and quota usage, not bytes on disk.
+                    QuotaReservation wanted;
+                    std::unordered_map<std::string, std::string> digests;
+                    for (const auto& file : file_index_.tree_files(ctx.username, from)) {
+                        wanted.bytes += file.size;
+                        ++wanted.files;
+                        digests.emplace(file.logical_path.size() > from.size() ? file.logical_path.substr(from.size() + 1)
+                                                                               : std::string(),
+                                        file.md5);
+                    }
+                    const auto reservation = quota_.reserve(ctx.username, wanted);
+                    if (!reservation) {
+                        reply(protocol::make_message({{"cmd", command}, {"status", "quota_exceeded"}}));
+                        continue;
+                    }
+                    storage_manager_.submit_io(ctx.username, [this, username = ctx.username, to, source, destination,
+                                                              digests = std::move(digests),
+                                                              reservation = *reservation,
+                                                              respond = std::move(respond)]() mutable {
+                        TreeCopy copy;
+                        try {
+                            copy = storage_manager_.copy_tree(username, source, destination, digests);
+                        } catch (const std::exception&) {
+                            quota_.release(username, reservation);
+                            respond(false);
+                            return;
+                        }
+                        listing_cache_.invalidate(destination.parent_path());
+                        listing_cache_.invalidate_tree(destination);
+                        CommitRequest request;
+                        request.files = std::move(copy.copied);
+                        request.directories = std::move(copy.directories);
+                        request.apply = [this, username, to, destination, files = std::move(copy.files)] {
+                            for (const auto& file : files) {
+                                const auto relative = file.target.lexically_relative(destination);
+                                const auto logical = relative == "." ? to : to + "/" + relative.generic_string();
+                                file_index_.upsert(
+                                    FileMetadata{username, logical, file.md5, file.target.string(), file.size});
+                            }
+                        };
+                        request.done = [this, username, reservation, respond = std::move(respond)](bool committed) {
+                            quota_.release(username, reservation);
+                            respond(committed);
+                        };
+                        committer_.submit(std::move(request));
+                    });
+                    continue;
+                }
+                if (command == "FILE_DELTA_SIGNATURE") {
+                    auto path = protocol::header_value(message, "path");
+                    if (path.empty()) {
+                        reply(protocol::make_message({{"cmd", "FILE_DELTA_SIGNATURE"}, {"status", "invalid"}}));
+                        continue;
+                    }
+                    // Signatures come from the stored object, so they describe exactly the
+                    // bytes a delta against `base` will be rebuilt from.
+                    const auto logical = normalize_relative(ctx.cwd / std::string(path));
+                    const auto meta = file_index_.find_by_path(ctx.username, logical);
+                    const auto object = meta ? storage_manager_.find_blob(ctx.username, meta->md5)
+                                             : std::filesystem::path();
+                    if (object.empty()) {
+                        reply(protocol::make_message({{"cmd", "FILE_DELTA_SIGNATURE"}, {"status", "notfound"}}));
+                        continue;
                     }
+                    const auto block =
+                        delta::block_size(meta->size, ctx.max_chunk ? ctx.max_chunk : config_.max_chunk_bytes);
+                    auto produce = [this, object, block, md5 = meta->md5, size = meta->size,
+                                    compress = ctx.compression]() {
+                        auto resp = protocol::make_message({{"cmd", "FILE_DELTA_SIGNATURE"},
+                                                            {"status", "ok"},
+                                                            {"base", md5},
+                                                            {"size", std::to_string(size)},
+                                                            {"block", std::to_string(block)}});
+                        resp.body = to_bytes(delta::encode_signatures(storage_manager_.block_signatures(object, block)));
+                        if (compress) {
+                            deflate_response(resp);
+                        }
+                        return resp;
+                    };
+                    complete_async(fd, ctx.id, ctx.username, rid, "FILE_DELTA_SIGNATURE", std::move(produce));
                     continue;
                 }
                 if (command == "FILE_UPLOAD_INIT") {
@@ -441,124 +812,384 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
                     auto md5 = protocol::header_value(message, "md5");
                     auto size = protocol::header_value(message, "size");
                     if (path.empty() || md5.empty() || size.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "invalid"}}));
                         continue;
                     }
                     const auto logical = normalize_relative(ctx.cwd / std::string(path));
                     const auto absolute = storage_manager_.resolve(ctx.username, std::filesystem::path(logical));
+                    const auto total = static_cast<std::uint64_t>(std::stoull(std::string(size)));
+
+                    // Usage only grows by what the upload adds over the file it replaces.
+                    drop_upload(ctx);
+                    const auto replaced = file_index_.find_by_path(ctx.username, logical);
+                    const auto reservation =
+                        quota_.reserve(ctx.username, total,
+                                       replaced ? std::optional<std::uint64_t>(replaced->size) : std::nullopt);
+                    if (!reservation) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "quota_exceeded"}}));
+                        continue;
+                    }
+
+                    // Instant upload links the content-addressed object into place; files
+                    // stored before the object store existed are adopted on first reuse.
+                    // Content held on another device is not copied over here: that would be a
+                    // full copy on the reactor thread, so it is simply uploaded again.
+                    auto& device = storage_manager_.device_for(ctx.username);
+                    auto& blobs = device.blobs();
+                    const std::string digest(md5);
+                    auto instant = BlobStore::valid_digest(digest) ? file_index_.find_by_md5(digest) : std::nullopt;
+                    if (instant && !blobs.contains(digest) && device.same_filesystem(instant->storage_path)) {
+                        blobs.ingest(instant->storage_path, digest);
+                    }
+                    // Only a hardlink is made here; anything else falls back to a normal
+                    // upload. The replaced file is kept until the commit is decided, so a
+                    // failed commit leaves the old content in place.
+                    bool kept = false;
+                    std::filesystem::path backup;
+                    if (instant && blobs.contains(digest)) {
+                        backup = keep_replaced(absolute, kept);
+                        if (!kept && std::filesystem::exists(std::filesystem::symlink_status(absolute))) {
+                            instant.reset();
+                        }
+                    }
+                    if (instant && !blobs.materialize(digest, absolute)) {
+                        if (kept) {
+                            ::unlink(backup.c_str());
+                        }
+                        instant.reset();
+                    }
+                    if (instant) {
+                        listing_cache_.invalidate(absolute.parent_path());
+                        CommitRequest request;
+                        request.directories = {absolute.parent_path()};
+                        auto replaced = std::make_shared<std::optional<std::string>>();
+                        request.apply = [this, replaced, metadata = FileMetadata{ctx.username, logical, digest,
+                                                                                 absolute.string(), instant->size}] {
+                            *replaced = file_index_.upsert(metadata);
+                        };
+                        request.done = [this, fd, conn_id = ctx.id, rid, username = ctx.username,
+                                        reservation = *reservation, logical, replaced, absolute,
+                                        backup](bool committed) {
+                            if (committed) {
+                                if (!backup.empty()) {
+                                    ::unlink(backup.c_str());
+                                }
+                            } else if (!backup.empty()) {
+                                ::rename(backup.c_str(), absolute.c_str());
+                            } else {
+                                ::unlink(absolute.c_str());
+                            }
+                            listing_cache_.invalidate(absolute.parent_path());
+                            if (committed && *replaced) {
+                                storage_manager_.release_replaced(username, **replaced);
+                            }
+                            auto response = committed ? protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
+                                                                                {"status", "instant"},
+                                                                                {"path", logical}})
+                                                      : protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
+                                                                                {"status", "io_error"}});
+                            if (!rid.empty()) {
+                                response.headers["rid"] = rid;
+                            }
+                            quota_.release(username, reservation);
+                            schedule_response(fd, std::move(response), conn_id);
+                        };
+                        committer_.submit(std::move(request));
+                        continue;
+                    }
+
+                    ctx.upload_quota = *reservation;
 
-                    auto instant = file_index_.find_by_md5(std::string(md5));
-                    if (instant && std::filesystem::exists(instant->storage_path)) {
-                        std::filesystem::create_directories(absolute.parent_path());
-                        std::filesystem::copy_file(instant->storage_path, absolute,
-                                                   std::filesystem::copy_options::overwrite_existing);
-                        file_index_.upsert(FileMetadata{ctx.username, logical, std::string(md5),
-                                                        absolute.string(), instant->size});
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
-                                                                      {"status", "instant"},
-                                                                      {"path", logical}}));
+                    // Delta upload: the body maps the new file onto a base version the server
+                    // holds, and only the literal bytes between matched blocks are uploaded.
+                    // A base that has gone since the client fetched its signatures is `stale`,
+                    // and the client falls back to a full upload.
+                    if (protocol::header_value(message, "delta") == delta::kRsync) {
+                        const std::string base_md5(protocol::header_value(message, "base"));
+                        const auto base = BlobStore::valid_digest(base_md5)
+                                              ? storage_manager_.find_blob(ctx.username, base_md5)
+                                              : std::filesystem::path();
+                        auto segments = base.empty() ? std::nullopt
+                                                     : delta::parse_segments(bytes_to_string(message.body), total,
+                                                                             storage_manager_.file_size(base));
+                        if (!segments) {
+                            drop_upload(ctx);
+                            reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "stale"}}));
+                            continue;
+                        }
+                        auto checkpoint = storage_manager_.prepare_upload(ctx.username, digest + "." + base_md5,
+                                                                          std::filesystem::path(logical),
+                                                                          delta::literal_bytes(*segments));
+                        checkpoint.rebuild_bytes = total;
+                        if (!storage_manager_.has_space_for(checkpoint) ||
+                            !(ctx.upload = storage_manager_.open_upload(checkpoint))) {
+                            drop_upload(ctx);
+                            reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "no_space"}}));
+                            continue;
+                        }
+                        ctx.upload_expected = checkpoint.total;
+                        ctx.upload_md5 = digest;
+                        ctx.upload_logical = std::filesystem::path(logical);
+                        ctx.upload_delta = DeltaPlan{base, std::move(*segments)};
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
+                                                      {"status", "ready"},
+                                                      {"delta", std::string(delta::kRsync)},
+                                                      {"offset", std::to_string(checkpoint.received)}}));
                         continue;
                     }
 
                     auto checkpoint =
                         storage_manager_.prepare_upload(ctx.username, std::string(md5), std::filesystem::path(logical),
-                                                        static_cast<std::uint64_t>(std::stoull(std::string(size))));
-                    ctx.upload_active = true;
-                    ctx.upload_checkpoint = checkpoint;
+                                                        total);
+                    if (!storage_manager_.has_space_for(checkpoint) ||
+                        !(ctx.upload = storage_manager_.open_upload(checkpoint))) {
+                        drop_upload(ctx);
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "no_space"}}));
+                        continue;
+                    }
                     ctx.upload_expected = checkpoint.total;
                     ctx.upload_md5 = std::string(md5);
                     ctx.upload_logical = std::filesystem::path(logical);
 
-                    schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
-                                                                  {"status", "ready"},
-                                                                  {"offset", std::to_string(checkpoint.received)}}));
+                    auto ready = protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"},
+                                                         {"status", "ready"},
+                                                         {"offset", std::to_string(checkpoint.received)}});
+                    // Chunked upload: chunks already referenced by some blob are copied
+                    // into the part on the I/O queue, and the reply lists the indices the
+                    // client must still send. The session answers `busy` until then.
+                    if (protocol::header_value(message, "chunking") == chunking::kFastCdc) {
+                        auto manifest = parse_manifest(message.body, checkpoint.total, config_.max_chunk_bytes);
+                        if (!manifest) {
+                            drop_upload(ctx);
+                            reply(protocol::make_message({{"cmd", "FILE_UPLOAD_INIT"}, {"status", "invalid"}}));
+                            continue;
+                        }
+                        ctx.upload->begin_preparing();
+                        auto produce = [this, session = ctx.upload, manifest = std::move(*manifest),
+                                        username = ctx.username, ready = std::move(ready),
+                                        compression = ctx.compression]() mutable {
+                            try {
+                                std::unordered_map<std::string, std::uint64_t> blob_sizes;
+                                for (auto& chunk : manifest) {
+                                    auto ref = file_index_.find_chunk(chunk.chunk_id);
+                                    if (!ref || ref->length != chunk.length) {
+                                        continue;
+                                    }
+                                    const auto object = storage_manager_.find_blob(username, ref->md5);
+                                    auto [it, inserted] = blob_sizes.try_emplace(ref->md5, 0);
+                                    if (inserted) {
+                                        it->second = storage_manager_.file_size(object);
+                                    }
+                                    if (ref->offset + ref->length <= it->second) {
+                                        chunk.source = object;
+                                        chunk.source_offset = ref->offset;
+                                    } else {
+                                        file_index_.remove_chunk(chunk.chunk_id);
+                                    }
+                                }
+                                session->set_manifest(std::move(manifest));
+                                session->place_known();
+                            } catch (...) {
+                                session->end_preparing();
+                                throw;
+                            }
+                            std::string missing;
+                            std::size_t missing_count = 0;
+                            const auto& placed = session->manifest();
+                            for (std::size_t i = 0; i < placed.size(); ++i) {
+                                if (placed[i].source.empty()) {
+                                    missing += std::to_string(i) + "\n";
+                                    ++missing_count;
+                                }
+                            }
+                            session->end_preparing();
+                            ready.headers.emplace("chunking", std::string(chunking::kFastCdc));
+                            ready.headers.emplace("missing", std::to_string(missing_count));
+                            ready.body = to_bytes(missing);
+                            if (compression) {
+                                deflate_response(ready);
+                            }
+                            return std::move(ready);
+                        };
+                        complete_async(fd, ctx.id, ctx.username, rid, "FILE_UPLOAD_INIT", std::move(produce));
+                        continue;
+                    }
+                    reply(std::move(ready));
                     continue;
                 }
                 if (command == "FILE_UPLOAD_CHUNK") {
-                    if (!ctx.upload_active) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "no_session"}}));
+                    if (!ctx.upload) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "no_session"}}));
+                        continue;
+                    }
+                    if (ctx.upload->preparing()) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "busy"}}));
                         continue;
                     }
                     auto offset = protocol::header_value(message, "offset");
                     if (offset.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "invalid"}}));
                         continue;
                     }
                     const std::uint64_t off = std::stoull(std::string(offset));
-                    if (off != ctx.upload_checkpoint.received) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "offset"}}));
+                    ctx.upload->fill_known(off);
+                    if (off != ctx.upload->received()) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"},
+                                                      {"status", "offset"},
+                                                      {"received", std::to_string(ctx.upload->received())}}));
+                        continue;
+                    }
+                    if (message.body.size() > (ctx.max_chunk ? ctx.max_chunk : config_.max_chunk_bytes)) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"},
+                                                      {"status", "too_large"},
+                                                      {"received", std::to_string(ctx.upload->received())}}));
+                        continue;
+                    }
+                    if (!integrity::verify_crc32c(message.body, protocol::header_value(message, "crc32c"))) {
+                        ++rejected_chunks_;
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"},
+                                                      {"status", "checksum_mismatch"},
+                                                      {"received", std::to_string(off)}}));
                         continue;
                     }
-                    if (!storage_manager_.write_chunk(ctx.upload_checkpoint, off, message.body)) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "io_error"}}));
+                    if (!ctx.upload->write(off, message.body)) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"}, {"status", "io_error"}}));
                         continue;
                     }
-                    ctx.upload_checkpoint.received += message.body.size();
-                    storage_manager_.update_progress(ctx.upload_checkpoint, ctx.upload_checkpoint.received);
-                    schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"},
-                                                                  {"status", "ok"},
-                                                                  {"received", std::to_string(ctx.upload_checkpoint.received)}}));
+                    reply(protocol::make_message({{"cmd", "FILE_UPLOAD_CHUNK"},
+                                                  {"status", "ok"},
+                                                  {"received", std::to_string(ctx.upload->received())}}));
                     continue;
                 }
                 if (command == "FILE_UPLOAD_COMMIT") {
-                    if (!ctx.upload_active || ctx.upload_checkpoint.received != ctx.upload_expected) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_UPLOAD_COMMIT"},
-                                                                      {"status", "incomplete"}}));
+                    if (ctx.upload && ctx.upload->preparing()) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_COMMIT"}, {"status", "busy"}}));
                         continue;
                     }
-                    ctx.upload_active = false;
-                    auto checkpoint = ctx.upload_checkpoint;
+                    if (ctx.upload) {
+                        ctx.upload->fill_known(ctx.upload_expected);
+                    }
+                    if (!ctx.upload || ctx.upload->received() != ctx.upload_expected) {
+                        reply(protocol::make_message({{"cmd", "FILE_UPLOAD_COMMIT"},
+                                                      {"status", "incomplete"}}));
+                        continue;
+                    }
+                    // A durable commit syncs the part with the rest of its batch instead.
+                    ctx.upload->close(!committer_.durable());
+                    auto checkpoint = ctx.upload->checkpoint();
+                    auto streamed_md5 = ctx.upload->finish_digest();
+                    auto manifest = ctx.upload->manifest();
+                    auto delta = std::exchange(ctx.upload_delta, std::nullopt);
+                    ctx.upload.reset();
+                    auto reservation = std::exchange(ctx.upload_quota, QuotaReservation{});
                     auto md5 = ctx.upload_md5;
                     auto logical = ctx.upload_logical;
                     auto username = ctx.username;
                     auto fd_copy = fd;
+                    auto conn_id = ctx.id;
 
-                    task_executor_.submit([this, checkpoint, md5, logical, username, fd_copy]() {
+                    storage_manager_.submit_io(username, [this, checkpoint, md5, streamed_md5,
+                                                          manifest = std::move(manifest), delta = std::move(delta),
+                                                          logical, username, fd_copy, conn_id, rid, reservation]() {
                         protocol::Message response;
                         response.headers.emplace("cmd", "FILE_UPLOAD_COMMIT");
+                        if (!rid.empty()) {
+                            response.headers.emplace("rid", rid);
+                        }
                         try {
-                            auto final_path = storage_manager_.finalize_upload(checkpoint);
-                            auto actual_md5 = storage_manager_.compute_md5(final_path);
+                            // A delta upload's part holds only literals: the file is rebuilt here,
+                            // off the reactor, and hashed as it is written.
+                            std::string actual_md5;
+                            auto final_path = delta ? storage_manager_.finalize_delta(checkpoint, *delta, actual_md5)
+                                                    : storage_manager_.finalize_upload(checkpoint);
+                            listing_cache_.invalidate(final_path.parent_path());
+                            if (!delta) {
+                                actual_md5 =
+                                    streamed_md5.empty() ? storage_manager_.compute_md5(final_path) : streamed_md5;
+                            }
                             if (actual_md5 != md5) {
                                 storage_manager_.discard_checkpoint(checkpoint);
                                 response.headers.emplace("status", "md5_mismatch");
                             } else {
-                                file_index_.upsert(FileMetadata{username, logical, actual_md5,
-                                                                final_path.string(),
-                                                                checkpoint.total});
-                                response.headers.emplace("status", "ok");
-                                response.headers.emplace("path", logical.string());
+                                // The object is a hardlink of the final file, so syncing one
+                                // covers the data of both; each new name needs its directory.
+                                CommitRequest request;
+                                request.files = {final_path};
+                                request.directories = {final_path.parent_path(), checkpoint.temp_path.parent_path()};
+                                request.directories.insert(request.directories.end(),
+                                                           checkpoint.new_directories.begin(),
+                                                           checkpoint.new_directories.end());
+                                auto& blobs = storage_manager_.device_for(username).blobs();
+                                if (blobs.ingest(final_path, actual_md5)) {
+                                    request.directories.push_back(blobs.object_path(actual_md5).parent_path());
+                                }
+                                const auto size = delta ? storage_manager_.file_size(final_path) : checkpoint.total;
+                                auto replaced = std::make_shared<std::optional<std::string>>();
+                                request.apply = [this, replaced,
+                                                 refs = verified_chunks(manifest, final_path, actual_md5),
+                                                 metadata = FileMetadata{username, logical, actual_md5,
+                                                                         final_path.string(), size}] {
+                                    file_index_.add_chunks(refs);
+                                    *replaced = file_index_.upsert(metadata);
+                                };
+                                request.done = [this, response, username, actual_md5, logical, reservation, fd_copy,
+                                                conn_id, replaced](bool committed) mutable {
+                                    if (committed && *replaced) {
+                                        storage_manager_.release_replaced(username, **replaced);
+                                    }
+                                    if (committed) {
+                                        storage_manager_.schedule_erasure(username, actual_md5);
+                                        storage_manager_.schedule_packing(username, actual_md5);
+                                        response.headers.emplace("status", "ok");
+                                        response.headers.emplace("path", logical.string());
+                                    } else {
+                                        response.headers.emplace("status", "io_error");
+                                    }
+                                    quota_.release(username, reservation);
+                                    schedule_response(fd_copy, std::move(response), conn_id);
+                                };
+                                committer_.submit(std::move(request));
+                                return;
                             }
                         } catch (const std::exception& ex) {
                             response.headers.emplace("status", ex.what());
                         }
-                        schedule_response(fd_copy, std::move(response));
+                        quota_.release(username, reservation);
+                        schedule_response(fd_copy, std::move(response), conn_id);
                     });
                     continue;
                 }
                 if (command == "FILE_DOWNLOAD_INIT") {
                     auto path = protocol::header_value(message, "path");
                     if (path.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DOWNLOAD_INIT"},
-                                                                      {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_DOWNLOAD_INIT"},
+                                                      {"status", "invalid"}}));
                         continue;
                     }
                     auto logical = normalize_relative(ctx.cwd / std::string(path));
-                    const auto absolute = storage_manager_.resolve(ctx.username, std::filesystem::path(logical));
-                    if (!std::filesystem::exists(absolute)) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DOWNLOAD_INIT"},
-                                                                      {"status", "notfound"}}));
+                    struct stat st {};
+                    if (!storage_manager_.stat_file(ctx.username, logical, st) || !S_ISREG(st.st_mode)) {
+                        reply(protocol::make_message({{"cmd", "FILE_DOWNLOAD_INIT"},
+                                                      {"status", "notfound"}}));
                         continue;
                     }
                     auto meta = file_index_.find_by_path(ctx.username, logical);
-                    std::string md5 = meta ? meta->md5 : storage_manager_.compute_md5(absolute);
-                    protocol::Message resp;
-                    resp.headers.emplace("cmd", "FILE_DOWNLOAD_INIT");
-                    resp.headers.emplace("status", "ok");
-                    resp.headers.emplace("size", std::to_string(storage_manager_.file_size(absolute)));
-                    resp.headers.emplace("md5", md5);
-                    resp.headers.emplace("path", logical);
-                    schedule_response(fd, std::move(resp));
+                    auto produce = [this, username = ctx.username, size = static_cast<std::uint64_t>(st.st_size), logical,
+                                    known_md5 = meta ? meta->md5 : std::string()]() {
+                        protocol::Message resp;
+                        resp.headers.emplace("cmd", "FILE_DOWNLOAD_INIT");
+                        resp.headers.emplace("status", "ok");
+                        resp.headers.emplace("size", std::to_string(size));
+                        resp.headers.emplace("md5", known_md5.empty() ? storage_manager_.compute_md5(username, logical)
+                                                                      : known_md5);
+                        resp.headers.emplace("path", logical);
+                        return resp;
+                    };
+                    if (rid.empty() || meta) {
+                        reply(produce());
+                    } else {
+                        complete_async(fd, ctx.id, ctx.username, rid, "FILE_DOWNLOAD_INIT", std::move(produce));
+                    }
                     continue;
                 }
                 if (command == "FILE_DOWNLOAD_FETCH") {
@@ -566,36 +1197,68 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
                     auto offset = protocol::header_value(message, "offset");
                     auto length = protocol::header_value(message, "length");
                     if (path.empty() || offset.empty() || length.empty()) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DOWNLOAD_FETCH"},
-                                                                      {"status", "invalid"}}));
+                        reply(protocol::make_message({{"cmd", "FILE_DOWNLOAD_FETCH"},
+                                                      {"status", "invalid"}}));
                         continue;
                     }
                     auto logical = normalize_relative(ctx.cwd / std::string(path));
-                    const auto absolute = storage_manager_.resolve(ctx.username, std::filesystem::path(logical));
-                    if (!std::filesystem::exists(absolute)) {
-                        schedule_response(fd, protocol::make_message({{"cmd", "FILE_DOWNLOAD_FETCH"},
-                                                                      {"status", "notfound"}}));
+                    struct stat st {};
+                    if (!storage_manager_.stat_file(ctx.username, logical, st)) {
+                        reply(protocol::make_message({{"cmd", "FILE_DOWNLOAD_FETCH"},
+                                                      {"status", "notfound"}}));
                         continue;
                     }
+                    // One open session per connection keeps the fd and the access-pattern
+                    // history across fetches of the same file version. The session is keyed
+                    // on the logical path; the O_PATH stat above catches a replaced file.
+                    if (!ctx.download || ctx.download->path() != logical || !ctx.download->same_file(st)) {
+                        try {
+                            ctx.download = storage_manager_.open_download(ctx.username, logical);
+                        } catch (const std::exception&) {
+                            ctx.download.reset();
+                        }
+                        if (!ctx.download) {
+                            reply(protocol::make_message({{"cmd", "FILE_DOWNLOAD_FETCH"},
+                                                          {"status", "notfound"}}));
+                            continue;
+                        }
+                    }
                     const auto requested = static_cast<std::size_t>(std::stoul(std::string(length)));
-                    const auto chunk_size = std::min<std::size_t>(requested, config_.max_chunk_bytes);
-                    auto chunk = storage_manager_.read_chunk(absolute,
-                                                             std::stoull(std::string(offset)),
-                                                             chunk_size);
-                    protocol::Message resp;
-                    resp.headers.emplace("cmd", "FILE_DOWNLOAD_FETCH");
-                    resp.headers.emplace("status", chunk.empty() ? "done" : "ok");
-                    resp.headers.emplace("chunk", std::to_string(chunk.size()));
-                    resp.body = std::move(chunk);
-                    schedule_response(fd, std::move(resp));
+                    const auto chunk_size = std::min<std::size_t>(requested, ctx.max_chunk);
+                    const auto fetch_offset = static_cast<std::uint64_t>(std::stoull(std::string(offset)));
+                    const bool with_crc = ctx.checksum || protocol::header_value(message, "checksum") == "crc32c";
+                    const bool compress = ctx.compression;
+                    auto produce = [this, session = ctx.download, fetch_offset, chunk_size, with_crc, compress]() {
+                        auto chunk = read_cached(*session, fetch_offset, chunk_size);
+                        protocol::Message resp;
+                        resp.headers.emplace("cmd", "FILE_DOWNLOAD_FETCH");
+                        resp.headers.emplace("status", chunk.empty() ? "done" : "ok");
+                        resp.headers.emplace("chunk", std::to_string(chunk.size()));
+                        resp.headers.emplace("offset", std::to_string(fetch_offset));
+                        if (with_crc) {
+                            resp.headers.emplace("crc32c", integrity::crc32c_hex(chunk));
+                        }
+                        resp.body = std::move(chunk);
+                        if (compress) {
+                            deflate_response(resp);
+                        }
+                        return resp;
+                    };
+                    // Requests tagged with a rid may complete out of order, so the disk read
+                    // moves off the reactor; untagged requests keep strict FIFO replies.
+                    if (rid.empty()) {
+                        reply(produce());
+                    } else {
+                        complete_async(fd, ctx.id, ctx.username, rid, "FILE_DOWNLOAD_FETCH", std::move(produce));
+                    }
                     continue;
                 }
 
-                schedule_response(fd, protocol::make_message({{"cmd", command}, {"status", "unknown"}}));
+                reply(protocol::make_message({{"cmd", command}, {"status", "unknown"}}));
             } catch (const std::exception& ex) {
-                schedule_response(fd, protocol::make_message({{"cmd", std::string(cmd)},
-                                                              {"status", "error"},
-                                                              {"reason", ex.what()}}));
+                reply(protocol::make_message({{"cmd", std::string(cmd)},
+                                              {"status", "error"},
+                                              {"reason", ex.what()}}));
             }
         }
     }
@@ -621,9 +1284,9 @@ void CloudServer::handle_fd_event(int fd, uint32_t events) {
     }
 }
 
-void CloudServer::schedule_response(int fd, protocol::Message message) {
+void CloudServer::schedule_response(int fd, protocol::Message message, std::uint64_t connection_id) {
     std::lock_guard<std::mutex> lock(async_mutex_);
-    async_responses_.push_back(PendingResponse{fd, std::move(message)});
+    async_responses_.push_back(PendingResponse{fd, connection_id, std::move(message)});
     uint64_t value = 1;
     ::write(notify_fd_, &value, sizeof(value));
 }
@@ -639,6 +1302,11 @@ void CloudServer::drain_async_queue() {
         if (it == connections_.end()) {
             continue;
         }
+        if (resp.connection_id != 0 && it->second->id != resp.connection_id) {
+            // The fd was closed and reused by another client before the task finished.
+            continue;
+        }
+        resp.message.version = it->second->version;
         auto encoded = protocol::encode(resp.message);
         auto& buffer = it->second->outbound;
         buffer.insert(buffer.end(), encoded.begin(), encoded.end());
@@ -650,10 +1318,207 @@ void CloudServer::drain_async_queue() {
     }
 }
 
+void CloudServer::complete_async(int fd,
+                                 std::uint64_t connection_id,
+                                 const std::string& username,
+                                 std::string rid,
+                                 std::string command,
+                                 std::function<protocol::Message()> produce) {
+    storage_manager_.submit_io(username, [this, fd, connection_id, rid = std::move(rid), command = std::move(command),
+                                          produce = std::move(produce)]() {
+        protocol::Message response;
+        try {
+            response = produce();
+        } catch (const std::exception& ex) {
+            response = protocol::make_message({{"cmd", command}, {"status", "error"}, {"reason", ex.what()}});
+        }
+        response.headers["rid"] = rid;
+        schedule_response(fd, std::move(response), connection_id);
+    });
+}
+
+// Returns the encoded DIR_LIST body for a directory, from the listing cache when it is
+// still valid. The deflated form is computed once here rather than per reply.
+std::shared_ptr<const Listing> CloudServer::cached_listing(const std::string& username,
+                                                           const std::filesystem::path& relative) {
+    const auto dir = storage_manager_.resolve(username, relative);
+    if (auto cached = listing_cache_.lookup(dir)) {
+        return cached;
+    }
+    listing_cache_.begin(dir);
+    auto listing = std::make_shared<Listing>();
+    std::vector<DirEntry> entries;
+    try {
+        entries = storage_manager_.list(username, relative);
+    } catch (...) {
+        listing_cache_.abandon(dir);
+        throw;
+    }
+    std::ostringstream body;
+    std::vector<std::pair<std::string, std::uint64_t>> subdirs;
+    for (const auto& entry : entries) {
+        body << entry.name << "|" << (entry.is_directory ? "dir" : "file") << "|" << entry.size << "|" << entry.modified
+             << "\n";
+        if (entry.is_directory) {
+            subdirs.emplace_back(entry.name, entry.modified);
+        }
+    }
+    listing->count = entries.size();
+    listing->body = to_bytes(body.str());
+    if (config_.compression_enabled && compression::looks_compressible(listing->body)) {
+        const auto started = thread_cpu_ns();
+        listing->deflated = compression::deflate_bytes(listing->body);
+        compression_stats_.cpu_ns += thread_cpu_ns() - started;
+    }
+    listing_cache_.store(dir, listing, subdirs);
+    return listing;
+}
+
+// Serves a download range through the block cache. Missing blocks are read from disk
+// in one contiguous request and offered to the cache block by block.
+std::vector<std::byte> CloudServer::read_cached(DownloadSession& session, std::uint64_t offset, std::size_t length) {
+    if (!block_cache_.enabled()) {
+        return session.read(offset, length);
+    }
+    const auto& st = session.status();
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+    if (offset >= size || length == 0) {
+        return {};
+    }
+    const auto end = std::min<std::uint64_t>(size, offset + length);
+    const auto block_bytes = static_cast<std::uint64_t>(BlockCache::kBlockBytes);
+    const auto first = offset / block_bytes;
+    const auto last = (end - 1) / block_bytes;
+
+    BlockKey key{static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino), size,
+                 static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1'000'000'000ULL +
+                     static_cast<std::uint64_t>(st.st_mtim.tv_nsec),
+                 0};
+    std::vector<BlockData> blocks(last - first + 1);
+    std::optional<std::uint64_t> lo;
+    std::uint64_t hi = 0;
+    for (auto block = first; block <= last; ++block) {
+        key.block = block;
+        blocks[block - first] = block_cache_.lookup(key);
+        if (!blocks[block - first]) {
+            lo = lo.value_or(block);
+            hi = block;
+        }
+    }
+    if (lo) {
+        const auto read_start = *lo * block_bytes;
+        const auto read_end = std::min(size, (hi + 1) * block_bytes);
+        const auto data = session.read(read_start, static_cast<std::size_t>(read_end - read_start));
+        if (data.size() != read_end - read_start) {
+            return session.read(offset, length);
+        }
+        for (auto block = *lo; block <= hi; ++block) {
+            const auto from = (block - *lo) * block_bytes;
+            const auto to = std::min<std::uint64_t>(data.size(), from + block_bytes);
+            auto fresh = std::make_shared<const std::vector<std::byte>>(data.begin() + static_cast<std::ptrdiff_t>(from),
+                                                                        data.begin() + static_cast<std::ptrdiff_t>(to));
+            if (!blocks[block - first]) {
+                key.block = block;
+                block_cache_.insert(key, fresh);
+            }
+            blocks[block - first] = std::move(fresh);
+        }
+    }
+
+    std::vector<std::byte> out;
+    out.reserve(static_cast<std::size_t>(end - offset));
+    for (auto block = first; block <= last; ++block) {
+        const auto& data = *blocks[block - first];
+        const auto block_start = block * block_bytes;
+        const auto from = std::max(offset, block_start) - block_start;
+        const auto to = std::min<std::uint64_t>(end, block_start + data.size()) - block_start;
+        out.insert(out.end(), data.begin() + static_cast<std::ptrdiff_t>(from),
+                   data.begin() + static_cast<std::ptrdiff_t>(to));
+    }
+    return out;
+}
+
+// Maps every chunk of a committed upload to a range of its blob, for the index. Chunks
+// the client sent are re-fingerprinted first, so a forged manifest cannot poison it.
+std::vector<ChunkRef> CloudServer::verified_chunks(const std::vector<ManifestChunk>& manifest,
+                                                   const std::filesystem::path& final_path,
+                                                   const std::string& md5) {
+    std::vector<ChunkRef> refs;
+    refs.reserve(manifest.size());
+    for (const auto& chunk : manifest) {
+        if (chunk.source.empty()) {
+            const auto data = storage_manager_.read_chunk(final_path, chunk.offset, chunk.length);
+            if (chunking::chunk_id(data) != chunk.chunk_id) {
+                continue;
+            }
+        }
+        refs.push_back(ChunkRef{chunk.chunk_id, md5, chunk.offset, chunk.length});
+    }
+    return refs;
+}
+
+void CloudServer::inflate_request(protocol::Message& message) {
+    const auto wire = message.body.size();
+    const auto started = thread_cpu_ns();
+    compression::decompress_message(message);
+    compression_stats_.cpu_ns += thread_cpu_ns() - started;
+    compression_stats_.wire_in_bytes += wire;
+    compression_stats_.raw_in_bytes += message.body.size();
+}
+
+void CloudServer::deflate_response(protocol::Message& message) {
+    const auto raw = message.body.size();
+    const auto started = thread_cpu_ns();
+    const bool packed = compression::compress_message(message);
+    compression_stats_.cpu_ns += thread_cpu_ns() - started;
+    compression_stats_.raw_out_bytes += raw;
+    compression_stats_.wire_out_bytes += message.body.size();
+    if (!packed) {
+        ++compression_stats_.skipped_frames;
+    }
+}
+
+std::string CloudServer::stats_report() const {
+    const auto raw = compression_stats_.raw_in_bytes.load() + compression_stats_.raw_out_bytes.load();
+    const auto wire = compression_stats_.wire_in_bytes.load() + compression_stats_.wire_out_bytes.load();
+    const auto cpu_ns = compression_stats_.cpu_ns.load();
+    const double gib = static_cast<double>(raw) / (1024.0 * 1024.0 * 1024.0);
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "compression.raw_bytes=" << raw << "\n";
+    out << "compression.wire_bytes=" << wire << "\n";
+    out << "compression.saved_bytes=" << (raw > wire ? raw - wire : 0) << "\n";
+    out << "compression.ratio=" << (wire > 0 ? static_cast<double>(raw) / static_cast<double>(wire) : 1.0) << "\n";
+    out << "compression.skipped_frames=" << compression_stats_.skipped_frames.load() << "\n";
+    out << "compression.cpu_ms=" << static_cast<double>(cpu_ns) / 1e6 << "\n";
+    out << "compression.cpu_ms_per_gib=" << (gib > 0 ? static_cast<double>(cpu_ns) / 1e6 / gib : 0.0) << "\n";
+    out << "integrity.rejected_chunks=" << rejected_chunks_.load() << "\n";
+    out << block_cache_.stats_report();
+    out << listing_cache_.stats_report();
+    out << trash_.stats_report();
+    out << sweeper_.stats_report();
+    out << quota_.stats_report();
+    out << committer_.stats_report();
+    out << storage_manager_.io_report();
+    return out.str();
+}
+
 void CloudServer::close_connection(int fd) {
     ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
     ::close(fd);
-    connections_.erase(fd);
+    if (auto it = connections_.find(fd); it != connections_.end()) {
+        drop_upload(*it->second);
+        connections_.erase(it);
+    }
+}
+
+// Abandons the connection's upload session (its part stays for a resume) and frees
+// the quota it held.
+void CloudServer::drop_upload(ConnectionContext& ctx) {
+    ctx.upload.reset();
+    ctx.upload_delta.reset();
+    quota_.release(ctx.username, std::exchange(ctx.upload_quota, QuotaReservation{}));
 }
 
 }  // namespace cloud::server
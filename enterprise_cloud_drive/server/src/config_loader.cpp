@@ -1,5 +1,6 @@
 #include "config_loader.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -18,6 +19,10 @@ std::string trim(const std::string& value) {
     return value.substr(first, last - first + 1);
 }
 
+bool parse_bool(const std::string& value) {
+    return value == "1" || value == "true" || value == "on" || value == "yes";
+}
+
 }
 
 ServerConfig load_config(const std::string& path) {
@@ -50,6 +55,24 @@ ServerConfig load_config(const std::string& path) {
             config.max_clients = static_cast<std::size_t>(std::stoul(value));
         } else if (key == "storage_root") {
             config.storage_root = value;
+        } else if (key == "storage_devices") {
+            config.storage_devices = value;
+        } else if (key == "erasure_data_shards") {
+            config.erasure_data_shards = static_cast<unsigned>(std::stoul(value));
+        } else if (key == "erasure_parity_shards") {
+            config.erasure_parity_shards = static_cast<unsigned>(std::stoul(value));
+        } else if (key == "erasure_min_bytes") {
+            config.erasure_min_bytes = std::stoull(value);
+        } else if (key == "erasure_cell_bytes") {
+            config.erasure_cell_bytes = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "pack_max_file_bytes") {
+            config.pack_max_file_bytes = std::stoull(value);
+        } else if (key == "pack_segment_bytes") {
+            config.pack_segment_bytes = std::stoull(value);
+        } else if (key == "pack_compact_ratio") {
+            config.pack_compact_ratio = std::stod(value);
+        } else if (key == "pack_compact_interval_seconds") {
+            config.pack_compact_interval_seconds = static_cast<uint32_t>(std::max(1UL, std::stoul(value)));
         } else if (key == "thread_pool_size") {
             config.thread_pool_size = static_cast<std::size_t>(std::stoul(value));
         } else if (key == "database_file") {
@@ -66,6 +89,56 @@ ServerConfig load_config(const std::string& path) {
             config.max_chunk_bytes = static_cast<std::size_t>(std::stoul(value));
         } else if (key == "long_task_threads") {
             config.long_task_threads = static_cast<std::size_t>(std::stoul(value));
+        } else if (key == "max_frame_bytes") {
+            config.max_frame_bytes = static_cast<std::size_t>(std::stoul(value));
+        } else if (key == "pipeline_window") {
+            config.pipeline_window = static_cast<std::size_t>(std::stoul(value));
+        } else if (key == "compression") {
+            config.compression_enabled = parse_bool(value);
+        } else if (key == "resume_sync_bytes") {
+            config.resume_sync_bytes = std::stoull(value);
+        } else if (key == "block_cache_bytes") {
+            config.block_cache_bytes = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "direct_io_threshold") {
+            config.direct_io_threshold = std::stoull(value);
+        } else if (key == "direct_io_buffer_bytes") {
+            config.direct_io_buffer_bytes = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "direct_io_max_buffers") {
+            config.direct_io_max_buffers = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "preallocate_uploads") {
+            config.preallocate_uploads = parse_bool(value);
+        } else if (key == "preallocate_min_bytes") {
+            config.preallocate_min_bytes = std::stoull(value);
+        } else if (key == "disk_reserve_bytes") {
+            config.disk_reserve_bytes = std::stoull(value);
+        } else if (key == "listing_cache_bytes") {
+            config.listing_cache_bytes = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "trash_retention_seconds") {
+            config.trash_retention_seconds = static_cast<uint32_t>(std::stoul(value));
+        } else if (key == "trash_purge_rate") {
+            config.trash_purge_rate = std::stod(value);
+        } else if (key == "trash_batch_rows") {
+            config.trash_batch_rows = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "resume_max_age_seconds") {
+            config.resume_max_age_seconds = static_cast<uint32_t>(std::stoul(value));
+        } else if (key == "resume_sweep_interval_seconds") {
+            config.resume_sweep_interval_seconds = static_cast<uint32_t>(std::max(1UL, std::stoul(value)));
+        } else if (key == "resume_sweep_rate") {
+            config.resume_sweep_rate = std::stod(value);
+        } else if (key == "quota_bytes") {
+            config.quota_bytes = std::stoull(value);
+        } else if (key == "quota_files") {
+            config.quota_files = std::stoull(value);
+        } else if (key == "usage_reconcile_interval_seconds") {
+            config.usage_reconcile_interval_seconds = static_cast<uint32_t>(std::stoul(value));
+        } else if (key == "durable_commits") {
+            config.durable_commits = parse_bool(value);
+        } else if (key == "commit_window_us") {
+            config.commit_window_us = static_cast<uint32_t>(std::stoul(value));
+        } else if (key == "commit_max_batch") {
+            config.commit_max_batch = static_cast<std::size_t>(std::stoull(value));
+        } else if (key == "resume_sync_interval_ms") {
+            config.resume_sync_interval_ms = static_cast<uint32_t>(std::stoul(value));
         }
     }
 
@@ -0,0 +1,568 @@
+#include "erasure_store.hpp"
+
+#include "file_io.hpp"
+#include "hash_ring.hpp"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr std::size_t kShardHeaderBytes = 4096;  // keeps cell reads page aligned
+constexpr char kShardMagic[4] = {'C', 'D', 'E', 'S'};
+constexpr std::size_t kShardCacheEntries = 256;
+
+struct ShardHeader {
+    char magic[4];
+    std::uint8_t version;
+    std::uint8_t data_shards;
+    std::uint8_t parity_shards;
+    std::uint8_t index;
+    std::uint32_t cell_bytes;
+    std::uint64_t size;
+    char md5[32];
+};
+
+std::filesystem::path shard_dir(const StorageDevice& device, const std::string& md5) {
+    return device.root() / ".shards" / md5.substr(0, 2);
+}
+
+std::filesystem::path shard_path(const StorageDevice& device, const std::string& md5, unsigned index) {
+    return shard_dir(device, md5) / (md5 + "." + std::to_string(index));
+}
+
+}  // namespace
+
+struct ErasureStore::ShardSet {
+    unsigned data_shards = 0;
+    unsigned parity_shards = 0;
+    std::size_t cell_bytes = 0;
+    std::uint64_t size = 0;
+    std::vector<int> fds;
+
+    ~ShardSet() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+};
+
+ErasureStore::ErasureStore(const std::vector<std::unique_ptr<StorageDevice>>& devices, ErasureOptions options)
+    : devices_(devices), options_(options) {
+    options_.cell_bytes = std::max<std::size_t>(options_.cell_bytes / 4096 * 4096, 4096);
+}
+
+ErasureStore::~ErasureStore() {
+    stop();
+}
+
+void ErasureStore::start() {
+    if (!enabled() || worker_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    fetcher_.start(options_.data_shards + options_.parity_shards);
+    {
+        std::lock_guard<std::mutex> lock(fetch_mutex_);
+        fetching_ = true;
+    }
+    worker_ = std::thread(&ErasureStore::worker_loop, this);
+}
+
+void ErasureStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(fetch_mutex_);
+        fetching_ = false;
+    }
+    fetcher_.shutdown();
+}
+
+void ErasureStore::enqueue(StorageDevice& device, const std::string& md5) {
+    if (!enabled() || !BlobStore::valid_digest(md5)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(Job{&device, md5});
+    }
+    cv_.notify_one();
+}
+
+void ErasureStore::worker_loop() {
+    scan_objects();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (queue_.empty()) {
+            if (deferred_.empty()) {
+                cv_.wait(lock);
+            } else if (cv_.wait_for(lock, std::chrono::seconds(1)) == std::cv_status::timeout) {
+                queue_.insert(queue_.end(), deferred_.begin(), deferred_.end());
+                deferred_.clear();
+            }
+            continue;
+        }
+        auto job = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+        bool busy = false;
+        encode(*job.device, job.md5, busy);
+        lock.lock();
+        if (busy) {
+            deferred_.push_back(std::move(job));
+        }
+    }
+}
+
+// Objects committed while the worker was not running (or before encoding was turned
+// on) are picked up at startup.
+void ErasureStore::scan_objects() {
+    for (const auto& device : devices_) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(device->root() / ".objects", ec)) {
+            std::error_code status_ec;
+            if (!entry.is_regular_file(status_ec) || entry.file_size(status_ec) < options_.min_bytes) {
+                continue;
+            }
+            const auto name = entry.path().filename().string();
+            if (BlobStore::valid_digest(name) && !BlobStore::stub_digest(entry.path())) {
+                enqueue(*device, name);
+            }
+        }
+    }
+}
+
+// Rendezvous hashing: each object ranks the writable devices by hash(md5, device) and
+// puts shard i on the i-th, so shards spread evenly and placement needs no table.
+std::vector<StorageDevice*> ErasureStore::shard_devices(const std::string& md5) const {
+    std::vector<std::pair<std::uint64_t, StorageDevice*>> ranked;
+    for (const auto& device : devices_) {
+        if (device->state() == DeviceState::active) {
+            ranked.emplace_back(HashRing::hash(md5 + "|" + device->root().string()), device.get());
+        }
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    std::vector<StorageDevice*> order;
+    for (const auto& [score, device] : ranked) {
+        order.push_back(device);
+    }
+    return order;
+}
+
+const ReedSolomon& ErasureStore::coder(unsigned data_shards, unsigned parity_shards) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto& slot = coders_[{data_shards, parity_shards}];
+    if (!slot) {
+        slot = std::make_unique<ReedSolomon>(data_shards, parity_shards);
+    }
+    return *slot;
+}
+
+// Writes every shard under a temporary name, syncs and renames them, and only then
+// turns the object into a stub; a crash at any point leaves either the plain object
+// or a stub with complete shards.
+bool ErasureStore::encode(StorageDevice& device, const std::string& md5, bool& busy) {
+    const auto object = device.blobs().object_path(md5);
+    const int fd = ::open(object.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || BlobStore::stub_digest(fd) || BlobStore::packed_digest(fd) ||
+        static_cast<std::uint64_t>(st.st_size) < options_.min_bytes) {
+        ::close(fd);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex_);
+        if (readers_.count({st.st_dev, st.st_ino}) != 0) {
+            busy = true;
+            ::close(fd);
+            return false;
+        }
+    }
+
+    const unsigned k = options_.data_shards;
+    const unsigned m = options_.parity_shards;
+    const auto targets = shard_devices(md5);
+    if (targets.size() < k + m) {
+        ++skipped_;
+        ::close(fd);
+        return false;
+    }
+    const auto& rs = coder(k, m);
+    const auto cell = options_.cell_bytes;
+    const auto size = static_cast<std::uint64_t>(st.st_size);
+    const auto stripe = static_cast<std::uint64_t>(k) * cell;
+    const auto stripes = (size + stripe - 1) / stripe;
+
+    std::vector<int> outs(k + m, -1);
+    std::vector<std::filesystem::path> temps(k + m);
+    auto abandon = [&] {
+        for (unsigned i = 0; i < k + m; ++i) {
+            if (outs[i] >= 0) {
+                ::close(outs[i]);
+            }
+            if (!temps[i].empty()) {
+                ::unlink(temps[i].c_str());
+            }
+        }
+        ::close(fd);
+        return false;
+    };
+
+    std::vector<std::byte> header(kShardHeaderBytes);
+    for (unsigned i = 0; i < k + m; ++i) {
+        const auto final_path = shard_path(*targets[i], md5, i);
+        std::error_code ec;
+        std::filesystem::create_directories(final_path.parent_path(), ec);
+        temps[i] = final_path.string() + ".tmp";
+        outs[i] = ::open(temps[i].c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+        ShardHeader meta{};
+        std::memcpy(meta.magic, kShardMagic, sizeof(meta.magic));
+        meta.version = 1;
+        meta.data_shards = static_cast<std::uint8_t>(k);
+        meta.parity_shards = static_cast<std::uint8_t>(m);
+        meta.index = static_cast<std::uint8_t>(i);
+        meta.cell_bytes = static_cast<std::uint32_t>(cell);
+        meta.size = size;
+        std::memcpy(meta.md5, md5.data(), sizeof(meta.md5));
+        std::memcpy(header.data(), &meta, sizeof(meta));
+        if (outs[i] < 0 || !write_full(outs[i], header.data(), header.size(), 0)) {
+            return abandon();
+        }
+    }
+
+    std::vector<std::byte> buffer((k + m) * cell);
+    std::vector<const std::byte*> data(k);
+    std::vector<std::byte*> parity(m);
+    for (unsigned j = 0; j < k; ++j) {
+        data[j] = buffer.data() + j * cell;
+    }
+    for (unsigned i = 0; i < m; ++i) {
+        parity[i] = buffer.data() + (k + i) * cell;
+    }
+    for (std::uint64_t s = 0; s < stripes; ++s) {
+        const auto start = s * stripe;
+        const auto want = static_cast<std::size_t>(std::min(stripe, size - start));
+        std::fill(buffer.begin() + static_cast<std::ptrdiff_t>(want), buffer.begin() + static_cast<std::ptrdiff_t>(stripe),
+                  std::byte{0});
+        if (!read_full(fd, buffer.data(), want, start)) {
+            return abandon();
+        }
+        rs.encode(data, parity, cell);
+        for (unsigned i = 0; i < k + m; ++i) {
+            if (!write_full(outs[i], buffer.data() + i * cell, cell, kShardHeaderBytes + s * cell)) {
+                return abandon();
+            }
+        }
+    }
+    for (unsigned i = 0; i < k + m; ++i) {
+        if (::fdatasync(outs[i]) != 0) {
+            return abandon();
+        }
+    }
+    for (unsigned i = 0; i < k + m; ++i) {
+        ::close(outs[i]);
+        outs[i] = -1;
+        ::rename(temps[i].c_str(), shard_path(*targets[i], md5, i).c_str());
+        temps[i].clear();
+    }
+    // The renames (and any shard directory created above) must be durable before the
+    // object's own data is punched out.
+    for (unsigned i = 0; i < k + m; ++i) {
+        const auto dir = shard_dir(*targets[i], md5);
+        if (!sync_directory(dir) || !sync_directory(dir.parent_path()) ||
+            !sync_directory(targets[i]->root())) {
+            ++skipped_;
+            ::close(fd);
+            return false;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> cache(cache_mutex_);
+        shard_cache_.erase(md5);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex_);
+        if (readers_.count({st.st_dev, st.st_ino}) != 0) {
+            busy = true;
+            ::close(fd);
+            return false;
+        }
+        if (::fsetxattr(fd, BlobStore::kStubXattr, md5.data(), md5.size(), 0) != 0) {
+            ++skipped_;
+            ::close(fd);
+            drop(md5);
+            return false;
+        }
+        if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) != 0) {
+            ::fremovexattr(fd, BlobStore::kStubXattr);
+            ++skipped_;
+            ::close(fd);
+            drop(md5);
+            return false;
+        }
+        // Punching bumps mtime; the content is unchanged, so put it back.
+        const struct timespec times[2] = {{0, UTIME_OMIT}, st.st_mtim};
+        ::futimens(fd, times);
+    }
+    ::close(fd);
+    ++encoded_objects_;
+    encoded_bytes_ += size;
+    shard_bytes_ += (k + m) * stripes * cell;
+    return true;
+}
+
+std::optional<std::string> ErasureStore::open_reader(int fd, const struct stat& st) {
+    std::lock_guard<std::mutex> lock(readers_mutex_);
+    ++readers_[{st.st_dev, st.st_ino}];
+    return BlobStore::stub_digest(fd);
+}
+
+void ErasureStore::close_reader(const struct stat& st) {
+    std::lock_guard<std::mutex> lock(readers_mutex_);
+    auto it = readers_.find({st.st_dev, st.st_ino});
+    if (it != readers_.end() && --it->second == 0) {
+        readers_.erase(it);
+    }
+}
+
+std::shared_ptr<ErasureStore::ShardSet> ErasureStore::open_shards(const std::string& md5) {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        if (auto it = shard_cache_.find(md5); it != shard_cache_.end()) {
+            return it->second;
+        }
+    }
+    auto set = std::make_shared<ShardSet>();
+    const auto prefix = md5 + ".";
+    for (const auto& device : devices_) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(shard_dir(*device, md5), ec)) {
+            const auto name = entry.path().filename().string();
+            if (name.compare(0, prefix.size(), prefix) != 0 || name.find(".tmp") != std::string::npos) {
+                continue;
+            }
+            const int fd = ::open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+            ShardHeader meta{};
+            if (fd < 0) {
+                continue;
+            }
+            if (!read_full(fd, reinterpret_cast<std::byte*>(&meta), sizeof(meta), 0) ||
+                std::memcmp(meta.magic, kShardMagic, sizeof(meta.magic)) != 0 ||
+                std::memcmp(meta.md5, md5.data(), sizeof(meta.md5)) != 0 ||
+                (set->data_shards != 0 && (meta.data_shards != set->data_shards ||
+                                           meta.parity_shards != set->parity_shards))) {
+                ::close(fd);
+                continue;
+            }
+            if (set->data_shards == 0) {
+                set->data_shards = meta.data_shards;
+                set->parity_shards = meta.parity_shards;
+                set->cell_bytes = meta.cell_bytes;
+                set->size = meta.size;
+                set->fds.assign(meta.data_shards + meta.parity_shards, -1);
+            }
+            if (meta.index >= set->fds.size() || set->fds[meta.index] >= 0) {
+                ::close(fd);
+                continue;
+            }
+            set->fds[meta.index] = fd;
+        }
+    }
+    if (set->data_shards == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (shard_cache_.size() >= kShardCacheEntries) {
+        shard_cache_.clear();
+    }
+    shard_cache_[md5] = set;
+    return set;
+}
+
+// Each shard holds the cells of consecutive stripes back to back, so the cells of a
+// range are one pread per shard; those run in parallel on the fetch pool (inline when
+// it is not running). Data shards are fetched first, parity only if one of them fails.
+std::vector<std::byte> ErasureStore::read(const std::string& md5, std::uint64_t offset, std::size_t length) {
+    ++reads_;
+    const auto set = open_shards(md5);
+    if (!set) {
+        ++failed_reads_;
+        throw std::runtime_error("Erasure-coded object unavailable");
+    }
+    if (offset >= set->size) {
+        return {};
+    }
+    const auto end = std::min<std::uint64_t>(offset + length, set->size);
+    const unsigned k = set->data_shards;
+    const unsigned total = k + set->parity_shards;
+    const auto cell = set->cell_bytes;
+    const auto stripe = static_cast<std::uint64_t>(k) * cell;
+    const auto first_stripe = offset / stripe;
+    const auto stripes = static_cast<std::size_t>((end - 1) / stripe - first_stripe + 1);
+    const auto span = stripes * cell;
+    const auto shard_offset = kShardHeaderBytes + first_stripe * cell;
+
+    std::vector<std::vector<std::byte>> cells(total);
+    std::vector<bool> present(total, false);
+    auto read_cells = [&](unsigned i) {
+        cells[i].resize(span);
+        return set->fds[i] >= 0 && read_full(set->fds[i], cells[i].data(), span, shard_offset);
+    };
+    auto fetch = [&](const std::vector<unsigned>& indices) {
+        std::vector<std::future<bool>> pending;
+        std::unique_lock<std::mutex> lock(fetch_mutex_);
+        if (fetching_) {
+            for (std::size_t n = 1; n < indices.size(); ++n) {
+                auto task = std::make_shared<std::packaged_task<bool()>>([&read_cells, i = indices[n]] {
+                    return read_cells(i);
+                });
+                pending.push_back(task->get_future());
+                fetcher_.submit([task] { (*task)(); });
+            }
+        }
+        lock.unlock();
+        for (std::size_t n = pending.size() + 1; n < indices.size(); ++n) {
+            present[indices[n]] = read_cells(indices[n]);
+        }
+        if (!indices.empty()) {
+            present[indices.front()] = read_cells(indices.front());
+        }
+        for (std::size_t n = 0; n < pending.size(); ++n) {
+            try {
+                present[indices[n + 1]] = pending[n].get();
+            } catch (const std::future_error&) {
+                present[indices[n + 1]] = false;
+            }
+        }
+    };
+
+    std::vector<unsigned> wanted;
+    unsigned first_cell = 0;
+    unsigned last_cell = k - 1;
+    if (stripes == 1) {
+        first_cell = static_cast<unsigned>((offset - first_stripe * stripe) / cell);
+        last_cell = static_cast<unsigned>((end - 1 - first_stripe * stripe) / cell);
+    }
+    for (unsigned j = first_cell; j <= last_cell; ++j) {
+        wanted.push_back(j);
+    }
+    fetch(wanted);
+
+    const bool degraded = std::any_of(wanted.begin(), wanted.end(), [&](unsigned j) { return !present[j]; });
+    if (degraded) {
+        ++degraded_reads_;
+        std::vector<unsigned> rest;
+        for (unsigned i = 0; i < total; ++i) {
+            if (std::find(wanted.begin(), wanted.end(), i) == wanted.end()) {
+                rest.push_back(i);
+            }
+        }
+        fetch(rest);
+        const auto& rs = coder(k, set->parity_shards);
+        std::vector<std::byte*> shards(total);
+        for (std::size_t t = 0; t < stripes; ++t) {
+            for (unsigned i = 0; i < total; ++i) {
+                cells[i].resize(span);
+                shards[i] = cells[i].data() + t * cell;
+            }
+            if (!rs.reconstruct(shards, present, cell)) {
+                ++failed_reads_;
+                throw std::runtime_error("Too many erasure-coded shards lost");
+            }
+        }
+    }
+
+    std::vector<std::byte> out(static_cast<std::size_t>(end - offset));
+    for (auto position = offset; position < end;) {
+        const auto s = position / stripe;
+        const auto within = position - s * stripe;
+        const auto j = static_cast<unsigned>(within / cell);
+        const auto in_cell = static_cast<std::size_t>(within % cell);
+        const auto take = static_cast<std::size_t>(std::min<std::uint64_t>(cell - in_cell, end - position));
+        std::memcpy(out.data() + (position - offset), cells[j].data() + (s - first_stripe) * cell + in_cell, take);
+        position += take;
+    }
+    return out;
+}
+
+void ErasureStore::drop(const std::string& md5) {
+    for (const auto& device : devices_) {
+        if (device->state() != DeviceState::failed && device->blobs().contains(md5)) {
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        shard_cache_.erase(md5);
+    }
+    const auto prefix = md5 + ".";
+    for (const auto& device : devices_) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        std::error_code ec;
+        std::vector<std::filesystem::path> doomed;
+        for (const auto& entry : std::filesystem::directory_iterator(shard_dir(*device, md5), ec)) {
+            if (entry.path().filename().string().compare(0, prefix.size(), prefix) == 0) {
+                doomed.push_back(entry.path());
+            }
+        }
+        for (const auto& path : doomed) {
+            std::filesystem::remove(path, ec);
+        }
+    }
+}
+
+std::string ErasureStore::stats_report() const {
+    std::size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending = queue_.size() + deferred_.size();
+    }
+    std::ostringstream out;
+    out << "erasure.data_shards=" << options_.data_shards << "\n";
+    out << "erasure.parity_shards=" << options_.parity_shards << "\n";
+    out << "erasure.kernel=" << ReedSolomon::kernel_name() << "\n";
+    out << "erasure.pending=" << pending << "\n";
+    out << "erasure.encoded_objects=" << encoded_objects_.load() << "\n";
+    out << "erasure.encoded_bytes=" << encoded_bytes_.load() << "\n";
+    out << "erasure.shard_bytes=" << shard_bytes_.load() << "\n";
+    out << "erasure.skipped=" << skipped_.load() << "\n";
+    out << "erasure.reads=" << reads_.load() << "\n";
+    out << "erasure.degraded_reads=" << degraded_reads_.load() << "\n";
+    out << "erasure.failed_reads=" << failed_reads_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
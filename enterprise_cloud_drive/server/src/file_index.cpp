@@ -1,13 +1,35 @@
 #include "file_index.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <stdexcept>
+#include <thread>
 
 #include <sqlite3.h>
 
 namespace cloud::server {
 
-FileIndex::FileIndex(const std::string& database_path) {
+namespace {
+
+// SQL condition that holds for a user_files row `row` outside every tree waiting in
+// the trash (other than `except_trash`); only such rows count towards usage.
+std::string visible_row(const std::string& row, const std::string& except_trash = {}) {
+    return "NOT EXISTS (SELECT 1 FROM trash t WHERE t.owner=" + row + ".owner AND " + row +
+           ".id<=t.max_file_id AND (" + row + ".logical_path=t.logical_path OR substr(" + row +
+           ".logical_path, 1, length(t.logical_path) + 1)=t.logical_path || '/')" +
+           (except_trash.empty() ? "" : " AND t.id<>" + except_trash + ".id") + ")";
+}
+
+// Rows of the tree of trash entry `entry` still in the index.
+std::string tree_rows(const std::string& entry) {
+    return "f.owner=" + entry + ".owner AND f.id<=" + entry + ".max_file_id AND (f.logical_path=" + entry +
+           ".logical_path OR substr(f.logical_path, 1, length(" + entry + ".logical_path) + 1)=" + entry +
+           ".logical_path || '/')";
+}
+
+}  // namespace
+
+FileIndex::FileIndex(const std::string& database_path) : path_(database_path) {
     const auto parent = std::filesystem::path(database_path).parent_path();
     if (!parent.empty()) {
         std::filesystem::create_directories(parent);
@@ -15,16 +37,51 @@ FileIndex::FileIndex(const std::string& database_path) {
     if (sqlite3_open(database_path.c_str(), &db_) != SQLITE_OK) {
         throw std::runtime_error("Failed to open metadata database");
     }
+    // WAL lets the reader connection query while a transaction is open or syncing.
+    sqlite3_exec(db_, "PRAGMA journal_mode=WAL", nullptr, nullptr, nullptr);
+    sqlite3_busy_timeout(db_, 5000);
+    // REPLACE has to fire the delete trigger that keeps usage totals in step.
+    sqlite3_exec(db_, "PRAGMA recursive_triggers=ON", nullptr, nullptr, nullptr);
+    if (sqlite3_open_v2(database_path.c_str(), &reader_, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        sqlite3_close(reader_);
+        sqlite3_close(db_);
+        throw std::runtime_error("Failed to open metadata database");
+    }
+    sqlite3_busy_timeout(reader_, 5000);
 }
 
 FileIndex::~FileIndex() {
-    if (db_) {
-        sqlite3_close(db_);
-        db_ = nullptr;
+    sqlite3_close(reader_);
+    sqlite3_close(db_);
+}
+
+FileIndex::Connection::Connection(FileIndex& index, bool write)
+    : index_(index), write_(write || index.writer_thread_.load() == std::this_thread::get_id()) {
+    if (write_) {
+        index_.write_mutex_.lock();
+        if (index_.write_depth_++ == 0) {
+            index_.writer_thread_ = std::this_thread::get_id();
+        }
+        db_ = index_.db_;
+    } else {
+        index_.read_mutex_.lock();
+        db_ = index_.reader_;
+    }
+}
+
+FileIndex::Connection::~Connection() {
+    if (write_) {
+        if (--index_.write_depth_ == 0) {
+            index_.writer_thread_ = std::thread::id();
+        }
+        index_.write_mutex_.unlock();
+    } else {
+        index_.read_mutex_.unlock();
     }
 }
 
 void FileIndex::initialize_schema() {
+    const Connection db(*this, true);
     const char* ddl = R"SQL(
         CREATE TABLE IF NOT EXISTS user_files (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -37,24 +94,134 @@ void FileIndex::initialize_schema() {
             UNIQUE(owner, logical_path)
         );
         CREATE INDEX IF NOT EXISTS idx_user_files_md5 ON user_files(md5);
+        CREATE TABLE IF NOT EXISTS chunk_refs (
+            chunk_id TEXT PRIMARY KEY,
+            md5 TEXT NOT NULL,
+            offset INTEGER NOT NULL,
+            length INTEGER NOT NULL
+        );
+        CREATE TABLE IF NOT EXISTS segments (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            device TEXT NOT NULL,
+            live_bytes INTEGER NOT NULL DEFAULT 0,
+            sealed INTEGER NOT NULL DEFAULT 0
+        );
+        CREATE TABLE IF NOT EXISTS packed_blobs (
+            md5 TEXT PRIMARY KEY,
+            segment INTEGER NOT NULL,
+            offset INTEGER NOT NULL,
+            length INTEGER NOT NULL
+        );
+        CREATE INDEX IF NOT EXISTS idx_packed_blobs_segment ON packed_blobs(segment);
+        CREATE TRIGGER IF NOT EXISTS packed_blobs_insert AFTER INSERT ON packed_blobs BEGIN
+            UPDATE segments SET live_bytes=live_bytes+NEW.length WHERE id=NEW.segment;
+        END;
+        CREATE TRIGGER IF NOT EXISTS packed_blobs_delete AFTER DELETE ON packed_blobs BEGIN
+            UPDATE segments SET live_bytes=live_bytes-OLD.length WHERE id=OLD.segment;
+        END;
+        CREATE TRIGGER IF NOT EXISTS packed_blobs_move AFTER UPDATE OF segment ON packed_blobs BEGIN
+            UPDATE segments SET live_bytes=live_bytes-OLD.length WHERE id=OLD.segment;
+            UPDATE segments SET live_bytes=live_bytes+NEW.length WHERE id=NEW.segment;
+        END;
+        CREATE TABLE IF NOT EXISTS trash (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            owner TEXT NOT NULL,
+            logical_path TEXT NOT NULL,
+            trash_path TEXT NOT NULL,
+            max_file_id INTEGER NOT NULL,
+            deleted_at INTEGER NOT NULL
+        );
+        CREATE TABLE IF NOT EXISTS trash_blobs (
+            trash_id INTEGER NOT NULL,
+            md5 TEXT NOT NULL
+        );
+        CREATE INDEX IF NOT EXISTS idx_trash_blobs_entry ON trash_blobs(trash_id);
     )SQL";
 
     char* err = nullptr;
-    if (sqlite3_exec(db_, ddl, nullptr, nullptr, &err) != SQLITE_OK) {
+    if (sqlite3_exec(db, ddl, nullptr, nullptr, &err) != SQLITE_OK) {
         std::string msg = err ? err : "unknown error";
         sqlite3_free(err);
         throw std::runtime_error("Failed to initialize file index: " + msg);
     }
+    initialize_usage();
+}
+
+// Per-owner totals are kept by triggers, so every path that adds or drops rows
+// (upsert, trash, purge) updates them in the same statement. Rows of a trashed tree
+// stop counting when the trash entry is added; purging them later changes nothing.
+void FileIndex::initialize_usage() {
+    const Connection db(*this, true);
+    bool existed = false;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type='table' AND name='user_usage'", -1, &stmt,
+                           nullptr) == SQLITE_OK) {
+        existed = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+
+    const auto tree_total = [](const std::string& entry, const std::string& column, bool exclude_entry) {
+        return "(SELECT " + column + " FROM user_files f WHERE " + tree_rows(entry) + " AND " +
+               visible_row("f", exclude_entry ? entry : std::string()) + ")";
+    };
+    const std::string ddl = R"SQL(
+        CREATE TABLE IF NOT EXISTS user_usage (
+            owner TEXT PRIMARY KEY,
+            bytes INTEGER NOT NULL DEFAULT 0,
+            files INTEGER NOT NULL DEFAULT 0
+        );
+        CREATE TRIGGER IF NOT EXISTS user_files_usage_insert AFTER INSERT ON user_files
+        WHEN )SQL" + visible_row("NEW") + R"SQL(
+        BEGIN
+            -- No OR IGNORE: the REPLACE of an upsert would override it and reset the row.
+            INSERT INTO user_usage(owner) SELECT NEW.owner
+            WHERE NOT EXISTS (SELECT 1 FROM user_usage WHERE owner=NEW.owner);
+            UPDATE user_usage SET bytes=bytes+NEW.size, files=files+1 WHERE owner=NEW.owner;
+        END;
+        CREATE TRIGGER IF NOT EXISTS user_files_usage_delete AFTER DELETE ON user_files
+        WHEN )SQL" + visible_row("OLD") + R"SQL(
+        BEGIN
+            UPDATE user_usage SET bytes=bytes-OLD.size, files=files-1 WHERE owner=OLD.owner;
+        END;
+        CREATE TRIGGER IF NOT EXISTS user_files_usage_resize AFTER UPDATE OF size ON user_files
+        WHEN )SQL" + visible_row("NEW") + R"SQL(
+        BEGIN
+            UPDATE user_usage SET bytes=bytes+NEW.size-OLD.size WHERE owner=NEW.owner;
+        END;
+        CREATE TRIGGER IF NOT EXISTS trash_usage_insert AFTER INSERT ON trash
+        BEGIN
+            UPDATE user_usage SET bytes=bytes-)SQL" + tree_total("NEW", "COALESCE(SUM(f.size), 0)", true) + R"SQL(,
+                                  files=files-)SQL" + tree_total("NEW", "COUNT(*)", true) + R"SQL(
+            WHERE owner=NEW.owner;
+        END;
+        CREATE TRIGGER IF NOT EXISTS trash_usage_delete AFTER DELETE ON trash
+        BEGIN
+            UPDATE user_usage SET bytes=bytes+)SQL" + tree_total("OLD", "COALESCE(SUM(f.size), 0)", false) + R"SQL(,
+                                  files=files+)SQL" + tree_total("OLD", "COUNT(*)", false) + R"SQL(
+            WHERE owner=OLD.owner;
+        END;
+    )SQL";
+
+    char* err = nullptr;
+    if (sqlite3_exec(db, ddl.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+        std::string msg = err ? err : "unknown error";
+        sqlite3_free(err);
+        throw std::runtime_error("Failed to initialize usage accounting: " + msg);
+    }
+    if (!existed) {
+        reconcile_usage();
+    }
 }
 
 std::optional<FileMetadata> FileIndex::find_by_path(const std::string& owner, const std::string& logical_path) {
+    const Connection db(*this, false);
     const char* sql = R"SQL(
         SELECT owner,logical_path,md5,storage_path,size FROM user_files
         WHERE owner=? AND logical_path=?
     )SQL";
 
     sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
         return std::nullopt;
     }
     sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
@@ -74,6 +241,7 @@ std::optional<FileMetadata> FileIndex::find_by_path(const std::string& owner, co
 }
 
 std::optional<FileMetadata> FileIndex::find_by_md5(const std::string& md5) {
+    const Connection db(*this, false);
     const char* sql = R"SQL(
         SELECT owner,logical_path,md5,storage_path,size FROM user_files
         WHERE md5=?
@@ -81,7 +249,7 @@ std::optional<FileMetadata> FileIndex::find_by_md5(const std::string& md5) {
     )SQL";
 
     sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
         return std::nullopt;
     }
     sqlite3_bind_text(stmt, 1, md5.c_str(), -1, SQLITE_TRANSIENT);
@@ -99,34 +267,64 @@ std::optional<FileMetadata> FileIndex::find_by_md5(const std::string& md5) {
     return meta;
 }
 
-void FileIndex::upsert(const FileMetadata& metadata) {
+// Returns the digest of the live row it replaced; the caller releases that blob once
+// the replacement is committed. A replaced row of a tree waiting in the trash is handed
+// to the trash entry instead, since its file stays linked there until the purge.
+std::optional<std::string> FileIndex::upsert(const FileMetadata& metadata) {
+    const Connection db(*this, true);
+    const auto hold_sql = "INSERT INTO trash_blobs(trash_id, md5) SELECT t.id, f.md5 FROM user_files f JOIN trash t ON " +
+                          tree_rows("t") + " WHERE f.owner=? AND f.logical_path=?";
+    const auto replaced_sql =
+        "SELECT md5 FROM user_files f WHERE owner=? AND logical_path=? AND " + visible_row("f");
+    // REPLACE rather than an in-place update: the row gets a fresh id, which keeps it
+    // out of reach of a pending trash purge of an earlier file at the same path.
     const char* sql = R"SQL(
-        INSERT INTO user_files(owner, logical_path, md5, storage_path, size)
+        INSERT OR REPLACE INTO user_files(owner, logical_path, md5, storage_path, size)
         VALUES(?,?,?,?,?)
-        ON CONFLICT(owner, logical_path)
-        DO UPDATE SET md5=excluded.md5,
-                      storage_path=excluded.storage_path,
-                      size=excluded.size,
-                      updated_at=CURRENT_TIMESTAMP
     )SQL";
 
+    std::optional<std::string> replaced;
     sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        return;
+    for (const auto& lookup : {replaced_sql, hold_sql}) {
+        if (sqlite3_prepare_v2(db, lookup.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error("Failed to prepare file upsert");
+        }
+        sqlite3_bind_text(stmt, 1, metadata.owner.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, metadata.logical_path.c_str(), -1, SQLITE_TRANSIENT);
+        const int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            replaced = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+            throw std::runtime_error("Failed to upsert file metadata");
+        }
+    }
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare file upsert");
     }
     sqlite3_bind_text(stmt, 1, metadata.owner.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 2, metadata.logical_path.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 3, metadata.md5.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_text(stmt, 4, metadata.storage_path.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(metadata.size));
-    sqlite3_step(stmt);
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
     sqlite3_finalize(stmt);
+    if (!ok) {
+        throw std::runtime_error("Failed to upsert file metadata");
+    }
+    if (replaced == metadata.md5) {
+        return std::nullopt;
+    }
+    return replaced;
 }
 
 void FileIndex::remove(const std::string& owner, const std::string& logical_path) {
+    const Connection db(*this, true);
     const char* sql = "DELETE FROM user_files WHERE owner=? AND logical_path=?";
     sqlite3_stmt* stmt = nullptr;
-    if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
         return;
     }
     sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
@@ -135,6 +333,631 @@ void FileIndex::remove(const std::string& owner, const std::string& logical_path
     sqlite3_finalize(stmt);
 }
 
+std::vector<FileMetadata> FileIndex::files_of(const std::string& owner) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT owner,logical_path,md5,storage_path,size FROM user_files WHERE owner=?";
+    std::vector<FileMetadata> files;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return files;
+    }
+    sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        files.push_back(FileMetadata{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)),
+                                     static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 4))});
+    }
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+// Rows of the file or directory tree at `logical_path`, leaving out stale rows of
+// earlier trees at the same place that wait for a trash purge.
+std::vector<FileMetadata> FileIndex::tree_files(const std::string& owner, const std::string& logical_path) {
+    const Connection db(*this, false);
+    const auto sql = R"SQL(
+        SELECT owner,logical_path,md5,storage_path,size FROM user_files f
+        WHERE owner=? AND (logical_path=? OR substr(logical_path, 1, ?)=?) AND )SQL" + visible_row("f");
+    std::vector<FileMetadata> files;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        return files;
+    }
+    const auto prefix = logical_path + "/";
+    sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, logical_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 3, static_cast<int>(prefix.size()));
+    sqlite3_bind_text(stmt, 4, prefix.c_str(), -1, SQLITE_TRANSIENT);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        files.push_back(FileMetadata{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)),
+                                     static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 4))});
+    }
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+// Re-points every row of the tree at `from_path` to `to_path`, and the storage paths
+// under `from_storage` to `to_storage`, after the tree was renamed on disk. The rows
+// are re-inserted rather than updated in place: like an upsert, a moved row gets a
+// fresh id, so a pending trash purge of an earlier tree at `to_path` leaves it alone.
+// Stale rows waiting for a trash purge stay where they are. The usage triggers see
+// one insert and one delete per moved row, which nets out.
+void FileIndex::move_tree(const std::string& owner,
+                          const std::string& from_path,
+                          const std::string& to_path,
+                          const std::string& from_storage,
+                          const std::string& to_storage) {
+    const Connection db(*this, true);
+    const auto moved = visible_row("f");
+    const auto copy_sql = R"SQL(
+        INSERT OR REPLACE INTO user_files(owner, logical_path, md5, storage_path, size)
+        SELECT owner, ?1 || substr(logical_path, ?2), md5,
+               CASE WHEN storage_path=?3 OR substr(storage_path, 1, ?4)=?5
+                    THEN ?6 || substr(storage_path, ?7) ELSE storage_path END,
+               size
+        FROM user_files f
+        WHERE owner=?8 AND id<=?9 AND (logical_path=?10 OR substr(logical_path, 1, ?11)=?12) AND )SQL" +
+                          moved + " ORDER BY id";
+    const auto remove_sql = R"SQL(
+        DELETE FROM user_files WHERE id IN (
+            SELECT id FROM user_files f
+            WHERE owner=?1 AND id<=?2 AND (logical_path=?3 OR substr(logical_path, 1, ?4)=?5) AND )SQL" +
+                            moved + ")";
+    // Stale rows at the destination are replaced by the copy; their trash entries keep
+    // their digests, as in upsert.
+    const auto hold_sql = "INSERT INTO trash_blobs(trash_id, md5) SELECT t.id, f.md5 FROM user_files f JOIN trash t ON " +
+                          tree_rows("t") + " WHERE f.owner=?1 AND (f.logical_path=?2 OR substr(f.logical_path, 1, ?3)=?4)";
+    const auto last_id = max_file_id();
+    const auto prefix = from_path + "/";
+    const auto to_prefix = to_path + "/";
+    const auto storage_prefix = from_storage + "/";
+    sqlite3_stmt* hold = nullptr;
+    sqlite3_stmt* copy = nullptr;
+    sqlite3_stmt* remove = nullptr;
+    if (sqlite3_prepare_v2(db, hold_sql.c_str(), -1, &hold, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, copy_sql.c_str(), -1, &copy, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, remove_sql.c_str(), -1, &remove, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(hold);
+        sqlite3_finalize(copy);
+        throw std::runtime_error("Failed to prepare file index move");
+    }
+    sqlite3_bind_text(hold, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(hold, 2, to_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(hold, 3, static_cast<int>(to_prefix.size()));
+    sqlite3_bind_text(hold, 4, to_prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(copy, 1, to_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(copy, 2, static_cast<sqlite3_int64>(from_path.size() + 1));
+    sqlite3_bind_text(copy, 3, from_storage.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(copy, 4, static_cast<int>(storage_prefix.size()));
+    sqlite3_bind_text(copy, 5, storage_prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(copy, 6, to_storage.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(copy, 7, static_cast<sqlite3_int64>(from_storage.size() + 1));
+    sqlite3_bind_text(copy, 8, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(copy, 9, last_id);
+    sqlite3_bind_text(copy, 10, from_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(copy, 11, static_cast<int>(prefix.size()));
+    sqlite3_bind_text(copy, 12, prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(remove, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(remove, 2, last_id);
+    sqlite3_bind_text(remove, 3, from_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(remove, 4, static_cast<int>(prefix.size()));
+    sqlite3_bind_text(remove, 5, prefix.c_str(), -1, SQLITE_TRANSIENT);
+
+    // A savepoint, so the move is atomic alone and also nests in a group commit.
+    sqlite3_exec(db, "SAVEPOINT move_tree", nullptr, nullptr, nullptr);
+    const bool ok = sqlite3_step(hold) == SQLITE_DONE && sqlite3_step(copy) == SQLITE_DONE &&
+                    sqlite3_step(remove) == SQLITE_DONE;
+    sqlite3_finalize(hold);
+    sqlite3_finalize(copy);
+    sqlite3_finalize(remove);
+    if (!ok) {
+        sqlite3_exec(db, "ROLLBACK TO move_tree", nullptr, nullptr, nullptr);
+        sqlite3_exec(db, "RELEASE move_tree", nullptr, nullptr, nullptr);
+        throw std::runtime_error("Failed to move file index rows");
+    }
+    sqlite3_exec(db, "RELEASE move_tree", nullptr, nullptr, nullptr);
+}
+
+// Rewrites the storage paths of an owner's files after their home moved to another
+// device.
+void FileIndex::relocate(const std::string& owner, const std::string& from_prefix, const std::string& to_prefix) {
+    const Connection db(*this, true);
+    const char* sql = R"SQL(
+        UPDATE user_files SET storage_path = ? || substr(storage_path, ?)
+        WHERE owner=? AND substr(storage_path, 1, ?)=?
+    )SQL";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, to_prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(from_prefix.size() + 1));
+    sqlite3_bind_text(stmt, 3, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(from_prefix.size()));
+    sqlite3_bind_text(stmt, 5, from_prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+std::optional<ChunkRef> FileIndex::find_chunk(const std::string& chunk_id) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT chunk_id,md5,offset,length FROM chunk_refs WHERE chunk_id=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return std::nullopt;
+    }
+    sqlite3_bind_text(stmt, 1, chunk_id.c_str(), -1, SQLITE_TRANSIENT);
+
+    std::optional<ChunkRef> ref;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        ref = ChunkRef{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                       reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                       static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                       static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 3))};
+    }
+    sqlite3_finalize(stmt);
+    return ref;
+}
+
+// Throws on any failure, so the caller's transaction drops the chunks with the rest.
+void FileIndex::add_chunks(const std::vector<ChunkRef>& chunks) {
+    if (chunks.empty()) {
+        return;
+    }
+    transaction([&] {
+        const Connection db(*this, true);
+        const char* sql = "INSERT OR REPLACE INTO chunk_refs(chunk_id, md5, offset, length) VALUES(?,?,?,?)";
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error("Failed to prepare chunk insert");
+        }
+        for (const auto& chunk : chunks) {
+            sqlite3_bind_text(stmt, 1, chunk.chunk_id.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(stmt, 2, chunk.md5.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(chunk.offset));
+            sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(chunk.length));
+            const int rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            if (rc != SQLITE_DONE) {
+                sqlite3_finalize(stmt);
+                throw std::runtime_error("Failed to record chunk references");
+            }
+        }
+        sqlite3_finalize(stmt);
+    });
+}
+
+void FileIndex::remove_chunk(const std::string& chunk_id) {
+    const Connection db(*this, true);
+    const char* sql = "DELETE FROM chunk_refs WHERE chunk_id=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, chunk_id.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+std::int64_t FileIndex::add_segment(const std::string& device) {
+    const Connection db(*this, true);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "INSERT INTO segments(device) VALUES(?)", -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Failed to add segment");
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    if (!ok) {
+        throw std::runtime_error("Failed to add segment");
+    }
+    return sqlite3_last_insert_rowid(db);
+}
+
+std::optional<SegmentInfo> FileIndex::find_segment(std::int64_t id) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT id,device,live_bytes,sealed FROM segments WHERE id=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return std::nullopt;
+    }
+    sqlite3_bind_int64(stmt, 1, id);
+    std::optional<SegmentInfo> segment;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        segment = SegmentInfo{sqlite3_column_int64(stmt, 0),
+                              reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                              static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                              sqlite3_column_int(stmt, 3) != 0};
+    }
+    sqlite3_finalize(stmt);
+    return segment;
+}
+
+std::optional<SegmentInfo> FileIndex::open_segment(const std::string& device) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT id,device,live_bytes,sealed FROM segments WHERE device=? AND sealed=0 ORDER BY id DESC";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return std::nullopt;
+    }
+    sqlite3_bind_text(stmt, 1, device.c_str(), -1, SQLITE_TRANSIENT);
+    std::optional<SegmentInfo> segment;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        segment = SegmentInfo{sqlite3_column_int64(stmt, 0),
+                              reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                              static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                              sqlite3_column_int(stmt, 3) != 0};
+    }
+    sqlite3_finalize(stmt);
+    return segment;
+}
+
+std::vector<SegmentInfo> FileIndex::sealed_segments() {
+    const Connection db(*this, false);
+    const char* sql = "SELECT id,device,live_bytes,sealed FROM segments WHERE sealed=1 ORDER BY id";
+    std::vector<SegmentInfo> segments;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return segments;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        segments.push_back(SegmentInfo{sqlite3_column_int64(stmt, 0),
+                                       reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                       static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                                       sqlite3_column_int(stmt, 3) != 0});
+    }
+    sqlite3_finalize(stmt);
+    return segments;
+}
+
+void FileIndex::seal_segment(std::int64_t id) {
+    const Connection db(*this, true);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "UPDATE segments SET sealed=1 WHERE id=?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+void FileIndex::remove_segment(std::int64_t id) {
+    const Connection db(*this, true);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "DELETE FROM segments WHERE id=?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+std::uint64_t FileIndex::segment_end(std::int64_t id) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT COALESCE(MAX(offset + length), 0) FROM packed_blobs WHERE segment=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    sqlite3_bind_int64(stmt, 1, id);
+    std::uint64_t end = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        end = static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return end;
+}
+
+std::optional<PackedBlob> FileIndex::find_packed(const std::string& md5) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT md5,segment,offset,length FROM packed_blobs WHERE md5=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return std::nullopt;
+    }
+    sqlite3_bind_text(stmt, 1, md5.c_str(), -1, SQLITE_TRANSIENT);
+    std::optional<PackedBlob> blob;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        blob = PackedBlob{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                          sqlite3_column_int64(stmt, 1),
+                          static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                          static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 3))};
+    }
+    sqlite3_finalize(stmt);
+    return blob;
+}
+
+std::vector<PackedBlob> FileIndex::packed_in(std::int64_t segment) {
+    const Connection db(*this, false);
+    const char* sql = "SELECT md5,segment,offset,length FROM packed_blobs WHERE segment=? ORDER BY offset";
+    std::vector<PackedBlob> blobs;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return blobs;
+    }
+    sqlite3_bind_int64(stmt, 1, segment);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        blobs.push_back(PackedBlob{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                   sqlite3_column_int64(stmt, 1),
+                                   static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 2)),
+                                   static_cast<std::uint64_t>(sqlite3_column_int64(stmt, 3))});
+    }
+    sqlite3_finalize(stmt);
+    return blobs;
+}
+
+void FileIndex::add_packed(const PackedBlob& blob) {
+    const Connection db(*this, true);
+    const char* sql = "INSERT OR IGNORE INTO packed_blobs(md5, segment, offset, length) VALUES(?,?,?,?)";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Failed to index packed blob");
+    }
+    sqlite3_bind_text(stmt, 1, blob.md5.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 2, blob.segment);
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(blob.offset));
+    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(blob.length));
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    if (!ok) {
+        throw std::runtime_error("Failed to index packed blob");
+    }
+}
+
+void FileIndex::move_packed(const PackedBlob& blob, std::int64_t from_segment) {
+    const Connection db(*this, true);
+    const char* sql = "UPDATE packed_blobs SET segment=?, offset=? WHERE md5=? AND segment=?";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Failed to move packed blob");
+    }
+    sqlite3_bind_int64(stmt, 1, blob.segment);
+    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(blob.offset));
+    sqlite3_bind_text(stmt, 3, blob.md5.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, from_segment);
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    if (!ok) {
+        throw std::runtime_error("Failed to move packed blob");
+    }
+}
+
+void FileIndex::remove_packed(const std::string& md5) {
+    const Connection db(*this, true);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "DELETE FROM packed_blobs WHERE md5=?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return;
+    }
+    sqlite3_bind_text(stmt, 1, md5.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
+std::int64_t FileIndex::max_file_id() {
+    const Connection db(*this, false);
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(id), 0) FROM user_files", -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    std::int64_t id = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+// Deletes up to `limit` rows of the tree at `logical_path` in one transaction and
+// returns their digests, so the caller can release the blobs once the files are gone.
+std::vector<std::string> FileIndex::remove_tree_batch(const std::string& owner,
+                                                      const std::string& logical_path,
+                                                      std::int64_t max_file_id,
+                                                      std::size_t limit) {
+    const Connection db(*this, true);
+    const char* select_sql = R"SQL(
+        SELECT id, md5 FROM user_files
+        WHERE owner=? AND id<=? AND (logical_path=? OR substr(logical_path, 1, ?)=?)
+        LIMIT ?
+    )SQL";
+    std::vector<std::string> digests;
+    sqlite3_stmt* select = nullptr;
+    sqlite3_stmt* remove = nullptr;
+    if (sqlite3_prepare_v2(db, select_sql, -1, &select, nullptr) != SQLITE_OK ||
+        sqlite3_prepare_v2(db, "DELETE FROM user_files WHERE id=?", -1, &remove, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(select);
+        return digests;
+    }
+    const auto prefix = logical_path + "/";
+    sqlite3_bind_text(select, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(select, 2, max_file_id);
+    sqlite3_bind_text(select, 3, logical_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(select, 4, static_cast<int>(prefix.size()));
+    sqlite3_bind_text(select, 5, prefix.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(select, 6, static_cast<sqlite3_int64>(limit));
+
+    sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+    std::vector<std::int64_t> ids;
+    while (sqlite3_step(select) == SQLITE_ROW) {
+        ids.push_back(sqlite3_column_int64(select, 0));
+        digests.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(select, 1)));
+    }
+    for (const auto id : ids) {
+        sqlite3_bind_int64(remove, 1, id);
+        sqlite3_step(remove);
+        sqlite3_reset(remove);
+    }
+    sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+    sqlite3_finalize(select);
+    sqlite3_finalize(remove);
+    return digests;
+}
+
+std::int64_t FileIndex::add_trash(const TrashEntry& entry) {
+    const Connection db(*this, true);
+    const char* sql = R"SQL(
+        INSERT INTO trash(owner, logical_path, trash_path, max_file_id, deleted_at)
+        VALUES(?,?,?,?,?)
+    )SQL";
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return 0;
+    }
+    sqlite3_bind_text(stmt, 1, entry.owner.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, entry.logical_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, entry.trash_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, entry.max_file_id);
+    sqlite3_bind_int64(stmt, 5, entry.deleted_at);
+    const bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    return ok ? sqlite3_last_insert_rowid(db) : 0;
+}
+
+std::vector<TrashEntry> FileIndex::pending_trash() {
+    const Connection db(*this, false);
+    const char* sql = "SELECT id,owner,logical_path,trash_path,max_file_id,deleted_at FROM trash ORDER BY id";
+    std::vector<TrashEntry> entries;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        return entries;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        entries.push_back(TrashEntry{sqlite3_column_int64(stmt, 0),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                                     reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3)),
+                                     sqlite3_column_int64(stmt, 4),
+                                     sqlite3_column_int64(stmt, 5)});
+    }
+    sqlite3_finalize(stmt);
+    return entries;
+}
+
+// A savepoint starts a transaction when none is open and nests inside the open one
+// otherwise, so a failing body only undoes its own writes. A commit that fails is
+// rolled back rather than left open for whatever the connection runs next.
+void FileIndex::transaction(const std::function<void()>& body) {
+    const Connection db(*this, true);
+    const bool outermost = sqlite3_get_autocommit(db) != 0;
+    if (sqlite3_exec(db, "SAVEPOINT body", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        throw std::runtime_error("Failed to begin file index transaction");
+    }
+    const auto undo = [&] {
+        sqlite3_exec(db, "ROLLBACK TO body", nullptr, nullptr, nullptr);
+        sqlite3_exec(db, "RELEASE body", nullptr, nullptr, nullptr);
+        if (outermost && sqlite3_get_autocommit(db) == 0) {
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+    };
+    try {
+        body();
+    } catch (...) {
+        undo();
+        throw;
+    }
+    if (sqlite3_exec(db, "RELEASE body", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        undo();
+        throw std::runtime_error("Failed to commit file index transaction");
+    }
+}
+
+UsageTotals FileIndex::usage_of(const std::string& owner) {
+    const Connection db(*this, false);
+    UsageTotals totals;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT bytes, files FROM user_usage WHERE owner=?", -1, &stmt, nullptr) !=
+        SQLITE_OK) {
+        return totals;
+    }
+    sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        totals.bytes = static_cast<std::uint64_t>(std::max<sqlite3_int64>(sqlite3_column_int64(stmt, 0), 0));
+        totals.files = static_cast<std::uint64_t>(std::max<sqlite3_int64>(sqlite3_column_int64(stmt, 1), 0));
+    }
+    sqlite3_finalize(stmt);
+    return totals;
+}
+
+// The full scan runs on a connection of its own, so it holds neither the writer nor
+// the shared reader. Only the owners it finds drifted are recomputed, one short write
+// each, and the rewrite re-checks against rows committed since the scan.
+std::size_t FileIndex::reconcile_usage() {
+    const std::string actual =
+        "(SELECT o.owner AS owner, COALESCE(v.bytes, 0) AS bytes, COALESCE(v.files, 0) AS files "
+        "FROM (SELECT owner FROM user_usage UNION SELECT owner FROM user_files) o "
+        "LEFT JOIN (SELECT owner, SUM(size) AS bytes, COUNT(*) AS files FROM user_files f WHERE " +
+        visible_row("f") + " GROUP BY owner) v ON v.owner=o.owner)";
+    const std::string drift_sql = "SELECT a.owner FROM " + actual +
+                                  " a LEFT JOIN user_usage u ON u.owner=a.owner "
+                                  "WHERE u.owner IS NULL OR u.bytes<>a.bytes OR u.files<>a.files";
+    std::vector<std::string> owners;
+    sqlite3* scan = nullptr;
+    if (sqlite3_open_v2(path_.c_str(), &scan, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+        sqlite3_busy_timeout(scan, 5000);
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(scan, drift_sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                owners.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(scan);
+
+    const std::string rewrite_sql =
+        "INSERT OR REPLACE INTO user_usage(owner, bytes, files) SELECT ?1, a.bytes, a.files FROM "
+        "(SELECT COALESCE(SUM(size), 0) AS bytes, COUNT(*) AS files FROM user_files f WHERE f.owner=?1 AND " +
+        visible_row("f") +
+        ") a WHERE NOT EXISTS (SELECT 1 FROM user_usage u WHERE u.owner=?1 AND u.bytes=a.bytes AND u.files=a.files)";
+    std::size_t drifted = 0;
+    for (const auto& owner : owners) {
+        const Connection db(*this, true);
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, rewrite_sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+            break;
+        }
+        sqlite3_bind_text(stmt, 1, owner.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(db) > 0) {
+            ++drifted;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return drifted;
+}
+
+void FileIndex::remove_trash(std::int64_t id) {
+    const Connection db(*this, true);
+    for (const char* sql : {"DELETE FROM trash_blobs WHERE trash_id=?", "DELETE FROM trash WHERE id=?"}) {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            return;
+        }
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+}
+
+// Digests of rows of the entry's tree that were replaced before the purge got to them.
+std::vector<std::string> FileIndex::held_blobs(std::int64_t id) {
+    const Connection db(*this, false);
+    std::vector<std::string> digests;
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT md5 FROM trash_blobs WHERE trash_id=?", -1, &stmt, nullptr) != SQLITE_OK) {
+        return digests;
+    }
+    sqlite3_bind_int64(stmt, 1, id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        digests.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+    return digests;
+}
+
 }  // namespace cloud::server
 
 
@@ -0,0 +1,231 @@
+#include "group_commit.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <set>
+#include <sstream>
+#include <utility>
+
+namespace cloud::server {
+
+namespace {
+
+int open_for_sync(const std::filesystem::path& path, int flags) {
+    int fd = -1;
+    do {
+        fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    } while (fd < 0 && errno == EINTR);
+    return fd;
+}
+
+}  // namespace
+
+GroupCommitter::GroupCommitter(FileIndex& index, CommitOptions options) : index_(index), options_(options) {
+    options_.max_batch = std::max<std::size_t>(options_.max_batch, 1);
+}
+
+GroupCommitter::~GroupCommitter() {
+    stop();
+}
+
+void GroupCommitter::start() {
+    if (!options_.durable || worker_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    worker_ = std::thread(&GroupCommitter::worker_loop, this);
+}
+
+// Requests still queued are committed before the worker exits.
+void GroupCommitter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void GroupCommitter::submit(CommitRequest request) {
+    if (!worker_.joinable()) {
+        std::vector<Pending> batch;
+        batch.push_back(Pending{std::move(request), std::chrono::steady_clock::now()});
+        if (options_.durable) {
+            commit_batch(batch);
+            return;
+        }
+        // Not durable: publish right away and leave the data to normal writeback.
+        bool ok = true;
+        try {
+            if (batch.front().request.apply) {
+                index_.transaction(batch.front().request.apply);
+            }
+        } catch (const std::exception&) {
+            ok = false;
+        }
+        batch.front().request.done(ok);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(Pending{std::move(request), std::chrono::steady_clock::now()});
+    }
+    cv_.notify_all();
+}
+
+void GroupCommitter::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        // The first request opens the window; later ones ride along until it closes
+        // or the batch is full.
+        const auto deadline = queue_.front().queued + options_.window;
+        cv_.wait_until(lock, deadline, [this] { return stopping_ || queue_.size() >= options_.max_batch; });
+
+        std::vector<Pending> batch;
+        if (queue_.size() > options_.max_batch) {
+            batch.assign(std::make_move_iterator(queue_.begin()),
+                         std::make_move_iterator(queue_.begin() + static_cast<std::ptrdiff_t>(options_.max_batch)));
+            queue_.erase(queue_.begin(), queue_.begin() + static_cast<std::ptrdiff_t>(options_.max_batch));
+        } else {
+            batch.swap(queue_);
+        }
+        lock.unlock();
+        commit_batch(batch);
+        lock.lock();
+    }
+}
+
+void GroupCommitter::commit_batch(std::vector<Pending>& batch) {
+    std::set<std::filesystem::path> files;
+    std::set<std::filesystem::path> directories;
+    for (const auto& pending : batch) {
+        files.insert(pending.request.files.begin(), pending.request.files.end());
+        directories.insert(pending.request.directories.begin(), pending.request.directories.end());
+    }
+
+    // Kick off writeback for the whole batch before waiting on any of it, so the
+    // device can merge and reorder the writes instead of draining them one file at a time.
+    std::vector<std::pair<std::filesystem::path, int>> open_files;
+    open_files.reserve(files.size());
+    for (const auto& file : files) {
+        const int fd = open_for_sync(file, O_RDONLY);
+        if (fd >= 0) {
+            ::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+        open_files.emplace_back(file, fd);
+    }
+    std::set<std::filesystem::path> failed;
+    for (const auto& [file, fd] : open_files) {
+        if (fd < 0 || ::fdatasync(fd) != 0) {
+            failed.insert(file);
+        } else {
+            ++files_synced_;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    for (const auto& dir : directories) {
+        const int fd = open_for_sync(dir, O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || ::fsync(fd) != 0) {
+            failed.insert(dir);
+        } else {
+            ++dirs_synced_;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Data and names are on disk; now publish every commit whose files made it with a
+    // single index transaction.
+    std::vector<bool> ok(batch.size(), false);
+    try {
+        index_.transaction([&] {
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                const auto& request = batch[i].request;
+                const auto lost = [&](const std::filesystem::path& path) { return failed.count(path) != 0; };
+                if (std::any_of(request.files.begin(), request.files.end(), lost) ||
+                    std::any_of(request.directories.begin(), request.directories.end(), lost)) {
+                    continue;
+                }
+                // Each apply is a savepoint of its own, so one that fails halfway leaves
+                // none of its rows behind in the batch's transaction.
+                try {
+                    if (request.apply) {
+                        index_.transaction(request.apply);
+                    }
+                    ok[i] = true;
+                } catch (const std::exception&) {
+                }
+            }
+        });
+    } catch (const std::exception&) {
+        std::fill(ok.begin(), ok.end(), false);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    ++batches_;
+    entries_ += batch.size();
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (!ok[i]) {
+            ++failures_;
+        }
+        record_latency(now - batch[i].queued);
+        if (batch[i].request.done) {
+            batch[i].request.done(ok[i]);
+        }
+    }
+}
+
+void GroupCommitter::record_latency(std::chrono::steady_clock::duration latency) {
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    std::lock_guard<std::mutex> lock(latency_mutex_);
+    latencies_us_[latency_count_ % kLatencySamples] =
+        static_cast<std::uint32_t>(std::clamp<long long>(us, 0, UINT32_MAX));
+    ++latency_count_;
+}
+
+std::string GroupCommitter::stats_report() const {
+    std::vector<std::uint32_t> samples;
+    {
+        std::lock_guard<std::mutex> lock(latency_mutex_);
+        samples.assign(latencies_us_.begin(),
+                       latencies_us_.begin() + static_cast<std::ptrdiff_t>(std::min(latency_count_, kLatencySamples)));
+    }
+    std::sort(samples.begin(), samples.end());
+    const auto percentile = [&](double p) -> std::uint32_t {
+        if (samples.empty()) {
+            return 0;
+        }
+        return samples[static_cast<std::size_t>(p * static_cast<double>(samples.size() - 1))];
+    };
+
+    const auto batches = batches_.load();
+    std::ostringstream out;
+    out << "commit.durable=" << (options_.durable ? 1 : 0) << "\n";
+    out << "commit.window_us=" << options_.window.count() << "\n";
+    out << "commit.batches=" << batches << "\n";
+    out << "commit.entries=" << entries_.load() << "\n";
+    out << "commit.avg_batch=" << (batches == 0 ? 0.0 : static_cast<double>(entries_.load()) / batches) << "\n";
+    out << "commit.files_synced=" << files_synced_.load() << "\n";
+    out << "commit.dirs_synced=" << dirs_synced_.load() << "\n";
+    out << "commit.failures=" << failures_.load() << "\n";
+    out << "commit.latency_p50_us=" << percentile(0.50) << "\n";
+    out << "commit.latency_p95_us=" << percentile(0.95) << "\n";
+    out << "commit.latency_p99_us=" << percentile(0.99) << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,42 @@
+#include "hash_ring.hpp"
+
+#include <algorithm>
+#include <string>
+
+namespace cloud::server {
+
+std::uint64_t HashRing::hash(std::string_view data) {
+    std::uint64_t value = 1469598103934665603ULL;
+    for (unsigned char ch : data) {
+        value ^= ch;
+        value *= 1099511628211ULL;
+    }
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+void HashRing::add(std::size_t member, std::string_view name, unsigned weight) {
+    const auto points = static_cast<std::size_t>(weight) * kPointsPerWeight;
+    for (std::size_t i = 0; i < points; ++i) {
+        points_.emplace_back(hash(std::string(name) + "#" + std::to_string(i)), member);
+    }
+    std::sort(points_.begin(), points_.end());
+}
+
+std::optional<std::size_t> HashRing::locate(std::string_view key) const {
+    if (points_.empty()) {
+        return std::nullopt;
+    }
+    const auto point = hash(key);
+    auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(point, std::size_t{0}));
+    if (it == points_.end()) {
+        it = points_.begin();
+    }
+    return it->second;
+}
+
+}  // namespace cloud::server
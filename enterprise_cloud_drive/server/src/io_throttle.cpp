@@ -0,0 +1,31 @@
+#include "io_throttle.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace cloud::server {
+
+IoThrottle::IoThrottle(double rate, double burst)
+    : rate_(rate), burst_(std::max(burst, 1.0)), tokens_(burst_), last_(std::chrono::steady_clock::now()) {}
+
+void IoThrottle::acquire(double cost) {
+    if (rate_ <= 0) {
+        return;
+    }
+    std::chrono::duration<double> wait{0};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        tokens_ = std::min(burst_, tokens_ + std::chrono::duration<double>(now - last_).count() * rate_);
+        last_ = now;
+        tokens_ -= cost;
+        if (tokens_ < 0) {
+            wait = std::chrono::duration<double>(-tokens_ / rate_);
+        }
+    }
+    if (wait.count() > 0) {
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,251 @@
+#include "listing_cache.hpp"
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr std::uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                     IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+// What changes a subdirectory's mtime (or its own attributes). Added to whatever mask
+// the directory already has, since it may be cached in its own right.
+constexpr std::uint32_t kChildMask = IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+                                     IN_MOVE_SELF | IN_ONLYDIR | IN_MASK_ADD;
+// Watches are a per-user kernel budget (fs.inotify.max_user_watches); a directory with
+// more subdirectories than this is listed from disk every time instead.
+constexpr std::size_t kMaxChildWatches = 256;
+
+}  // namespace
+
+ListingCache::ListingCache(std::size_t capacity_bytes) : capacity_bytes_(capacity_bytes) {
+    if (capacity_bytes_ > 0) {
+        inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+}
+
+ListingCache::~ListingCache() {
+    if (inotify_fd_ >= 0) {
+        ::close(inotify_fd_);
+    }
+}
+
+std::shared_ptr<const Listing> ListingCache::lookup(const std::filesystem::path& dir) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_events();
+    auto it = index_.find(dir.string());
+    if (it == index_.end() || !it->second->listing) {
+        ++misses_;
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    ++hits_;
+    return it->second->listing;
+}
+
+void ListingCache::begin(const std::filesystem::path& dir) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_events();
+    auto key = dir.string();
+    if (index_.count(key) != 0) {
+        return;
+    }
+    const int wd = ::inotify_add_watch(inotify_fd_, key.c_str(), kWatchMask);
+    if (wd < 0) {
+        return;
+    }
+    Entry entry;
+    entry.key = key;
+    entry.wd = wd;
+    lru_.push_front(std::move(entry));
+    index_.emplace(key, lru_.begin());
+    watches_[wd].push_back(std::move(key));
+}
+
+void ListingCache::store(const std::filesystem::path& dir,
+                         std::shared_ptr<const Listing> listing,
+                         const std::vector<std::pair<std::string, std::uint64_t>>& subdirs) {
+    if (!enabled() || !listing) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_events();
+    auto it = index_.find(dir.string());
+    if (it == index_.end() || it->second->listing) {
+        return;
+    }
+    auto entry = it->second;
+    if (subdirs.size() > kMaxChildWatches) {
+        erase(entry);
+        ++uncacheable_;
+        return;
+    }
+    // A subdirectory that changed before its watch existed no longer shows the
+    // listed mtime; such a listing is not kept.
+    for (const auto& [name, modified] : subdirs) {
+        auto key = (dir / name).string();
+        const int wd = ::inotify_add_watch(inotify_fd_, key.c_str(), kChildMask);
+        struct stat st {};
+        if (wd < 0 || ::stat(key.c_str(), &st) != 0 || static_cast<std::uint64_t>(st.st_mtim.tv_sec) != modified) {
+            if (wd >= 0 && watches_.count(wd) == 0) {
+                ::inotify_rm_watch(inotify_fd_, wd);
+            }
+            erase(entry);
+            return;
+        }
+        watches_[wd].push_back(key);
+        entry->children.emplace_back(wd, std::move(key));
+    }
+    entry->bytes = entry->key.size() + listing->body.size() + (listing->deflated ? listing->deflated->size() : 0);
+    if (entry->bytes > capacity_bytes_) {
+        erase(entry);
+        return;
+    }
+    entry->listing = std::move(listing);
+    used_bytes_ += entry->bytes;
+    lru_.splice(lru_.begin(), lru_, entry);
+    while (used_bytes_ > capacity_bytes_ && !lru_.empty()) {
+        erase(std::prev(lru_.end()));
+    }
+}
+
+void ListingCache::abandon(const std::filesystem::path& dir) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto it = index_.find(dir.string()); it != index_.end() && !it->second->listing) {
+        erase(it->second);
+    }
+}
+
+void ListingCache::invalidate(const std::filesystem::path& dir) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    erase_key(dir.string());
+    erase_key(dir.parent_path().string());
+}
+
+void ListingCache::invalidate_tree(const std::filesystem::path& dir) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto key = dir.string();
+    const auto prefix = key + "/";
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        auto next = std::next(it);
+        if (it->key == key || it->key.compare(0, prefix.size(), prefix) == 0) {
+            erase(it);
+            ++invalidations_;
+        }
+        it = next;
+    }
+    erase_key(dir.parent_path().string());
+}
+
+void ListingCache::drain_events() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true) {
+        const ssize_t got = ::read(inotify_fd_, buffer, sizeof(buffer));
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        for (ssize_t pos = 0; pos < got;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + pos);
+            pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            if (event->mask & IN_Q_OVERFLOW) {
+                clear();
+                continue;
+            }
+            auto it = watches_.find(event->wd);
+            if (it == watches_.end()) {
+                continue;
+            }
+            const auto keys = it->second;
+            for (const auto& key : keys) {
+                erase_key(key);
+                erase_key(std::filesystem::path(key).parent_path().string());
+            }
+        }
+    }
+}
+
+void ListingCache::erase_key(const std::string& key) {
+    if (auto it = index_.find(key); it != index_.end()) {
+        erase(it->second);
+        ++invalidations_;
+    }
+}
+
+void ListingCache::erase(EntryList::iterator it) {
+    used_bytes_ -= it->listing ? it->bytes : 0;
+    unwatch(it->wd, it->key);
+    for (const auto& [wd, key] : it->children) {
+        unwatch(wd, key);
+    }
+    index_.erase(it->key);
+    lru_.erase(it);
+}
+
+// One directory can be watched for several reasons (cached itself, subdirectory of
+// one or more cached listings); the watch goes once the last of them does.
+void ListingCache::unwatch(int wd, const std::string& key) {
+    auto watch = watches_.find(wd);
+    if (watch == watches_.end()) {
+        return;
+    }
+    auto& keys = watch->second;
+    if (auto found = std::find(keys.begin(), keys.end(), key); found != keys.end()) {
+        keys.erase(found);
+    }
+    if (keys.empty()) {
+        ::inotify_rm_watch(inotify_fd_, wd);
+        watches_.erase(watch);
+    }
+}
+
+void ListingCache::clear() {
+    while (!lru_.empty()) {
+        erase(lru_.begin());
+        ++invalidations_;
+    }
+}
+
+std::string ListingCache::stats_report() const {
+    std::size_t entries = 0;
+    std::size_t used = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = index_.size();
+        used = used_bytes_;
+    }
+    std::ostringstream out;
+    out << "listing.capacity_bytes=" << (enabled() ? capacity_bytes_ : 0) << "\n";
+    out << "listing.used_bytes=" << used << "\n";
+    out << "listing.directories=" << entries << "\n";
+    out << "listing.hits=" << hits_.load() << "\n";
+    out << "listing.misses=" << misses_.load() << "\n";
+    out << "listing.invalidations=" << invalidations_.load() << "\n";
+    out << "listing.uncacheable=" << uncacheable_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
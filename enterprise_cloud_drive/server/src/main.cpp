@@ -4,6 +4,7 @@
 #include "file_index.hpp"
 #include "jwt_service.hpp"
 #include "logger.hpp"
+#include "storage_device.hpp"
 #include "storage_manager.hpp"
 
 #include <atomic>
@@ -33,7 +34,26 @@ int main(int argc, char* argv[]) {
         cloud::server::JwtService jwt({.issuer = config.jwt_issuer,
                                        .secret = config.jwt_secret,
                                        .ttl_seconds = config.token_ttl_seconds});
-        cloud::server::StorageManager storage(config.storage_root);
+        cloud::server::StorageManager storage(
+            config.storage_root,
+            {.sync_bytes = config.resume_sync_bytes,
+             .sync_interval = std::chrono::milliseconds(config.resume_sync_interval_ms)},
+            {.threshold = config.direct_io_threshold,
+             .buffer_bytes = config.direct_io_buffer_bytes,
+             .max_buffers = config.direct_io_max_buffers},
+            {.preallocate = config.preallocate_uploads,
+             .preallocate_min_bytes = config.preallocate_min_bytes,
+             .reserve_bytes = config.disk_reserve_bytes},
+            cloud::server::parse_device_specs(config.storage_devices),
+            {.data_shards = config.erasure_data_shards,
+             .parity_shards = config.erasure_parity_shards,
+             .min_bytes = config.erasure_min_bytes,
+             .cell_bytes = config.erasure_cell_bytes},
+            {.max_file_bytes = config.pack_max_file_bytes,
+             .segment_bytes = config.pack_segment_bytes,
+             .compact_ratio = config.pack_compact_ratio,
+             .compact_interval = std::chrono::seconds(config.pack_compact_interval_seconds)});
+        storage.attach_index(file_index);
 
         cloud::server::CloudServer server(config, auth, storage, file_index, jwt, logger);
         server.start();
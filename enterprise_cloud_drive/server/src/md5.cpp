@@ -0,0 +1,201 @@
+#include "md5.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr std::string_view kStateTag = "m1:";
+constexpr char kHex[] = "0123456789abcdef";
+
+constexpr std::uint32_t kSines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+constexpr unsigned kShifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 5, 9,  14, 20, 5, 9,  14, 20,
+    5, 9,  14, 20, 5, 9,  14, 20, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+std::uint32_t rotate_left(std::uint32_t value, unsigned bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+void append_word(std::string& out, std::uint32_t value) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        out.push_back(kHex[(value >> shift) & 0xf]);
+    }
+}
+
+int nibble(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    return -1;
+}
+
+// Consumes `digits` hex digits from the front of `hex`.
+bool take_hex(std::string_view& hex, std::size_t digits, std::uint32_t& value) {
+    if (hex.size() < digits) {
+        return false;
+    }
+    value = 0;
+    for (std::size_t i = 0; i < digits; ++i) {
+        const int n = nibble(hex[i]);
+        if (n < 0) {
+            return false;
+        }
+        value = (value << 4) | static_cast<std::uint32_t>(n);
+    }
+    hex.remove_prefix(digits);
+    return true;
+}
+
+}  // namespace
+
+void Md5::transform(const std::uint8_t* block) {
+    std::uint32_t m[16];
+    for (unsigned i = 0; i < 16; ++i) {
+        m[i] = static_cast<std::uint32_t>(block[i * 4]) | static_cast<std::uint32_t>(block[i * 4 + 1]) << 8 |
+               static_cast<std::uint32_t>(block[i * 4 + 2]) << 16 | static_cast<std::uint32_t>(block[i * 4 + 3]) << 24;
+    }
+    auto [a, b, c, d] = words_;
+    for (unsigned i = 0; i < 64; ++i) {
+        std::uint32_t f = 0;
+        unsigned g = 0;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        const std::uint32_t next = b + rotate_left(a + f + kSines[i] + m[g], kShifts[i]);
+        a = d;
+        d = c;
+        c = b;
+        b = next;
+    }
+    words_[0] += a;
+    words_[1] += b;
+    words_[2] += c;
+    words_[3] += d;
+}
+
+void Md5::update(const void* data, std::size_t length) {
+    const auto* in = static_cast<const std::uint8_t*>(data);
+    auto used = static_cast<std::size_t>(length_ % kBlockBytes);
+    length_ += length;
+    if (used > 0) {
+        const auto take = std::min(length, kBlockBytes - used);
+        std::memcpy(buffer_.data() + used, in, take);
+        in += take;
+        length -= take;
+        if (used + take < kBlockBytes) {
+            return;
+        }
+        transform(buffer_.data());
+    }
+    for (; length >= kBlockBytes; in += kBlockBytes, length -= kBlockBytes) {
+        transform(in);
+    }
+    if (length > 0) {
+        std::memcpy(buffer_.data(), in, length);
+    }
+}
+
+std::string Md5::hex_digest() const {
+    Md5 copy = *this;
+    const std::uint64_t bits = length_ * 8;
+    const std::uint8_t pad = 0x80;
+    copy.update(&pad, 1);
+    const std::uint8_t zero = 0;
+    while (copy.length_ % kBlockBytes != kBlockBytes - 8) {
+        copy.update(&zero, 1);
+    }
+    std::uint8_t trailer[8];
+    for (unsigned i = 0; i < 8; ++i) {
+        trailer[i] = static_cast<std::uint8_t>(bits >> (8 * i));
+    }
+    copy.update(trailer, sizeof(trailer));
+    std::string out;
+    out.reserve(kDigestBytes * 2);
+    for (const auto word : copy.words_) {
+        for (unsigned i = 0; i < 4; ++i) {
+            const auto byte = static_cast<std::uint8_t>(word >> (8 * i));
+            out.push_back(kHex[byte >> 4]);
+            out.push_back(kHex[byte & 0xf]);
+        }
+    }
+    return out;
+}
+
+std::string Md5::save() const {
+    std::string out(kStateTag);
+    const std::uint64_t bits = length_ * 8;
+    for (const auto word : words_) {
+        append_word(out, word);
+    }
+    append_word(out, static_cast<std::uint32_t>(bits));
+    append_word(out, static_cast<std::uint32_t>(bits >> 32));
+    const auto buffered = static_cast<std::uint32_t>(length_ % kBlockBytes);
+    append_word(out, buffered);
+    for (std::uint32_t i = 0; i < buffered; ++i) {
+        out.push_back(kHex[buffer_[i] >> 4]);
+        out.push_back(kHex[buffer_[i] & 0xf]);
+    }
+    return out;
+}
+
+bool Md5::restore(std::string_view state) {
+    if (state.substr(0, kStateTag.size()) != kStateTag) {
+        return false;
+    }
+    state.remove_prefix(kStateTag.size());
+    std::uint32_t fields[7];
+    for (auto& field : fields) {
+        if (!take_hex(state, 8, field)) {
+            return false;
+        }
+    }
+    const std::uint64_t bits = static_cast<std::uint64_t>(fields[5]) << 32 | fields[4];
+    const std::uint32_t buffered = fields[6];
+    if (bits % 8 != 0 || buffered != (bits / 8) % kBlockBytes || state.size() != buffered * 2) {
+        return false;
+    }
+    Md5 restored;
+    for (unsigned i = 0; i < 4; ++i) {
+        restored.words_[i] = fields[i];
+    }
+    restored.length_ = bits / 8;
+    for (std::uint32_t i = 0; i < buffered; ++i) {
+        std::uint32_t byte = 0;
+        if (!take_hex(state, 2, byte)) {
+            return false;
+        }
+        restored.buffer_[i] = static_cast<std::uint8_t>(byte);
+    }
+    *this = restored;
+    return true;
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,196 @@
+#include "path_resolver.hpp"
+
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+
+namespace cloud::server {
+
+namespace {
+
+[[noreturn]] void traversal() {
+    throw std::runtime_error("Path traversal detected");
+}
+
+// Lexically normalized `relative`, empty for the root itself.
+std::filesystem::path normalized(const std::filesystem::path& relative) {
+    auto normal = relative.lexically_normal();
+    if (normal.is_absolute() || (!normal.empty() && *normal.begin() == "..")) {
+        traversal();
+    }
+    if (!normal.empty() && normal.filename().empty()) {
+        normal = normal.parent_path();  // trailing separator
+    }
+    if (normal == ".") {
+        normal.clear();
+    }
+    return normal;
+}
+
+}  // namespace
+
+PathResolver::PathResolver(HomeLocator locate) : locate_(std::move(locate)) {}
+
+PathResolver::~PathResolver() {
+    for (auto& [name, user] : roots_) {
+        if (user.fd >= 0) {
+            ::close(user.fd);
+        }
+    }
+}
+
+// Entries are never erased, so references stay valid after the lock is dropped.
+const PathResolver::UserRoot& PathResolver::root_for(const std::string& username) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto it = roots_.find(username); it != roots_.end()) {
+        return it->second;
+    }
+    const auto path = locate_(username);
+    std::filesystem::create_directories(path);
+    UserRoot user;
+    user.path = std::filesystem::canonical(path);
+    user.fd = ::open(user.path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    return roots_.emplace(username, std::move(user)).first->second;
+}
+
+std::filesystem::path PathResolver::user_root(const std::string& username) {
+    return root_for(username).path;
+}
+
+std::filesystem::path PathResolver::resolve(const std::string& username, const std::filesystem::path& relative) {
+    const auto& user = root_for(username);
+    const auto normal = normalized(relative);
+    if (normal.empty()) {
+        return user.path;
+    }
+    if (!beneath(user, normal)) {
+        traversal();
+    }
+    return user.path / normal;
+}
+
+int PathResolver::open(const std::string& username, const std::filesystem::path& relative, int flags, mode_t mode) {
+    const auto& user = root_for(username);
+    const auto normal = normalized(relative);
+    return open_beneath(user, normal.empty() ? std::filesystem::path(".") : normal, flags, mode);
+}
+
+// Every step is looked up from the root again, so the descriptor returned is confined
+// by the kernel no matter what happened to the directories walked before.
+int PathResolver::open_parent(const std::string& username,
+                              const std::filesystem::path& relative,
+                              std::string& name,
+                              bool create,
+                              std::vector<std::filesystem::path>* created) {
+    const auto& user = root_for(username);
+    const auto normal = normalized(relative);
+    if (normal.empty()) {
+        throw std::runtime_error("Path has no parent directory");
+    }
+    name = normal.filename().string();
+    const auto parent = normal.parent_path();
+    if (!create) {
+        return open_beneath(user, parent.empty() ? std::filesystem::path(".") : parent, O_PATH | O_DIRECTORY, 0);
+    }
+    int dir = open_beneath(user, ".", O_PATH | O_DIRECTORY, 0);
+    std::filesystem::path walked;
+    for (const auto& part : parent) {
+        if (dir < 0) {
+            return -1;
+        }
+        const bool made = ::mkdirat(dir, part.c_str(), 0755) == 0;
+        if (!made && errno != EEXIST) {
+            const int saved = errno;
+            ::close(dir);
+            errno = saved;
+            return -1;
+        }
+        walked /= part;
+        if (made && created) {
+            created->push_back(walked);
+        }
+        const int next = open_beneath(user, walked, O_PATH | O_DIRECTORY, 0);
+        const int saved = errno;
+        ::close(dir);
+        errno = saved;
+        dir = next;
+    }
+    return dir;
+}
+
+// EXDEV is openat2's answer to a lookup that would leave the root.
+int PathResolver::open_beneath(const UserRoot& user, const std::filesystem::path& relative, int flags, mode_t mode) {
+    if (user.fd >= 0 && openat2_available_.load(std::memory_order_relaxed)) {
+        open_how how{};
+        how.flags = static_cast<std::uint64_t>(flags | O_CLOEXEC);
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        while (true) {
+            const long fd = ::syscall(SYS_openat2, user.fd, relative.c_str(), &how, sizeof(how));
+            if (fd >= 0) {
+                return static_cast<int>(fd);
+            }
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            if (errno == EXDEV) {
+                traversal();
+            }
+            if (errno != ENOSYS && errno != EPERM) {
+                return -1;
+            }
+            openat2_available_.store(false, std::memory_order_relaxed);
+            break;
+        }
+    }
+    if (relative != "." && !beneath(user, relative)) {
+        traversal();
+    }
+    return ::open((user.path / relative).c_str(), flags | O_CLOEXEC, mode);
+}
+
+// Lexical normalization already rejected `..` escapes; what is left are symlinks. A
+// path that does not exist yet (upload target, new directory) is judged by its
+// deepest existing ancestor, as weakly_canonical would.
+bool PathResolver::beneath(const UserRoot& user, const std::filesystem::path& relative) {
+    if (user.fd >= 0 && openat2_available_.load(std::memory_order_relaxed)) {
+        open_how how{};
+        how.flags = O_PATH | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        auto probe = relative;
+        while (!probe.empty()) {
+            const long fd = ::syscall(SYS_openat2, user.fd, probe.c_str(), &how, sizeof(how));
+            if (fd >= 0) {
+                ::close(static_cast<int>(fd));
+                return true;
+            }
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOENT || errno == ENOTDIR) {
+                probe = probe.parent_path();
+                continue;
+            }
+            if (errno != ENOSYS && errno != EPERM) {
+                return false;
+            }
+            openat2_available_.store(false, std::memory_order_relaxed);
+            break;
+        }
+        if (probe.empty()) {
+            return true;
+        }
+    }
+    const auto target = std::filesystem::weakly_canonical(user.path / relative);
+    const auto [root_end, target_it] = std::mismatch(user.path.begin(), user.path.end(), target.begin(), target.end());
+    return root_end == user.path.end();
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,119 @@
+#include "quota_manager.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace cloud::server {
+
+QuotaManager::QuotaManager(FileIndex& index, QuotaOptions options) : index_(index), options_(options) {}
+
+QuotaManager::~QuotaManager() {
+    stop();
+}
+
+void QuotaManager::start() {
+    if (options_.reconcile_interval.count() == 0 || worker_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    worker_ = std::thread(&QuotaManager::worker_loop, this);
+}
+
+void QuotaManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void QuotaManager::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, options_.reconcile_interval, [this] { return stopping_; })) {
+        lock.unlock();
+        drifted_owners_ += index_.reconcile_usage();
+        ++reconciliations_;
+        lock.lock();
+    }
+}
+
+std::optional<QuotaReservation> QuotaManager::reserve(const std::string& owner,
+                                                      std::uint64_t bytes,
+                                                      std::optional<std::uint64_t> replaced_bytes) {
+    QuotaReservation reservation;
+    const auto credit = replaced_bytes.value_or(0);
+    reservation.bytes = bytes > credit ? bytes - credit : 0;
+    reservation.files = replaced_bytes ? 0 : 1;
+    return reserve(owner, reservation);
+}
+
+std::optional<QuotaReservation> QuotaManager::reserve(const std::string& owner, QuotaReservation reservation) {
+    if (options_.max_bytes == 0 && options_.max_files == 0) {
+        ++admitted_;
+        return reservation;
+    }
+    // Usage is read under the lock: a release between the read and the lock would drop a
+    // reservation whose commit the stale usage does not yet count.
+    std::lock_guard<std::mutex> lock(reserved_mutex_);
+    const auto used = index_.usage_of(owner);
+    auto& pending = reserved_[owner];
+    const bool bytes_ok =
+        options_.max_bytes == 0 || used.bytes + pending.bytes + reservation.bytes <= options_.max_bytes;
+    const bool files_ok =
+        options_.max_files == 0 || used.files + pending.files + reservation.files <= options_.max_files;
+    if (!bytes_ok || !files_ok) {
+        if (pending.bytes == 0 && pending.files == 0) {
+            reserved_.erase(owner);
+        }
+        ++rejected_;
+        return std::nullopt;
+    }
+    pending.bytes += reservation.bytes;
+    pending.files += reservation.files;
+    ++admitted_;
+    return reservation;
+}
+
+void QuotaManager::release(const std::string& owner, const QuotaReservation& reservation) {
+    if (options_.max_bytes == 0 && options_.max_files == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(reserved_mutex_);
+    auto it = reserved_.find(owner);
+    if (it == reserved_.end()) {
+        return;
+    }
+    it->second.bytes -= std::min(it->second.bytes, reservation.bytes);
+    it->second.files -= std::min(it->second.files, reservation.files);
+    if (it->second.bytes == 0 && it->second.files == 0) {
+        reserved_.erase(it);
+    }
+}
+
+UsageStatus QuotaManager::status(const std::string& owner) {
+    UsageStatus status;
+    status.max_bytes = options_.max_bytes;
+    status.max_files = options_.max_files;
+    std::lock_guard<std::mutex> lock(reserved_mutex_);
+    status.used = index_.usage_of(owner);
+    if (auto it = reserved_.find(owner); it != reserved_.end()) {
+        status.pending = it->second;
+    }
+    return status;
+}
+
+std::string QuotaManager::stats_report() const {
+    std::ostringstream out;
+    out << "quota.max_bytes=" << options_.max_bytes << "\n";
+    out << "quota.max_files=" << options_.max_files << "\n";
+    out << "quota.admitted=" << admitted_.load() << "\n";
+    out << "quota.rejected=" << rejected_.load() << "\n";
+    out << "quota.reconciliations=" << reconciliations_.load() << "\n";
+    out << "quota.drifted_owners=" << drifted_owners_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
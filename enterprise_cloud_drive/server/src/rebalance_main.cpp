@@ -0,0 +1,57 @@
+#include "config_loader.hpp"
+#include "file_index.hpp"
+#include "storage_device.hpp"
+#include "storage_manager.hpp"
+#include "storage_rebalancer.hpp"
+#include "trash_manager.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Moves user homes to the storage devices the hash ring assigns them. Run it with the
+// server stopped, after adding a device to `storage_devices` or marking one draining.
+int main(int argc, char* argv[]) {
+    std::string config_path = "server/config/server.conf";
+    bool dry_run = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--dry-run") {
+            dry_run = true;
+        } else {
+            config_path = arg;
+        }
+    }
+
+    try {
+        auto config = cloud::server::load_config(config_path);
+        cloud::server::FileIndex file_index(config.database_file);
+        file_index.initialize_schema();
+        cloud::server::StorageManager storage(config.storage_root, {}, {}, {},
+                                              cloud::server::parse_device_specs(config.storage_devices));
+        cloud::server::TrashManager trash(
+            storage, file_index,
+            cloud::server::TrashOptions{std::chrono::seconds(config.trash_retention_seconds), config.trash_purge_rate,
+                                        config.trash_batch_rows});
+        cloud::server::StorageRebalancer rebalancer(storage, file_index, trash);
+
+        const auto& devices = storage.devices();
+        const auto moves = rebalancer.plan();
+        std::cout << moves.size() << " home(s) to move" << (dry_run ? " (dry run)" : "") << std::endl;
+        for (const auto& move : moves) {
+            std::cout << move.username << ": " << devices[move.from]->root().string() << " -> "
+                      << devices[move.to]->root().string() << std::flush;
+            if (dry_run) {
+                std::cout << std::endl;
+                continue;
+            }
+            const auto result = rebalancer.migrate(move);
+            std::cout << " (" << result.files << " files, " << result.bytes << " bytes, " << result.linked
+                      << " linked)" << std::endl;
+        }
+    } catch (const std::exception& ex) {
+        std::cerr << "Rebalance failed: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
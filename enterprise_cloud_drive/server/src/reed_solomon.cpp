@@ -0,0 +1,275 @@
+#include "reed_solomon.hpp"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace cloud::server {
+
+namespace {
+
+struct GfTables {
+    std::array<std::uint8_t, 512> exp{};
+    std::array<std::uint8_t, 256> log{};
+    std::vector<std::uint8_t> product;  // product[a * 256 + b]
+    std::array<std::array<std::uint8_t, 16>, 256> low{};   // c * n
+    std::array<std::array<std::uint8_t, 16>, 256> high{};  // c * (n << 4)
+
+    GfTables() : product(256 * 256) {
+        unsigned x = 1;
+        for (unsigned i = 0; i < 255; ++i) {
+            exp[i] = static_cast<std::uint8_t>(x);
+            log[x] = static_cast<std::uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11d;
+            }
+        }
+        for (unsigned i = 255; i < exp.size(); ++i) {
+            exp[i] = exp[i - 255];
+        }
+        for (unsigned a = 1; a < 256; ++a) {
+            for (unsigned b = 1; b < 256; ++b) {
+                product[a * 256 + b] = exp[log[a] + log[b]];
+            }
+        }
+        for (unsigned c = 0; c < 256; ++c) {
+            for (unsigned n = 0; n < 16; ++n) {
+                low[c][n] = product[c * 256 + n];
+                high[c][n] = product[c * 256 + (n << 4)];
+            }
+        }
+    }
+};
+
+const GfTables& gf() {
+    static const GfTables tables;
+    return tables;
+}
+
+std::uint8_t gf_mul(std::uint8_t a, std::uint8_t b) {
+    return gf().product[a * 256 + b];
+}
+
+std::uint8_t gf_inv(std::uint8_t a) {
+    return gf().exp[255 - gf().log[a]];
+}
+
+// dst ^= c * src
+void mul_add_scalar(std::uint8_t* dst, const std::uint8_t* src, std::uint8_t c, std::size_t length) {
+    const std::uint8_t* row = &gf().product[c * 256];
+    for (std::size_t i = 0; i < length; ++i) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#if defined(__x86_64__)
+// c * x = c * (x & 0x0f) ^ c * (x & 0xf0): two 16-entry lookups per byte via pshufb.
+__attribute__((target("avx2"))) void mul_add_avx2(std::uint8_t* dst,
+                                                  const std::uint8_t* src,
+                                                  std::uint8_t c,
+                                                  std::size_t length) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gf().low[c].data())));
+    const __m256i high =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(gf().high[c].data())));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        const __m256i lo = _mm256_shuffle_epi8(low, _mm256_and_si256(in, mask));
+        const __m256i hi = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask));
+        const __m256i out = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(out, _mm256_xor_si256(lo, hi)));
+    }
+    mul_add_scalar(dst + i, src + i, c, length - i);
+}
+
+__attribute__((target("ssse3"))) void mul_add_ssse3(std::uint8_t* dst,
+                                                    const std::uint8_t* src,
+                                                    std::uint8_t c,
+                                                    std::size_t length) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gf().low[c].data()));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gf().high[c].data()));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const __m128i lo = _mm_shuffle_epi8(low, _mm_and_si128(in, mask));
+        const __m128i hi = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        const __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(out, _mm_xor_si128(lo, hi)));
+    }
+    mul_add_scalar(dst + i, src + i, c, length - i);
+}
+#endif
+
+using MulAdd = void (*)(std::uint8_t*, const std::uint8_t*, std::uint8_t, std::size_t);
+
+struct Kernel {
+    MulAdd fn;
+    const char* name;
+};
+
+Kernel& kernel() {
+    static Kernel selected = [] {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernel{mul_add_avx2, "avx2"};
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return Kernel{mul_add_ssse3, "ssse3"};
+        }
+#endif
+        return Kernel{mul_add_scalar, "scalar"};
+    }();
+    return selected;
+}
+
+void mul_add(std::byte* dst, const std::byte* src, std::uint8_t c, std::size_t length) {
+    if (c != 0) {
+        kernel().fn(reinterpret_cast<std::uint8_t*>(dst), reinterpret_cast<const std::uint8_t*>(src), c, length);
+    }
+}
+
+// Gauss-Jordan elimination over GF(2^8); `matrix` is n x n, row-major.
+bool invert(std::vector<std::uint8_t>& matrix, unsigned n) {
+    std::vector<std::uint8_t> inverse(n * n, 0);
+    for (unsigned i = 0; i < n; ++i) {
+        inverse[i * n + i] = 1;
+    }
+    for (unsigned col = 0; col < n; ++col) {
+        unsigned pivot = col;
+        while (pivot < n && matrix[pivot * n + col] == 0) {
+            ++pivot;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        if (pivot != col) {
+            for (unsigned j = 0; j < n; ++j) {
+                std::swap(matrix[pivot * n + j], matrix[col * n + j]);
+                std::swap(inverse[pivot * n + j], inverse[col * n + j]);
+            }
+        }
+        const auto scale = gf_inv(matrix[col * n + col]);
+        for (unsigned j = 0; j < n; ++j) {
+            matrix[col * n + j] = gf_mul(matrix[col * n + j], scale);
+            inverse[col * n + j] = gf_mul(inverse[col * n + j], scale);
+        }
+        for (unsigned row = 0; row < n; ++row) {
+            const auto factor = matrix[row * n + col];
+            if (row == col || factor == 0) {
+                continue;
+            }
+            for (unsigned j = 0; j < n; ++j) {
+                matrix[row * n + j] ^= gf_mul(factor, matrix[col * n + j]);
+                inverse[row * n + j] ^= gf_mul(factor, inverse[col * n + j]);
+            }
+        }
+    }
+    matrix = std::move(inverse);
+    return true;
+}
+
+}  // namespace
+
+ReedSolomon::ReedSolomon(unsigned data_shards, unsigned parity_shards)
+    : k_(data_shards), m_(parity_shards), matrix_((data_shards + parity_shards) * data_shards, 0) {
+    if (k_ == 0 || k_ + m_ > 256) {
+        throw std::invalid_argument("Unsupported erasure code geometry");
+    }
+    for (unsigned i = 0; i < k_; ++i) {
+        matrix_[i * k_ + i] = 1;
+    }
+    for (unsigned i = 0; i < m_; ++i) {
+        for (unsigned j = 0; j < k_; ++j) {
+            matrix_[(k_ + i) * k_ + j] = gf_inv(static_cast<std::uint8_t>((k_ + i) ^ j));
+        }
+    }
+}
+
+void ReedSolomon::encode(const std::vector<const std::byte*>& data,
+                         const std::vector<std::byte*>& parity,
+                         std::size_t length) const {
+    for (unsigned i = 0; i < m_; ++i) {
+        std::memset(parity[i], 0, length);
+        for (unsigned j = 0; j < k_; ++j) {
+            mul_add(parity[i], data[j], coefficient(k_ + i, j), length);
+        }
+    }
+}
+
+bool ReedSolomon::reconstruct(const std::vector<std::byte*>& shards,
+                              const std::vector<bool>& present,
+                              std::size_t length) const {
+    std::vector<unsigned> rows;
+    bool data_missing = false;
+    for (unsigned i = 0; i < k_ + m_ && rows.size() < k_; ++i) {
+        if (present[i]) {
+            rows.push_back(i);
+        }
+    }
+    for (unsigned i = 0; i < k_; ++i) {
+        data_missing = data_missing || !present[i];
+    }
+    if (rows.size() < k_) {
+        return false;
+    }
+
+    if (data_missing) {
+        std::vector<std::uint8_t> decode(k_ * k_);
+        for (unsigned r = 0; r < k_; ++r) {
+            for (unsigned c = 0; c < k_; ++c) {
+                decode[r * k_ + c] = coefficient(rows[r], c);
+            }
+        }
+        if (!invert(decode, k_)) {
+            return false;
+        }
+        for (unsigned j = 0; j < k_; ++j) {
+            if (present[j]) {
+                continue;
+            }
+            std::memset(shards[j], 0, length);
+            for (unsigned r = 0; r < k_; ++r) {
+                mul_add(shards[j], shards[rows[r]], decode[j * k_ + r], length);
+            }
+        }
+    }
+    for (unsigned i = k_; i < k_ + m_; ++i) {
+        if (present[i]) {
+            continue;
+        }
+        std::memset(shards[i], 0, length);
+        for (unsigned j = 0; j < k_; ++j) {
+            mul_add(shards[i], shards[j], coefficient(i, j), length);
+        }
+    }
+    return true;
+}
+
+const char* ReedSolomon::kernel_name() {
+    return kernel().name;
+}
+
+bool ReedSolomon::select_kernel(std::string_view name) {
+    Kernel chosen{mul_add_scalar, "scalar"};
+#if defined(__x86_64__)
+    if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+        chosen = Kernel{mul_add_avx2, "avx2"};
+    } else if (name == "ssse3" && __builtin_cpu_supports("ssse3")) {
+        chosen = Kernel{mul_add_ssse3, "ssse3"};
+    }
+#endif
+    if (name != chosen.name) {
+        return false;
+    }
+    kernel() = chosen;
+    return true;
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,331 @@
+#include "resume_journal.hpp"
+
+#include "crc32c.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace cloud::server {
+
+namespace {
+constexpr std::size_t kCompactMinRecords = 4096;
+constexpr std::size_t kCompactRatio = 4;
+
+std::string frame_record(const std::string& payload) {
+    const auto bytes = std::as_bytes(std::span(payload.data(), payload.size()));
+    return integrity::crc32c_hex(bytes) + " " + payload + "\n";
+}
+
+// "H <total> <received> <digest state|-> <key>"; older journals only carry "P" records
+// without the digest field.
+std::string progress_payload(const std::string& key, const ResumeRecord& record) {
+    return "H " + std::to_string(record.total) + " " + std::to_string(record.received) + " " +
+           (record.digest_state.empty() ? std::string("-") : record.digest_state) + " " + key;
+}
+
+bool write_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return true;
+}
+
+void sync_directory(const std::filesystem::path& dir) {
+    const int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
+
+}  // namespace
+
+ResumeJournal::ResumeJournal(std::filesystem::path path, std::chrono::milliseconds sync_interval)
+    : path_(std::move(path)), sync_interval_(sync_interval), last_sync_(std::chrono::steady_clock::now()) {
+    if (path_.has_parent_path()) {
+        std::filesystem::create_directories(path_.parent_path());
+    }
+    replay();
+    open_for_append();
+}
+
+ResumeJournal::~ResumeJournal() {
+    stop();
+    try {
+        flush();
+    } catch (...) {
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void ResumeJournal::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (flusher_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    flusher_ = std::thread(&ResumeJournal::flusher_loop, this);
+}
+
+// Checkpoints still queued are synced and recorded before the flusher exits.
+void ResumeJournal::stop() {
+    std::thread flusher;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        flusher.swap(flusher_);
+    }
+    cv_.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+}
+
+void ResumeJournal::flusher_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait_for(lock, sync_interval_, [this] { return stopping_ || !syncs_.empty(); });
+        std::vector<PartSync> batch;
+        batch.swap(syncs_);
+        for (const auto& sync : batch) {
+            syncing_[sync.key] = true;
+        }
+        lock.unlock();
+        for (auto& sync : batch) {
+            sync.synced = ::fdatasync(sync.fd) == 0;
+            ::close(sync.fd);
+        }
+        lock.lock();
+        for (auto& sync : batch) {
+            if (sync.synced && syncing_[sync.key]) {
+                record_locked(sync.key, std::move(sync.record));
+            }
+        }
+        syncing_.clear();
+        if (!pending_.empty() && (stopping_ || std::chrono::steady_clock::now() - last_sync_ >= sync_interval_)) {
+            try {
+                flush_locked();
+            } catch (const std::exception&) {
+                // The records stay pending and are retried on the next round.
+            }
+        }
+        if (stopping_ && syncs_.empty()) {
+            return;
+        }
+    }
+}
+
+void ResumeJournal::open_for_append() {
+    fd_ = ::open(path_.c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Unable to open resume journal");
+    }
+}
+
+void ResumeJournal::replay() {
+    std::ifstream stream(path_, std::ios::binary);
+    if (!stream) {
+        return;
+    }
+    std::uint64_t valid_bytes = 0;
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (stream.eof()) {
+            break;  // no trailing newline: torn write
+        }
+        const auto space = line.find(' ');
+        if (space == std::string::npos) {
+            break;
+        }
+        const std::string payload = line.substr(space + 1);
+        const auto bytes = std::as_bytes(std::span(payload.data(), payload.size()));
+        if (!integrity::verify_crc32c(bytes, std::string_view(line).substr(0, space))) {
+            break;
+        }
+        try {
+            if (payload.rfind("P ", 0) == 0 || payload.rfind("H ", 0) == 0) {
+                const bool has_digest = payload[0] == 'H';
+                const auto total_end = payload.find(' ', 2);
+                const auto received_end = payload.find(' ', total_end + 1);
+                const auto state_end = has_digest ? payload.find(' ', received_end + 1) : received_end;
+                if (total_end == std::string::npos || received_end == std::string::npos ||
+                    state_end == std::string::npos) {
+                    break;
+                }
+                ResumeRecord record;
+                record.total = std::stoull(payload.substr(2, total_end - 2));
+                record.received = std::stoull(payload.substr(total_end + 1, received_end - total_end - 1));
+                if (has_digest) {
+                    record.digest_state = payload.substr(received_end + 1, state_end - received_end - 1);
+                    if (record.digest_state == "-") {
+                        record.digest_state.clear();
+                    }
+                }
+                entries_[payload.substr(state_end + 1)] = record;
+            } else if (payload.rfind("E ", 0) == 0) {
+                entries_.erase(payload.substr(2));
+            } else {
+                break;
+            }
+        } catch (const std::exception&) {
+            break;
+        }
+        valid_bytes += line.size() + 1;
+        ++records_;
+    }
+    stream.close();
+    if (valid_bytes != std::filesystem::file_size(path_)) {
+        std::filesystem::resize_file(path_, valid_bytes);
+    }
+}
+
+std::optional<ResumeRecord> ResumeJournal::lookup(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void ResumeJournal::progress(const std::string& key,
+                             std::uint64_t total,
+                             std::uint64_t received,
+                             std::string digest_state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    record_locked(key, ResumeRecord{total, received, std::move(digest_state)});
+}
+
+void ResumeJournal::checkpoint(int part_fd,
+                               const std::string& key,
+                               std::uint64_t total,
+                               std::uint64_t received,
+                               std::string digest_state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const int fd = flusher_.joinable() ? ::fcntl(part_fd, F_DUPFD_CLOEXEC, 0) : -1;
+        if (fd >= 0) {
+            PartSync sync{fd, key, ResumeRecord{total, received, std::move(digest_state)}};
+            auto it = std::find_if(syncs_.begin(), syncs_.end(), [&](const PartSync& queued) { return queued.key == key; });
+            if (it != syncs_.end()) {
+                ::close(it->fd);
+                *it = std::move(sync);
+            } else {
+                syncs_.push_back(std::move(sync));
+            }
+            cv_.notify_one();
+            return;
+        }
+    }
+    // No flusher (offline tools, shutdown) or no descriptor to spare: sync right here.
+    if (::fdatasync(part_fd) == 0) {
+        progress(key, total, received, std::move(digest_state));
+    }
+}
+
+void ResumeJournal::record_locked(const std::string& key, ResumeRecord record) {
+    auto& entry = entries_[key];
+    entry = std::move(record);
+    append_locked(progress_payload(key, entry));
+}
+
+void ResumeJournal::finish(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A checkpoint still in flight must not bring the record back.
+    std::erase_if(syncs_, [&](const PartSync& queued) {
+        if (queued.key != key) {
+            return false;
+        }
+        ::close(queued.fd);
+        return true;
+    });
+    if (auto it = syncing_.find(key); it != syncing_.end()) {
+        it->second = false;
+    }
+    if (entries_.erase(key) == 0) {
+        return;
+    }
+    append_locked("E " + key);
+}
+
+std::vector<std::string> ResumeJournal::keys() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::string> keys;
+    keys.reserve(entries_.size());
+    for (const auto& [key, record] : entries_) {
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+void ResumeJournal::append_locked(const std::string& payload) {
+    pending_ += frame_record(payload);
+    ++records_;
+    if (!flusher_.joinable() && std::chrono::steady_clock::now() - last_sync_ >= sync_interval_) {
+        flush_locked();
+    }
+}
+
+void ResumeJournal::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flush_locked();
+}
+
+void ResumeJournal::flush_locked() {
+    last_sync_ = std::chrono::steady_clock::now();
+    if (pending_.empty()) {
+        return;
+    }
+    if (records_ >= kCompactMinRecords && records_ > kCompactRatio * entries_.size()) {
+        compact_locked();
+        return;
+    }
+    if (!write_all(fd_, pending_) || ::fdatasync(fd_) != 0) {
+        throw std::runtime_error("Failed to persist resume journal");
+    }
+    pending_.clear();
+}
+
+// Rewrites the log as one record per live upload, then atomically swaps it in.
+void ResumeJournal::compact_locked() {
+    const auto temp_path = std::filesystem::path(path_.string() + ".tmp");
+    const int temp_fd = ::open(temp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    if (temp_fd < 0) {
+        throw std::runtime_error("Unable to create resume journal snapshot");
+    }
+    std::string snapshot;
+    for (const auto& [key, record] : entries_) {
+        snapshot += frame_record(progress_payload(key, record));
+    }
+    const bool ok = write_all(temp_fd, snapshot) && ::fdatasync(temp_fd) == 0;
+    ::close(temp_fd);
+    if (!ok) {
+        std::filesystem::remove(temp_path);
+        throw std::runtime_error("Failed to write resume journal snapshot");
+    }
+    std::filesystem::rename(temp_path, path_);
+    sync_directory(path_.parent_path());
+
+    ::close(fd_);
+    open_for_append();
+    pending_.clear();
+    records_ = entries_.size();
+}
+
+}  // namespace cloud::server
@@ -0,0 +1,135 @@
+#include "resume_sweeper.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ctime>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr off_t kTruncateStep = 64LL * 1024 * 1024;
+
+bool ends_with(const std::string& name, const std::string& suffix) {
+    return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}  // namespace
+
+ResumeSweeper::ResumeSweeper(StorageManager& storage, SweepOptions options)
+    : storage_(storage), options_(options), throttle_(options.rate, std::max(options.rate / 10, 1.0)) {}
+
+ResumeSweeper::~ResumeSweeper() {
+    stop();
+}
+
+void ResumeSweeper::start() {
+    if (options_.max_age.count() == 0 || worker_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    worker_ = std::thread(&ResumeSweeper::worker_loop, this);
+}
+
+void ResumeSweeper::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void ResumeSweeper::worker_loop() {
+    while (!stopping_) {
+        try {
+            sweep();
+        } catch (const std::exception&) {
+            // A vanished directory or a journal write error only cuts this pass short.
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, options_.interval, [this] { return stopping_.load(); });
+    }
+}
+
+void ResumeSweeper::sweep() {
+    const auto cutoff = std::time(nullptr) - static_cast<std::time_t>(options_.max_age.count());
+    for (const auto& device : storage_.devices()) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        for (const auto& username : device->homes()) {
+            std::vector<std::filesystem::path> files;
+            std::error_code ec;
+            for (const auto& entry : std::filesystem::directory_iterator(device->home(username) / ".resume", ec)) {
+                files.push_back(entry.path());
+            }
+            for (const auto& file : files) {
+                if (stopping_) {
+                    return;
+                }
+                throttle_.acquire();
+                ++scanned_;
+                const auto name = file.filename().string();
+                if (ends_with(name, ".expired")) {
+                    reclaim(file);  // left behind by an interrupted pass
+                } else if (ends_with(name, ".part") || ends_with(name, ".meta")) {
+                    if (auto retired = storage_.retire_checkpoint(file, cutoff); !retired.empty()) {
+                        ++expired_;
+                        reclaim(retired);
+                    }
+                }
+            }
+        }
+    }
+    journal_pruned_ += storage_.prune_resume_journal();
+    ++passes_;
+}
+
+// A retired file interrupted by shutdown keeps its `.expired` name and is finished on
+// the next pass.
+void ResumeSweeper::reclaim(const std::filesystem::path& file) {
+    const int fd = ::open(file.c_str(), O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+    struct stat st {};
+    if (fd >= 0 && ::fstat(fd, &st) == 0) {
+        for (auto size = st.st_size; size > kTruncateStep;) {
+            if (stopping_) {
+                ::close(fd);
+                return;
+            }
+            size -= kTruncateStep;
+            throttle_.acquire();
+            if (::ftruncate(fd, size) != 0) {
+                break;
+            }
+        }
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (::unlink(file.c_str()) == 0) {
+        reclaimed_bytes_ += static_cast<std::uint64_t>(st.st_blocks) * 512;
+    }
+}
+
+std::string ResumeSweeper::stats_report() const {
+    std::ostringstream out;
+    out << "sweep.max_age_seconds=" << options_.max_age.count() << "\n";
+    out << "sweep.passes=" << passes_.load() << "\n";
+    out << "sweep.scanned=" << scanned_.load() << "\n";
+    out << "sweep.expired=" << expired_.load() << "\n";
+    out << "sweep.reclaimed_bytes=" << reclaimed_bytes_.load() << "\n";
+    out << "sweep.journal_pruned=" << journal_pruned_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
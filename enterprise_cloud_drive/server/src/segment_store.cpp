@@ -0,0 +1,508 @@
+#include "segment_store.hpp"
+
+#include "file_io.hpp"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr std::size_t kPackBatch = 256;
+constexpr const char* kSegmentsDir = ".segments";
+
+}  // namespace
+
+SegmentStore::File::~File() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+SegmentStore::SegmentStore(const std::vector<std::unique_ptr<StorageDevice>>& devices, SegmentOptions options)
+    : devices_(devices), options_(options) {
+    options_.segment_bytes = std::max<std::uint64_t>(options_.segment_bytes, options_.max_file_bytes);
+}
+
+SegmentStore::~SegmentStore() {
+    stop();
+}
+
+void SegmentStore::start() {
+    if (!enabled() || worker_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    worker_ = std::thread(&SegmentStore::worker_loop, this);
+}
+
+void SegmentStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void SegmentStore::enqueue(StorageDevice& device, const std::string& md5) {
+    if (!enabled() || !BlobStore::valid_digest(md5)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(Job{&device, md5});
+    }
+    cv_.notify_one();
+}
+
+// Packs whatever has queued up as one batch; when idle, retries objects that were
+// being read and compacts on its interval.
+void SegmentStore::worker_loop() {
+    scan_objects();
+    auto next_compaction = std::chrono::steady_clock::now() + options_.compact_interval;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (queue_.empty()) {
+            auto wake = next_compaction;
+            if (!deferred_.empty()) {
+                wake = std::min(wake, std::chrono::steady_clock::now() + std::chrono::seconds(1));
+            }
+            cv_.wait_until(lock, wake, [this] { return stopping_ || !queue_.empty(); });
+            if (stopping_) {
+                break;
+            }
+            if (queue_.empty()) {
+                queue_.insert(queue_.end(), deferred_.begin(), deferred_.end());
+                deferred_.clear();
+                if (std::chrono::steady_clock::now() >= next_compaction) {
+                    lock.unlock();
+                    compact();
+                    lock.lock();
+                    next_compaction = std::chrono::steady_clock::now() + options_.compact_interval;
+                }
+                continue;
+            }
+        }
+        std::vector<Job> batch;
+        while (!queue_.empty() && batch.size() < kPackBatch) {
+            batch.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+        lock.unlock();
+        std::vector<Job> busy;
+        pack(batch, busy);
+        lock.lock();
+        deferred_.insert(deferred_.end(), busy.begin(), busy.end());
+    }
+    for (auto& [device, writer] : writers_) {
+        ::close(writer.fd);
+    }
+    writers_.clear();
+}
+
+// Small objects committed while the worker was not running (or before packing was
+// turned on) are picked up at startup.
+void SegmentStore::scan_objects() {
+    for (const auto& device : devices_) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(device->root() / ".objects", ec)) {
+            std::error_code status_ec;
+            if (!entry.is_regular_file(status_ec)) {
+                continue;
+            }
+            const auto size = entry.file_size(status_ec);
+            if (status_ec || size == 0 || size > options_.max_file_bytes) {
+                continue;
+            }
+            const auto name = entry.path().filename().string();
+            if (BlobStore::valid_digest(name) && !BlobStore::stub_digest(entry.path()) &&
+                !BlobStore::packed_digest(entry.path())) {
+                enqueue(*device, name);
+            }
+        }
+    }
+}
+
+// The open segment of a device. Bytes past its last indexed blob were appended by a
+// batch that never got published, and are cut off when the segment is reopened.
+SegmentStore::Writer& SegmentStore::writer_for(StorageDevice& device) {
+    if (auto it = writers_.find(&device); it != writers_.end()) {
+        return it->second;
+    }
+    const auto root = device.root().string();
+    std::error_code ec;
+    std::filesystem::create_directories(device.root() / kSegmentsDir, ec);
+    Writer writer;
+    bool created = false;
+    if (const auto open = index_->open_segment(root)) {
+        writer.id = open->id;
+        writer.end = index_->segment_end(writer.id);
+    } else {
+        writer.id = index_->add_segment(root);
+        created = true;
+    }
+    const auto path = segment_path(root, writer.id);
+    writer.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (writer.fd < 0 || ::ftruncate(writer.fd, static_cast<off_t>(writer.end)) != 0) {
+        if (writer.fd >= 0) {
+            ::close(writer.fd);
+        }
+        throw std::runtime_error("Unable to open segment " + path.string());
+    }
+    if (created) {
+        sync_directory(path.parent_path());
+    }
+    return writers_.emplace(&device, writer).first->second;
+}
+
+bool SegmentStore::append(Writer& writer, const std::byte* data, std::size_t length) {
+    if (!write_full(writer.fd, data, length, writer.end)) {
+        return false;
+    }
+    writer.end += length;
+    return true;
+}
+
+void SegmentStore::seal_if_full(StorageDevice& device) {
+    auto it = writers_.find(&device);
+    if (it == writers_.end() || it->second.end < options_.segment_bytes) {
+        return;
+    }
+    index_->seal_segment(it->second.id);
+    ::close(it->second.fd);
+    writers_.erase(it);
+}
+
+bool SegmentStore::has_readers(const struct stat& st) {
+    std::lock_guard<std::mutex> lock(readers_mutex_);
+    return readers_.count({st.st_dev, st.st_ino}) != 0;
+}
+
+// Appends every object of the batch, syncs each segment once and publishes all the
+// offsets in one transaction; only then are the objects turned into stubs, so a crash
+// at any point leaves either the plain object or a stub whose blob is indexed.
+void SegmentStore::pack(std::vector<Job>& batch, std::vector<Job>& busy) {
+    struct Candidate {
+        Job job;
+        int fd;
+        struct stat st;
+        PackedBlob blob;
+        bool appended;
+    };
+    std::vector<Candidate> candidates;
+    std::set<StorageDevice*> touched;
+    std::vector<std::byte> buffer;
+    for (auto& job : batch) {
+        const auto object = job.device->blobs().object_path(job.md5);
+        const int fd = ::open(object.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0 || st.st_size == 0 || static_cast<std::uint64_t>(st.st_size) > options_.max_file_bytes ||
+            BlobStore::stub_digest(fd) || BlobStore::packed_digest(fd)) {
+            ::close(fd);
+            continue;
+        }
+        if (has_readers(st)) {
+            busy.push_back(std::move(job));
+            ::close(fd);
+            continue;
+        }
+        // Already packed from another device's copy, or by an attempt that was interrupted
+        // before the stub was made.
+        if (const auto existing = index_->find_packed(job.md5)) {
+            candidates.push_back(Candidate{std::move(job), fd, st, *existing, false});
+            continue;
+        }
+        const auto size = static_cast<std::size_t>(st.st_size);
+        buffer.resize(size);
+        Writer* writer = nullptr;
+        try {
+            writer = &writer_for(*job.device);
+        } catch (const std::exception&) {
+        }
+        const auto offset = writer ? writer->end : 0;
+        if (!writer || !read_full(fd, buffer.data(), size, 0) || !append(*writer, buffer.data(), size)) {
+            ++skipped_;
+            ::close(fd);
+            continue;
+        }
+        touched.insert(job.device);
+        PackedBlob blob{job.md5, writer->id, offset, size};
+        candidates.push_back(Candidate{std::move(job), fd, st, std::move(blob), true});
+    }
+
+    std::set<StorageDevice*> unsynced;
+    for (auto* device : touched) {
+        if (::fdatasync(writers_.at(device).fd) != 0) {
+            unsynced.insert(device);
+        }
+    }
+    bool published = true;
+    try {
+        index_->transaction([&] {
+            for (const auto& candidate : candidates) {
+                if (candidate.appended && unsynced.count(candidate.job.device) == 0) {
+                    index_->add_packed(candidate.blob);
+                }
+            }
+        });
+    } catch (const std::exception&) {
+        published = false;
+    }
+
+    for (auto& candidate : candidates) {
+        const bool indexed = !candidate.appended || (published && unsynced.count(candidate.job.device) == 0);
+        if (!indexed) {
+            ++skipped_;
+            ::close(candidate.fd);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(readers_mutex_);
+            if (readers_.count({candidate.st.st_dev, candidate.st.st_ino}) != 0) {
+                busy.push_back(std::move(candidate.job));
+                ::close(candidate.fd);
+                continue;
+            }
+            const auto& md5 = candidate.job.md5;
+            if (::fsetxattr(candidate.fd, BlobStore::kPackedXattr, md5.data(), md5.size(), 0) != 0) {
+                ++skipped_;
+                ::close(candidate.fd);
+                continue;
+            }
+            // A partial last block is only zeroed, and for small files it is most of the data.
+            const off_t block = candidate.st.st_blksize > 0 ? candidate.st.st_blksize : 4096;
+            const off_t span = (candidate.st.st_size + block - 1) / block * block;
+            if (::fallocate(candidate.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, span) != 0) {
+                ::fremovexattr(candidate.fd, BlobStore::kPackedXattr);
+                ++skipped_;
+                ::close(candidate.fd);
+                continue;
+            }
+            // Punching bumps mtime; the content is unchanged, so put it back.
+            const struct timespec times[2] = {{0, UTIME_OMIT}, candidate.st.st_mtim};
+            ::futimens(candidate.fd, times);
+        }
+        ::close(candidate.fd);
+        ++packed_objects_;
+        packed_bytes_ += candidate.blob.length;
+    }
+    for (auto* device : touched) {
+        seal_if_full(*device);
+    }
+}
+
+// Rewrites sealed segments that are mostly garbage: their live blobs are appended to
+// the device's open segment and re-pointed in one transaction, then the old file goes.
+void SegmentStore::compact() {
+    for (const auto& segment : index_->sealed_segments()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_) {
+                return;
+            }
+        }
+        auto* device = device_at(segment.device);
+        if (!device || device->state() == DeviceState::failed) {
+            continue;
+        }
+        if (segment.live_bytes == 0) {
+            retire(segment);
+            continue;
+        }
+        const auto path = segment_path(segment.device, segment.id);
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(path, ec);
+        if (ec || size <= segment.live_bytes ||
+            static_cast<double>(size - segment.live_bytes) < options_.compact_ratio * static_cast<double>(size)) {
+            continue;
+        }
+
+        const int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            continue;
+        }
+        Writer* writer = nullptr;
+        try {
+            writer = &writer_for(*device);
+        } catch (const std::exception&) {
+            ::close(in);
+            continue;
+        }
+        std::vector<PackedBlob> moved;
+        std::vector<std::byte> buffer;
+        bool ok = true;
+        for (const auto& blob : index_->packed_in(segment.id)) {
+            buffer.resize(static_cast<std::size_t>(blob.length));
+            const auto offset = writer->end;
+            if (!read_full(in, buffer.data(), buffer.size(), blob.offset) ||
+                !append(*writer, buffer.data(), buffer.size())) {
+                ok = false;
+                break;
+            }
+            moved.push_back(PackedBlob{blob.md5, writer->id, offset, blob.length});
+        }
+        ::close(in);
+        if (!ok || ::fdatasync(writer->fd) != 0) {
+            ++skipped_;
+            continue;
+        }
+        try {
+            index_->transaction([&] {
+                for (const auto& blob : moved) {
+                    index_->move_packed(blob, segment.id);
+                }
+            });
+        } catch (const std::exception&) {
+            ++skipped_;
+            continue;
+        }
+        for (const auto& blob : moved) {
+            compacted_bytes_ += blob.length;
+        }
+        ++compactions_;
+        seal_if_full(*device);
+        retire(segment);
+    }
+}
+
+// Deletes a segment nothing points into any more. Readers that already opened it keep
+// their descriptor; new lookups see the blobs' new homes.
+void SegmentStore::retire(const SegmentInfo& segment) {
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    if (!index_->packed_in(segment.id).empty()) {
+        return;
+    }
+    index_->remove_segment(segment.id);
+    files_.erase(segment.id);
+    const auto path = segment_path(segment.device, segment.id);
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (!ec && std::filesystem::remove(path, ec)) {
+        reclaimed_bytes_ += size;
+    }
+}
+
+std::optional<SegmentStore::Extent> SegmentStore::open_reader(int fd, const struct stat& st) {
+    std::optional<std::string> md5;
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex_);
+        ++readers_[{st.st_dev, st.st_ino}];
+        md5 = index_ ? BlobStore::packed_digest(fd) : std::nullopt;
+    }
+    if (!md5) {
+        return std::nullopt;
+    }
+    Extent extent;
+    std::lock_guard<std::mutex> lock(files_mutex_);
+    const auto blob = index_->find_packed(*md5);
+    if (!blob) {
+        return extent;
+    }
+    extent.offset = blob->offset;
+    extent.length = blob->length;
+    auto& slot = files_[blob->segment];
+    auto file = slot.lock();
+    if (!file) {
+        if (const auto segment = index_->find_segment(blob->segment)) {
+            auto opened = std::make_shared<File>();
+            opened->fd = ::open(segment_path(segment->device, segment->id).c_str(), O_RDONLY | O_CLOEXEC);
+            if (opened->fd >= 0) {
+                file = opened;
+                slot = file;
+            }
+        }
+    }
+    extent.file = std::move(file);
+    return extent;
+}
+
+void SegmentStore::close_reader(const struct stat& st) {
+    std::lock_guard<std::mutex> lock(readers_mutex_);
+    auto it = readers_.find({st.st_dev, st.st_ino});
+    if (it != readers_.end() && --it->second == 0) {
+        readers_.erase(it);
+    }
+}
+
+// A packed blob is one contiguous extent, so any range of it is a single pread.
+std::vector<std::byte> SegmentStore::read(const Extent& extent, std::uint64_t offset, std::size_t length) {
+    ++reads_;
+    if (!extent.file) {
+        ++failed_reads_;
+        throw std::runtime_error("Packed object unavailable");
+    }
+    if (offset >= extent.length) {
+        return {};
+    }
+    std::vector<std::byte> out(static_cast<std::size_t>(std::min<std::uint64_t>(length, extent.length - offset)));
+    if (!read_full(extent.file->fd, out.data(), out.size(), extent.offset + offset)) {
+        ++failed_reads_;
+        throw std::runtime_error("Packed object unreadable");
+    }
+    return out;
+}
+
+void SegmentStore::drop(const std::string& md5) {
+    if (!index_) {
+        return;
+    }
+    for (const auto& device : devices_) {
+        if (device->state() != DeviceState::failed && device->blobs().contains(md5)) {
+            return;
+        }
+    }
+    index_->remove_packed(md5);
+}
+
+StorageDevice* SegmentStore::device_at(const std::string& root) const {
+    for (const auto& device : devices_) {
+        if (device->root().string() == root) {
+            return device.get();
+        }
+    }
+    return nullptr;
+}
+
+std::filesystem::path SegmentStore::segment_path(const std::string& device, std::int64_t id) const {
+    return std::filesystem::path(device) / kSegmentsDir / (std::to_string(id) + ".seg");
+}
+
+std::string SegmentStore::stats_report() const {
+    std::size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending = queue_.size() + deferred_.size();
+    }
+    std::ostringstream out;
+    out << "pack.max_file_bytes=" << options_.max_file_bytes << "\n";
+    out << "pack.pending=" << pending << "\n";
+    out << "pack.packed_objects=" << packed_objects_.load() << "\n";
+    out << "pack.packed_bytes=" << packed_bytes_.load() << "\n";
+    out << "pack.skipped=" << skipped_.load() << "\n";
+    out << "pack.reads=" << reads_.load() << "\n";
+    out << "pack.failed_reads=" << failed_reads_.load() << "\n";
+    out << "pack.compactions=" << compactions_.load() << "\n";
+    out << "pack.compacted_bytes=" << compacted_bytes_.load() << "\n";
+    out << "pack.reclaimed_bytes=" << reclaimed_bytes_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
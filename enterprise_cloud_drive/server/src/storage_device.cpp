@@ -0,0 +1,145 @@
+#include "storage_device.hpp"
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace cloud::server {
+
+namespace {
+
+constexpr const char* kObjectsDir = ".objects";
+constexpr const char* kTrashDir = ".trash";
+
+// A device whose root cannot be created (unmounted, read-only, gone) is treated as
+// failed rather than taking the whole server down.
+DeviceSpec probe(DeviceSpec spec) {
+    if (spec.state != DeviceState::failed) {
+        std::error_code ec;
+        std::filesystem::create_directories(spec.root, ec);
+        if (ec || !std::filesystem::is_directory(spec.root, ec)) {
+            spec.state = DeviceState::failed;
+        }
+    }
+    return spec;
+}
+
+DeviceState parse_state(const std::string& value) {
+    if (value.empty() || value == "active") {
+        return DeviceState::active;
+    }
+    if (value == "draining") {
+        return DeviceState::draining;
+    }
+    if (value == "failed") {
+        return DeviceState::failed;
+    }
+    throw std::invalid_argument("Unknown storage device state: " + value);
+}
+
+}  // namespace
+
+const char* to_string(DeviceState state) {
+    switch (state) {
+        case DeviceState::active:
+            return "active";
+        case DeviceState::draining:
+            return "draining";
+        case DeviceState::failed:
+            return "failed";
+    }
+    return "unknown";
+}
+
+std::vector<DeviceSpec> parse_device_specs(const std::string& list) {
+    std::vector<DeviceSpec> specs;
+    std::istringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        std::istringstream fields(entry);
+        std::string path;
+        std::string weight;
+        std::string state;
+        std::getline(fields, path, ':');
+        std::getline(fields, weight, ':');
+        std::getline(fields, state, ':');
+        if (path.empty()) {
+            continue;
+        }
+        DeviceSpec spec;
+        spec.root = path;
+        spec.weight = weight.empty() ? 1 : static_cast<unsigned>(std::stoul(weight));
+        spec.state = parse_state(state);
+        specs.push_back(std::move(spec));
+    }
+    return specs;
+}
+
+StorageDevice::StorageDevice(DeviceSpec spec) : spec_(probe(std::move(spec))), blobs_(spec_.root / kObjectsDir) {}
+
+bool StorageDevice::has_home(const std::string& username) const {
+    std::error_code ec;
+    return std::filesystem::is_directory(home(username), ec);
+}
+
+bool StorageDevice::same_filesystem(const std::filesystem::path& path) const {
+    struct stat root {};
+    struct stat other {};
+    return ::stat(spec_.root.c_str(), &root) == 0 && ::stat(path.c_str(), &other) == 0 && root.st_dev == other.st_dev;
+}
+
+std::vector<std::string> StorageDevice::homes() const {
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(spec_.root, ec)) {
+        auto name = entry.path().filename().string();
+        if (!name.empty() && name[0] != '.' && entry.is_directory(ec)) {
+            names.push_back(std::move(name));
+        }
+    }
+    return names;
+}
+
+std::filesystem::path StorageDevice::trash_root() const {
+    return spec_.root / kTrashDir;
+}
+
+void StorageDevice::start_io(std::size_t threads) {
+    if (spec_.state != DeviceState::failed) {
+        io_.start(threads);
+    }
+}
+
+void StorageDevice::stop_io() {
+    io_.shutdown();
+}
+
+void StorageDevice::submit(std::function<void()> task) {
+    ++queued_;
+    io_.submit([this, task = std::move(task)] {
+        task();
+        ++completed_;
+    });
+}
+
+std::string StorageDevice::report(std::size_t index) const {
+    const auto prefix = "device." + std::to_string(index) + ".";
+    std::uint64_t free_bytes = 0;
+    if (struct statvfs fs {}; spec_.state != DeviceState::failed && ::statvfs(spec_.root.c_str(), &fs) == 0) {
+        free_bytes = static_cast<std::uint64_t>(fs.f_bavail) * fs.f_frsize;
+    }
+    const auto done = completed_.load();
+    std::ostringstream out;
+    out << prefix << "root=" << spec_.root.string() << "\n";
+    out << prefix << "weight=" << spec_.weight << "\n";
+    out << prefix << "state=" << to_string(spec_.state) << "\n";
+    out << prefix << "free_bytes=" << free_bytes << "\n";
+    out << prefix << "admitted_bytes=" << admitted_.load() << "\n";
+    out << prefix << "io_queued=" << queued_.load() - done << "\n";
+    out << prefix << "io_completed=" << done << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
@@ -1,23 +1,120 @@
 #include "storage_manager.hpp"
 
+#include "file_io.hpp"
+
+#include <dirent.h>
 #include <fcntl.h>
-#include <openssl/md5.h>
+#include <openssl/evp.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <climits>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iomanip>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 
 namespace cloud::server {
 
 namespace {
 constexpr std::uint64_t kMmapThreshold = 100ULL * 1024 * 1024;
 constexpr std::size_t kReadChunk = 1024 * 1024;
+constexpr const char* kJournalName = ".resume.journal";
+
+// Download access-pattern tuning.
+constexpr std::uint64_t kSequentialSlack = 16ULL * 1024 * 1024;  // pipelined fetches arrive out of order
+constexpr unsigned kSequentialStreak = 2;
+constexpr std::uint64_t kInitialReadahead = 2ULL * 1024 * 1024;
+constexpr std::uint64_t kMaxReadahead = 32ULL * 1024 * 1024;
+constexpr std::uint64_t kDropBehindMinFile = 256ULL * 1024 * 1024;
+constexpr std::uint64_t kDropBehindLag = 32ULL * 1024 * 1024;
+constexpr std::uint64_t kDropBehindStep = 8ULL * 1024 * 1024;
+constexpr unsigned kResidencyProbes = 64;
+constexpr unsigned kResidentProbesWarm = 8;
+
+// O_DIRECT offsets, lengths and buffers are kept aligned to this; it covers 512e and
+// 4Kn devices alike.
+constexpr std::size_t kDirectAlignment = 4096;
+
+// Copies `length` bytes between two files inside the kernel; on filesystems that
+// support it the range is shared (reflinked) rather than copied. Pairs the call
+// refuses (different filesystems, special files) fall back to a read/write loop.
+bool copy_range(int from, std::uint64_t from_offset, int to, std::uint64_t to_offset, std::uint64_t length) {
+    auto in = static_cast<loff_t>(from_offset);
+    auto out = static_cast<loff_t>(to_offset);
+    while (length > 0) {
+        const ssize_t copied = ::copy_file_range(from, &in, to, &out, static_cast<std::size_t>(length), 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            break;
+        }
+        if (copied <= 0) {
+            return false;
+        }
+        length -= static_cast<std::uint64_t>(copied);
+    }
+    std::vector<std::byte> buffer(length > 0 ? std::min<std::uint64_t>(length, kReadChunk) : 0);
+    while (length > 0) {
+        const auto want = static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), length));
+        const ssize_t got = ::pread(from, buffer.data(), want, in);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0 || !write_full(to, buffer.data(), static_cast<std::size_t>(got), static_cast<std::uint64_t>(out))) {
+            return false;
+        }
+        in += got;
+        out += got;
+        length -= static_cast<std::uint64_t>(got);
+    }
+    return true;
+}
+
+// Probes pages spread evenly over the file with mincore(). A file with a good share
+// of them resident was read (or written) recently, so its pages are worth keeping.
+bool mostly_cached(int fd, std::uint64_t size) {
+    if (size == 0) {
+        return false;
+    }
+    void* map = ::mmap(nullptr, static_cast<std::size_t>(size), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    const auto pages = (size + page - 1) / page;
+    unsigned resident = 0;
+    for (unsigned i = 0; i < kResidencyProbes; ++i) {
+        const auto index = pages * i / kResidencyProbes;
+        unsigned char state = 0;
+        if (::mincore(static_cast<char*>(map) + index * page, static_cast<std::size_t>(page), &state) == 0 &&
+            (state & 1)) {
+            ++resident;
+        }
+    }
+    ::munmap(map, static_cast<std::size_t>(size));
+    return resident >= kResidentProbesWarm;
+}
+
+// What the part still has to allocate to reach its full size.
+std::uint64_t unallocated_bytes(const UploadCheckpoint& checkpoint) {
+    std::uint64_t allocated = 0;
+    if (struct stat st {}; ::stat(checkpoint.temp_path.c_str(), &st) == 0) {
+        allocated = static_cast<std::uint64_t>(st.st_blocks) * 512;
+    }
+    return (checkpoint.total > allocated ? checkpoint.total - allocated : 0) + checkpoint.rebuild_bytes;
+}
 
 std::uint64_t last_write_offset(const UploadCheckpoint& checkpoint) {
     if (!std::filesystem::exists(checkpoint.temp_path)) {
@@ -26,57 +123,236 @@ std::uint64_t last_write_offset(const UploadCheckpoint& checkpoint) {
     return std::filesystem::file_size(checkpoint.temp_path);
 }
 
-void write_meta(const UploadCheckpoint& checkpoint) {
-    std::ofstream meta(checkpoint.meta_path, std::ios::trunc);
-    meta << "path=" << checkpoint.final_path.string() << "\n";
-    meta << "total=" << checkpoint.total << "\n";
-    meta << "received=" << checkpoint.received << "\n";
-    meta.flush();
+std::string digest_hex(const unsigned char* digest) {
+    std::ostringstream oss;
+    oss << std::hex;
+    for (std::size_t i = 0; i < Md5::kDigestBytes; ++i) {
+        oss << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+    }
+    return oss.str();
 }
 
-UploadCheckpoint read_meta(const std::filesystem::path& meta_path, const std::filesystem::path& final_path) {
-    UploadCheckpoint cp;
-    cp.meta_path = meta_path;
-    cp.final_path = final_path;
-    cp.active = std::filesystem::exists(meta_path);
-    if (!cp.active) {
-        return cp;
+// Hashes the whole file and closes `fd`.
+std::string md5_of(int fd) {
+    const std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    bool ok = ctx && EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr) == 1;
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    std::vector<std::byte> buf(kReadChunk);
+    for (std::uint64_t offset = 0; ok;) {
+        const ssize_t got = ::pread(fd, buf.data(), buf.size(), static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            ok = got == 0;
+            break;
+        }
+        ok = EVP_DigestUpdate(ctx.get(), buf.data(), static_cast<size_t>(got)) == 1;
+        offset += static_cast<std::uint64_t>(got);
+    }
+    ::close(fd);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (!ok || EVP_DigestFinal_ex(ctx.get(), digest, &digest_length) != 1) {
+        throw std::runtime_error("Unable to read file for MD5");
     }
+    return digest_hex(digest);
+}
 
+// Upload progress used to live in per-upload `.meta` text files; they are read once
+// so in-flight uploads survive the switch to the resume journal.
+std::optional<std::uint64_t> read_legacy_meta(const std::filesystem::path& meta_path) {
     std::ifstream meta(meta_path);
+    if (!meta) {
+        return std::nullopt;
+    }
     std::string line;
     while (std::getline(meta, line)) {
-        const auto pos = line.find('=');
-        if (pos == std::string::npos) {
-            continue;
+        if (line.rfind("received=", 0) == 0) {
+            try {
+                return std::stoull(line.substr(9));
+            } catch (const std::exception&) {
+                return std::nullopt;
+            }
         }
-        const auto key = line.substr(0, pos);
-        const auto value = line.substr(pos + 1);
-        if (key == "total") {
-            cp.total = std::stoull(value);
-        } else if (key == "received") {
-            cp.received = std::stoull(value);
-        } else if (key == "path") {
-            cp.final_path = value;
+    }
+    return std::nullopt;
+}
+
+bool has_homes(const std::filesystem::path& root) {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(root, ec)) {
+        const auto name = entry.path().filename().string();
+        if (!name.empty() && name[0] != '.' && name != "lost+found" && entry.is_directory(ec)) {
+            return true;
         }
     }
-    return cp;
+    return false;
 }
 
 }  // namespace
 
-StorageManager::StorageManager(std::filesystem::path root) : root_(std::move(root)) {
+StorageManager::StorageManager(std::filesystem::path root,
+                               ResumeOptions resume_options,
+                               DirectIoOptions direct_options,
+                               SpaceOptions space_options,
+                               std::vector<DeviceSpec> devices,
+                               ErasureOptions erasure_options,
+                               SegmentOptions segment_options)
+    : root_(std::move(root)),
+      erasure_(devices_, erasure_options),
+      segments_(devices_, segment_options),
+      resolver_([this](const std::string& username) { return device_for(username).home(username); }),
+      resume_options_(resume_options),
+      direct_options_(direct_options),
+      space_options_(space_options),
+      journal_(root_ / kJournalName, resume_options.sync_interval),
+      direct_buffers_(std::max(direct_options.buffer_bytes, kDirectAlignment),
+                      kDirectAlignment,
+                      std::max<std::size_t>(direct_options.max_buffers, 1)) {
     std::filesystem::create_directories(root_);
+    if (devices.empty()) {
+        devices.push_back(DeviceSpec{root_, 1, DeviceState::active});
+    } else if (std::none_of(devices.begin(), devices.end(),
+                            [this](const DeviceSpec& spec) {
+                                std::error_code ec;
+                                return std::filesystem::equivalent(spec.root, root_, ec);
+                            }) &&
+               has_homes(root_)) {
+        // Homes created before storage_devices was set would silently vanish.
+        throw std::runtime_error("storage_root " + root_.string() +
+                                 " holds user homes but is not in storage_devices; list it (e.g. as draining) "
+                                 "and run cloud_drive_rebalance");
+    }
+    for (auto& spec : devices) {
+        devices_.push_back(std::make_unique<StorageDevice>(std::move(spec)));
+        const auto& device = *devices_.back();
+        if (device.state() == DeviceState::active && device.weight() > 0) {
+            ring_.add(devices_.size() - 1, device.root().string(), device.weight());
+        }
+    }
 }
 
 std::filesystem::path StorageManager::user_root(const std::string& username) const {
-    auto path = root_ / username;
-    std::filesystem::create_directories(path);
-    return path;
+    return resolver_.user_root(username);
+}
+
+// An existing home wins over the ring: homes only move when the rebalancer moves them.
+std::size_t StorageManager::locate_home(const std::string& username) const {
+    std::lock_guard<std::mutex> lock(homes_mutex_);
+    if (auto it = homes_.find(username); it != homes_.end()) {
+        return it->second;
+    }
+    const auto target = ring_.locate(username);
+    std::optional<std::size_t> found;
+    for (std::size_t i = 0; i < devices_.size(); ++i) {
+        if (devices_[i]->has_home(username) && (!found || i == target)) {
+            found = i;
+        }
+    }
+    if (!found) {
+        found = target;
+    }
+    if (!found) {
+        throw std::runtime_error("No storage device accepts new users");
+    }
+    if (devices_[*found]->state() == DeviceState::failed) {
+        throw std::runtime_error("Storage device unavailable");
+    }
+    homes_.emplace(username, *found);
+    return *found;
+}
+
+StorageDevice& StorageManager::device_for(const std::string& username) const {
+    return *devices_[locate_home(username)];
+}
+
+StorageDevice* StorageManager::device_containing(const std::filesystem::path& path) const {
+    for (const auto& device : devices_) {
+        const auto [root_end, path_it] =
+            std::mismatch(device->root().begin(), device->root().end(), path.begin(), path.end());
+        if (root_end == device->root().end()) {
+            return device.get();
+        }
+    }
+    return nullptr;
+}
+
+std::optional<std::size_t> StorageManager::placement(const std::string& username) const {
+    return ring_.locate(username);
+}
+
+// The user's own device first; a blob elsewhere is still readable, just not linkable.
+// Stubs have no data to read in place and are skipped.
+std::filesystem::path StorageManager::find_blob(const std::string& username, const std::string& md5) const {
+    auto& home = device_for(username);
+    auto readable = [&md5](StorageDevice& device) {
+        if (!device.blobs().contains(md5)) {
+            return false;
+        }
+        const auto object = device.blobs().object_path(md5);
+        return !BlobStore::stub_digest(object) && !BlobStore::packed_digest(object);
+    };
+    if (readable(home)) {
+        return home.blobs().object_path(md5);
+    }
+    for (const auto& device : devices_) {
+        if (device.get() != &home && device->state() != DeviceState::failed && readable(*device)) {
+            return device->blobs().object_path(md5);
+        }
+    }
+    return {};
+}
+
+void StorageManager::schedule_erasure(const std::string& username, const std::string& md5) {
+    erasure_.enqueue(device_for(username), md5);
+}
+
+void StorageManager::schedule_packing(const std::string& username, const std::string& md5) {
+    segments_.enqueue(device_for(username), md5);
+}
+
+bool StorageManager::release_blob(StorageDevice& device, const std::string& md5) {
+    if (!device.blobs().release(md5)) {
+        return false;
+    }
+    if (!device.blobs().contains(md5)) {
+        erasure_.drop(md5);
+        segments_.drop(md5);
+    }
+    return true;
+}
+
+void StorageManager::release_replaced(const std::string& username, const std::string& md5) {
+    auto& device = device_for(username);
+    device.submit([this, &device, md5] { release_blob(device, md5); });
+}
+
+void StorageManager::start_io(std::size_t threads_per_device) {
+    for (auto& device : devices_) {
+        device->start_io(threads_per_device);
+    }
+    erasure_.start();
+    segments_.start();
+    journal_.start();
+}
+
+void StorageManager::stop_io() {
+    segments_.stop();
+    erasure_.stop();
+    for (auto& device : devices_) {
+        device->stop_io();
+    }
+    journal_.stop();
 }
 
+void StorageManager::submit_io(const std::string& username, std::function<void()> task) {
+    device_for(username).submit(std::move(task));
+}
+
+// Part files keep their uncanonicalized location: it doubles as the resume journal key.
 std::filesystem::path StorageManager::checkpoint_dir(const std::string& username) const {
-    auto dir = user_root(username) / ".resume";
+    auto dir = device_for(username).home(username) / ".resume";
     std::filesystem::create_directories(dir);
     return dir;
 }
@@ -89,46 +365,147 @@ std::filesystem::path StorageManager::temp_file(const std::string& username, con
     return checkpoint_dir(username) / (md5 + ".part");
 }
 
-std::filesystem::path StorageManager::sanitize_path(const std::filesystem::path& base,
-                                                    const std::filesystem::path& relative) const {
-    auto target = base / relative;
-    auto canonical_base = std::filesystem::weakly_canonical(base);
-    auto canonical_target = std::filesystem::weakly_canonical(target);
-    if (canonical_target.string().rfind(canonical_base.string(), 0) != 0) {
-        throw std::runtime_error("Path traversal detected");
-    }
-    return canonical_target;
-}
-
 std::filesystem::path StorageManager::resolve(const std::string& username,
                                               const std::filesystem::path& relative) const {
-    return sanitize_path(user_root(username), relative);
+    return resolver_.resolve(username, relative);
 }
 
+// Entries are stat'ed relative to the directory descriptor without following
+// symlinks, so a link in the home cannot reveal what it points to.
 std::vector<DirEntry> StorageManager::list(const std::string& username, const std::filesystem::path& relative_path) {
     std::vector<DirEntry> entries;
-    const auto target = resolve(username, relative_path);
-    if (!std::filesystem::exists(target)) {
+    const int fd = resolver_.open(username, relative_path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return entries;
+    }
+    DIR* dir = ::fdopendir(fd);
+    if (!dir) {
+        ::close(fd);
         return entries;
     }
-    for (const auto& entry : std::filesystem::directory_iterator(target)) {
+    while (const dirent* entry = ::readdir(dir)) {
+        const std::string_view name(entry->d_name);
+        if (name == "." || name == "..") {
+            continue;
+        }
+        struct stat st {};
+        if (::fstatat(::dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
         DirEntry item;
-        item.name = entry.path().filename().string();
-        item.is_directory = entry.is_directory();
-        item.size = entry.is_regular_file() ? entry.file_size() : 0;
-        const auto ftime = entry.last_write_time();
-        const auto sys_time = decltype(ftime)::clock::to_sys(ftime);
-        item.modified =
-            std::chrono::duration_cast<std::chrono::seconds>(sys_time.time_since_epoch()).count();
+        item.name = std::string(name);
+        item.is_directory = S_ISDIR(st.st_mode);
+        item.size = S_ISREG(st.st_mode) ? static_cast<std::uint64_t>(st.st_size) : 0;
+        item.modified = static_cast<std::uint64_t>(st.st_mtim.tv_sec);
         entries.push_back(std::move(item));
     }
+    ::closedir(dir);
     return entries;
 }
 
 bool StorageManager::ensure_directory(const std::string& username, const std::filesystem::path& relative_path) {
-    const auto path = resolve(username, relative_path);
-    std::filesystem::create_directories(path);
-    return std::filesystem::exists(path);
+    std::string name;
+    const int parent = resolver_.open_parent(username, relative_path, name, true);
+    if (parent < 0) {
+        return false;
+    }
+    struct stat st {};
+    const bool ok = (::mkdirat(parent, name.c_str(), 0755) == 0 || errno == EEXIST) &&
+                    ::fstatat(parent, name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode);
+    ::close(parent);
+    return ok;
+}
+
+// A file whose digest is known gets a new link to its content-addressed object (or a
+// reflink, where links cannot be made), so copying never moves its bytes; only files
+// the index does not know are copied and hashed.
+TreeCopy StorageManager::copy_tree(const std::string& username,
+                                   const std::filesystem::path& source,
+                                   const std::filesystem::path& target,
+                                   const std::unordered_map<std::string, std::string>& digests) {
+    auto& blobs = device_for(username).blobs();
+    TreeCopy copy;
+    const auto copy_file = [&](const std::filesystem::path& from, const std::filesystem::path& to,
+                               const std::string& relative) {
+        std::string md5;
+        if (auto it = digests.find(relative); it != digests.end()) {
+            md5 = it->second;
+        } else if (auto stub = BlobStore::stub_of(from)) {
+            md5 = std::move(*stub);
+        }
+        const auto size = file_size(from);
+        if (!md5.empty() && (blobs.contains(md5) || blobs.ingest(from, md5)) && blobs.materialize(md5, to)) {
+            ++io_stats_.copy_linked_files;
+        } else {
+            if (!BlobStore::copy_data(from, to) && !unpack(from, to)) {
+                throw std::runtime_error("Cannot copy " + from.string());
+            }
+            if (md5.empty()) {
+                md5 = compute_md5(to);
+            }
+            io_stats_.copy_written_bytes += size;
+            copy.copied.push_back(to);
+        }
+        copy.files.push_back(TreeCopy::File{to, md5, size});
+    };
+
+    copy.directories.push_back(target.parent_path());
+    std::filesystem::create_directories(target.parent_path());
+    if (!std::filesystem::is_directory(source)) {
+        copy_file(source, target, "");
+        return copy;
+    }
+    std::filesystem::create_directory(target);
+    copy.directories.push_back(target);
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(source)) {
+        const auto relative = entry.path().lexically_relative(source);
+        const auto to = target / relative;
+        if (entry.is_directory()) {
+            std::filesystem::create_directory(to);
+            copy.directories.push_back(to);
+        } else if (entry.is_regular_file()) {
+            copy_file(entry.path(), to, relative.generic_string());
+        }
+    }
+    return copy;
+}
+
+// Writes out a stub's content as a plain file, read back through its store. Used when
+// a stub cannot be linked (e.g. its object is at the hardlink limit).
+bool StorageManager::unpack(const std::filesystem::path& from, const std::filesystem::path& to) {
+    const int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (in < 0 || ::fstat(in, &st) != 0) {
+        if (in >= 0) {
+            ::close(in);
+        }
+        return false;
+    }
+    const auto stub = erasure_.open_reader(in, st);
+    const auto packed = segments_.open_reader(in, st);
+    const int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    bool ok = out >= 0 && (stub || packed);
+    try {
+        const auto size = static_cast<std::uint64_t>(st.st_size);
+        for (std::uint64_t offset = 0; ok && offset < size;) {
+            const auto want = static_cast<std::size_t>(std::min<std::uint64_t>(kReadChunk, size - offset));
+            const auto bytes = stub ? erasure_.read(*stub, offset, want) : segments_.read(*packed, offset, want);
+            ok = bytes.size() == want && write_full(out, bytes.data(), want, offset);
+            offset += want;
+        }
+    } catch (const std::exception&) {
+        ok = false;
+    }
+    erasure_.close_reader(st);
+    segments_.close_reader(st);
+    ::close(in);
+    if (out >= 0) {
+        ::close(out);
+        if (!ok) {
+            ::unlink(to.c_str());
+        }
+    }
+    return ok;
 }
 
 bool StorageManager::remove(const std::string& username, const std::filesystem::path& relative_path) {
@@ -151,49 +528,595 @@ UploadCheckpoint StorageManager::prepare_upload(const std::string& username,
     checkpoint.active = true;
     checkpoint.total = total_bytes;
     checkpoint.final_path = resolve(username, logical_path);
-    checkpoint.meta_path = meta_file(username, md5);
     checkpoint.temp_path = temp_file(username, md5);
+    checkpoint.device = &device_for(username);
+    checkpoint.username = username;
+    checkpoint.logical_path = logical_path;
+    {
+        // A fresh mtime keeps the sweeper off the part while the upload resumes.
+        std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+        ::utimensat(AT_FDCWD, checkpoint.temp_path.c_str(), nullptr, 0);
+    }
 
-    std::filesystem::create_directories(checkpoint.final_path.parent_path());
+    checkpoint.new_directories = place_in_home(checkpoint, {});
 
-    if (std::filesystem::exists(checkpoint.meta_path)) {
-        auto existing = read_meta(checkpoint.meta_path, checkpoint.final_path);
-        checkpoint.received = std::min(existing.received, total_bytes);
-    } else if (std::filesystem::exists(checkpoint.temp_path)) {
-        checkpoint.received = std::min<std::uint64_t>(last_write_offset(checkpoint), total_bytes);
-        write_meta(checkpoint);
-    } else {
-        checkpoint.received = 0;
-        write_meta(checkpoint);
+    // Only trust bytes covered by a checkpoint: the part was fdatasync'ed before its
+    // journal record was written, while anything past it may not have survived a crash.
+    std::uint64_t recorded = 0;
+    if (auto record = journal_.lookup(checkpoint.temp_path.string()); record && record->total == total_bytes) {
+        recorded = record->received;
+        checkpoint.digest_state = record->digest_state;
+    } else if (auto legacy = read_legacy_meta(meta_file(username, md5))) {
+        recorded = *legacy;
+    }
+    std::filesystem::remove(meta_file(username, md5));
+    checkpoint.received = std::min({recorded, last_write_offset(checkpoint), total_bytes});
+    if (checkpoint.received != recorded) {
+        checkpoint.digest_state.clear();
     }
     return checkpoint;
 }
 
-bool StorageManager::write_chunk(const UploadCheckpoint& checkpoint,
-                                 std::uint64_t offset,
-                                 std::span<const std::byte> data) {
-    const int fd = ::open(checkpoint.temp_path.c_str(), O_CREAT | O_RDWR, 0644);
-    if (fd < 0) {
+// Blocks the part already holds (earlier attempts, preallocation) are part of the
+// filesystem's used space, so only the rest of the upload is charged against it, on
+// top of what uploads admitted earlier may still write to the same device.
+bool StorageManager::has_space_for(const UploadCheckpoint& checkpoint) {
+    struct statvfs fs {};
+    if (::statvfs(checkpoint.temp_path.parent_path().c_str(), &fs) != 0) {
+        return true;
+    }
+    const auto available = static_cast<std::uint64_t>(fs.f_bavail) * fs.f_frsize;
+    const auto admitted = checkpoint.device ? checkpoint.device->admitted() : 0;
+    if (available >= unallocated_bytes(checkpoint) + admitted + space_options_.reserve_bytes) {
+        return true;
+    }
+    ++io_stats_.rejected_uploads;
+    return false;
+}
+
+// A preallocated part already holds its blocks, which statvfs reports as used; any
+// other upload is admitted with what it still needs.
+std::unique_ptr<UploadSession> StorageManager::open_upload(const UploadCheckpoint& checkpoint) {
+    auto session = std::make_unique<UploadSession>(checkpoint, journal_, resume_options_,
+                                                   direct_pool_for(checkpoint.total), io_stats_);
+    if (space_options_.preallocate && checkpoint.total >= space_options_.preallocate_min_bytes) {
+        if (!session->preallocate()) {
+            ++io_stats_.rejected_uploads;
+            return nullptr;
+        }
+    }
+    session->admit(unallocated_bytes(checkpoint));
+    return session;
+}
+
+AlignedBufferPool* StorageManager::direct_pool_for(std::uint64_t size) {
+    if (direct_options_.threshold == 0 || size < direct_options_.threshold) {
+        return nullptr;
+    }
+    return &direct_buffers_;
+}
+
+std::filesystem::path StorageManager::retire_checkpoint(const std::filesystem::path& file, std::time_t cutoff) {
+    std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+    struct stat st {};
+    if (::lstat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_mtime >= cutoff) {
+        return {};
+    }
+    auto retired = file;
+    retired += ".expired";
+    if (::rename(file.c_str(), retired.c_str()) != 0) {
+        return {};
+    }
+    journal_.finish(file.string());
+    return retired;
+}
+
+std::size_t StorageManager::prune_resume_journal() {
+    std::size_t pruned = 0;
+    for (const auto& key : journal_.keys()) {
+        std::lock_guard<std::mutex> lock(checkpoints_mutex_);
+        std::error_code ec;
+        if (!std::filesystem::exists(key, ec) && !ec) {
+            journal_.finish(key);
+            ++pruned;
+        }
+    }
+    return pruned;
+}
+
+UploadSession::UploadSession(UploadCheckpoint checkpoint,
+                             ResumeJournal& journal,
+                             ResumeOptions options,
+                             AlignedBufferPool* direct_pool,
+                             IoStats& stats)
+    : checkpoint_(std::move(checkpoint)),
+      journal_(journal),
+      options_(options),
+      stats_(stats),
+      persisted_(checkpoint_.received),
+      last_checkpoint_(std::chrono::steady_clock::now()) {
+    fd_ = ::open(checkpoint_.temp_path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Unable to open upload part file");
+    }
+    // Drop any unacknowledged tail so the part never holds bytes past `received`.
+    if (::ftruncate(fd_, static_cast<off_t>(checkpoint_.received)) != 0) {
+        ::close(fd_);
+        throw std::runtime_error("Unable to truncate upload part file");
+    }
+
+    // Without a usable saved context (older format, offset clamped below the record)
+    // the prefix is not re-read here, on the thread opening the session: the running
+    // digest stays off and the commit, on an I/O thread, hashes the whole file.
+    if (md5_.restore(checkpoint_.digest_state)) {
+        hashed_ = checkpoint_.received;
+    } else {
+        md5_ = Md5();
+        hashed_ = 0;
+    }
+
+    // Filesystems without O_DIRECT support (tmpfs, some FUSE mounts) refuse the open,
+    // and a pool with all its buffers lent out has none to give; such uploads simply
+    // stay buffered.
+    if (direct_pool) {
+        stage_ = direct_pool->acquire();
+        if (!stage_) {
+            ++stats_.direct_pool_exhausted;
+        } else if (direct_fd_ = ::open(checkpoint_.temp_path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+                   direct_fd_ >= 0) {
+            direct_pool_ = direct_pool;
+        } else {
+            stage_ = AlignedBuffer();
+            ++stats_.direct_fallbacks;
+        }
+    }
+}
+
+UploadSession::~UploadSession() {
+    close();
+}
+
+bool UploadSession::write(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers) {
+    if (fd_ < 0) {
         return false;
     }
-    const ssize_t written =
-        ::pwrite(fd, data.data(), static_cast<size_t>(data.size()), static_cast<off_t>(offset));
-    ::close(fd);
-    return written == static_cast<ssize_t>(data.size());
+    const bool written = direct_fd_ >= 0 ? write_staged(offset, buffers) : write_buffered(offset, buffers);
+    if (!written) {
+        return false;
+    }
+
+    std::uint64_t total = 0;
+    for (const auto& buffer : buffers) {
+        total += buffer.size();
+    }
+    // Only contiguous appends can be folded into the running digest.
+    if (offset == hashed_) {
+        for (const auto& buffer : buffers) {
+            md5_.update(buffer.data(), buffer.size());
+        }
+        hashed_ += total;
+    }
+    if (offset + total > checkpoint_.received) {
+        consume_admitted(offset + total - checkpoint_.received);
+        checkpoint_.received = offset + total;
+    }
+    maybe_checkpoint();
+    return true;
+}
+
+void UploadSession::admit(std::uint64_t bytes) {
+    if (checkpoint_.device) {
+        checkpoint_.device->admit(bytes);
+        admitted_ += bytes;
+    }
+}
+
+void UploadSession::consume_admitted(std::uint64_t bytes) {
+    const auto settled = std::min(bytes, admitted_);
+    if (settled > 0) {
+        checkpoint_.device->settle(settled);
+        admitted_ -= settled;
+    }
+}
+
+void UploadSession::maybe_checkpoint() {
+    if (checkpoint_.received - persisted_ >= options_.sync_bytes ||
+        std::chrono::steady_clock::now() - last_checkpoint_ >= options_.sync_interval) {
+        checkpoint_progress();
+    }
+}
+
+bool UploadSession::write_buffered(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers) {
+    std::vector<iovec> iov;
+    iov.reserve(buffers.size());
+    for (const auto& buffer : buffers) {
+        if (!buffer.empty()) {
+            iov.push_back(iovec{const_cast<std::byte*>(buffer.data()), buffer.size()});
+        }
+    }
+
+    std::size_t first = 0;
+    std::uint64_t position = offset;
+    while (first < iov.size()) {
+        const int count = static_cast<int>(std::min<std::size_t>(iov.size() - first, IOV_MAX));
+        const ssize_t written = ::pwritev(fd_, iov.data() + first, count, static_cast<off_t>(position));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (written == 0) {
+            return false;
+        }
+        position += static_cast<std::uint64_t>(written);
+        // Skip fully written vectors and trim the partially written one.
+        auto remaining = static_cast<std::size_t>(written);
+        while (first < iov.size() && remaining >= iov[first].iov_len) {
+            remaining -= iov[first].iov_len;
+            ++first;
+        }
+        if (remaining > 0) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool UploadSession::write_staged(std::uint64_t offset, std::span<const std::span<const std::byte>> buffers) {
+    if (!staged_ || offset != stage_start_ + stage_len_) {
+        if (!flush_stage(true) || !begin_stage(offset)) {
+            return false;
+        }
+    }
+    std::uint64_t position = offset;
+    for (auto remaining : buffers) {
+        while (!remaining.empty()) {
+            if (direct_fd_ < 0) {
+                // A failed direct write switched the session to buffered I/O.
+                const std::span<const std::byte> rest[] = {remaining};
+                if (!write_buffered(position, rest)) {
+                    return false;
+                }
+                position += remaining.size();
+                break;
+            }
+            const auto take = std::min(stage_.size() - stage_len_, remaining.size());
+            std::memcpy(stage_.data() + stage_len_, remaining.data(), take);
+            stage_len_ += take;
+            position += take;
+            remaining = remaining.subspan(take);
+            if (stage_len_ == stage_.size() && !flush_stage(false)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Starts a stage at the aligned block holding `offset`; the bytes of that block before
+// `offset` are loaded from the part so the first direct write does not clobber them.
+bool UploadSession::begin_stage(std::uint64_t offset) {
+    if (direct_fd_ < 0) {
+        return true;
+    }
+    stage_start_ = offset / kDirectAlignment * kDirectAlignment;
+    stage_len_ = static_cast<std::size_t>(offset - stage_start_);
+    if (stage_len_ > 0) {
+        const ssize_t got = ::pread(fd_, stage_.data(), stage_len_, static_cast<off_t>(stage_start_));
+        if (got < 0) {
+            return false;
+        }
+        std::memset(stage_.data() + got, 0, stage_len_ - static_cast<std::size_t>(got));
+    }
+    staged_ = true;
+    return true;
+}
+
+// Writes the aligned part of the stage with O_DIRECT and keeps the unaligned tail
+// staged. `with_tail` also writes that tail through the page cache so the part is
+// complete on disk, as checkpoints require.
+bool UploadSession::flush_stage(bool with_tail) {
+    if (!staged_ || direct_fd_ < 0) {
+        return true;
+    }
+    const std::size_t aligned = stage_len_ / kDirectAlignment * kDirectAlignment;
+    if (aligned > 0) {
+        if (!write_full(direct_fd_, stage_.data(), aligned, stage_start_)) {
+            // Some filesystems accept the O_DIRECT open but fail the write; finish the
+            // upload buffered instead.
+            ++stats_.direct_fallbacks;
+            ::close(direct_fd_);
+            direct_fd_ = -1;
+            staged_ = false;
+            const bool ok = write_full(fd_, stage_.data(), stage_len_, stage_start_);
+            stage_start_ += stage_len_;
+            stage_len_ = 0;
+            return ok;
+        }
+        stats_.direct_written_bytes += aligned;
+    }
+    const std::size_t tail = stage_len_ - aligned;
+    if (with_tail && tail > 0 && !write_full(fd_, stage_.data() + aligned, tail, stage_start_ + aligned)) {
+        return false;
+    }
+    if (aligned > 0) {
+        std::memmove(stage_.data(), stage_.data() + aligned, tail);
+        stage_start_ += aligned;
+        stage_len_ = tail;
+    }
+    return true;
+}
+
+bool UploadSession::write(std::uint64_t offset, std::span<const std::byte> data) {
+    const std::span<const std::byte> buffers[] = {data};
+    return write(offset, buffers);
+}
+
+void UploadSession::checkpoint_progress() {
+    last_checkpoint_ = std::chrono::steady_clock::now();
+    if (fd_ < 0 || !flush_stage(true) || persisted_ == checkpoint_.received) {
+        return;
+    }
+    journal_.checkpoint(fd_, checkpoint_.temp_path.string(), checkpoint_.total, checkpoint_.received,
+                        hashed_ == checkpoint_.received ? md5_.save() : std::string());
+    persisted_ = checkpoint_.received;
+}
+
+// Reserves the not yet received range without changing the file size: the part's size
+// keeps meaning "bytes written", which resume relies on. Filesystems that cannot
+// preallocate are not an error; running out of space is.
+bool UploadSession::preallocate() {
+    if (fd_ < 0 || checkpoint_.received >= checkpoint_.total) {
+        return true;
+    }
+    const auto length = checkpoint_.total - checkpoint_.received;
+    int rc = 0;
+    do {
+        rc = ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(checkpoint_.received), static_cast<off_t>(length));
+    } while (rc != 0 && errno == EINTR);
+    if (rc == 0) {
+        stats_.preallocated_bytes += length;
+        return true;
+    }
+    return errno != ENOSPC && errno != EDQUOT;
+}
+
+// Copies every chunk the server already holds from its source blob into the part at
+// the chunk's own offset, without going through user space. Runs on an I/O thread
+// while the session is preparing. A source that turns out to be unreadable, or is only
+// a stub of an erasure-coded or packed object, is downgraded to "missing" so the
+// client is asked for it instead.
+void UploadSession::place_known() {
+    for (auto& chunk : manifest_) {
+        if (chunk.source.empty() || chunk.offset + chunk.length <= checkpoint_.received) {
+            continue;
+        }
+        const auto skip = checkpoint_.received > chunk.offset ? checkpoint_.received - chunk.offset : 0;
+        const int src = ::open(chunk.source.c_str(), O_RDONLY | O_CLOEXEC);
+        const bool placed = src >= 0 && !BlobStore::stub_digest(src) && !BlobStore::packed_digest(src) &&
+                            copy_range(src, chunk.source_offset + skip, fd_, chunk.offset + skip, chunk.length - skip);
+        if (src >= 0) {
+            ::close(src);
+        }
+        if (!placed) {
+            chunk.source.clear();
+        }
+    }
+}
+
+// Moves `received` across the chunks place_known() already wrote, until `upto` or the
+// first chunk the client still has to send. Those bytes bypass the running digest, so
+// such an upload is hashed in full at commit.
+void UploadSession::fill_known(std::uint64_t upto) {
+    const auto before = checkpoint_.received;
+    while (checkpoint_.received < upto) {
+        auto it = std::upper_bound(manifest_.begin(), manifest_.end(), checkpoint_.received,
+                                   [](std::uint64_t pos, const ManifestChunk& chunk) { return pos < chunk.offset; });
+        if (it == manifest_.begin()) {
+            break;
+        }
+        const auto& chunk = *std::prev(it);
+        if (chunk.source.empty() || checkpoint_.received >= chunk.offset + chunk.length) {
+            break;
+        }
+        checkpoint_.received = chunk.offset + chunk.length;
+    }
+    if (checkpoint_.received != before) {
+        consume_admitted(checkpoint_.received - before);
+        maybe_checkpoint();
+    }
+}
+
+// Returns the MD5 of the bytes written so far, or an empty string if chunks arrived
+// out of order and the running digest no longer covers the whole part.
+std::string UploadSession::finish_digest() {
+    if (hashed_ != checkpoint_.received) {
+        return {};
+    }
+    return md5_.hex_digest();
 }
 
-void StorageManager::update_progress(const UploadCheckpoint& checkpoint, std::uint64_t received_bytes) {
-    UploadCheckpoint updated = checkpoint;
-    updated.received = received_bytes;
-    write_meta(updated);
+void UploadSession::close(bool checkpoint) {
+    consume_admitted(admitted_);
+    if (fd_ < 0) {
+        return;
+    }
+    if (checkpoint) {
+        checkpoint_progress();
+    } else {
+        flush_stage(true);
+    }
+    if (direct_fd_ >= 0) {
+        ::close(direct_fd_);
+        direct_fd_ = -1;
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
+
+// Creates the directories leading to the upload's target beneath the user's home and,
+// given a `file`, renames it into place through the parent's descriptor.
+// Returns the directories that gained an entry because a missing parent was created.
+std::vector<std::filesystem::path> StorageManager::place_in_home(const UploadCheckpoint& checkpoint,
+                                                                 const std::filesystem::path& file) {
+    std::string name;
+    std::vector<std::filesystem::path> created;
+    const int parent = resolver_.open_parent(checkpoint.username, checkpoint.logical_path, name, true, &created);
+    if (parent < 0) {
+        throw std::runtime_error("Unable to create upload directory");
+    }
+    const bool ok = file.empty() || ::renameat(AT_FDCWD, file.c_str(), parent, name.c_str()) == 0;
+    ::close(parent);
+    if (!ok) {
+        throw std::runtime_error("Unable to move upload into place");
+    }
+    const auto home = device_for(checkpoint.username).home(checkpoint.username);
+    std::vector<std::filesystem::path> directories;
+    for (const auto& dir : created) {
+        directories.push_back(dir.has_parent_path() ? home / dir.parent_path() : home);
+    }
+    return directories;
 }
 
 std::filesystem::path StorageManager::finalize_upload(const UploadCheckpoint& checkpoint) {
-    std::filesystem::create_directories(checkpoint.final_path.parent_path());
-    std::filesystem::rename(checkpoint.temp_path, checkpoint.final_path);
-    if (std::filesystem::exists(checkpoint.meta_path)) {
-        std::filesystem::remove(checkpoint.meta_path);
+    place_in_home(checkpoint, checkpoint.temp_path);
+    journal_.finish(checkpoint.temp_path.string());
+    return checkpoint.final_path;
+}
+
+std::vector<delta::BlockSignature> StorageManager::block_signatures(const std::filesystem::path& object,
+                                                                    std::size_t block) {
+    std::vector<delta::BlockSignature> signatures;
+    const int fd = ::open(object.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file for signatures");
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    std::vector<std::byte> buffer(block);
+    for (std::uint64_t offset = 0;; offset += block) {
+        std::size_t got = 0;
+        while (got < block) {
+            const ssize_t n = ::pread(fd, buffer.data() + got, block - got, static_cast<off_t>(offset + got));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            got += static_cast<std::size_t>(n);
+        }
+        if (got < block) {
+            break;  // a short tail is simply sent as literal data
+        }
+        signatures.push_back(delta::sign_block(buffer));
+    }
+    ::close(fd);
+    ++io_stats_.delta_signatures;
+    return signatures;
+}
+
+// One sequential pass: every range of the new file is read from the base or the part
+// to be hashed, and copied with copy_file_range (shared extents where the filesystem
+// reflinks). The base is registered as a reader, so it cannot become a stub halfway;
+// if it already is one, its ranges come from the shards or segment. The file is
+// assembled next to the part under a `.part` name, so a rebuild cut short by a crash
+// is reclaimed by the resume sweeper.
+std::filesystem::path StorageManager::finalize_delta(const UploadCheckpoint& checkpoint,
+                                                     const DeltaPlan& plan,
+                                                     std::string& md5) {
+    auto rebuilt = checkpoint.temp_path;
+    rebuilt.replace_extension(".rebuild.part");
+    const int base = ::open(plan.base.c_str(), O_RDONLY | O_CLOEXEC);
+    const int literals = ::open(checkpoint.temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    const int out = ::open(rebuilt.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat base_st {};
+    const bool reading = base >= 0 && ::fstat(base, &base_st) == 0;
+    std::optional<std::string> stub;
+    std::optional<SegmentStore::Extent> packed;
+    if (reading) {
+        stub = erasure_.open_reader(base, base_st);
+        packed = segments_.open_reader(base, base_st);
+    }
+    if (checkpoint.device) {
+        checkpoint.device->admit(checkpoint.rebuild_bytes);
+    }
+    const auto close_all = [&] {
+        if (reading) {
+            erasure_.close_reader(base_st);
+            segments_.close_reader(base_st);
+        }
+        if (checkpoint.device) {
+            checkpoint.device->settle(checkpoint.rebuild_bytes);
+        }
+        for (const int fd : {base, literals, out}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    };
+    if (!reading || literals < 0 || out < 0) {
+        close_all();
+        std::filesystem::remove(rebuilt);
+        throw std::runtime_error("Unable to open delta upload files");
+    }
+
+    const std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    bool ok = ctx && EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr) == 1;
+    std::vector<std::byte> buffer(kReadChunk);
+    std::uint64_t written = 0;
+    std::uint64_t literal_offset = 0;
+    try {
+        for (const auto& segment : plan.segments) {
+            const bool from_base = segment.base_offset.has_value();
+            const bool stubbed = from_base && (stub || packed);
+            const int source = from_base ? base : literals;
+            const auto from = from_base ? *segment.base_offset : literal_offset;
+            for (std::uint64_t done = 0; ok && done < segment.length;) {
+                const auto want =
+                    static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), segment.length - done));
+                if (stubbed) {
+                    const auto bytes = stub ? erasure_.read(*stub, from + done, want)
+                                            : segments_.read(*packed, from + done, want);
+                    ok = bytes.size() == want;
+                    if (ok) {
+                        std::memcpy(buffer.data(), bytes.data(), want);
+                    }
+                    ok = ok && write_full(out, buffer.data(), want, written);
+                } else {
+                    ok = read_full(source, buffer.data(), want, from + done) &&
+                         copy_range(source, from + done, out, written, want);
+                }
+                ok = ok && EVP_DigestUpdate(ctx.get(), buffer.data(), want) == 1;
+                done += want;
+                written += want;
+            }
+            if (!from_base) {
+                literal_offset += segment.length;
+            }
+            (from_base ? io_stats_.delta_reused_bytes : io_stats_.delta_literal_bytes) += segment.length;
+        }
+    } catch (const std::exception&) {
+        ok = false;
     }
+    close_all();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_length = 0;
+    if (!ok || EVP_DigestFinal_ex(ctx.get(), digest, &digest_length) != 1) {
+        std::filesystem::remove(rebuilt);
+        throw std::runtime_error("Unable to rebuild delta upload");
+    }
+    md5 = digest_hex(digest);
+
+    try {
+        place_in_home(checkpoint, rebuilt);
+    } catch (...) {
+        std::filesystem::remove(rebuilt);
+        throw;
+    }
+    discard_checkpoint(checkpoint);
+    ++io_stats_.delta_rebuilt_files;
     return checkpoint.final_path;
 }
 
@@ -201,9 +1124,284 @@ void StorageManager::discard_checkpoint(const UploadCheckpoint& checkpoint) {
     if (std::filesystem::exists(checkpoint.temp_path)) {
         std::filesystem::remove(checkpoint.temp_path);
     }
-    if (std::filesystem::exists(checkpoint.meta_path)) {
-        std::filesystem::remove(checkpoint.meta_path);
+    journal_.finish(checkpoint.temp_path.string());
+}
+
+std::shared_ptr<DownloadSession> StorageManager::open_download(const std::string& username,
+                                                               const std::filesystem::path& relative) {
+    const int fd = resolver_.open(username, relative, O_RDONLY);
+    struct stat st {};
+    if (fd < 0 || ::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return nullptr;
+    }
+    auto* direct_pool = direct_pool_for(static_cast<std::uint64_t>(st.st_size));
+    const int direct_fd = direct_pool ? resolver_.open(username, relative, O_RDONLY | O_DIRECT) : -1;
+    if (direct_pool && direct_fd < 0) {
+        ++io_stats_.direct_fallbacks;
+    }
+    return std::make_shared<DownloadSession>(fd, direct_fd, relative, io_stats_, direct_pool,
+                                             &erasure_, &segments_, &readers_);
+}
+
+bool StorageManager::stat_file(const std::string& username, const std::filesystem::path& relative, struct stat& st) {
+    const int fd = resolver_.open(username, relative, O_PATH);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = ::fstat(fd, &st) == 0;
+    ::close(fd);
+    return ok;
+}
+
+std::string StorageManager::io_report() const {
+    std::ostringstream out;
+    out << "readahead.sequential_streams=" << io_stats_.sequential_streams.load() << "\n";
+    out << "readahead.advised_bytes=" << io_stats_.readahead_bytes.load() << "\n";
+    out << "readahead.dropped_bytes=" << io_stats_.dropped_bytes.load() << "\n";
+    out << "readahead.kept_streams=" << io_stats_.kept_streams.load() << "\n";
+    out << "direct.threshold_bytes=" << direct_options_.threshold << "\n";
+    out << "direct.written_bytes=" << io_stats_.direct_written_bytes.load() << "\n";
+    out << "direct.read_bytes=" << io_stats_.direct_read_bytes.load() << "\n";
+    out << "direct.fallbacks=" << io_stats_.direct_fallbacks.load() << "\n";
+    out << "direct.pool_exhausted=" << io_stats_.direct_pool_exhausted.load() << "\n";
+    out << "direct.buffers_outstanding=" << direct_buffers_.outstanding() << "\n";
+    out << "space.preallocated_bytes=" << io_stats_.preallocated_bytes.load() << "\n";
+    out << "space.rejected_uploads=" << io_stats_.rejected_uploads.load() << "\n";
+    out << "copy.linked_files=" << io_stats_.copy_linked_files.load() << "\n";
+    out << "copy.written_bytes=" << io_stats_.copy_written_bytes.load() << "\n";
+    out << "delta.signatures=" << io_stats_.delta_signatures.load() << "\n";
+    out << "delta.rebuilt_files=" << io_stats_.delta_rebuilt_files.load() << "\n";
+    out << "delta.reused_bytes=" << io_stats_.delta_reused_bytes.load() << "\n";
+    out << "delta.literal_bytes=" << io_stats_.delta_literal_bytes.load() << "\n";
+    for (std::size_t i = 0; i < devices_.size(); ++i) {
+        out << devices_[i]->report(i);
+    }
+    if (erasure_.enabled()) {
+        out << erasure_.stats_report();
+    }
+    if (segments_.enabled()) {
+        out << segments_.stats_report();
+    }
+    return out.str();
+}
+
+DownloadSession::DownloadSession(int fd,
+                                 int direct_fd,
+                                 const std::filesystem::path& path,
+                                 IoStats& stats,
+                                 AlignedBufferPool* direct_pool,
+                                 ErasureStore* erasure,
+                                 SegmentStore* segments,
+                                 ReaderCounts* readers)
+    : path_(path), stats_(stats), fd_(fd), window_(kInitialReadahead) {
+    if (::fstat(fd_, &st_) != 0) {
+        ::close(fd_);
+        if (direct_fd >= 0) {
+            ::close(direct_fd);
+        }
+        throw std::runtime_error("Unable to open file for download");
+    }
+    if (erasure) {
+        erasure_ = erasure;
+        stub_ = erasure_->open_reader(fd_, st_);
+    }
+    if (segments) {
+        segments_ = segments;
+        packed_ = segments_->open_reader(fd_, st_);
+    }
+    if (readers && !stub_ && !packed_) {
+        readers_ = readers;
+        readers_->add(st_);
+        if (static_cast<std::uint64_t>(st_.st_size) >= kDropBehindMinFile) {
+            cached_at_open_ = mostly_cached(fd_, static_cast<std::uint64_t>(st_.st_size));
+        }
+    }
+    // The O_DIRECT descriptor was opened separately; it is only used if it still
+    // names the same file.
+    struct stat direct_st {};
+    if (direct_fd >= 0 && direct_pool && !stub_ && !packed_ && ::fstat(direct_fd, &direct_st) == 0 &&
+        direct_st.st_dev == st_.st_dev && direct_st.st_ino == st_.st_ino) {
+        direct_fd_ = direct_fd;
+        direct_pool_ = direct_pool;
+        direct_ = true;
+    } else if (direct_fd >= 0) {
+        ::close(direct_fd);
+    }
+}
+
+DownloadSession::~DownloadSession() {
+    if (readers_) {
+        readers_->remove(st_);
+    }
+    if (erasure_) {
+        erasure_->close_reader(st_);
+    }
+    if (segments_) {
+        segments_->close_reader(st_);
+    }
+    if (direct_fd_ >= 0) {
+        ::close(direct_fd_);
+    }
+    ::close(fd_);
+}
+
+bool DownloadSession::same_file(const struct stat& st) const {
+    return st.st_dev == st_.st_dev && st.st_ino == st_.st_ino && st.st_size == st_.st_size &&
+           st.st_mtim.tv_sec == st_.st_mtim.tv_sec && st.st_mtim.tv_nsec == st_.st_mtim.tv_nsec;
+}
+
+std::vector<std::byte> DownloadSession::read(std::uint64_t offset, std::size_t length) {
+    const auto size = static_cast<std::uint64_t>(st_.st_size);
+    if (offset >= size) {
+        return {};
+    }
+    const auto to_read = static_cast<std::size_t>(std::min<std::uint64_t>(length, size - offset));
+    if (stub_) {
+        return erasure_->read(*stub_, offset, to_read);
+    }
+    if (packed_) {
+        return segments_->read(*packed_, offset, to_read);
+    }
+    std::vector<std::byte> buffer(to_read);
+    std::size_t done = 0;
+    if (direct_) {
+        done = read_direct(offset, buffer);
+    } else {
+        advise(offset, offset + to_read);
+    }
+    while (done < to_read) {
+        const ssize_t got = ::pread(fd_, buffer.data() + done, to_read - done, static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        done += static_cast<std::size_t>(got);
+    }
+    buffer.resize(done);
+    return buffer;
+}
+
+// Reads the aligned blocks covering [offset, offset + out.size()) into a pooled buffer
+// and copies the requested bytes out. Returns how many bytes were produced; on an
+// O_DIRECT error the session switches to buffered reads for good, and while the pool
+// has no buffer to spare the caller reads buffered.
+std::size_t DownloadSession::read_direct(std::uint64_t offset, std::span<std::byte> out) {
+    auto block = direct_pool_->acquire();
+    if (!block) {
+        ++stats_.direct_pool_exhausted;
+        return 0;
+    }
+    std::size_t done = 0;
+    while (done < out.size()) {
+        const auto position = offset + done;
+        const auto start = position / kDirectAlignment * kDirectAlignment;
+        const auto skip = static_cast<std::size_t>(position - start);
+        const auto span = (skip + out.size() - done + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+        const auto want = std::min(block.size(), span);
+        const ssize_t got = ::pread(direct_fd_, block.data(), want, static_cast<off_t>(start));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            if (direct_.exchange(false)) {
+                ++stats_.direct_fallbacks;
+            }
+            break;
+        }
+        if (static_cast<std::size_t>(got) <= skip) {
+            break;
+        }
+        const auto take = std::min(static_cast<std::size_t>(got) - skip, out.size() - done);
+        std::memcpy(out.data() + done, block.data() + skip, take);
+        done += take;
+        if (static_cast<std::size_t>(got) < want) {
+            break;
+        }
+    }
+    stats_.direct_read_bytes += done;
+    return done;
+}
+
+void DownloadSession::advise(std::uint64_t offset, std::uint64_t end) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const bool near = offset + kSequentialSlack >= stream_end_ && offset <= stream_end_ + kSequentialSlack;
+    if (!near) {
+        if (sequential_) {
+            ::posix_fadvise(fd_, 0, 0, POSIX_FADV_NORMAL);
+        }
+        sequential_ = false;
+        streak_ = 0;
+        window_ = kInitialReadahead;
+        readahead_end_ = end;
+        stream_end_ = end;
+        return;
+    }
+    stream_end_ = std::max(stream_end_, end);
+    if (!sequential_ && ++streak_ >= kSequentialStreak) {
+        sequential_ = true;
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+        ++stats_.sequential_streams;
+    }
+    if (!sequential_) {
+        return;
+    }
+
+    const auto size = static_cast<std::uint64_t>(st_.st_size);
+    if (readahead_end_ < size && readahead_end_ < stream_end_ + window_) {
+        const auto start = std::max(readahead_end_, stream_end_);
+        const auto length = std::min(window_, size - std::min(size, start));
+        if (length > 0) {
+            ::posix_fadvise(fd_, static_cast<off_t>(start), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+            stats_.readahead_bytes += length;
+        }
+        readahead_end_ = start + length;
+        window_ = std::min(window_ * 2, kMaxReadahead);
+    }
+
+    if (size >= kDropBehindMinFile && stream_end_ > kDropBehindLag && !keep_pages()) {
+        const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+        const auto drop_to = (stream_end_ - kDropBehindLag) / page * page;
+        if (drop_to >= dropped_until_ + kDropBehindStep) {
+            ::posix_fadvise(fd_, static_cast<off_t>(dropped_until_), static_cast<off_t>(drop_to - dropped_until_),
+                            POSIX_FADV_DONTNEED);
+            stats_.dropped_bytes += drop_to - dropped_until_;
+            dropped_until_ = drop_to;
+        }
+    }
+}
+
+// Drop-behind is withheld, for good, from a download of a file that was cached when
+// it was opened or that another download is reading too.
+bool DownloadSession::keep_pages() {
+    if (!kept_ && (cached_at_open_ || !readers_ || readers_->count(st_) > 1)) {
+        kept_ = true;
+        ++stats_.kept_streams;
     }
+    return kept_;
+}
+
+void ReaderCounts::add(const struct stat& st) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++counts_[{st.st_dev, st.st_ino}];
+}
+
+void ReaderCounts::remove(const struct stat& st) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = counts_.find({st.st_dev, st.st_ino});
+    if (it != counts_.end() && --it->second == 0) {
+        counts_.erase(it);
+    }
+}
+
+unsigned ReaderCounts::count(const struct stat& st) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = counts_.find({st.st_dev, st.st_ino});
+    return it == counts_.end() ? 0 : it->second;
 }
 
 std::vector<std::byte> StorageManager::read_chunk(const std::filesystem::path& absolute_path,
@@ -243,28 +1441,19 @@ std::vector<std::byte> StorageManager::read_chunk(const std::filesystem::path& a
 }
 
 std::string StorageManager::compute_md5(const std::filesystem::path& absolute_path) const {
-    MD5_CTX ctx;
-    MD5_Init(&ctx);
-    std::ifstream stream(absolute_path, std::ios::binary);
-    if (!stream) {
+    const int fd = ::open(absolute_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         throw std::runtime_error("Unable to open file for MD5");
     }
-    std::vector<char> buf(kReadChunk);
-    while (stream) {
-        stream.read(buf.data(), static_cast<std::streamsize>(buf.size()));
-        const auto read = stream.gcount();
-        if (read > 0) {
-            MD5_Update(&ctx, buf.data(), static_cast<size_t>(read));
-        }
-    }
-    unsigned char digest[MD5_DIGEST_LENGTH];
-    MD5_Final(digest, &ctx);
-    std::ostringstream oss;
-    oss << std::hex;
-    for (unsigned char byte : digest) {
-        oss << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+    return md5_of(fd);
+}
+
+std::string StorageManager::compute_md5(const std::string& username, const std::filesystem::path& relative) {
+    const int fd = resolver_.open(username, relative, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file for MD5");
     }
-    return oss.str();
+    return md5_of(fd);
 }
 
 std::uint64_t StorageManager::file_size(const std::filesystem::path& absolute_path) const {
@@ -0,0 +1,99 @@
+#include "storage_rebalancer.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cloud::server {
+
+StorageRebalancer::StorageRebalancer(StorageManager& storage, FileIndex& index, TrashManager& trash)
+    : storage_(storage), index_(index), trash_(trash) {}
+
+std::vector<HomeMove> StorageRebalancer::plan() const {
+    std::vector<HomeMove> moves;
+    const auto& devices = storage_.devices();
+    for (std::size_t i = 0; i < devices.size(); ++i) {
+        if (devices[i]->state() == DeviceState::failed) {
+            continue;
+        }
+        for (auto& username : devices[i]->homes()) {
+            const auto target = storage_.placement(username);
+            if (target && *target != i) {
+                moves.push_back(HomeMove{std::move(username), i, *target});
+            }
+        }
+    }
+    return moves;
+}
+
+// Files the index knows are placed as links of the target's object for their digest
+// (ingesting the copy when the target has none yet), so deduplication survives the
+// move. Unfinished uploads are not carried over; their clients start again.
+MoveResult StorageRebalancer::migrate(const HomeMove& move) {
+    auto& source = *storage_.devices()[move.from];
+    auto& target = *storage_.devices()[move.to];
+    const auto old_home = std::filesystem::canonical(source.home(move.username));
+    const auto new_home = target.home(move.username);
+    trash_.purge_owner(move.username, source);
+
+    std::unordered_map<std::string, std::string> digests;
+    for (auto& file : index_.files_of(move.username)) {
+        digests.emplace(std::move(file.storage_path), std::move(file.md5));
+    }
+
+    MoveResult result;
+    if (!target.has_home(move.username)) {
+        const auto staging = target.root() / ("." + move.username + ".rebalance");
+        std::filesystem::remove_all(staging);
+        std::filesystem::create_directories(staging);
+        std::filesystem::recursive_directory_iterator it(old_home);
+        for (; it != std::filesystem::recursive_directory_iterator(); ++it) {
+            const auto relative = it->path().lexically_relative(old_home);
+            const auto dest = staging / relative;
+            const auto status = it->symlink_status();
+            if (std::filesystem::is_directory(status)) {
+                if (relative == ".resume") {
+                    it.disable_recursion_pending();
+                    continue;
+                }
+                std::filesystem::create_directories(dest);
+            } else if (std::filesystem::is_symlink(status)) {
+                std::filesystem::copy_symlink(it->path(), dest);
+            } else if (std::filesystem::is_regular_file(status)) {
+                ++result.files;
+                result.bytes += it->file_size();
+                auto md5 = BlobStore::stub_of(it->path());
+                if (const auto digest = digests.find(it->path().string()); digest != digests.end()) {
+                    md5 = digest->second;
+                }
+                if (md5) {
+                    if (target.blobs().materialize(*md5, dest)) {
+                        ++result.linked;
+                        continue;
+                    }
+                    // Ingesting from the source keeps erasure-coded and packed stubs stubs.
+                    if (target.blobs().ingest(it->path(), *md5) && target.blobs().materialize(*md5, dest)) {
+                        continue;
+                    }
+                }
+                // The old home is removed afterwards, so a file that was not copied is lost.
+                if (!BlobStore::copy_data(it->path(), dest)) {
+                    throw std::runtime_error("Cannot copy " + it->path().string());
+                }
+            }
+        }
+        std::filesystem::rename(staging, new_home);
+    }
+
+    index_.relocate(move.username, old_home.string() + "/", std::filesystem::canonical(new_home).string() + "/");
+    std::filesystem::remove_all(old_home);
+    std::unordered_set<std::string> released;
+    for (const auto& [path, md5] : digests) {
+        if (released.insert(md5).second) {
+            storage_.release_blob(source, md5);
+        }
+    }
+    return result;
+}
+
+}  // namespace cloud::server
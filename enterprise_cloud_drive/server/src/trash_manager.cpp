@@ -0,0 +1,266 @@
+#include "trash_manager.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+namespace cloud::server {
+
+namespace {
+
+std::int64_t unix_now() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace
+
+TrashManager::TrashManager(StorageManager& storage, FileIndex& index, TrashOptions options)
+    : storage_(storage),
+      index_(index),
+      options_(options),
+      throttle_(options.purge_rate, std::max(options.purge_rate / 10, 1.0)) {
+    options_.batch_rows = std::max<std::size_t>(options_.batch_rows, 1);
+}
+
+TrashManager::~TrashManager() {
+    stop();
+}
+
+void TrashManager::start() {
+    if (worker_.joinable()) {
+        return;
+    }
+    recover();
+    stopping_ = false;
+    worker_ = std::thread(&TrashManager::worker_loop, this);
+}
+
+void TrashManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+// Entries recorded in the index are resumed. A trash item without a record (the server
+// died between the rename and the insert) is purged without touching the index.
+void TrashManager::recover() {
+    auto entries = index_.pending_trash();
+    std::unordered_set<std::string> known;
+    for (const auto& entry : entries) {
+        known.insert(entry.trash_path);
+    }
+    for (const auto& device : storage_.devices()) {
+        if (device->state() == DeviceState::failed) {
+            continue;
+        }
+        std::error_code ec;
+        for (const auto& user : std::filesystem::directory_iterator(device->trash_root(), ec)) {
+            std::error_code item_ec;
+            for (const auto& item : std::filesystem::directory_iterator(user.path(), item_ec)) {
+                if (known.count(item.path().string()) == 0) {
+                    entries.push_back(
+                        TrashEntry{0, user.path().filename().string(), "", item.path().string(), 0, 0});
+                }
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.assign(entries.begin(), entries.end());
+}
+
+bool TrashManager::move_to_trash(const std::string& owner,
+                                 const std::string& logical_path,
+                                 const std::filesystem::path& absolute) {
+    std::error_code ec;
+    if (!std::filesystem::exists(std::filesystem::symlink_status(absolute, ec))) {
+        return false;
+    }
+    static std::atomic<std::uint64_t> sequence{0};
+    TrashEntry entry;
+    entry.owner = owner;
+    entry.logical_path = logical_path;
+    // Read before the rename: a row committed in between stays (and is merely stale)
+    // instead of being purged while its file is still in place.
+    entry.max_file_id = index_.max_file_id();
+    entry.deleted_at = unix_now();
+    const auto dir = storage_.device_for(owner).trash_root() / owner;
+    std::filesystem::create_directories(dir, ec);
+    const auto target = dir / (std::to_string(entry.deleted_at) + "-" + std::to_string(::getpid()) + "-" +
+                               std::to_string(sequence++));
+    std::filesystem::rename(absolute, target, ec);
+    if (ec) {
+        return false;
+    }
+    entry.trash_path = target.string();
+    entry.id = index_.add_trash(entry);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(entry));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void TrashManager::worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        if (queue_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+        const auto due = std::chrono::system_clock::from_time_t(static_cast<std::time_t>(queue_.front().deleted_at)) +
+                         options_.retention;
+        if (std::chrono::system_clock::now() < due) {
+            cv_.wait_until(lock, due);
+            continue;
+        }
+        const auto entry = queue_.front();
+        lock.unlock();
+        const bool done = purge(entry);
+        lock.lock();
+        if (done) {
+            queue_.pop_front();
+        }
+    }
+}
+
+// Unlinks the files first (throttled; interrupted by stop() and resumed on the next
+// start), then drops the index rows and finally releases blobs whose last user link
+// just went away. Returns false only when interrupted.
+bool TrashManager::purge(const TrashEntry& entry) {
+    current_id_ = entry.id;
+    current_files_ = 0;
+    auto unlink_one = [this](const std::filesystem::path& path) {
+        throttle_.acquire();
+        struct stat st {};
+        const bool known = ::lstat(path.c_str(), &st) == 0;
+        if (::unlink(path.c_str()) == 0) {
+            ++files_purged_;
+            ++current_files_;
+            bytes_purged_ += known ? static_cast<std::uint64_t>(st.st_size) : 0;
+        }
+    };
+
+    std::error_code ec;
+    const std::filesystem::path path = entry.trash_path;
+    const auto status = std::filesystem::symlink_status(path, ec);
+    if (std::filesystem::is_directory(status)) {
+        std::filesystem::recursive_directory_iterator it(
+            path, std::filesystem::directory_options::skip_permission_denied, ec);
+        for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (std::filesystem::is_directory(it->symlink_status(ec))) {
+                continue;
+            }
+            unlink_one(it->path());
+            if (stopping_) {
+                current_id_ = 0;
+                return false;
+            }
+        }
+        std::filesystem::remove_all(path, ec);
+    } else if (std::filesystem::exists(status)) {
+        unlink_one(path);
+    }
+
+    std::unordered_set<std::string> digests;
+    if (!entry.logical_path.empty()) {
+        while (true) {
+            const auto batch =
+                index_.remove_tree_batch(entry.owner, entry.logical_path, entry.max_file_id, options_.batch_rows);
+            rows_deleted_ += batch.size();
+            digests.insert(batch.begin(), batch.end());
+            if (batch.size() < options_.batch_rows) {
+                break;
+            }
+        }
+    }
+    if (entry.id != 0) {
+        const auto held = index_.held_blobs(entry.id);
+        digests.insert(held.begin(), held.end());
+    }
+    if (auto* device = storage_.device_containing(path)) {
+        for (const auto& md5 : digests) {
+            if (storage_.release_blob(*device, md5)) {
+                ++blobs_released_;
+            }
+        }
+    }
+    if (entry.id != 0) {
+        index_.remove_trash(entry.id);
+    }
+    ++entries_purged_;
+    current_id_ = 0;
+    return true;
+}
+
+// Used by the rebalancer while the server is stopped: trash is never restored, and
+// entries left behind would keep pointing at a device the home no longer lives on.
+std::size_t TrashManager::purge_owner(const std::string& owner, const StorageDevice& device) {
+    std::vector<TrashEntry> entries;
+    std::unordered_set<std::string> known;
+    for (auto& entry : index_.pending_trash()) {
+        if (entry.owner == owner && storage_.device_containing(entry.trash_path) == &device) {
+            known.insert(entry.trash_path);
+            entries.push_back(std::move(entry));
+        }
+    }
+    std::error_code ec;
+    for (const auto& item : std::filesystem::directory_iterator(device.trash_root() / owner, ec)) {
+        if (known.count(item.path().string()) == 0) {
+            entries.push_back(TrashEntry{0, owner, "", item.path().string(), 0, 0});
+        }
+    }
+    for (const auto& entry : entries) {
+        purge(entry);
+    }
+    std::filesystem::remove(device.trash_root() / owner, ec);
+    return entries.size();
+}
+
+std::string TrashManager::status_report(const std::string& owner) const {
+    std::ostringstream out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : queue_) {
+        if (entry.owner != owner || entry.logical_path.empty()) {
+            continue;
+        }
+        out << entry.logical_path << "|" << entry.deleted_at << "|";
+        if (entry.id == current_id_) {
+            out << "purging|" << current_files_.load();
+        } else {
+            out << "queued|" << entry.deleted_at + options_.retention.count();
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+std::string TrashManager::stats_report() const {
+    std::size_t pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending = queue_.size();
+    }
+    std::ostringstream out;
+    out << "trash.retention_seconds=" << options_.retention.count() << "\n";
+    out << "trash.purge_rate=" << options_.purge_rate << "\n";
+    out << "trash.pending=" << pending << "\n";
+    out << "trash.entries_purged=" << entries_purged_.load() << "\n";
+    out << "trash.files_purged=" << files_purged_.load() << "\n";
+    out << "trash.bytes_purged=" << bytes_purged_.load() << "\n";
+    out << "trash.rows_deleted=" << rows_deleted_.load() << "\n";
+    out << "trash.blobs_released=" << blobs_released_.load() << "\n";
+    return out.str();
+}
+
+}  // namespace cloud::server
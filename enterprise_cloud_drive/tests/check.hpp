@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal assertions for the test drivers: a failed CHECK is reported and counted, and
+// the driver exits non-zero if any failed, which is all ctest looks at.
+namespace cloud::test {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int finish(const char* name) {
+    if (failures() == 0) {
+        std::printf("%s: ok\n", name);
+        return 0;
+    }
+    std::printf("%s: %d check(s) failed\n", name, failures());
+    return 1;
+}
+
+}  // namespace cloud::test
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition)) {                                                             \
+            ++cloud::test::failures();                                                  \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+        }                                                                               \
+    } while (false)
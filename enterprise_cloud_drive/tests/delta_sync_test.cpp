@@ -0,0 +1,129 @@
+#include "check.hpp"
+#include "delta_sync.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace {
+
+namespace delta = cloud::delta;
+
+std::vector<std::byte> random_bytes(std::size_t size, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<std::byte> data(size);
+    for (auto& b : data) {
+        b = static_cast<std::byte>(rng());
+    }
+    return data;
+}
+
+void check_parse_segments() {
+    const auto parsed = delta::parse_segments("100 0\n50 -\n25 400\n", 175, 500);
+    CHECK(parsed && parsed->size() == 3);
+    if (parsed && parsed->size() == 3) {
+        CHECK((*parsed)[0].length == 100 && (*parsed)[0].base_offset == 0u);
+        CHECK((*parsed)[1].length == 50 && !(*parsed)[1].base_offset);
+        CHECK((*parsed)[2].length == 25 && (*parsed)[2].base_offset == 400u);
+        CHECK(delta::literal_bytes(*parsed) == 50);
+        CHECK(delta::encode_segments(*parsed) == "100 0\n50 -\n25 400\n");
+    }
+
+    // A copy may end exactly at the end of the base.
+    CHECK(delta::parse_segments("10 490\n", 10, 500));
+    CHECK(delta::parse_segments("", 0, 0));
+
+    CHECK(!delta::parse_segments("100 0\n", 101, 500));         // short of total
+    CHECK(!delta::parse_segments("100 0\n2 -\n", 101, 500));    // past total
+    CHECK(!delta::parse_segments("0 -\n10 -\n", 10, 500));      // empty segment
+    CHECK(!delta::parse_segments("10 491\n", 10, 500));         // reads past the base
+    CHECK(!delta::parse_segments("10 501\n", 10, 500));         // starts past the base
+    CHECK(!delta::parse_segments("-10 0\n", 10, 500));
+    CHECK(!delta::parse_segments("10 +0\n", 10, 500));
+    CHECK(!delta::parse_segments("1e1 -\n", 10, 500));
+    CHECK(!delta::parse_segments("10 0x0\n", 10, 500));
+    CHECK(!delta::parse_segments("99999999999999999999 -\n", 10, 500));
+    CHECK(!delta::parse_segments("10 99999999999999999999\n", 10, 500));
+    CHECK(!delta::parse_segments("18446744073709551615 -\n", 10, 500));
+}
+
+void check_literal_bytes() {
+    CHECK(delta::literal_bytes({}) == 0);
+    const std::vector<delta::Segment> segments = {{10, std::nullopt}, {20, 0}, {5, std::nullopt}};
+    CHECK(delta::literal_bytes(segments) == 15);
+}
+
+void check_parse_signatures() {
+    const auto block = random_bytes(2048, 49);
+    const std::vector<delta::BlockSignature> signatures = {delta::sign_block(block), delta::sign_block(block)};
+    const auto parsed = delta::parse_signatures(delta::encode_signatures(signatures));
+    CHECK(parsed && parsed->size() == 2);
+    if (parsed && !parsed->empty()) {
+        CHECK((*parsed)[0].weak == signatures[0].weak && (*parsed)[0].strong == signatures[0].strong);
+    }
+    const std::string strong(32, 'a');
+    CHECK(!delta::parse_signatures("1234567 " + strong + "\n"));
+    CHECK(!delta::parse_signatures("zzzzzzzz " + strong + "\n"));
+    CHECK(!delta::parse_signatures("12345678 abc\n"));
+}
+
+// Rebuilding from the delta gives back the new file, and unchanged blocks are copied.
+void check_compute_delta() {
+    const std::size_t block = 2048;
+    const auto base = random_bytes(64 * block + 100, 50);
+    std::vector<delta::BlockSignature> signatures;
+    for (std::size_t offset = 0; offset < base.size(); offset += block) {
+        signatures.push_back(delta::sign_block(std::span(base).subspan(offset, std::min(block, base.size() - offset))));
+    }
+
+    const auto unchanged = delta::compute_delta(base, block, signatures);
+    CHECK(!unchanged.empty() && unchanged.front().base_offset == 0u);
+    CHECK(unchanged.front().length == 64 * block);
+    CHECK(delta::literal_bytes(unchanged) == 100);
+
+    auto edited = base;
+    const auto inserted = random_bytes(77, 51);
+    edited.insert(edited.begin() + 10 * block + 5, inserted.begin(), inserted.end());
+    edited[40 * block] ^= std::byte{0xff};
+    const auto segments = delta::compute_delta(edited, block, signatures);
+    const auto parsed = delta::parse_segments(delta::encode_segments(segments), edited.size(), base.size());
+    CHECK(parsed.has_value());
+    CHECK(delta::literal_bytes(segments) <= 3 * block + 100 + inserted.size());
+
+    std::vector<std::byte> rebuilt;
+    std::size_t literal_offset = 0;
+    for (const auto& segment : segments) {
+        if (segment.base_offset) {
+            rebuilt.insert(rebuilt.end(), base.begin() + static_cast<std::ptrdiff_t>(*segment.base_offset),
+                           base.begin() + static_cast<std::ptrdiff_t>(*segment.base_offset + segment.length));
+        } else {
+            rebuilt.insert(rebuilt.end(), edited.begin() + static_cast<std::ptrdiff_t>(rebuilt.size()),
+                           edited.begin() + static_cast<std::ptrdiff_t>(rebuilt.size() + segment.length));
+            literal_offset += segment.length;
+        }
+    }
+    CHECK(rebuilt == edited);
+    CHECK(literal_offset == delta::literal_bytes(segments));
+}
+
+void check_block_size() {
+    CHECK(delta::block_size(0, 1 << 20) == 2048);
+    CHECK(delta::block_size(100ULL << 20, 1 << 20) >= 8192);
+    const auto block = delta::block_size(10ULL << 30, 64 * 1024);
+    CHECK(((10ULL << 30) / block + 1) * 42 <= 64 * 1024);
+}
+
+}  // namespace
+
+int main() {
+    check_parse_segments();
+    check_literal_bytes();
+    check_parse_signatures();
+    check_compute_delta();
+    check_block_size();
+    return cloud::test::finish("delta_sync_test");
+}
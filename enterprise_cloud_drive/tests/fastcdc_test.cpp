@@ -0,0 +1,137 @@
+#include "check.hpp"
+#include "fastcdc.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace {
+
+namespace chunking = cloud::chunking;
+
+std::vector<std::byte> random_bytes(std::size_t size, unsigned seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<std::byte> data(size);
+    for (auto& b : data) {
+        b = static_cast<std::byte>(rng());
+    }
+    return data;
+}
+
+// Textbook FastCDC, one byte per step. next_boundary() rolls two bytes at a time with
+// a pre-shifted table and must cut at exactly the same places.
+std::size_t reference_boundary(std::span<const std::byte> data, const chunking::Params& params) {
+    const std::size_t size = data.size();
+    if (size <= params.min_size) {
+        return size;
+    }
+    const std::size_t limit = std::min(size, params.max_size);
+    const std::size_t normal = std::min(limit, params.avg_size);
+    const int bits = chunking::detail::log2_floor(params.avg_size);
+    const std::uint64_t mask_s = chunking::detail::high_mask(bits + 2);
+    const std::uint64_t mask_l = chunking::detail::high_mask(bits - 2);
+    const auto& gear = chunking::detail::kGear.gear;
+    std::uint64_t fp = 0;
+    for (std::size_t i = params.min_size; i < limit; ++i) {
+        fp = (fp << 1) + gear[static_cast<unsigned char>(data[i])];
+        if ((fp & (i < normal ? mask_s : mask_l)) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+const chunking::Params kSmall{2 * 1024, 8 * 1024, 32 * 1024};
+
+void check_matches_reference() {
+    for (const auto& params : {chunking::Params{}, kSmall}) {
+        const auto data = random_bytes(4 * 1024 * 1024 + 13, 35);
+        std::size_t offset = 0;
+        while (offset < data.size()) {
+            const auto rest = std::span(data).subspan(offset);
+            const auto expected = reference_boundary(rest, params);
+            CHECK(chunking::next_boundary(rest, params) == expected);
+            offset += expected;
+        }
+    }
+}
+
+// Chunks tile the input, respect the size bounds (only the last may be short) and
+// average somewhere near the target.
+void check_bounds() {
+    for (const auto& params : {chunking::Params{}, kSmall}) {
+        const auto data = random_bytes(8 * 1024 * 1024 + 5, 36);
+        const auto chunks = chunking::split(data, params);
+        std::uint64_t expected_offset = 0;
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            CHECK(chunks[i].offset == expected_offset);
+            CHECK(chunks[i].length <= params.max_size);
+            CHECK(chunks[i].length > 0);
+            if (i + 1 < chunks.size()) {
+                CHECK(chunks[i].length > params.min_size);
+            }
+            expected_offset += chunks[i].length;
+        }
+        CHECK(expected_offset == data.size());
+        const auto mean = data.size() / chunks.size();
+        CHECK(mean >= params.avg_size / 2 && mean <= params.avg_size * 2);
+    }
+
+    // Short inputs are one chunk; a run of identical bytes never matches, so it is cut
+    // at max_size.
+    const auto tiny = random_bytes(kSmall.min_size, 37);
+    CHECK(chunking::split(tiny, kSmall).size() == 1);
+    CHECK(chunking::split(std::span<const std::byte>(), kSmall).empty());
+    const std::vector<std::byte> zeros(3 * kSmall.max_size);
+    for (const auto& chunk : chunking::split(zeros, kSmall)) {
+        CHECK(chunk.length == kSmall.max_size);
+    }
+}
+
+// Boundaries depend only on content: the same input always splits the same way, and
+// bytes inserted near the front leave the chunks after the edit intact.
+void check_shift_resilience() {
+    const auto data = random_bytes(4 * 1024 * 1024, 38);
+    const auto first = chunking::split(data, kSmall);
+    const auto second = chunking::split(data, kSmall);
+    CHECK(first.size() == second.size());
+    for (std::size_t i = 0; i < first.size() && i < second.size(); ++i) {
+        CHECK(first[i].offset == second[i].offset && first[i].length == second[i].length);
+    }
+
+    auto shifted = random_bytes(17, 39);
+    shifted.insert(shifted.end(), data.begin(), data.end());
+    std::set<std::string> before;
+    for (const auto& chunk : first) {
+        before.insert(chunking::chunk_id(std::span(data).subspan(chunk.offset, chunk.length)));
+    }
+    std::size_t shared = 0;
+    const auto after = chunking::split(shifted, kSmall);
+    for (const auto& chunk : after) {
+        shared += before.count(chunking::chunk_id(std::span(shifted).subspan(chunk.offset, chunk.length)));
+    }
+    CHECK(shared + 2 >= first.size());
+}
+
+void check_chunk_ids() {
+    const auto data = random_bytes(1000, 40);
+    const auto id = chunking::chunk_id(data);
+    CHECK(id.size() == 64);
+    CHECK(chunking::valid_chunk_id(id));
+    CHECK(!chunking::valid_chunk_id(id.substr(1)));
+    CHECK(!chunking::valid_chunk_id(std::string(64, 'G')));
+}
+
+}  // namespace
+
+int main() {
+    check_matches_reference();
+    check_bounds();
+    check_shift_resilience();
+    check_chunk_ids();
+    return cloud::test::finish("fastcdc_test");
+}
@@ -0,0 +1,89 @@
+#include "check.hpp"
+#include "md5.hpp"
+
+#include <openssl/evp.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using cloud::server::Md5;
+
+std::string evp_md5(const std::vector<unsigned char>& data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_Digest(data.data(), data.size(), digest, &length, EVP_md5(), nullptr);
+    std::string out;
+    char hex[3];
+    for (unsigned int i = 0; i < length; ++i) {
+        std::snprintf(hex, sizeof(hex), "%02x", digest[i]);
+        out += hex;
+    }
+    return out;
+}
+
+// RFC 1321, appendix A.5.
+void check_known_vectors() {
+    const auto digest = [](const std::string& text) {
+        Md5 md5;
+        md5.update(text.data(), text.size());
+        return md5.hex_digest();
+    };
+    CHECK(digest("") == "d41d8cd98f00b204e9800998ecf8427e");
+    CHECK(digest("abc") == "900150983cd24fb0d6963f7d28e17f72");
+    CHECK(digest("message digest") == "f96b697d7cb7938d525a2f31aaf161d0");
+    CHECK(digest("12345678901234567890123456789012345678901234567890123456789012345678901234567890") ==
+          "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+// Random split points, with the state saved and restored before every piece, must
+// give the same digest as hashing in one go, across the padding boundaries.
+void check_resume() {
+    std::mt19937 rng(33);
+    for (const std::size_t size : {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000, 100000}) {
+        std::vector<unsigned char> data(size);
+        for (auto& b : data) {
+            b = static_cast<unsigned char>(rng());
+        }
+        Md5 md5;
+        for (std::size_t pos = 0; pos < size;) {
+            const auto piece = std::min<std::size_t>(size - pos, rng() % 200);
+            Md5 restored;
+            CHECK(restored.restore(md5.save()));
+            md5 = restored;
+            md5.update(data.data() + pos, piece);
+            pos += piece;
+        }
+        CHECK(md5.hex_digest() == evp_md5(data));
+        CHECK(md5.hex_digest() == md5.hex_digest());
+    }
+}
+
+void check_rejects_bad_state() {
+    Md5 md5;
+    md5.update("abc", 3);
+    const auto state = md5.save();
+    Md5 other;
+    CHECK(!other.restore(""));
+    CHECK(!other.restore("m0:" + state.substr(3)));
+    CHECK(!other.restore(state.substr(0, state.size() - 2)));
+    CHECK(!other.restore(state + "00"));
+    auto upper = state;
+    upper[5] = 'G';
+    CHECK(!other.restore(upper));
+    CHECK(other.hex_digest() == Md5().hex_digest());
+    CHECK(other.restore(state) && other.hex_digest() == md5.hex_digest());
+}
+
+}  // namespace
+
+int main() {
+    check_known_vectors();
+    check_resume();
+    check_rejects_bad_state();
+    return cloud::test::finish("md5_test");
+}
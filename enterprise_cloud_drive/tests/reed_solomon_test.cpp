@@ -0,0 +1,121 @@
+#include "check.hpp"
+#include "reed_solomon.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using cloud::server::ReedSolomon;
+
+struct Stripe {
+    std::vector<std::vector<std::byte>> shards;  // data shards, then parity shards
+
+    std::vector<std::byte*> pointers() {
+        std::vector<std::byte*> out;
+        for (auto& shard : shards) {
+            out.push_back(shard.data());
+        }
+        return out;
+    }
+};
+
+Stripe make_stripe(const ReedSolomon& rs, std::size_t length, std::mt19937& rng) {
+    Stripe stripe;
+    stripe.shards.assign(rs.total_shards(), std::vector<std::byte>(length));
+    for (unsigned i = 0; i < rs.data_shards(); ++i) {
+        for (auto& b : stripe.shards[i]) {
+            b = static_cast<std::byte>(rng());
+        }
+    }
+    std::vector<const std::byte*> data;
+    std::vector<std::byte*> parity;
+    for (unsigned i = 0; i < rs.total_shards(); ++i) {
+        if (i < rs.data_shards()) {
+            data.push_back(stripe.shards[i].data());
+        } else {
+            parity.push_back(stripe.shards[i].data());
+        }
+    }
+    rs.encode(data, parity, length);
+    return stripe;
+}
+
+// The SIMD kernels process 32 or 16 bytes at a time and hand the tail to the scalar
+// loop, so lengths around those widths matter most.
+const std::size_t kLengths[] = {1, 15, 16, 17, 31, 32, 33, 100, 4096 + 7};
+const std::pair<unsigned, unsigned> kLayouts[] = {{1, 1}, {3, 2}, {4, 2}, {6, 3}, {10, 4}};
+
+// Parity from every kernel the CPU has must match the scalar table lookup byte for byte.
+void check_kernels_agree(const std::vector<std::string>& kernels) {
+    for (const auto& [k, m] : kLayouts) {
+        const ReedSolomon rs(k, m);
+        for (const auto length : kLengths) {
+            std::mt19937 rng(k * 1000 + m * 100 + static_cast<unsigned>(length));
+            ReedSolomon::select_kernel("scalar");
+            const auto reference = make_stripe(rs, length, rng);
+            for (const auto& name : kernels) {
+                std::mt19937 again(k * 1000 + m * 100 + static_cast<unsigned>(length));
+                CHECK(ReedSolomon::select_kernel(name));
+                const auto stripe = make_stripe(rs, length, again);
+                CHECK(stripe.shards == reference.shards);
+            }
+        }
+    }
+}
+
+// Any data_shards() of the shards must rebuild all the others, whichever they are.
+void check_every_subset(const std::vector<std::string>& kernels) {
+    for (const auto& name : kernels) {
+        CHECK(ReedSolomon::select_kernel(name));
+        for (const auto& [k, m] : kLayouts) {
+            const ReedSolomon rs(k, m);
+            const unsigned n = k + m;
+            std::mt19937 rng(n);
+            const auto original = make_stripe(rs, 257, rng);
+            for (std::uint32_t mask = 0; mask < (1u << n); ++mask) {
+                const auto present_count = static_cast<unsigned>(std::popcount(mask));
+                if (present_count > k) {
+                    continue;
+                }
+                auto stripe = original;
+                std::vector<bool> present(n);
+                for (unsigned i = 0; i < n; ++i) {
+                    present[i] = (mask >> i) & 1;
+                    if (!present[i]) {
+                        stripe.shards[i].assign(stripe.shards[i].size(), std::byte{0xa5});
+                    }
+                }
+                const bool rebuilt = rs.reconstruct(stripe.pointers(), present, 257);
+                if (present_count < k) {
+                    CHECK(!rebuilt);
+                    continue;
+                }
+                CHECK(rebuilt);
+                CHECK(stripe.shards == original.shards);
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    std::vector<std::string> kernels;
+    for (const char* name : {"scalar", "ssse3", "avx2"}) {
+        if (ReedSolomon::select_kernel(name)) {
+            kernels.emplace_back(name);
+            std::printf("kernel %s\n", name);
+        }
+    }
+    CHECK(!kernels.empty());
+    check_kernels_agree(kernels);
+    check_every_subset(kernels);
+    return cloud::test::finish("reed_solomon_test");
+}